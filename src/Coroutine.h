@@ -0,0 +1,54 @@
+#pragma once
+#include <HeatPumpClock.h>
+
+/**
+ * Minimal stackless coroutines (protothread style) for the controller workflows.
+ *
+ * The ESP32 toolchain builds with gnu++11, so there are no C++20 coroutines. Instead a workflow is a
+ * void function wrapped in CO_BEGIN/CO_END that resumes at the line it last suspended on. Locals don't
+ * survive a suspension, keep state in the owning object, and use at most one CO_ macro per line.
+ * A suspended coroutine is just this struct.
+ */
+struct Coroutine {
+    uint16_t line = 0; // where to resume, 0 = from the start
+    bool waitingOnTimer = false;
+    heatpumpDeadline wakeAt = {0};
+
+    /**
+     * Time until this coroutine's timer fires, or `idle` if it is waiting on something else.
+     */
+    unsigned long idleTime(heatpumpClock &clock, unsigned long idle) const {
+        return waitingOnTimer ? min(idle, wakeAt.remaining(clock)) : idle;
+    }
+};
+
+// the case labels below are entered by falling through, on purpose
+#if defined(__GNUC__) && __GNUC__ >= 7
+#define CO_FALLTHROUGH __attribute__((fallthrough))
+#else
+#define CO_FALLTHROUGH
+#endif
+
+#define CO_BEGIN(co) switch ((co).line) { case 0:
+
+#define CO_END(co) } (co).line = 0
+
+// suspend until the condition holds, it is re-evaluated on every resume
+#define CO_AWAIT(co, condition) \
+    do { (co).line = __LINE__; (co).waitingOnTimer = false; CO_FALLTHROUGH; case __LINE__: \
+        if (!(condition)) return; } while (0)
+
+// suspend until the deadline expires, it is re-read on every resume so it may be moved meanwhile
+#define CO_AWAIT_DEADLINE(co, clock, deadline) \
+    do { (co).line = __LINE__; CO_FALLTHROUGH; case __LINE__: (co).wakeAt = (deadline); \
+        (co).waitingOnTimer = !(co).wakeAt.expired(clock); if ((co).waitingOnTimer) return; } while (0)
+
+#define CO_SLEEP(co, clock, ms) \
+    do { (co).wakeAt = heatpumpDeadline::after((clock), (ms)); CO_AWAIT_DEADLINE(co, clock, (co).wakeAt); } while (0)
+
+// CO_SLEEP that also ends once the condition holds. Only the timer counts for idleTime(), so whatever makes
+// the condition true has to wake the task, like a UART receive callback
+#define CO_SLEEP_OR(co, clock, ms, condition) \
+    do { (co).wakeAt = heatpumpDeadline::after((clock), (ms)); (co).line = __LINE__; CO_FALLTHROUGH; \
+        case __LINE__: (co).waitingOnTimer = !(co).wakeAt.expired(clock) && !(condition); \
+        if ((co).waitingOnTimer) return; } while (0)
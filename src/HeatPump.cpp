@@ -17,6 +17,7 @@
   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 */
 #include "HeatPump.h"
+#include "HeatPumpTrace.h"
 
 // Structures //////////////////////////////////////////////////////////////////
 
@@ -40,10 +41,19 @@ bool operator!=(const heatpumpSettings &lhs, const heatpumpSettings &rhs) {
            lhs.iSee != rhs.iSee;
 }
 
+void heatpumpSettingsChange::applyTo(heatpumpSettings &target) const {
+    if (fields & POWER) target.power = settings.power;
+    if (fields & MODE) target.mode = settings.mode;
+    if (fields & TEMPERATURE) target.temperature = settings.temperature;
+    if (fields & FAN) target.fan = settings.fan;
+    if (fields & VANE) target.vane = settings.vane;
+    if (fields & WIDEVANE) target.wideVane = settings.wideVane;
+}
+
 bool operator!(const heatpumpSettings &settings) {
     return !settings.power &&
            !settings.mode &&
-           !settings.temperature &&
+           !settings.temperature.halfDegrees &&
            !settings.fan &&
            !settings.vane &&
            !settings.wideVane &&
@@ -66,20 +76,268 @@ bool operator!=(const heatpumpTimers &lhs, const heatpumpTimers &rhs) {
            lhs.offMinutesRemaining != rhs.offMinutesRemaining;
 }
 
+// Statistics //////////////////////////////////////////////////////////////////
+
+heatpumpRollingWindow::heatpumpRollingWindow(unsigned long lengthMs) {
+    bucketMs = (uint32_t) max(lengthMs / BUCKETS, 1UL);
+    started = false;
+    clear(0);
+}
+
+unsigned long heatpumpRollingWindow::length() const {
+    return bucketMs * BUCKETS;
+}
+
+void heatpumpRollingWindow::clear(uint32_t now) {
+    memset(buckets, 0, sizeof(buckets));
+    current = 0;
+    closed = 0;
+    currentStart = now;
+    roomSum = 0;
+    ms = 0;
+    operatingMs = 0;
+    frequencySum = 0;
+    minimums.head = minimums.count = 0;
+    maximums.head = maximums.count = 0;
+}
+
+void heatpumpRollingWindow::weigh(const heatpumpStatus &status, unsigned long weightMs) {
+    if (!weightMs) return;
+    bucket &open = buckets[current];
+    open.roomSum += (int64_t) status.roomTemperature.halfDegrees * weightMs;
+    open.frequencySum += (uint64_t) status.compressorFrequency * weightMs;
+    open.ms += weightMs;
+    if (status.operating) open.operatingMs += weightMs;
+    include(status.roomTemperature);
+}
+
+void heatpumpRollingWindow::include(heatpumpTemperature roomTemperature) {
+    bucket &open = buckets[current];
+    if (!open.hasRoom || roomTemperature.halfDegrees < open.roomMin) open.roomMin = roomTemperature.halfDegrees;
+    if (!open.hasRoom || roomTemperature.halfDegrees > open.roomMax) open.roomMax = roomTemperature.halfDegrees;
+    open.hasRoom = true;
+}
+
+void heatpumpRollingWindow::close() {
+    const bucket &done = buckets[current];
+    roomSum += done.roomSum;
+    frequencySum += done.frequencySum;
+    ms += done.ms;
+    operatingMs += done.operatingMs;
+    if (done.hasRoom) {
+        while (minimums.count && buckets[minimums.back()].roomMin >= done.roomMin) minimums.popBack();
+        minimums.push(current);
+        while (maximums.count && buckets[maximums.back()].roomMax <= done.roomMax) maximums.popBack();
+        maximums.push(current);
+    }
+    closed++;
+
+    // the next bucket's slot holds the oldest closed bucket once the ring is full
+    const uint8_t next = (current + 1) % BUCKETS;
+    if (closed == BUCKETS) {
+        const bucket &oldest = buckets[next];
+        roomSum -= oldest.roomSum;
+        frequencySum -= oldest.frequencySum;
+        ms -= oldest.ms;
+        operatingMs -= oldest.operatingMs;
+        if (minimums.count && minimums.front() == next) minimums.popFront();
+        if (maximums.count && maximums.front() == next) maximums.popFront();
+        closed--;
+    }
+    memset(&buckets[next], 0, sizeof(bucket));
+    current = next;
+    currentStart += bucketMs;
+}
+
+void heatpumpRollingWindow::add(uint32_t now, unsigned long weightMs, const heatpumpStatus &previous,
+                                const heatpumpStatus &current) {
+    if (!started || now - currentStart >= length()) {
+        // nothing in the window is recent enough to keep
+        clear(now);
+        started = true;
+        weightMs = 0;
+    }
+
+    // split the weight over the buckets it spans, the part before the oldest one is dropped
+    while (now - currentStart >= bucketMs) {
+        const uint32_t after = now - (currentStart + bucketMs);
+        if (weightMs > after) {
+            weigh(previous, weightMs - after);
+            weightMs = after;
+        }
+        close();
+    }
+    weigh(previous, weightMs);
+    include(current.roomTemperature);
+}
+
+heatpumpWindowStatistics heatpumpRollingWindow::get() const {
+    const bucket &open = buckets[current];
+    const uint64_t totalMs = ms + open.ms;
+
+    heatpumpWindowStatistics result {};
+    result.spanMs = (unsigned long) totalMs;
+    result.valid = totalMs > 0;
+    if (!result.valid) return result;
+
+    int16_t roomMin = open.hasRoom ? open.roomMin : INT16_MAX;
+    int16_t roomMax = open.hasRoom ? open.roomMax : INT16_MIN;
+    if (minimums.count) roomMin = min(roomMin, buckets[minimums.front()].roomMin);
+    if (maximums.count) roomMax = max(roomMax, buckets[maximums.front()].roomMax);
+    result.roomTemperatureMin = heatpumpTemperature::fromHalfDegrees(roomMin);
+    result.roomTemperatureMax = heatpumpTemperature::fromHalfDegrees(roomMax);
+    result.roomTemperatureMean = (float) (roomSum + open.roomSum) / totalMs / 2.0f;
+    result.dutyCycle = (float) (operatingMs + open.operatingMs) / totalMs;
+    result.compressorFrequencyMean = (float) (frequencySum + open.frequencySum) / totalMs;
+    return result;
+}
+
+heatpumpStatistics::heatpumpStatistics(unsigned long shortMs, unsigned long mediumMs, unsigned long longMs)
+        : windows{heatpumpRollingWindow(shortMs), heatpumpRollingWindow(mediumMs), heatpumpRollingWindow(longMs)} {
+}
+
+void heatpumpStatistics::sample(uint32_t now, const heatpumpStatus &status) {
+    const unsigned long weightMs = sampled ? min((unsigned long) (now - lastSample), (unsigned long) MAX_SAMPLE_GAP_MS) : 0;
+    for (int i = 0; i < WINDOWS; i++) {
+        windows[i].add(now, weightMs, sampled ? last : status, status);
+    }
+    last = status;
+    lastSample = now;
+    sampled = true;
+}
+
+void heatpumpStatistics::modeChanged(uint32_t now) {
+    modeChangedAt = now;
+    modeKnown = true;
+}
+
+heatpumpWindowStatistics heatpumpStatistics::get(int window) const {
+    return windows[constrain(window, 0, WINDOWS - 1)].get();
+}
+
+unsigned long heatpumpStatistics::windowLength(int window) const {
+    return windows[constrain(window, 0, WINDOWS - 1)].length();
+}
+
+bool heatpumpStatistics::timeSinceModeChange(uint32_t now, unsigned long &ms) const {
+    if (!modeKnown) return false;
+    ms = now - modeChangedAt;
+    return true;
+}
+
+
+// Runtime and energy //////////////////////////////////////////////////////////
+
+unsigned long heatpumpPowerCurve::watts(bool power, int frequency) const {
+    const int points = min((int) count, (int) MAX_POINTS);
+    if (!points) return 0;
+    if (!power) return offWatts;
+    if (frequency <= 0) return idleWatts;
+    if (frequency <= this->points[0].frequency) return this->points[0].watts;
+    for (int i = 1; i < points; i++) {
+        const point &high = this->points[i];
+        if (frequency > high.frequency) continue;
+        const point &low = this->points[i - 1];
+        const long span = high.frequency - low.frequency;
+        if (span <= 0) return high.watts;
+        return (unsigned long) (low.watts + ((long) high.watts - low.watts) * (frequency - low.frequency) / span);
+    }
+    return this->points[points - 1].watts;
+}
+
+heatpumpRuntime::heatpumpRuntime(const heatpumpPowerCurve &curve) : powerCurve(curve) {
+}
+
+void heatpumpRuntime::sample(uint32_t now, const heatpumpStatus &status, bool power, int mode) {
+    if (sampled) {
+        const unsigned long weightMs = min((unsigned long) (now - lastSample), (unsigned long) MAX_SAMPLE_GAP_MS);
+        sums.accountedMs += weightMs;
+        if (lastOperating) sums.operatingMs += weightMs;
+        if (lastFrequency > 0) {
+            sums.compressorMs += weightMs;
+            if (lastMode >= 0 && lastMode < 5) sums.compressorModeMs[lastMode] += weightMs;
+        }
+        sums.energyWattMs += (uint64_t) powerCurve.watts(lastPower, lastFrequency) * weightMs;
+
+        if (lastFrequency == 0 && status.compressorFrequency > 0) sums.compressorStarts++;
+        if (lastFrequency > 0 && status.compressorFrequency == 0) sums.compressorStops++;
+    }
+    lastSample = now;
+    lastPower = power;
+    lastMode = mode;
+    lastFrequency = status.compressorFrequency;
+    lastOperating = status.operating;
+    sampled = true;
+}
+
+void heatpumpRuntime::restore(const heatpumpRuntimeTotals &totals) {
+    sums = totals;
+}
+
+const heatpumpRuntimeTotals &heatpumpRuntime::totals() const {
+    return sums;
+}
+
+const heatpumpPowerCurve &heatpumpRuntime::curve() const {
+    return powerCurve;
+}
+
+
+// Protocol tables //////////////////////////////////////////////////////////
+
+const byte HeatPump::CONNECT[CONNECT_LEN] = {0xfc, 0x5a, 0x01, 0x30, 0x02, 0xca, 0x01, 0xa8};
+const byte HeatPump::HEADER[HEADER_LEN]  = {0xfc, 0x41, 0x01, 0x30, 0x10, 0x01, 0x00, 0x00};
+const byte HeatPump::INFOHEADER[INFOHEADER_LEN]  = {0xfc, 0x42, 0x01, 0x30, 0x10};
+
+const byte HeatPump::INFOMODE[INFOMODE_LEN] = {
+    0x02, // request a settings packet - RQST_PKT_SETTINGS
+    0x03, // request the current room temp - RQST_PKT_ROOM_TEMP
+    0x04, // unknown
+    0x05, // request the timers - RQST_PKT_TIMERS
+    0x06, // request status - RQST_PKT_STATUS
+    0x09  // request standby mode (maybe?) RQST_PKT_STANDBY
+};
+
+const byte HeatPump::CONTROL_PACKET_1[5] = {0x01,    0x02,  0x04,  0x08, 0x10};
+                                         //{"POWER","MODE","TEMP","FAN","VANE"};
+const byte HeatPump::CONTROL_PACKET_2[1] = {0x01};
+                                         //{"WIDEVANE"};
+const byte HeatPump::POWER[2]                   = {0x00, 0x01};
+const char* const HeatPump::POWER_MAP[2]        = {"OFF", "ON"};
+const byte HeatPump::MODE[5]                    = {0x01,   0x02,  0x03, 0x07, 0x08};
+const char* const HeatPump::MODE_MAP[5]         = {"HEAT", "DRY", "COOL", "FAN", "AUTO"};
+const byte HeatPump::TEMP[16]                   = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+const int HeatPump::TEMP_MAP[16]                = {31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16};
+const byte HeatPump::FAN[6]                     = {0x00,  0x01,   0x02, 0x03, 0x05, 0x06};
+const char* const HeatPump::FAN_MAP[6]          = {"AUTO", "QUIET", "1", "2", "3", "4"};
+const byte HeatPump::VANE[7]                    = {0x00,  0x01, 0x02, 0x03, 0x04, 0x05, 0x07};
+const char* const HeatPump::VANE_MAP[7]         = {"AUTO", "1", "2", "3", "4", "5", "SWING"};
+const byte HeatPump::WIDEVANE[7]                = {0x01, 0x02, 0x03, 0x04, 0x05, 0x08, 0x0c};
+const char* const HeatPump::WIDEVANE_MAP[7]     = {"<<", "<",  "|",  ">",  ">>", "<>", "SWING"};
+const byte HeatPump::ROOM_TEMP[32]              = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+                                                   0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f};
+const int HeatPump::ROOM_TEMP_MAP[32]           = {10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25,
+                                                   26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40, 41};
+const byte HeatPump::TIMER_MODE[4]              = {0x00,  0x01,  0x02, 0x03};
+const char* const HeatPump::TIMER_MODE_MAP[4]   = {"NONE", "OFF", "ON", "BOTH"};
+
 
 // Constructor /////////////////////////////////////////////////////////////////
 
 HeatPump::HeatPump() {
     lastSend = 0;
     infoMode = 0;
-    lastRecv = millis() - (PACKET_SENT_INTERVAL_MS * 10);
+    lastRecv = clock->millis() - (PACKET_SENT_INTERVAL_MS * 10);
+    lastSetSend = 0;
     autoUpdate = false;
     firstRun = true;
     tempMode = false;
     waitForRead = false;
     externalUpdate = false;
     wideVaneAdj = false;
+#ifndef HEATPUMP_NO_FUNCTIONS
     functions = heatpumpFunctions();
+#endif
 }
 
 // Public Methods //////////////////////////////////////////////////////////////
@@ -97,6 +355,7 @@ bool HeatPump::connect(HardwareSerial *serial, int rx, int tx) {
 }
 
 bool HeatPump::connect(HardwareSerial *serial, int bitrate, int rx, int tx) {
+    HEATPUMP_TRACE_SPAN("HeatPump::connect");
     if (serial != NULL) {
         _HardSerial = serial;
     }
@@ -106,6 +365,13 @@ bool HeatPump::connect(HardwareSerial *serial, int bitrate, int rx, int tx) {
         retry = true;
     }
     connected = false;
+    if (waitForRead) {
+        // reconnecting gives up on the request in flight
+        counters.responseTimeouts++;
+        waitForRead = false;
+    }
+    updateLinkState();
+    if (!listenOnly) counters.connects++;
     if (rx >= 0 && tx >= 0) {
 #if defined(ESP32)
         _HardSerial->begin(bitrate, SERIAL_8E1, rx, tx);
@@ -118,17 +384,21 @@ bool HeatPump::connect(HardwareSerial *serial, int bitrate, int rx, int tx) {
     if (onConnectCallback) {
         onConnectCallback();
     }
+    if (listenOnly) {
+        return true; // connected once a valid frame is heard, see readPacket()
+    }
 
     // settle before we start sending packets
-    delay(2000);
+    clock->delay(2000);
 
     // send the CONNECT packet twice - need to copy the CONNECT packet locally
     byte packet[CONNECT_LEN];
     memcpy(packet, CONNECT, CONNECT_LEN);
     //for(int count = 0; count < 2; count++) {
     writePacket(packet, CONNECT_LEN);
-    while (!canRead()) { delay(10); }
+    while (!canRead()) { clock->delay(10); }
     int packetType = readPacket();
+    updateLinkState();
     if (packetType != RCVD_PKT_CONNECT_SUCCESS && retry) {
         return connect(serial, 9600, rx, tx);
     }
@@ -137,25 +407,35 @@ bool HeatPump::connect(HardwareSerial *serial, int bitrate, int rx, int tx) {
 }
 
 bool HeatPump::update() {
-    while (!canSend(false)) { delay(10); }
+    HEATPUMP_TRACE_SPAN("HeatPump::update");
+    if (listenOnly) {
+        return false; // the other master owns the settings
+    }
+    while (!canSend(false)) { clock->delay(10); }
 
     // Flush the serial buffer before updating settings to clear out
     // any remaining responses that would prevent us from receiving
-    // RCVD_PKT_UPDATE_SUCCESS
+    // RCVD_PKT_UPDATE_SUCCESS. A settings reply among them mustn't take
+    // the place of the settings we are about to send (externalUpdate).
+    const heatpumpSettings wanted = wantedSettings;
     readAllPackets();
+    wantedSettings = wanted;
 
     byte packet[PACKET_LEN] = {};
     createPacket(packet, wantedSettings);
+    if (packet[6] == 0 && packet[7] == 0) {
+        return true; // the flushed replies already show the wanted settings, no field to change
+    }
     writePacket(packet, PACKET_LEN);
 
-    while (!canRead()) { delay(10); }
+    while (!canRead()) { clock->delay(10); }
     int packetType = readPacket();
 
     if (packetType == RCVD_PKT_UPDATE_SUCCESS) {
         // call sync() to get the latest settings from the heatpump for autoUpdate, which should now have the updated settings
         if (autoUpdate) { //this sync will happen regardless, but autoUpdate needs it sooner than later.
             while (!canSend(true)) {
-                delay(10);
+                clock->delay(10);
             }
             sync(RQST_PKT_SETTINGS);
         } else {
@@ -170,11 +450,23 @@ bool HeatPump::update() {
 }
 
 void HeatPump::sync(byte packetType) {
-    if ((!connected) || (millis() - lastRecv > (PACKET_SENT_INTERVAL_MS * 30))) {
+    HEATPUMP_TRACE_SPAN("HeatPump::sync");
+    decodeSettings(); // for the wantedSettings comparison below
+    if (listenOnly) {
+        if (_HardSerial->available() > 0) {
+            readAllPackets();
+        }
+        updateLinkState();
+        return;
+    }
+    updateLinkState();
+    if (linkState == HEATPUMP_LINK_DOWN) {
         connect(NULL);
     } else if (canRead()) {
         readAllPackets();
-    } else if (autoUpdate && !firstRun && wantedSettings != currentSettings && packetType == PACKET_TYPE_DEFAULT) {
+    } else if (autoUpdate && !firstRun && !waitForRead && wantedSettings != currentSettings &&
+               packetType == PACKET_TYPE_DEFAULT) {
+        // not while a reply is due: after a write it is the settings read that tells whether it took
         update();
     } else if (canSend(true)) {
         byte packet[PACKET_LEN] = {};
@@ -196,18 +488,92 @@ void HeatPump::enableAutoUpdate() {
     autoUpdate = true;
 }
 
+void HeatPump::enableListenOnly() {
+    listenOnly = true;
+}
+
+void HeatPump::disableListenOnly() {
+    listenOnly = false;
+    connected = false;
+}
+
+bool HeatPump::isListenOnly() {
+    return listenOnly;
+}
+
 void HeatPump::disableAutoUpdate() {
     autoUpdate = false;
 }
 
 heatpumpSettings HeatPump::getSettings() {
+    decodeSettings();
     return currentSettings;
 }
 
+heatpumpSettings HeatPump::getWantedSettings() {
+    return wantedSettings;
+}
+
+void HeatPump::setClock(heatpumpClock *clock) {
+    this->clock = clock;
+    lastRecv = clock->millis() - (PACKET_SENT_INTERVAL_MS * 10);
+}
+
 bool HeatPump::isConnected() {
     return connected;
 }
 
+heatpumpLinkState HeatPump::getLinkState() {
+    updateLinkState();
+    return linkState;
+}
+
+const heatpumpCounters &HeatPump::getCounters() {
+    return counters;
+}
+
+void HeatPump::setFrameGapBounds(unsigned long minMs, unsigned long maxMs) {
+    minFrameGap = minMs;
+    maxFrameGap = max(minMs, maxMs);
+}
+
+unsigned long HeatPump::getFrameGap() {
+    return frameGap();
+}
+
+unsigned long HeatPump::getReplyLatency() {
+    return busTiming.sampled ? busTiming.latency : 0;
+}
+
+void HeatPump::setStatusPollInterval(unsigned long ms) {
+    statusPollInterval = ms;
+}
+
+void HeatPump::setStatistics(heatpumpStatistics *statistics) {
+    this->statistics = statistics;
+    if (!statistics) return;
+    // from here on replies are decoded as they come in
+    decodeSettings();
+    decodeRoomTemp();
+    decodeStatus();
+}
+
+const heatpumpStatistics* HeatPump::getStatistics() {
+    return statistics;
+}
+
+void HeatPump::setRuntime(heatpumpRuntime *runtime) {
+    this->runtime = runtime;
+    if (!runtime) return;
+    // the mode setting attributes compressor time, so settings are decoded as they come in too
+    decodeSettings();
+    decodeStatus();
+}
+
+const heatpumpRuntime* HeatPump::getRuntime() {
+    return runtime;
+}
+
 void HeatPump::setSettings(heatpumpSettings settings) {
     setPowerSetting(settings.power);
     setModeSetting(settings.mode);
@@ -218,6 +584,7 @@ void HeatPump::setSettings(heatpumpSettings settings) {
 }
 
 bool HeatPump::getPowerSettingBool() {
+    decodeSettings();
     return currentSettings.power == POWER_MAP[1] ? true : false;
 }
 
@@ -228,6 +595,7 @@ void HeatPump::setPowerSetting(bool setting) {
 }
 
 const char *HeatPump::getPowerSetting() {
+    decodeSettings();
     return currentSettings.power;
 }
 
@@ -241,6 +609,7 @@ void HeatPump::setPowerSetting(const char *setting) {
 }
 
 const char *HeatPump::getModeSetting() {
+    decodeSettings();
     return currentSettings.mode;
 }
 
@@ -254,36 +623,40 @@ void HeatPump::setModeSetting(const char *setting) {
 }
 
 float HeatPump::getTemperature() {
-    return currentSettings.temperature;
+    decodeSettings();
+    return currentSettings.temperature.toCelsius();
 }
 
 void HeatPump::setTemperature(float setting) {
+    setTemperature(heatpumpTemperature::fromCelsius(setting));
+}
+
+void HeatPump::setTemperature(heatpumpTemperature setting) {
     if (!tempMode) {
-        wantedSettings.temperature =
-                lookupByteMapIndex(TEMP_MAP, 16, (int) (setting + 0.5)) > -1 ? setting : TEMP_MAP[0];
+        // whole degrees only, the unit can't take half degrees in this mode, and only TEMP_MAP's 16-31
+        wantedSettings.temperature = heatpumpTemperature::fromDegrees(
+                setting.clamp(heatpumpTemperature::fromDegrees(TEMP_MAP[15]),
+                              heatpumpTemperature::fromDegrees(TEMP_MAP[0])).toDegrees());
     } else {
-        setting = setting * 2;
-        setting = round(setting);
-        setting = setting / 2;
-        wantedSettings.temperature = setting < 10 ? 10 : (setting > 31 ? 31 : setting);
+        wantedSettings.temperature = setting.clamp(heatpumpTemperature::fromDegrees(10),
+                                                   heatpumpTemperature::fromDegrees(31));
     }
 }
 
 void HeatPump::setRemoteTemperature(float setting) {
+    setRemoteTemperature(heatpumpTemperature::fromCelsius(setting));
+}
+
+void HeatPump::setRemoteTemperature(heatpumpTemperature setting) {
     byte packet[PACKET_LEN] = {};
 
     prepareSetPacket(packet, PACKET_LEN);
 
     packet[5] = 0x07;
-    if (setting > 0) {
+    if (setting.halfDegrees > 0) {
         packet[6] = 0x01;
-        setting = setting * 2;
-        setting = round(setting);
-        setting = setting / 2;
-        float temp1 = 3 + ((setting - 10) * 2);
-        packet[7] = (int) temp1;
-        float temp2 = (setting * 2) + 128;
-        packet[8] = (int) temp2;
+        packet[7] = (byte) (3 + (setting.halfDegrees - 20)); // 3 + ((t - 10) * 2)
+        packet[8] = setting.toWire();
     } else {
         packet[6] = 0x00;
         packet[8] = 0x80; //MHK1 send 80, even though it could be 00, since ControlByte is 00
@@ -291,11 +664,12 @@ void HeatPump::setRemoteTemperature(float setting) {
     // add the checksum
     byte chkSum = checkSum(packet, 21);
     packet[21] = chkSum;
-    while (!canSend(false)) { delay(10); }
+    while (!canSend(false)) { clock->delay(10); }
     writePacket(packet, PACKET_LEN);
 }
 
 const char *HeatPump::getFanSpeed() {
+    decodeSettings();
     return currentSettings.fan;
 }
 
@@ -310,6 +684,7 @@ void HeatPump::setFanSpeed(const char *setting) {
 }
 
 const char *HeatPump::getVaneSetting() {
+    decodeSettings();
     return currentSettings.vane;
 }
 
@@ -323,6 +698,7 @@ void HeatPump::setVaneSetting(const char *setting) {
 }
 
 const char *HeatPump::getWideVaneSetting() {
+    decodeSettings();
     return currentSettings.wideVane;
 }
 
@@ -335,30 +711,84 @@ void HeatPump::setWideVaneSetting(const char *setting) {
     }
 }
 
+void HeatPump::setSettings(const heatpumpSettingsChange &change) {
+    if (change.fields & heatpumpSettingsChange::POWER) setPowerSetting(change.settings.power);
+    if (change.fields & heatpumpSettingsChange::MODE) setModeSetting(change.settings.mode);
+    if (change.fields & heatpumpSettingsChange::TEMPERATURE) setTemperature(change.settings.temperature);
+    if (change.fields & heatpumpSettingsChange::FAN) setFanSpeed(change.settings.fan);
+    if (change.fields & heatpumpSettingsChange::VANE) setVaneSetting(change.settings.vane);
+    if (change.fields & heatpumpSettingsChange::WIDEVANE) setWideVaneSetting(change.settings.wideVane);
+}
+
+heatpumpFieldResult HeatPump::parseSettingsField(const char *name, const char *value,
+                                                 heatpumpSettingsChange &change) {
+    static const struct {
+        const char *name;
+        const char *const *map;
+        int length;
+        const char *heatpumpSettings::*setting;
+        heatpumpSettingsChange::Field field;
+    } MAPPED[] = {
+        {"POWER", POWER_MAP, 2, &heatpumpSettings::power, heatpumpSettingsChange::POWER},
+        {"MODE", MODE_MAP, 5, &heatpumpSettings::mode, heatpumpSettingsChange::MODE},
+        {"FAN", FAN_MAP, 6, &heatpumpSettings::fan, heatpumpSettingsChange::FAN},
+        {"VANE", VANE_MAP, 7, &heatpumpSettings::vane, heatpumpSettingsChange::VANE},
+        {"WIDEVANE", WIDEVANE_MAP, 7, &heatpumpSettings::wideVane, heatpumpSettingsChange::WIDEVANE},
+    };
+
+    if (strcasecmp(name, "TEMP") == 0 || strcasecmp(name, "TEMPERATURE") == 0) {
+        char *end;
+        const float celsius = strtof(value, &end);
+        if (end == value || *end || !(celsius >= 10 && celsius <= 31)) { // also NaN
+            return HEATPUMP_FIELD_INVALID;
+        }
+        change.settings.temperature = heatpumpTemperature::fromCelsius(celsius);
+        change.fields |= heatpumpSettingsChange::TEMPERATURE;
+        return HEATPUMP_FIELD_SET;
+    }
+    for (const auto &mapped : MAPPED) {
+        if (strcasecmp(name, mapped.name) != 0) {
+            continue;
+        }
+        const int index = lookupByteMapIndex(mapped.map, mapped.length, value);
+        if (index < 0) {
+            return HEATPUMP_FIELD_INVALID;
+        }
+        change.settings.*mapped.setting = mapped.map[index];
+        change.fields |= mapped.field;
+        return HEATPUMP_FIELD_SET;
+    }
+    return HEATPUMP_FIELD_UNKNOWN;
+}
+
 bool HeatPump::getIseeBool() { //no setter yet
+    decodeSettings();
     return currentSettings.iSee;
 }
 
 heatpumpStatus HeatPump::getStatus() {
+    decodeRoomTemp();
+    decodeTimers();
+    decodeStatus();
     return currentStatus;
 }
 
 float HeatPump::getRoomTemperature() {
-    return currentStatus.roomTemperature;
+    decodeRoomTemp();
+    return currentStatus.roomTemperature.toCelsius();
 }
 
 bool HeatPump::getOperating() {
+    decodeStatus();
     return currentStatus.operating;
 }
 
 float HeatPump::FahrenheitToCelsius(int tempF) {
-    float temp = (tempF - 32) / 1.8;
-    return ((float) round(temp * 2)) / 2;                 //Round to nearest 0.5C
+    return heatpumpTemperature::fromFahrenheit(tempF).toCelsius(); //Round to nearest 0.5C
 }
 
 int HeatPump::CelsiusToFahrenheit(float tempC) {
-    float temp = (tempC * 1.8) + 32;                //round up if heat, down if cool or any other mode
-    return (int) (temp + 0.5);
+    return heatpumpTemperature::fromCelsius(tempC).toFahrenheit();
 }
 
 void HeatPump::setOnConnectCallback(ON_CONNECT_CALLBACK_SIGNATURE) {
@@ -373,17 +803,24 @@ void HeatPump::setStatusChangedCallback(STATUS_CHANGED_CALLBACK_SIGNATURE) {
     this->statusChangedCallback = statusChangedCallback;
 }
 
+#ifndef HEATPUMP_NO_PACKET_CALLBACK
 void HeatPump::setPacketCallback(PACKET_CALLBACK_SIGNATURE) {
     this->packetCallback = packetCallback;
 }
+#endif
 
 void HeatPump::setRoomTempChangedCallback(ROOM_TEMP_CHANGED_CALLBACK_SIGNATURE) {
     this->roomTempChangedCallback = roomTempChangedCallback;
 }
 
+void HeatPump::setLinkStateChangedCallback(LINK_STATE_CHANGED_CALLBACK_SIGNATURE) {
+    this->linkStateChangedCallback = linkStateChangedCallback;
+}
+
+#ifndef HEATPUMP_NO_CUSTOM_PACKET
 //#### WARNING, THE FOLLOWING METHOD CAN F--K YOUR HP UP, USE WISELY ####
 void HeatPump::sendCustomPacket(byte data[], int packetLength) {
-    while (!canSend(false)) { delay(10); }
+    while (!canSend(false)) { clock->delay(10); }
 
     packetLength += 2; // +2 for first header byte and checksum
     packetLength = (packetLength > PACKET_LEN) ? PACKET_LEN : packetLength; // ensure we are not exceeding PACKET_LEN
@@ -401,6 +838,7 @@ void HeatPump::sendCustomPacket(byte data[], int packetLength) {
 
     writePacket(packet, packetLength);
 }
+#endif
 
 // Private Methods //////////////////////////////////////////////////////////////
 
@@ -413,7 +851,7 @@ int HeatPump::lookupByteMapIndex(const int valuesMap[], int len, int lookupValue
     return -1;
 }
 
-int HeatPump::lookupByteMapIndex(const char *valuesMap[], int len, const char *lookupValue) {
+int HeatPump::lookupByteMapIndex(const char *const valuesMap[], int len, const char *lookupValue) {
     for (int i = 0; i < len; i++) {
         if (strcasecmp(valuesMap[i], lookupValue) == 0) {
             return i;
@@ -423,7 +861,7 @@ int HeatPump::lookupByteMapIndex(const char *valuesMap[], int len, const char *l
 }
 
 
-const char *HeatPump::lookupByteMapValue(const char *valuesMap[], const byte byteMap[], int len, byte byteValue) {
+const char *HeatPump::lookupByteMapValue(const char *const valuesMap[], const byte byteMap[], int len, byte byteValue) {
     for (int i = 0; i < len; i++) {
         if (byteMap[i] == byteValue) {
             return valuesMap[i];
@@ -442,11 +880,131 @@ int HeatPump::lookupByteMapValue(const int valuesMap[], const byte byteMap[], in
 }
 
 bool HeatPump::canSend(bool isInfo) {
-    return (millis() - (isInfo ? PACKET_INFO_INTERVAL_MS : PACKET_SENT_INTERVAL_MS)) > lastSend;
+    const uint32_t now = clock->millis();
+    if (waitForRead && now - lastSend <= responseTimeout()) {
+        return false; // the reply to the last request may still be on its way
+    }
+    // writes keep the original 1:2 ratio to info polls so they go out first
+    const unsigned long gap = isInfo ? frameGap() : max(minFrameGap, frameGap() / 2);
+    return now - lastExchange >= gap;
+}
+
+unsigned long HeatPump::timeUntilSync() {
+    const uint32_t now = clock->millis();
+    if (listenOnly) {
+        // data wakes the caller, otherwise the next look is when silence takes the link down
+        const unsigned long silence = now - lastRecv;
+        return connected && silence <= (unsigned long) LINK_DOWN_MS ? LINK_DOWN_MS - silence + 1 : maxFrameGap;
+    }
+    if (!connected || linkState == HEATPUMP_LINK_DOWN ||
+        (autoUpdate && !firstRun && !waitForRead && wantedSettings != currentSettings)) {
+        return 0;
+    }
+    if (waitForRead) {
+        if (replyAvailable()) {
+            return 0;
+        }
+        // an earlier reply shows up as serial data, this is the timeout
+        const unsigned long timeout = responseTimeout();
+        return now - lastSend > timeout ? 0 : timeout - (now - lastSend) + 1;
+    }
+    const unsigned long gap = frameGap();
+    return now - lastExchange >= gap ? 0 : gap - (now - lastExchange);
 }
 
 bool HeatPump::canRead() {
-    return (waitForRead && (millis() - PACKET_SENT_INTERVAL_MS) > lastSend);
+    return waitForRead && (replyAvailable() || clock->millis() - lastSend > responseTimeout());
+}
+
+bool HeatPump::replyAvailable() {
+    if (_HardSerial->available() <= 0) {
+        return false;
+    }
+    // readPacket() may come later, e.g. at the caller's next sync() interval
+    if (!replySeen) {
+        replySeen = true;
+        replySeenAt = clock->millis();
+    }
+    return true;
+}
+
+unsigned long HeatPump::responseTimeout() {
+    const responseTiming &t = timing[pendingTiming].sampled ? timing[pendingTiming] : busTiming;
+    if (!t.sampled) {
+        return PACKET_SENT_INTERVAL_MS;
+    }
+    const unsigned long timeout = (t.latency + 4 * t.variance + PACKET_RESPONSE_SLACK_MS) << backoff;
+    return constrain(timeout, minFrameGap, (unsigned long) PACKET_SENT_INTERVAL_MS);
+}
+
+unsigned long HeatPump::frameGap() {
+    // give the unit as long to settle as it takes to answer, and the original pacing until it has answered
+    if (!busTiming.sampled) {
+        return maxFrameGap;
+    }
+    return constrain(busTiming.latency << backoff, minFrameGap, maxFrameGap);
+}
+
+void HeatPump::exchangeSucceeded(bool awaitingReply, uint32_t responseAt) {
+    consecutiveMisses = 0;
+    updateLinkState();
+    if (backoff > 0) {
+        backoff--;
+    }
+    if (awaitingReply) {
+        const unsigned long latency = responseAt - lastSend;
+        timing[pendingTiming].sample(latency);
+        busTiming.sample(latency);
+    }
+}
+
+void HeatPump::exchangeFailed() {
+    if (backoff < PACKET_BACKOFF_MAX) {
+        backoff++;
+    }
+    if (consecutiveMisses < 255) {
+        consecutiveMisses++;
+    }
+    updateLinkState();
+}
+
+void HeatPump::updateLinkState() {
+    const uint32_t now = clock->millis();
+    // a request past its reply deadline counts as missed before readPacket() gets to it
+    const int misses = consecutiveMisses + (waitForRead && now - lastSend > responseTimeout() ? 1 : 0);
+
+    heatpumpLinkState state = HEATPUMP_LINK_HEALTHY;
+    if (listenOnly) {
+        // nothing is awaited, the link is as good as what is heard
+        if (!connected || now - lastRecv > (unsigned long) LINK_DOWN_MS) {
+            state = HEATPUMP_LINK_DOWN;
+        } else if (consecutiveMisses > 0) {
+            state = HEATPUMP_LINK_DEGRADED;
+        }
+    } else if (!connected || misses >= LINK_DOWN_MISSES || (misses > 0 && now - lastRecv > (unsigned long) LINK_DOWN_MS)) {
+        state = HEATPUMP_LINK_DOWN;
+    } else if (misses > 0) {
+        state = HEATPUMP_LINK_DEGRADED;
+    }
+
+    if (state != linkState) {
+        linkState = state;
+        if (linkStateChangedCallback) {
+            linkStateChangedCallback(linkState);
+        }
+    }
+}
+
+void HeatPump::responseTiming::sample(unsigned long ms) {
+    if (!sampled) {
+        latency = ms;
+        variance = ms / 2;
+        sampled = true;
+        return;
+    }
+    const long error = (long) ms - (long) latency;
+    latency = (unsigned long) ((long) latency + error / 8);
+    variance = (unsigned long) ((long) variance + ((long) labs(error) - (long) variance) / 4);
 }
 
 byte HeatPump::checkSum(byte bytes[], int len) {
@@ -458,6 +1016,7 @@ byte HeatPump::checkSum(byte bytes[], int len) {
 }
 
 void HeatPump::createPacket(byte *packet, heatpumpSettings settings) {
+    decodeSettings(); // only the changed fields are sent
     prepareSetPacket(packet, PACKET_LEN);
 
     if (settings.power != currentSettings.power) {
@@ -469,11 +1028,10 @@ void HeatPump::createPacket(byte *packet, heatpumpSettings settings) {
         packet[6] += CONTROL_PACKET_1[1];
     }
     if (!tempMode && settings.temperature != currentSettings.temperature) {
-        packet[10] = TEMP[lookupByteMapIndex(TEMP_MAP, 16, settings.temperature)];
+        packet[10] = TEMP[lookupByteMapIndex(TEMP_MAP, 16, settings.temperature.toDegrees())];
         packet[6] += CONTROL_PACKET_1[2];
     } else if (tempMode && settings.temperature != currentSettings.temperature) {
-        float temp = (settings.temperature * 2) + 128;
-        packet[19] = (int) temp;
+        packet[19] = settings.temperature.toWire();
         packet[6] += CONTROL_PACKET_1[2];
     }
     if (settings.fan != currentSettings.fan) {
@@ -502,7 +1060,12 @@ void HeatPump::createInfoPacket(byte *packet, byte packetType) {
     // set the mode - settings or room temperature
     if (packetType != PACKET_TYPE_DEFAULT) {
         packet[5] = INFOMODE[packetType];
+    } else if (statusPollInterval && !statusInserted && clock->millis() - lastStatusRequest >= statusPollInterval) {
+        // telemetry: an extra status request, without advancing the rotation
+        packet[5] = INFOMODE[RQST_PKT_STATUS];
+        statusInserted = true;
     } else {
+        statusInserted = false;
         // request current infoMode, and increment for the next request
         packet[5] = INFOMODE[infoMode];
         if (infoMode == (INFOMODE_LEN - 1)) {
@@ -523,15 +1086,44 @@ void HeatPump::createInfoPacket(byte *packet, byte packetType) {
 }
 
 void HeatPump::writePacket(byte *packet, int length) {
+    if (listenOnly) {
+        return;
+    }
     for (int i = 0; i < length; i++) {
         _HardSerial->write((uint8_t) packet[i]);
     }
 
+#ifndef HEATPUMP_NO_PACKET_CALLBACK
     if (packetCallback) {
         packetCallback(packet, length, (char *) "packetSent");
     }
+#endif
     waitForRead = true;
-    lastSend = millis();
+    replySeen = false;
+    lastSend = clock->millis();
+    lastExchange = lastSend;
+
+    switch (packet[1]) {
+        case 0x5a: counters.sentConnect++; pendingTiming = TIMING_CONNECT; break;
+        case 0x41:
+            counters.sentSet++;
+            counters.lastSetSentMs = lastSend;
+            pendingTiming = TIMING_SET;
+            lastSetSend = lastSend;
+            break;
+        case 0x42:
+            counters.sentInfo++;
+            pendingTiming = TIMING_INFO;
+            for (int i = 0; i < INFOMODE_LEN; i++) {
+                if (INFOMODE[i] == packet[5]) {
+                    pendingTiming = TIMING_INFO + i;
+                }
+            }
+            if (packet[5] == INFOMODE[RQST_PKT_STATUS]) {
+                lastStatusRequest = lastSend;
+            }
+            break;
+    }
 }
 
 int HeatPump::readPacket() {
@@ -542,30 +1134,42 @@ int HeatPump::readPacket() {
     byte checksum = 0;
     byte dataLength = 0;
 
+    const bool awaitingReply = waitForRead;
+    // the reply arrived when its bytes were first seen, not when we got around to reading them
+    const uint32_t responseAt = replySeen ? replySeenAt : clock->millis();
     waitForRead = false;
+    replySeen = false;
 
     if (_HardSerial->available() > 0) {
+        HEATPUMP_TRACE_SPAN("HeatPump::readPacket"); // calls that find nothing to read aren't traced
+        lastExchange = responseAt;
+
         // read until we get start byte 0xfc
         while (_HardSerial->available() > 0 && !foundStart) {
             header[0] = _HardSerial->read();
             if (header[0] == HEADER[0]) {
                 foundStart = true;
-                delay(100); // found that this delay increases accuracy when reading, might not be needed though
             }
         }
 
         if (!foundStart) {
+            exchangeFailed();
             return RCVD_PKT_FAIL;
         }
 
+        // wait for the rest of the frame rather than a flat delay, a full frame takes ~100ms at 2400 baud
+        const heatpumpDeadline frameEnd = heatpumpDeadline::after(*clock, PACKET_READ_TIMEOUT_MS);
+        waitForBytes(INFOHEADER_LEN - 1, frameEnd);
+
         //read header
         for (int i = 1; i < 5; i++) {
             header[i] = _HardSerial->read();
         }
 
         //check header
-        if (header[0] == HEADER[0] && header[2] == HEADER[2] && header[3] == HEADER[3]) {
+        if (header[0] == HEADER[0] && header[2] == HEADER[2] && header[3] == HEADER[3] && header[4] < PACKET_LEN) {
             dataLength = header[4];
+            waitForBytes(dataLength + 1, frameEnd);
 
             for (int i = 0; i < dataLength; i++) {
                 data[i] = _HardSerial->read();
@@ -587,8 +1191,17 @@ int HeatPump::readPacket() {
             // calculate checksum
             checksum = (0xfc - dataSum) & 0xff;
 
-            if (data[dataLength] == checksum) {
-                lastRecv = millis();
+            if (data[dataLength] != checksum) {
+                counters.checksumFailures++;
+                exchangeFailed();
+            } else {
+                lastRecv = clock->millis();
+                counters.lastRecvMs = lastRecv;
+                if (listenOnly) {
+                    connected = true;
+                }
+                exchangeSucceeded(awaitingReply, responseAt);
+#ifndef HEATPUMP_NO_PACKET_CALLBACK
                 if (packetCallback) {
                     byte packet[37]; // we are going to put header[5] and data[32] into this, so the whole packet is sent to the callback
                     for (int i = 0; i < INFOHEADER_LEN; i++) {
@@ -599,36 +1212,23 @@ int HeatPump::readPacket() {
                     }
                     packetCallback(packet, PACKET_LEN, (char *) "packetRecv");
                 }
+#endif
+
+                if (listenOnly && (header[1] == 0x5a || header[1] == 0x41 || header[1] == 0x42)) {
+                    heardRequest(header[1], data, dataLength);
+                    return RCVD_PKT_REQUEST;
+                }
 
                 if (header[1] == 0x62) {
                     switch (data[0]) {
                         case 0x02: { // setting information
-                            heatpumpSettings receivedSettings;
-                            receivedSettings.power = lookupByteMapValue(POWER_MAP, POWER, 2, data[3]);
-                            receivedSettings.iSee = data[4] > 0x08 ? true : false;
-                            receivedSettings.mode = lookupByteMapValue(MODE_MAP, MODE, 5,
-                                                                       receivedSettings.iSee ? (data[4] - 0x08)
-                                                                                             : data[4]);
-
+                            counters.receivedSettings++;
                             if (data[11] != 0x00) {
-                                int temp = data[11];
-                                temp -= 128;
-                                receivedSettings.temperature = (float) temp / 2;
                                 tempMode = true;
-                            } else {
-                                receivedSettings.temperature = lookupByteMapValue(TEMP_MAP, TEMP, 16, data[5]);
                             }
-
-                            receivedSettings.fan = lookupByteMapValue(FAN_MAP, FAN, 6, data[6]);
-                            receivedSettings.vane = lookupByteMapValue(VANE_MAP, VANE, 7, data[7]);
-                            receivedSettings.wideVane = lookupByteMapValue(WIDEVANE_MAP, WIDEVANE, 7, data[10] & 0x0F);
-                            wideVaneAdj = (data[10] & 0xF0) == 0x80 ? true : false;
-
-                            if (settingsChangedCallback && receivedSettings != currentSettings) {
-                                currentSettings = receivedSettings;
-                                settingsChangedCallback();
-                            } else {
-                                currentSettings = receivedSettings;
+                            cacheRawFrame(RAW_SETTINGS, data, dataLength);
+                            if (settingsChangedCallback || statistics || runtime || firstRun || (autoUpdate && externalUpdate)) {
+                                decodeSettings();
                             }
 
                             // if this is the first time we have synced with the heatpump, set wantedSettings to receivedSettings
@@ -641,83 +1241,52 @@ int HeatPump::readPacket() {
                         }
 
                         case 0x03: { //Room temperature reading
-                            heatpumpStatus receivedStatus;
-
-                            if (data[6] != 0x00) {
-                                int temp = data[6];
-                                temp -= 128;
-                                receivedStatus.roomTemperature = (float) temp / 2;
-                            } else {
-                                receivedStatus.roomTemperature = lookupByteMapValue(ROOM_TEMP_MAP, ROOM_TEMP, 32,
-                                                                                    data[3]);
-                            }
-
-                            if ((statusChangedCallback || roomTempChangedCallback) &&
-                                currentStatus.roomTemperature != receivedStatus.roomTemperature) {
-                                currentStatus.roomTemperature = receivedStatus.roomTemperature;
-
-                                if (statusChangedCallback) {
-                                    statusChangedCallback(currentStatus);
-                                }
-
-                                if (roomTempChangedCallback) { // this should be deprecated - statusChangedCallback covers it
-                                    roomTempChangedCallback(currentStatus.roomTemperature);
-                                }
-                            } else {
-                                currentStatus.roomTemperature = receivedStatus.roomTemperature;
+                            counters.receivedRoomTemp++;
+                            cacheRawFrame(RAW_ROOM_TEMP, data, dataLength);
+                            if (statusChangedCallback || roomTempChangedCallback || statistics) {
+                                decodeRoomTemp();
                             }
+                            sampleStatistics(); // an unchanged reading still counts for the time since the last
 
                             return RCVD_PKT_ROOM_TEMP;
                         }
 
                         case 0x04: { // unknown
+                            counters.receivedOther++;
                             break;
                         }
 
                         case 0x05: { // timer packet
-                            heatpumpTimers receivedTimers;
-
-                            receivedTimers.mode = lookupByteMapValue(TIMER_MODE_MAP, TIMER_MODE, 4, data[3]);
-                            receivedTimers.onMinutesSet = data[4] * TIMER_INCREMENT_MINUTES;
-                            receivedTimers.onMinutesRemaining = data[6] * TIMER_INCREMENT_MINUTES;
-                            receivedTimers.offMinutesSet = data[5] * TIMER_INCREMENT_MINUTES;
-                            receivedTimers.offMinutesRemaining = data[7] * TIMER_INCREMENT_MINUTES;
-
-                            // callback for status change
-                            if (statusChangedCallback && currentStatus.timers != receivedTimers) {
-                                currentStatus.timers = receivedTimers;
-                                statusChangedCallback(currentStatus);
-                            } else {
-                                currentStatus.timers = receivedTimers;
+                            counters.receivedTimers++;
+                            cacheRawFrame(RAW_TIMERS, data, dataLength);
+                            if (statusChangedCallback) {
+                                decodeTimers();
                             }
 
                             return RCVD_PKT_TIMER;
                         }
 
                         case 0x06: { // status
-                            heatpumpStatus receivedStatus;
-                            receivedStatus.operating = data[4];
-                            receivedStatus.compressorFrequency = data[3];
-
-                            // callback for status change -- not triggered for compressor frequency at the moment
-                            if (statusChangedCallback && currentStatus.operating != receivedStatus.operating) {
-                                currentStatus.operating = receivedStatus.operating;
-                                currentStatus.compressorFrequency = receivedStatus.compressorFrequency;
-                                statusChangedCallback(currentStatus);
-                            } else {
-                                currentStatus.operating = receivedStatus.operating;
-                                currentStatus.compressorFrequency = receivedStatus.compressorFrequency;
+                            counters.receivedStatus++;
+                            cacheRawFrame(RAW_STATUS, data, dataLength);
+                            if (statusChangedCallback || statistics || runtime) {
+                                decodeStatus();
                             }
+                            sampleStatistics();
+                            sampleRuntime();
 
                             return RCVD_PKT_STATUS;
                         }
 
                         case 0x09: { // standby mode maybe?
+                            counters.receivedOther++;
                             break;
                         }
 
                         case 0x20:
                         case 0x22: {
+                            counters.receivedFunctions++;
+#ifndef HEATPUMP_NO_FUNCTIONS
                             if (dataLength == 0x10) {
                                 if (data[0] == 0x20) {
                                     functions.setData1(&data[1]);
@@ -727,28 +1296,256 @@ int HeatPump::readPacket() {
 
                                 return RCVD_PKT_FUNCTIONS;
                             }
+#endif
                             break;
                         }
                     }
                 }
 
                 if (header[1] == 0x61) { //Last update was successful
+                    counters.receivedSetAck++;
+                    counters.lastSetAckMs = responseAt;
+                    if (heardSetPending) {
+                        heardSetPending = false;
+                        applyHeardSet();
+                    }
+                    if (lastSetSend) {
+                        unsigned long latency = responseAt - lastSetSend;
+                        counters.setAckCount++;
+                        counters.setAckLatencySumMs += latency;
+                        counters.setAckLatencyMaxMs = max(counters.setAckLatencyMaxMs, latency);
+                        lastSetSend = 0;
+                    }
                     return RCVD_PKT_UPDATE_SUCCESS;
                 } else if (header[1] == 0x7a) { //Last update was successful
+                    counters.receivedConnectAck++;
                     connected = true;
                     return RCVD_PKT_CONNECT_SUCCESS;
                 }
             }
+        } else {
+            exchangeFailed();
         }
+    } else if (awaitingReply) {
+        counters.responseTimeouts++;
+        exchangeFailed();
     }
 
     return RCVD_PKT_FAIL;
 }
 
+bool HeatPump::waitForBytes(int count, const heatpumpDeadline &until) {
+    while (_HardSerial->available() < count) {
+        if (until.expired(*clock)) {
+            return false;
+        }
+        clock->delay(1);
+    }
+    return true;
+}
+
+void HeatPump::cacheRawFrame(int rawType, byte *data, int dataLength) {
+    rawFrame &frame = rawFrames[rawType];
+    if (dataLength > PACKET_LEN) {
+        dataLength = PACKET_LEN;
+    }
+    if (frame.length == dataLength && memcmp(frame.data, data, dataLength) == 0) {
+        return; // same bytes as last time, the decoded values still hold
+    }
+    memcpy(frame.data, data, dataLength);
+    frame.length = dataLength;
+    frame.stale = true;
+}
+
+heatpumpSettings HeatPump::parseSettings(const byte *data) {
+    heatpumpSettings settings;
+    settings.power = lookupByteMapValue(POWER_MAP, POWER, 2, data[3]);
+    settings.iSee = data[4] > 0x08 ? true : false;
+    settings.mode = lookupByteMapValue(MODE_MAP, MODE, 5, settings.iSee ? (data[4] - 0x08) : data[4]);
+
+    if (data[11] != 0x00) {
+        settings.temperature = heatpumpTemperature::fromWire(data[11]);
+    } else {
+        settings.temperature = heatpumpTemperature::fromDegrees(lookupByteMapValue(TEMP_MAP, TEMP, 16, data[5]));
+    }
+
+    settings.fan = lookupByteMapValue(FAN_MAP, FAN, 6, data[6]);
+    settings.vane = lookupByteMapValue(VANE_MAP, VANE, 7, data[7]);
+    settings.wideVane = lookupByteMapValue(WIDEVANE_MAP, WIDEVANE, 7, data[10] & 0x0F);
+    return settings;
+}
+
+heatpumpTemperature HeatPump::parseRoomTemperature(const byte *data) {
+    if (data[6] != 0x00) {
+        return heatpumpTemperature::fromWire(data[6]);
+    }
+    return heatpumpTemperature::fromDegrees(lookupByteMapValue(ROOM_TEMP_MAP, ROOM_TEMP, 32, data[3]));
+}
+
+heatpumpTimers HeatPump::parseTimers(const byte *data) {
+    heatpumpTimers timers;
+    timers.mode = lookupByteMapValue(TIMER_MODE_MAP, TIMER_MODE, 4, data[3]);
+    timers.onMinutesSet = data[4] * TIMER_INCREMENT_MINUTES;
+    timers.onMinutesRemaining = data[6] * TIMER_INCREMENT_MINUTES;
+    timers.offMinutesSet = data[5] * TIMER_INCREMENT_MINUTES;
+    timers.offMinutesRemaining = data[7] * TIMER_INCREMENT_MINUTES;
+    return timers;
+}
+
+void HeatPump::decodeSettings() {
+    rawFrame &frame = rawFrames[RAW_SETTINGS];
+    if (!frame.stale) return;
+    frame.stale = false;
+    const byte *data = frame.data;
+
+    heatpumpSettings receivedSettings = parseSettings(data);
+    receivedSettings.connected = currentSettings.connected;
+    wideVaneAdj = (data[10] & 0xF0) == 0x80 ? true : false;
+
+    if (statistics && (receivedSettings.power != currentSettings.power || receivedSettings.mode != currentSettings.mode)) {
+        statistics->modeChanged(clock->millis());
+    }
+
+    if (settingsChangedCallback && receivedSettings != currentSettings) {
+        currentSettings = receivedSettings;
+        settingsChangedCallback();
+    } else {
+        currentSettings = receivedSettings;
+    }
+}
+
+void HeatPump::decodeRoomTemp() {
+    rawFrame &frame = rawFrames[RAW_ROOM_TEMP];
+    if (!frame.stale) return;
+    frame.stale = false;
+    const byte *data = frame.data;
+
+    heatpumpStatus receivedStatus;
+    receivedStatus.roomTemperature = parseRoomTemperature(data);
+
+    if ((statusChangedCallback || roomTempChangedCallback) &&
+        currentStatus.roomTemperature != receivedStatus.roomTemperature) {
+        currentStatus.roomTemperature = receivedStatus.roomTemperature;
+
+        if (statusChangedCallback) {
+            statusChangedCallback(currentStatus);
+        }
+
+        if (roomTempChangedCallback) { // this should be deprecated - statusChangedCallback covers it
+            roomTempChangedCallback(currentStatus.roomTemperature.toCelsius());
+        }
+    } else {
+        currentStatus.roomTemperature = receivedStatus.roomTemperature;
+    }
+}
+
+void HeatPump::decodeTimers() {
+    rawFrame &frame = rawFrames[RAW_TIMERS];
+    if (!frame.stale) return;
+    frame.stale = false;
+
+    heatpumpTimers receivedTimers = parseTimers(frame.data);
+
+    // callback for status change
+    if (statusChangedCallback && currentStatus.timers != receivedTimers) {
+        currentStatus.timers = receivedTimers;
+        statusChangedCallback(currentStatus);
+    } else {
+        currentStatus.timers = receivedTimers;
+    }
+}
+
+void HeatPump::decodeStatus() {
+    rawFrame &frame = rawFrames[RAW_STATUS];
+    if (!frame.stale) return;
+    frame.stale = false;
+    const byte *data = frame.data;
+
+    heatpumpStatus receivedStatus;
+    receivedStatus.operating = data[4];
+    receivedStatus.compressorFrequency = data[3];
+
+    // callback for status change -- not triggered for compressor frequency at the moment
+    if (statusChangedCallback && currentStatus.operating != receivedStatus.operating) {
+        currentStatus.operating = receivedStatus.operating;
+        currentStatus.compressorFrequency = receivedStatus.compressorFrequency;
+        statusChangedCallback(currentStatus);
+    } else {
+        currentStatus.operating = receivedStatus.operating;
+        currentStatus.compressorFrequency = receivedStatus.compressorFrequency;
+    }
+}
+
+void HeatPump::sampleStatistics() {
+    // both the room temperature and the status have to be known
+    if (!statistics || !counters.receivedRoomTemp || !counters.receivedStatus) return;
+    statistics->sample(clock->millis(), currentStatus);
+}
+
+void HeatPump::sampleRuntime() {
+    if (!runtime) return;
+    const bool power = currentSettings.power && lookupByteMapIndex(POWER_MAP, 2, currentSettings.power) == 1;
+    const int mode = currentSettings.mode ? lookupByteMapIndex(MODE_MAP, 5, currentSettings.mode) : -1;
+    runtime->sample(clock->millis(), currentStatus, power, mode);
+}
+
 void HeatPump::readAllPackets() {
-    while (_HardSerial->available() > 0) {
+    // read at least once, so a reply that never came is noticed and waitForRead cleared
+    do {
         readPacket();
+    } while (_HardSerial->available() > 0);
+}
+
+void HeatPump::heardRequest(byte type, const byte *data, int dataLength) {
+    // a reply answers the latest request, so a set is only applied by the ack right after it
+    heardSetPending = false;
+    switch (type) {
+        case 0x5a:
+            counters.heardConnect++;
+            break;
+        case 0x41:
+            counters.heardSet++;
+            if (data[0] == 0x01 && dataLength >= 16) {
+                memcpy(heardSet, data, dataLength);
+                heardSetPending = true;
+            }
+            break;
+        case 0x42:
+            counters.heardInfo++;
+            break;
+    }
+}
+
+void HeatPump::applyHeardSet() {
+    // the set fields go over the last settings reply, where parseSettings() reads them
+    const rawFrame &last = rawFrames[RAW_SETTINGS];
+    if (!last.length) {
+        return; // the other master's next settings request fills them in
     }
+    byte data[PACKET_LEN];
+    memcpy(data, last.data, last.length);
+    const byte *set = heardSet;
+    if (set[1] & CONTROL_PACKET_1[0]) {
+        data[3] = set[3];
+    }
+    if (set[1] & CONTROL_PACKET_1[1]) {
+        data[4] = set[4] + (data[4] > 0x08 ? 0x08 : 0x00); // keeps the iSee bit
+    }
+    if (set[1] & CONTROL_PACKET_1[2]) {
+        data[5] = set[5];
+        data[11] = set[14];
+    }
+    if (set[1] & CONTROL_PACKET_1[3]) {
+        data[6] = set[6];
+    }
+    if (set[1] & CONTROL_PACKET_1[4]) {
+        data[7] = set[7];
+    }
+    if (set[2] & CONTROL_PACKET_2[0]) {
+        data[10] = set[13];
+    }
+    cacheRawFrame(RAW_SETTINGS, data, last.length);
+    decodeSettings();
 }
 
 void HeatPump::prepareInfoPacket(byte *packet, int length) {
@@ -767,6 +1564,7 @@ void HeatPump::prepareSetPacket(byte *packet, int length) {
     }
 }
 
+#ifndef HEATPUMP_NO_FUNCTIONS
 heatpumpFunctions HeatPump::getFunctions() {
     functions.clear();
 
@@ -781,18 +1579,18 @@ heatpumpFunctions HeatPump::getFunctions() {
     packet2[5] = FUNCTIONS_GET_PART2;
     packet2[21] = checkSum(packet2, 21);
 
-    while (!canSend(false)) { delay(10); }
+    while (!canSend(false)) { clock->delay(10); }
     writePacket(packet1, PACKET_LEN);
     readPacket();
 
-    while (!canSend(false)) { delay(10); }
+    while (!canSend(false)) { clock->delay(10); }
     writePacket(packet2, PACKET_LEN);
     readPacket();
 
     // retry reading a few times in case responses were related
     // to other requests
     for (int i = 0; i < 5 && !functions.isValid(); ++i) {
-        delay(100);
+        clock->delay(100);
         readPacket();
     }
 
@@ -829,11 +1627,11 @@ bool HeatPump::setFunctions(heatpumpFunctions const &functions) {
     packet1[21] = checkSum(packet1, 21);
     packet2[21] = checkSum(packet2, 21);
 
-    while (!canSend(false)) { delay(10); }
+    while (!canSend(false)) { clock->delay(10); }
     writePacket(packet1, PACKET_LEN);
     readPacket();
 
-    while (!canSend(false)) { delay(10); }
+    while (!canSend(false)) { clock->delay(10); }
     writePacket(packet2, PACKET_LEN);
     readPacket();
 
@@ -928,3 +1726,4 @@ bool heatpumpFunctions::operator==(const heatpumpFunctions &rhs) {
 bool heatpumpFunctions::operator!=(const heatpumpFunctions &rhs) {
     return !(*this == rhs);
 }
+#endif
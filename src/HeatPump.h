@@ -18,37 +18,100 @@
 #include <stdint.h>
 #include <math.h>
 #include <HardwareSerial.h>
+#include "HeatPumpClock.h"
 #if defined(ARDUINO) && ARDUINO >= 100
 #include "Arduino.h"
 #else
 #include "WProgram.h"
 #endif
 
+/*
+ * Optional features. Define these (e.g. in platformio.ini build_flags) to compile them out:
+ *   HEATPUMP_NO_FUNCTIONS        getFunctions()/setFunctions() and heatpumpFunctions
+ *   HEATPUMP_NO_CUSTOM_PACKET    sendCustomPacket()
+ *   HEATPUMP_NO_PACKET_CALLBACK  setPacketCallback(), and the frame copy made for it on every send/receive
+ * They apply to the whole build, not per HeatPump. The class stays a plain one: the serial and heatpumpClock
+ * are pointers set at run time and the clock's calls stay virtual. linux_bench counts 8 clock calls per
+ * frame exchange, about 10 ns of 150 on the host, too little to make HeatPump a template over them.
+ */
+
 /* 
  * Callback function definitions. Code differs for the ESP8266 platform, which requires the functional library.
  * Based on callback implementation in the Arduino Client for MQTT library (https://github.com/knolleary/pubsubclient)
  */
-#if defined(ESP8266) || defined(ESP32)
+#if defined(ESP8266) || defined(ESP32) || defined(__linux__)
 #include <functional>
 #define ON_CONNECT_CALLBACK_SIGNATURE std::function<void()> onConnectCallback
 #define SETTINGS_CHANGED_CALLBACK_SIGNATURE std::function<void()> settingsChangedCallback
 #define STATUS_CHANGED_CALLBACK_SIGNATURE std::function<void(heatpumpStatus newStatus)> statusChangedCallback
 #define PACKET_CALLBACK_SIGNATURE std::function<void(byte* packet, unsigned int length, char* packetDirection)> packetCallback
 #define ROOM_TEMP_CHANGED_CALLBACK_SIGNATURE std::function<void(float currentRoomTemperature)> roomTempChangedCallback
+#define LINK_STATE_CHANGED_CALLBACK_SIGNATURE std::function<void(heatpumpLinkState linkState)> linkStateChangedCallback
 #else
 #define ON_CONNECT_CALLBACK_SIGNATURE void (*onConnectCallback)()
 #define SETTINGS_CHANGED_CALLBACK_SIGNATURE void (*settingsChangedCallback)()
 #define STATUS_CHANGED_CALLBACK_SIGNATURE void (*statusChangedCallback)(heatpumpStatus newStatus)
 #define PACKET_CALLBACK_SIGNATURE void (*packetCallback)(byte* packet, unsigned int length, char* packetDirection)
 #define ROOM_TEMP_CHANGED_CALLBACK_SIGNATURE void (*roomTempChangedCallback)(float currentRoomTemperature)
+#define LINK_STATE_CHANGED_CALLBACK_SIGNATURE void (*linkStateChangedCallback)(heatpumpLinkState linkState)
 #endif
 
 typedef uint8_t byte;
 
+/*
+ * Temperature in fixed-point half degrees Celsius. This matches the 0.5C resolution of the
+ * heat pump's (t*2)+128 wire encoding, so values round once on the way in and compare exactly.
+ * Convert to/from float only at the edges (HomeKit, user input).
+ */
+struct heatpumpTemperature {
+  int16_t halfDegrees;
+
+  static heatpumpTemperature fromHalfDegrees(int halfDegrees) {
+    return heatpumpTemperature{(int16_t) halfDegrees};
+  }
+  static heatpumpTemperature fromDegrees(int degrees) {
+    return fromHalfDegrees(degrees * 2);
+  }
+  static heatpumpTemperature fromCelsius(float celsius) { // rounds to nearest 0.5C
+    return fromHalfDegrees((int) lroundf(celsius * 2));
+  }
+  static heatpumpTemperature fromFahrenheit(int fahrenheit) { // rounds to nearest 0.5C
+    int tenths = (fahrenheit - 32) * 10; // half degrees C = tenths of a degree F / 9
+    return fromHalfDegrees(tenths >= 0 ? (tenths + 4) / 9 : -((4 - tenths) / 9));
+  }
+  static heatpumpTemperature fromWire(byte encoded) {
+    return fromHalfDegrees(encoded - 128);
+  }
+
+  float toCelsius() const {
+    return halfDegrees / 2.0f;
+  }
+  int toFahrenheit() const { // rounds half up, like (int)(f + 0.5)
+    return (halfDegrees * 9 + 320 + 5) / 10;
+  }
+  byte toWire() const {
+    return (byte) (halfDegrees + 128);
+  }
+  int toDegrees() const { // rounds half up
+    return (halfDegrees + 1) >> 1;
+  }
+  int toString(char *buffer, size_t length) const { // "21.5", returns the snprintf length
+    return snprintf(buffer, length, "%s%d.%d", halfDegrees < 0 ? "-" : "", abs(halfDegrees) / 2, (abs(halfDegrees) % 2) * 5);
+  }
+  heatpumpTemperature clamp(heatpumpTemperature low, heatpumpTemperature high) const {
+    return halfDegrees < low.halfDegrees ? low : (halfDegrees > high.halfDegrees ? high : *this);
+  }
+};
+
+inline bool operator==(heatpumpTemperature lhs, heatpumpTemperature rhs) { return lhs.halfDegrees == rhs.halfDegrees; }
+inline bool operator!=(heatpumpTemperature lhs, heatpumpTemperature rhs) { return lhs.halfDegrees != rhs.halfDegrees; }
+inline bool operator<(heatpumpTemperature lhs, heatpumpTemperature rhs) { return lhs.halfDegrees < rhs.halfDegrees; }
+inline bool operator>(heatpumpTemperature lhs, heatpumpTemperature rhs) { return lhs.halfDegrees > rhs.halfDegrees; }
+
 struct heatpumpSettings {
   const char* power;
   const char* mode;
-  float temperature;
+  heatpumpTemperature temperature;
   const char* fan;
   const char* vane; //vertical vane, up/down
   const char* wideVane; //horizontal vane, left/right
@@ -59,6 +122,32 @@ struct heatpumpSettings {
 bool operator==(const heatpumpSettings& lhs, const heatpumpSettings& rhs);
 bool operator!=(const heatpumpSettings& lhs, const heatpumpSettings& rhs);
 
+/*
+ * Settings fields given by name and value, e.g. in an HTTP form or an MQTT command, parsed by
+ * HeatPump::parseSettingsField(). Only the fields in `fields` are set.
+ */
+struct heatpumpSettingsChange {
+  enum Field : uint8_t {
+    POWER = 0x01,
+    MODE = 0x02,
+    TEMPERATURE = 0x04,
+    FAN = 0x08,
+    VANE = 0x10,
+    WIDEVANE = 0x20
+  };
+
+  heatpumpSettings settings;
+  uint8_t fields;
+
+  void applyTo(heatpumpSettings& target) const; // copies the fields that are set
+};
+
+enum heatpumpFieldResult {
+  HEATPUMP_FIELD_SET,
+  HEATPUMP_FIELD_UNKNOWN, // not a settings field
+  HEATPUMP_FIELD_INVALID  // a value the unit doesn't take
+};
+
 struct heatpumpTimers {
   const char* mode;
   int onMinutesSet;
@@ -71,12 +160,224 @@ bool operator==(const heatpumpTimers& lhs, const heatpumpTimers& rhs);
 bool operator!=(const heatpumpTimers& lhs, const heatpumpTimers& rhs);
 
 struct heatpumpStatus {
-  float roomTemperature;
+  heatpumpTemperature roomTemperature;
   bool operating; // if true, the heatpump is operating to reach the desired temperature
   heatpumpTimers timers;
   int compressorFrequency;
 };
 
+// protocol counters, for health metrics. All counts are totals since boot.
+struct heatpumpCounters {
+  unsigned long sentConnect;        // 0x5a
+  unsigned long sentSet;            // 0x41
+  unsigned long sentInfo;           // 0x42
+  unsigned long receivedConnectAck; // 0x7a
+  unsigned long receivedSetAck;     // 0x61
+  unsigned long receivedSettings;   // 0x62 0x02
+  unsigned long receivedRoomTemp;   // 0x62 0x03
+  unsigned long receivedTimers;     // 0x62 0x05
+  unsigned long receivedStatus;     // 0x62 0x06
+  unsigned long receivedFunctions;  // 0x62 0x20/0x22
+  unsigned long receivedOther;
+  unsigned long checksumFailures;
+  unsigned long responseTimeouts;   // requests that got no reply in time
+  unsigned long connects;
+  // requests from another master, heard in listen-only mode
+  unsigned long heardConnect;       // 0x5a
+  unsigned long heardSet;           // 0x41
+  unsigned long heardInfo;          // 0x42
+  // time from writing a set packet to reading its 0x61 ack
+  unsigned long setAckCount;
+  unsigned long setAckLatencySumMs;
+  unsigned long setAckLatencyMaxMs;
+  uint32_t lastRecvMs;    // clock millis() of the last valid packet
+  uint32_t lastSetSentMs; // clock millis() the last set packet was written
+  uint32_t lastSetAckMs;  // clock millis() of the last 0x61 ack
+};
+
+/*
+ * Link health, judged from requests that went unanswered in a row. DOWN triggers a reconnect.
+ */
+enum heatpumpLinkState {
+  HEATPUMP_LINK_DOWN,     // not connected, or the unit stopped answering
+  HEATPUMP_LINK_DEGRADED, // the last request(s) got no valid reply
+  HEATPUMP_LINK_HEALTHY
+};
+
+inline const char* heatpumpLinkStateName(heatpumpLinkState state) {
+  return state == HEATPUMP_LINK_HEALTHY ? "healthy" : state == HEATPUMP_LINK_DEGRADED ? "degraded" : "down";
+}
+
+// statistics of one heatpumpRollingWindow, means are weighted by time
+struct heatpumpWindowStatistics {
+  bool valid;                       // false until a sample with a room temperature has been weighed
+  unsigned long spanMs;             // time covered so far, at most the window length
+  heatpumpTemperature roomTemperatureMin;
+  heatpumpTemperature roomTemperatureMax;
+  float roomTemperatureMean;        // Celsius
+  float dutyCycle;                  // share of the time the unit was operating, 0..1
+  float compressorFrequencyMean;    // idle time counts as 0
+};
+
+/*
+ * Sliding window over the status stream in fixed memory. The window is split into BUCKETS buckets with
+ * running sums, the oldest bucket drops out as a new one starts. Min/max come from monotonic queues of
+ * bucket indexes. A sample costs O(1), amortized over bucket changes, and get() is O(1). The window moves
+ * a bucket at a time, so it covers between BUCKETS-1 and BUCKETS bucket lengths. A gap of a whole
+ * window empties it.
+ */
+class heatpumpRollingWindow {
+  public:
+    static const int BUCKETS = 30;
+
+    explicit heatpumpRollingWindow(unsigned long lengthMs = 5 * 60000UL);
+
+    // weighs `previous` over the weightMs up to now, and takes `current` into the min/max
+    void add(uint32_t now, unsigned long weightMs, const heatpumpStatus& previous, const heatpumpStatus& current);
+    heatpumpWindowStatistics get() const;
+    unsigned long length() const;
+
+  private:
+    struct bucket {
+      int64_t roomSum;       // half degrees * ms
+      uint64_t frequencySum; // Hz * ms
+      uint32_t ms;
+      uint32_t operatingMs;
+      int16_t roomMin;
+      int16_t roomMax;
+      bool hasRoom;
+    };
+
+    // a ring of bucket indexes, oldest first
+    struct queue {
+      uint8_t items[BUCKETS];
+      uint8_t head;
+      uint8_t count;
+
+      uint8_t front() const { return items[head]; }
+      uint8_t back() const { return items[(head + count - 1) % BUCKETS]; }
+      void push(uint8_t item) { items[(head + count++) % BUCKETS] = item; }
+      void popFront() { head = (head + 1) % BUCKETS; count--; }
+      void popBack() { count--; }
+    };
+
+    uint32_t bucketMs;
+    bucket buckets[BUCKETS];
+    uint8_t current;            // the open bucket, the others are closed
+    uint8_t closed;             // closed buckets in the window
+    uint32_t currentStart;      // millis() the open bucket started
+    bool started;
+    // sums of the closed buckets
+    int64_t roomSum;
+    uint64_t ms;
+    uint64_t operatingMs;
+    uint64_t frequencySum;
+    queue minimums;             // closed buckets with rising roomMin
+    queue maximums;             // closed buckets with falling roomMax
+
+    void clear(uint32_t now);
+    void weigh(const heatpumpStatus& status, unsigned long weightMs);
+    void include(heatpumpTemperature roomTemperature); // into the open bucket's min/max
+    void close();                                      // opens the next bucket, evicting the oldest
+};
+
+/*
+ * Rolling statistics fed by HeatPump from every room temperature and status reply once set with
+ * HeatPump::setStatistics(). Three windows, by default 5 minutes, 1 hour and 24 hours, about 1 KB each.
+ * The first sample is taken once both the room temperature and the status have been read.
+ * A sample is weighed over the time until the next one, up to MAX_SAMPLE_GAP_MS, so a dead link
+ * doesn't stretch the last reading.
+ */
+class heatpumpStatistics {
+  public:
+    static const int WINDOWS = 3;
+    static const unsigned long MAX_SAMPLE_GAP_MS = 60000;
+
+    heatpumpStatistics(unsigned long shortMs = 5 * 60000UL, unsigned long mediumMs = 60 * 60000UL,
+                       unsigned long longMs = 24 * 3600000UL);
+
+    void sample(uint32_t now, const heatpumpStatus& status);
+    void modeChanged(uint32_t now); // power or mode setting
+    heatpumpWindowStatistics get(int window) const;
+    unsigned long windowLength(int window) const;
+    // ms since the power or mode setting last changed, or since it was first read; false before that
+    bool timeSinceModeChange(uint32_t now, unsigned long& ms) const;
+
+  private:
+    heatpumpRollingWindow windows[WINDOWS];
+    heatpumpStatus last;
+    uint32_t lastSample = 0;
+    bool sampled = false;
+    uint32_t modeChangedAt = 0;
+    bool modeKnown = false;
+};
+
+/*
+ * Estimated input power of a model by compressor frequency, for heatpumpRuntime's energy figure. Points
+ * are interpolated linearly and held flat past the ends; take them from the data sheet (input power at
+ * the minimum, rated and maximum capacity) or a plug meter. Power on with the compressor stopped (fan,
+ * controls) is idleWatts, standby offWatts. A curve without points estimates nothing.
+ */
+struct heatpumpPowerCurve {
+  static const int MAX_POINTS = 8;
+
+  struct point {
+    uint8_t frequency; // Hz, rising
+    uint16_t watts;
+  };
+
+  uint16_t offWatts;
+  uint16_t idleWatts;
+  uint8_t count;
+  point points[MAX_POINTS];
+
+  unsigned long watts(bool power, int frequency) const;
+};
+
+// totals since they were first counted, the blob heatpumpRuntime persists
+struct heatpumpRuntimeTotals {
+  uint64_t accountedMs;          // time covered by status replies
+  uint64_t operatingMs;          // the status operating flag set
+  uint64_t compressorMs;         // compressor frequency above 0
+  uint64_t compressorModeMs[5];  // compressorMs by mode setting, HeatPump::MODE_MAP order: HEAT, DRY, COOL, FAN, AUTO
+  uint32_t compressorStarts;
+  uint32_t compressorStops;
+  uint64_t energyWattMs;         // estimated from the power curve
+
+  float energyKWh() const { return energyWattMs / 3.6e9f; }
+};
+
+/*
+ * Runtime and energy accounting fed by HeatPump from every status reply once set with
+ * HeatPump::setRuntime(). Each reply weighs the previous one over the time in between, up to
+ * MAX_SAMPLE_GAP_MS like heatpumpStatistics, so a sample is O(1) and the totals take a fixed 80 bytes.
+ * Compressor time goes to the mode setting in effect, starts and stops are counted on the compressor
+ * frequency going from 0 and to 0. Persisting the totals is up to the caller: save totals() now and
+ * then, and restore() them before the first sample after a reboot.
+ */
+class heatpumpRuntime {
+  public:
+    static const unsigned long MAX_SAMPLE_GAP_MS = 60000;
+
+    explicit heatpumpRuntime(const heatpumpPowerCurve& curve = heatpumpPowerCurve());
+
+    void sample(uint32_t now, const heatpumpStatus& status, bool power, int mode); // mode -1 if unknown
+    void restore(const heatpumpRuntimeTotals& totals);
+    const heatpumpRuntimeTotals& totals() const;
+    const heatpumpPowerCurve& curve() const;
+
+  private:
+    heatpumpPowerCurve powerCurve;
+    heatpumpRuntimeTotals sums {};
+    uint32_t lastSample = 0;
+    bool lastPower = false;
+    int lastMode = -1;
+    int lastFrequency = 0;
+    bool lastOperating = false;
+    bool sampled = false;
+};
+
+#ifndef HEATPUMP_NO_FUNCTIONS
 #define MAX_FUNCTION_CODE_COUNT 30
 
 struct heatpumpFunctionCodes {
@@ -114,6 +415,7 @@ class heatpumpFunctions  {
     bool operator==(const heatpumpFunctions& rhs);
     bool operator!=(const heatpumpFunctions& rhs);
 };
+#endif
 
 class HeatPump
 {
@@ -121,80 +423,135 @@ class HeatPump
     static const int PACKET_LEN = 22;
     static const int PACKET_SENT_INTERVAL_MS = 1000;
     static const int PACKET_INFO_INTERVAL_MS = 2000;
+    static const int PACKET_GAP_MIN_MS = 100;
+    static const int PACKET_RESPONSE_SLACK_MS = 50;
+    static const int PACKET_READ_TIMEOUT_MS = 150; // from the start byte to the end of the frame
+    static const int PACKET_BACKOFF_MAX = 4;
+    static const int LINK_DOWN_MISSES = 3;  // unanswered requests in a row
+    static const int LINK_DOWN_MS = 4000;   // or this long without a valid frame once one was missed
     static const int PACKET_TYPE_DEFAULT = 99;
 
+    // protocol tables, shared by all instances and kept in flash (defined in HeatPump.cpp)
     static const int CONNECT_LEN = 8;
-    const byte CONNECT[CONNECT_LEN] = {0xfc, 0x5a, 0x01, 0x30, 0x02, 0xca, 0x01, 0xa8};
+    static const byte CONNECT[CONNECT_LEN];
     static const int HEADER_LEN  = 8;
-    const byte HEADER[HEADER_LEN]  = {0xfc, 0x41, 0x01, 0x30, 0x10, 0x01, 0x00, 0x00};
+    static const byte HEADER[HEADER_LEN];
 
     static const int INFOHEADER_LEN  = 5;
-    const byte INFOHEADER[INFOHEADER_LEN]  = {0xfc, 0x42, 0x01, 0x30, 0x10};
-    
- 
-    static const int INFOMODE_LEN = 6;
-    const byte INFOMODE[INFOMODE_LEN] = {
-      0x02, // request a settings packet - RQST_PKT_SETTINGS
-      0x03, // request the current room temp - RQST_PKT_ROOM_TEMP
-      0x04, // unknown
-      0x05, // request the timers - RQST_PKT_TIMERS
-      0x06, // request status - RQST_PKT_STATUS
-      0x09  // request standby mode (maybe?) RQST_PKT_STANDBY
-    };
+    static const byte INFOHEADER[INFOHEADER_LEN];
 
-    const int RCVD_PKT_FAIL            = 0;
-    const int RCVD_PKT_CONNECT_SUCCESS = 1;
-    const int RCVD_PKT_SETTINGS        = 2;
-    const int RCVD_PKT_ROOM_TEMP       = 3;
-    const int RCVD_PKT_UPDATE_SUCCESS  = 4;
-    const int RCVD_PKT_STATUS          = 5;
-    const int RCVD_PKT_TIMER           = 6;
-    const int RCVD_PKT_FUNCTIONS       = 7;
-
-    const byte CONTROL_PACKET_1[5] = {0x01,    0x02,  0x04,  0x08, 0x10};
-                                   //{"POWER","MODE","TEMP","FAN","VANE"};
-    const byte CONTROL_PACKET_2[1] = {0x01};
-                                   //{"WIDEVANE"};
-    const byte POWER[2]            = {0x00, 0x01};
-    const char* POWER_MAP[2]       = {"OFF", "ON"};
-    const byte MODE[5]             = {0x01,   0x02,  0x03, 0x07, 0x08};
-    const char* MODE_MAP[5]        = {"HEAT", "DRY", "COOL", "FAN", "AUTO"};
-    const byte TEMP[16]            = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
-    const int TEMP_MAP[16]         = {31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16};
-    const byte FAN[6]              = {0x00,  0x01,   0x02, 0x03, 0x05, 0x06};
-    const char* FAN_MAP[6]         = {"AUTO", "QUIET", "1", "2", "3", "4"};
-    const byte VANE[7]             = {0x00,  0x01, 0x02, 0x03, 0x04, 0x05, 0x07};
-    const char* VANE_MAP[7]        = {"AUTO", "1", "2", "3", "4", "5", "SWING"};
-    const byte WIDEVANE[7]         = {0x01, 0x02, 0x03, 0x04, 0x05, 0x08, 0x0c};
-    const char* WIDEVANE_MAP[7]    = {"<<", "<",  "|",  ">",  ">>", "<>", "SWING"};
-    const byte ROOM_TEMP[32]       = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
-                                      0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f};
-    const int ROOM_TEMP_MAP[32]    = {10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25,
-                                      26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40, 41};
-    const byte TIMER_MODE[4]       = {0x00,  0x01,  0x02, 0x03};
-    const char* TIMER_MODE_MAP[4]  = {"NONE", "OFF", "ON", "BOTH"};
+    static const int INFOMODE_LEN = 6;
+    static const byte INFOMODE[INFOMODE_LEN];
+
+    static const int RCVD_PKT_FAIL            = 0;
+    static const int RCVD_PKT_CONNECT_SUCCESS = 1;
+    static const int RCVD_PKT_SETTINGS        = 2;
+    static const int RCVD_PKT_ROOM_TEMP       = 3;
+    static const int RCVD_PKT_UPDATE_SUCCESS  = 4;
+    static const int RCVD_PKT_STATUS          = 5;
+    static const int RCVD_PKT_TIMER           = 6;
+    static const int RCVD_PKT_FUNCTIONS       = 7;
+    static const int RCVD_PKT_REQUEST         = 8; // listen-only: another master's request
+
+    static const byte CONTROL_PACKET_1[5];
+    static const byte CONTROL_PACKET_2[1];
+    static const byte POWER[2];
+    static const char* const POWER_MAP[2];
+    static const byte MODE[5];
+    static const char* const MODE_MAP[5];
+    static const byte TEMP[16];
+    static const int TEMP_MAP[16];
+    static const byte FAN[6];
+    static const char* const FAN_MAP[6];
+    static const byte VANE[7];
+    static const char* const VANE_MAP[7];
+    static const byte WIDEVANE[7];
+    static const char* const WIDEVANE_MAP[7];
+    static const byte ROOM_TEMP[32];
+    static const int ROOM_TEMP_MAP[32];
+    static const byte TIMER_MODE[4];
+    static const char* const TIMER_MODE_MAP[4];
 
     static const int TIMER_INCREMENT_MINUTES = 10;
 
-    const byte FUNCTIONS_SET_PART1 = 0x1F;
-    const byte FUNCTIONS_GET_PART1 = 0x20;
-    const byte FUNCTIONS_SET_PART2 = 0x21;
-    const byte FUNCTIONS_GET_PART2 = 0x22;
+#ifndef HEATPUMP_NO_FUNCTIONS
+    static const byte FUNCTIONS_SET_PART1 = 0x1F;
+    static const byte FUNCTIONS_GET_PART1 = 0x20;
+    static const byte FUNCTIONS_SET_PART2 = 0x21;
+    static const byte FUNCTIONS_GET_PART2 = 0x22;
+#endif
 
     // these settings will be initialised in connect()
     heatpumpSettings currentSettings {};
     heatpumpSettings wantedSettings {};
 
     // initialise to all off, then it will update shortly after connect;
-    heatpumpStatus currentStatus {0, false, {TIMER_MODE_MAP[0], 0, 0, 0, 0}, 0};
+    heatpumpStatus currentStatus {{0}, false, {TIMER_MODE_MAP[0], 0, 0, 0, 0}, 0};
 
+#ifndef HEATPUMP_NO_FUNCTIONS
     heatpumpFunctions functions;
+#endif
+
+    // last raw 0x62 payload per response type. An unchanged poll is detected with one memcmp,
+    // and the payload is only decoded into currentSettings/currentStatus when a callback or getter needs it.
+    static const int RAW_SETTINGS  = 0;
+    static const int RAW_ROOM_TEMP = 1;
+    static const int RAW_TIMERS    = 2;
+    static const int RAW_STATUS    = 3;
+    static const int RAW_FRAME_COUNT = 4;
+
+    struct rawFrame {
+      byte data[PACKET_LEN];
+      byte length;
+      bool stale; // data hasn't been decoded yet
+    };
+    rawFrame rawFrames[RAW_FRAME_COUNT] {};
+
+    // listen-only: the other master's last settings set (0x41 0x01), merged into the settings once acked
+    bool listenOnly = false;
+    byte heardSet[PACKET_LEN] {};
+    bool heardSetPending = false;
+
+    // measured reply latency, smoothed like a TCP RTT estimate (srtt/rttvar), in ms
+    struct responseTiming {
+      unsigned long latency;
+      unsigned long variance;
+      bool sampled;
+
+      void sample(unsigned long ms);
+    };
+
+    // one slot per request type, so a slow status reply doesn't stretch the settings timeout
+    static const int TIMING_CONNECT = 0;
+    static const int TIMING_SET     = 1;
+    static const int TIMING_INFO    = 2; // + INFOMODE index
+    static const int TIMING_SLOTS   = TIMING_INFO + INFOMODE_LEN;
+    responseTiming timing[TIMING_SLOTS] {};
+    responseTiming busTiming {};
+    int pendingTiming = TIMING_CONNECT; // slot of the request we are waiting on
+    byte backoff = 0;                   // gaps and timeouts are doubled this many times
+    uint32_t lastExchange = 0;          // last write, or start of the last read
+    unsigned long minFrameGap = PACKET_GAP_MIN_MS;
+    unsigned long maxFrameGap = PACKET_INFO_INTERVAL_MS;
+    unsigned long statusPollInterval = 0; // 0 = status only comes up in the rotation
+    uint32_t lastStatusRequest = 0;
+    bool statusInserted = false;          // the last info request was an extra status request
+    heatpumpStatistics *statistics {nullptr};
+    heatpumpRuntime *runtime {nullptr};
+
+    byte consecutiveMisses = 0;
+    heatpumpLinkState linkState = HEATPUMP_LINK_DOWN;
   
     HardwareSerial * _HardSerial {nullptr};
-    unsigned long lastSend;
+    heatpumpClock * clock {&heatpumpClock::system()};
+    uint32_t lastSend;
     bool waitForRead;
+    bool replySeen = false;   // reply bytes were available before readPacket() got to them
+    uint32_t replySeenAt = 0; // when they were first seen, the reply's arrival for the latency
     int infoMode;
-    unsigned long lastRecv;
+    uint32_t lastRecv;
+    uint32_t lastSetSend;
+    heatpumpCounters counters {};
     bool connected = false;
     bool autoUpdate;
     bool firstRun;
@@ -202,18 +559,34 @@ class HeatPump
     bool externalUpdate;
     bool wideVaneAdj;
 
-    const char* lookupByteMapValue(const char* valuesMap[], const byte byteMap[], int len, byte byteValue);
-    int    lookupByteMapValue(const int valuesMap[], const byte byteMap[], int len, byte byteValue);
-    int    lookupByteMapIndex(const char* valuesMap[], int len, const char* lookupValue);
-    int    lookupByteMapIndex(const int valuesMap[], int len, int lookupValue);
+    static const char* lookupByteMapValue(const char* const valuesMap[], const byte byteMap[], int len, byte byteValue);
+    static int    lookupByteMapValue(const int valuesMap[], const byte byteMap[], int len, byte byteValue);
+    static int    lookupByteMapIndex(const char* const valuesMap[], int len, const char* lookupValue);
+    static int    lookupByteMapIndex(const int valuesMap[], int len, int lookupValue);
 
     bool canSend(bool isInfo);
     bool canRead();
+    unsigned long responseTimeout();
+    unsigned long frameGap();
+    bool replyAvailable();
+    void exchangeSucceeded(bool awaitingReply, uint32_t responseAt);
+    void exchangeFailed();
+    void updateLinkState();
     byte checkSum(byte bytes[], int len);
     void createPacket(byte *packet, heatpumpSettings settings);
     void createInfoPacket(byte *packet, byte packetType);
     int readPacket();
+    bool waitForBytes(int count, const heatpumpDeadline &until);
+    void cacheRawFrame(int rawType, byte *data, int dataLength);
+    void decodeSettings();
+    void decodeRoomTemp();
+    void decodeTimers();
+    void decodeStatus();
+    void sampleStatistics();
+    void sampleRuntime();
     void readAllPackets();
+    void heardRequest(byte type, const byte *data, int dataLength);
+    void applyHeardSet();
     void writePacket(byte *packet, int length);
     void prepareInfoPacket(byte* packet, int length);
     void prepareSetPacket(byte* packet, int length);
@@ -222,8 +595,11 @@ class HeatPump
     ON_CONNECT_CALLBACK_SIGNATURE {nullptr};
     SETTINGS_CHANGED_CALLBACK_SIGNATURE {nullptr};
     STATUS_CHANGED_CALLBACK_SIGNATURE {nullptr};
+#ifndef HEATPUMP_NO_PACKET_CALLBACK
     PACKET_CALLBACK_SIGNATURE {nullptr};
+#endif
     ROOM_TEMP_CHANGED_CALLBACK_SIGNATURE {nullptr};
+    LINK_STATE_CHANGED_CALLBACK_SIGNATURE {nullptr};
 
   public:
     // indexes for INFOMODE array (public so they can be optionally passed to sync())
@@ -245,9 +621,30 @@ class HeatPump
     void disableExternalUpdate();
     void enableAutoUpdate();
     void disableAutoUpdate();
+    // listen-only: nothing is ever sent, for a bus another master (MHK1/MHK2) already polls. The settings,
+    // status and callbacks follow the unit's replies to it, and its settings changes once the unit acks
+    // them. connect() only opens the serial, update() returns false, and the link is down after
+    // LINK_DOWN_MS without a valid frame. Call before connect().
+    void enableListenOnly();
+    void disableListenOnly(); // the next sync() connects
+    bool isListenOnly();
+    void setClock(heatpumpClock *clock); // defaults to the system clock
+    // the gap between info requests follows the unit's measured reply latency within these bounds
+    void setFrameGapBounds(unsigned long minMs, unsigned long maxMs);
+    unsigned long getFrameGap();
+    // request status (0x06) at least this often for telemetry, 0 turns it off. The extra requests take at
+    // most every other info request, the rotation keeps going in between.
+    void setStatusPollInterval(unsigned long ms);
+    // ms until sync() next has work to do, 0 once reply bytes are available, for event loops. A reply's
+    // latency counts to the first call that sees its bytes, so call this when serial data wakes the loop.
+    unsigned long timeUntilSync();
+    // smoothed latency of the unit's replies, 0 until it has answered
+    unsigned long getReplyLatency();
 
     // settings
     heatpumpSettings getSettings();
+    // the settings update() sends, as the setters took them: e.g. whole degrees unless the unit reports half
+    heatpumpSettings getWantedSettings();
     void setSettings(heatpumpSettings settings);
     void setPowerSetting(bool setting);
     bool getPowerSettingBool(); 
@@ -257,25 +654,47 @@ class HeatPump
     void setModeSetting(const char* setting);
     float getTemperature();
     void setTemperature(float setting);
+    void setTemperature(heatpumpTemperature setting);
     void setRemoteTemperature(float setting);
+    void setRemoteTemperature(heatpumpTemperature setting);
     const char* getFanSpeed();
     void setFanSpeed(const char* setting);
     const char* getVaneSetting();
     void setVaneSetting(const char* setting);
     const char* getWideVaneSetting();
     void setWideVaneSetting(const char* setting);
+    void setSettings(const heatpumpSettingsChange& change); // only the fields it sets
     bool getIseeBool();
+    // POWER, MODE, TEMP (or TEMPERATURE), FAN, VANE or WIDEVANE, in any case, into the change. Values are
+    // checked against the value maps, TEMP must be a number from 10 to 31. The change is left as it is
+    // unless the field is set.
+    static heatpumpFieldResult parseSettingsField(const char* name, const char* value, heatpumpSettingsChange& change);
 
     // status
     heatpumpStatus getStatus();
     float getRoomTemperature();
     bool getOperating();
     bool isConnected();
-
+    heatpumpLinkState getLinkState();
+    const heatpumpCounters& getCounters();
+    // rolling statistics are kept in `statistics` from here on (nullptr stops), it must outlive the HeatPump
+    void setStatistics(heatpumpStatistics *statistics);
+    const heatpumpStatistics* getStatistics();
+    // runtime and energy totals are kept in `runtime` from here on (nullptr stops), it must outlive the HeatPump
+    void setRuntime(heatpumpRuntime *runtime);
+    const heatpumpRuntime* getRuntime();
+
+    // decode the data bytes of a 0x62 info reply, for tools that read recorded traffic
+    static heatpumpSettings parseSettings(const byte *data);
+    static heatpumpTemperature parseRoomTemperature(const byte *data);
+    static heatpumpTimers parseTimers(const byte *data);
+
+#ifndef HEATPUMP_NO_FUNCTIONS
     // functions
     // NOTE: These methods have been tested with a PVA (P-series air handler) unit and has not been tested with anything else. Use at your own risk.
     heatpumpFunctions getFunctions();
     bool setFunctions(heatpumpFunctions const& functions);
+#endif
     
     // helpers
     float FahrenheitToCelsius(int tempF);
@@ -285,11 +704,26 @@ class HeatPump
     void setOnConnectCallback(ON_CONNECT_CALLBACK_SIGNATURE);
     void setSettingsChangedCallback(SETTINGS_CHANGED_CALLBACK_SIGNATURE);
     void setStatusChangedCallback(STATUS_CHANGED_CALLBACK_SIGNATURE);
+#ifndef HEATPUMP_NO_PACKET_CALLBACK
     void setPacketCallback(PACKET_CALLBACK_SIGNATURE);
+#endif
     void setRoomTempChangedCallback(ROOM_TEMP_CHANGED_CALLBACK_SIGNATURE); // need to deprecate this, is available from setStatusChangedCallback
+    void setLinkStateChangedCallback(LINK_STATE_CHANGED_CALLBACK_SIGNATURE);
 
+#ifndef HEATPUMP_NO_CUSTOM_PACKET
     // expert users only!
     void sendCustomPacket(byte data[], int len); 
+#endif
 
 };
+
+/*
+ * Per-instance RAM budget. The protocol tables are static, so an instance only holds its own state:
+ * settings, status, the raw frame cache, bus timing, counters and callbacks (~580 bytes on ESP32).
+ * Keep it under budget so several instances fit on one ESP32; the budget is doubled for 64-bit hosts.
+ */
+#ifndef HEATPUMP_RAM_BUDGET
+#define HEATPUMP_RAM_BUDGET (sizeof(void*) == 4 ? 768 : 1536)
+#endif
+static_assert(sizeof(HeatPump) <= HEATPUMP_RAM_BUDGET, "HeatPump grew past its per-instance RAM budget");
 #endif
@@ -0,0 +1,63 @@
+#ifndef __HeatPumpClock_H__
+#define __HeatPumpClock_H__
+#include <Arduino.h>
+
+/*
+ * Time source for the HeatPump library and the controller. The default reads the platform's
+ * millis()/delay(); swap in a heatpumpVirtualClock to run long soaks faster than real time.
+ * Time is 32 bits everywhere, so it wraps after ~49 days on a 64-bit host just like on the ESP32.
+ */
+class heatpumpClock {
+  public:
+    virtual uint32_t millis() { return (uint32_t) ::millis(); }
+    virtual void delay(uint32_t ms) { ::delay(ms); }
+    virtual ~heatpumpClock() {}
+
+    static heatpumpClock& system() {
+      static heatpumpClock clock;
+      return clock;
+    }
+};
+
+/*
+ * Clock that only moves when told to. delay() advances it instantly, so code that waits on the
+ * bus runs as fast as the simulation around it. Start it near 0xFFFFFFFF to cover the 49 day millis() wrap.
+ */
+class heatpumpVirtualClock : public heatpumpClock {
+  private:
+    uint32_t now;
+
+  public:
+    explicit heatpumpVirtualClock(uint32_t start = 0) : now(start) {}
+
+    uint32_t millis() override { return now; }
+    void delay(uint32_t ms) override { now += ms; }
+    void advance(uint32_t ms) { now += ms; }
+};
+
+/*
+ * A point in time on a heatpumpClock. Comparisons use the signed difference to now, so deadlines
+ * keep working across the millis() wraparound as long as they are less than ~24 days away.
+ */
+struct heatpumpDeadline {
+  uint32_t time;
+
+  static heatpumpDeadline after(heatpumpClock& clock, unsigned long ms) {
+    return heatpumpDeadline{(uint32_t) (clock.millis() + ms)};
+  }
+
+  bool expired(heatpumpClock& clock) const {
+    return (int32_t) (clock.millis() - time) >= 0;
+  }
+
+  bool before(const heatpumpDeadline& other) const {
+    return (int32_t) (time - other.time) < 0;
+  }
+
+  // milliseconds left, 0 once expired
+  unsigned long remaining(heatpumpClock& clock) const {
+    int32_t left = (int32_t) (time - clock.millis());
+    return left > 0 ? (unsigned long) left : 0;
+  }
+};
+#endif
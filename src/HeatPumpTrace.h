@@ -0,0 +1,149 @@
+#ifndef __HeatPumpTrace_H__
+#define __HeatPumpTrace_H__
+/*
+ * Scoped timing spans for finding stalls in the library and the controller, built with -D HEATPUMP_TRACE.
+ * Without it HEATPUMP_TRACE_SPAN() compiles to nothing.
+ *
+ *   void HeatPump::sync(byte packetType) {
+ *     HEATPUMP_TRACE_SPAN("HeatPump::sync");
+ *     ...
+ *
+ * A span is recorded when it ends, into a ring of the last HEATPUMP_TRACE_EVENTS spans of the core it
+ * ran on. Recording takes one atomic increment and no lock, so spans can end in any task. Span names
+ * must be string literals, only the pointer is kept. heatpumpTrace::write() exports the rings as Chrome
+ * trace JSON (chrome://tracing, ui.perfetto.dev) with one track per core.
+ */
+#ifdef HEATPUMP_TRACE
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#if defined(ESP32)
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#else
+#include <time.h>
+#endif
+
+#ifndef HEATPUMP_TRACE_EVENTS
+#define HEATPUMP_TRACE_EVENTS 256 // per core, ~24 bytes each
+#endif
+
+class heatpumpTrace {
+  public:
+#if defined(ESP32)
+    static const int CORES = portNUM_PROCESSORS;
+#else
+    static const int CORES = 1; // the gateway runs on one thread
+#endif
+
+    static uint64_t micros() {
+#if defined(ESP32)
+      return (uint64_t) esp_timer_get_time();
+#else
+      timespec now;
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+#endif
+    }
+
+    static void record(const char* name, uint64_t startUs, uint64_t endUs) {
+#if defined(ESP32)
+      ring& r = rings()[xPortGetCoreID()];
+#else
+      ring& r = rings()[0];
+#endif
+      const uint32_t index = r.head.fetch_add(1, std::memory_order_relaxed);
+      event& e = r.events[index % HEATPUMP_TRACE_EVENTS];
+      // an odd stamp marks the slot as being written, readers skip it
+      e.stamp.store(index * 2 + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      e.name = name;
+      e.startUs = startUs;
+      e.durationUs = (uint32_t) (endUs - startUs);
+      e.stamp.store(index * 2 + 2, std::memory_order_release);
+    }
+
+    static void clear() {
+      for (int core = 0; core < CORES; core++) {
+        ring& r = rings()[core];
+        for (int i = 0; i < HEATPUMP_TRACE_EVENTS; i++) r.events[i].stamp.store(0, std::memory_order_relaxed);
+      }
+    }
+
+    /*
+     * Streams the recorded spans as Chrome trace JSON through write(const char* text, size_t length).
+     * Spans keep being recorded meanwhile; one overwritten while it is copied is left out.
+     */
+    template<typename Write>
+    static void write(Write write) {
+      static const char HEAD[] = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+      write(HEAD, sizeof(HEAD) - 1);
+      bool first = true;
+      for (int core = 0; core < CORES; core++) {
+        ring& r = rings()[core];
+        const uint32_t head = r.head.load(std::memory_order_acquire);
+        const uint32_t count = head < HEATPUMP_TRACE_EVENTS ? head : HEATPUMP_TRACE_EVENTS;
+        for (uint32_t index = head - count; index != head; index++) {
+          const event& e = r.events[index % HEATPUMP_TRACE_EVENTS];
+          const uint32_t stamp = e.stamp.load(std::memory_order_acquire);
+          if (stamp != index * 2 + 2) continue; // not written yet, being written or already reused
+          const char* name = e.name;
+          const uint64_t startUs = e.startUs;
+          const uint32_t durationUs = e.durationUs;
+          std::atomic_thread_fence(std::memory_order_acquire);
+          if (e.stamp.load(std::memory_order_relaxed) != stamp) continue;
+
+          char line[160];
+          int length = snprintf(line, sizeof(line),
+                                "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%llu,\"dur\":%lu}",
+                                first ? "" : ",\n", name, core, (unsigned long long) startUs,
+                                (unsigned long) durationUs);
+          if (length >= (int) sizeof(line)) length = sizeof(line) - 1;
+          write(line, (size_t) length);
+          first = false;
+        }
+      }
+      static const char TAIL[] = "]}\n";
+      write(TAIL, sizeof(TAIL) - 1);
+    }
+
+  private:
+    struct event {
+      std::atomic<uint32_t> stamp; // 2 * index + 2 once written
+      const char* name;
+      uint64_t startUs;
+      uint32_t durationUs;
+    };
+
+    struct ring {
+      std::atomic<uint32_t> head;
+      event events[HEATPUMP_TRACE_EVENTS];
+    };
+
+    static ring* rings() {
+      static ring r[CORES];
+      return r;
+    }
+};
+
+class heatpumpTraceSpan {
+  private:
+    const char* name;
+    uint64_t startUs;
+
+  public:
+    explicit heatpumpTraceSpan(const char* name) : name(name), startUs(heatpumpTrace::micros()) {}
+    ~heatpumpTraceSpan() { heatpumpTrace::record(name, startUs, heatpumpTrace::micros()); }
+
+    heatpumpTraceSpan(const heatpumpTraceSpan&) = delete;
+    heatpumpTraceSpan& operator=(const heatpumpTraceSpan&) = delete;
+};
+
+#define HEATPUMP_TRACE_CONCAT_(a, b) a##b
+#define HEATPUMP_TRACE_CONCAT(a, b) HEATPUMP_TRACE_CONCAT_(a, b)
+#define HEATPUMP_TRACE_SPAN(name) heatpumpTraceSpan HEATPUMP_TRACE_CONCAT(heatpumpTraceSpan_, __LINE__)(name)
+#else
+#define HEATPUMP_TRACE_SPAN(name) do {} while (0)
+#endif
+#endif
@@ -0,0 +1,451 @@
+#include "History.h"
+#include <string.h>
+
+static const uint32_t BLOCK_MAGIC = 0x31485048; // "HPH1"
+
+const size_t HistoryStore::TIER_SECTORS[TIERS] = {16, 48, 48};
+const uint32_t HistoryStore::TIER_RETENTION[TIERS] = {3600, 7 * 24 * 3600, 365 * 24 * 3600};
+
+static const uint32_t TIER_INTERVAL[HistoryStore::TIERS] = {1, 60, 3600};
+
+static inline uint32_t zigzag(int32_t value) {
+    return ((uint32_t) value << 1) ^ (uint32_t) (value >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t value) {
+    return (int32_t) (value >> 1) ^ -(int32_t) (value & 1);
+}
+
+static inline size_t putVarint(uint8_t *out, uint32_t value) {
+    size_t length = 0;
+    while (value >= 0x80) {
+        out[length++] = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+    out[length++] = (uint8_t) value;
+    return length;
+}
+
+template<typename Read>
+static inline bool getVarint(Read &read, uint32_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        uint8_t byte;
+        if (!read(byte)) return false;
+        value |= (uint32_t) (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+// reads a stored block a few bytes at a time
+class SectorReader {
+public:
+    SectorReader(HistoryStorage &storage, size_t sector, size_t offset, size_t end)
+            : storage(storage), sector(sector), offset(offset), end(end) {
+    }
+
+    bool operator()(uint8_t &byte) {
+        if (position == filled) {
+            if (offset >= end) return false;
+            filled = end - offset < sizeof(buffer) ? end - offset : sizeof(buffer);
+            if (!storage.read(sector, offset, buffer, filled)) return false;
+            offset += filled;
+            position = 0;
+        }
+        byte = buffer[position++];
+        return true;
+    }
+
+private:
+    HistoryStorage &storage;
+    size_t sector;
+    size_t offset;
+    size_t end;
+    uint8_t buffer[64];
+    size_t filled = 0;
+    size_t position = 0;
+};
+
+// reads the open block from RAM
+class MemoryReader {
+public:
+    MemoryReader(const uint8_t *data, size_t length) : data(data), end(data + length) {
+    }
+
+    bool operator()(uint8_t &byte) {
+        if (data == end) return false;
+        byte = *data++;
+        return true;
+    }
+
+private:
+    const uint8_t *data;
+    const uint8_t *end;
+};
+
+#if defined(ESP32)
+// FlashHistoryStorage /////////////////////////////////////////////////////////
+
+FlashHistoryStorage::FlashHistoryStorage(const char *label) : label(label) {
+}
+
+bool FlashHistoryStorage::begin() {
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+    return partition != nullptr;
+}
+
+size_t FlashHistoryStorage::sectorCount() {
+    return partition ? partition->size / SECTOR_SIZE : 0;
+}
+
+bool FlashHistoryStorage::read(size_t sector, size_t offset, void *data, size_t length) {
+    return partition && esp_partition_read(partition, sector * SECTOR_SIZE + offset, data, length) == ESP_OK;
+}
+
+bool FlashHistoryStorage::writeSector(size_t sector, const void *data) {
+    return partition && esp_partition_erase_range(partition, sector * SECTOR_SIZE, SECTOR_SIZE) == ESP_OK &&
+           esp_partition_write(partition, sector * SECTOR_SIZE, data, SECTOR_SIZE) == ESP_OK;
+}
+#endif
+
+// HistoryStore ////////////////////////////////////////////////////////////////
+
+void HistoryStore::Aggregate::add(const HistoryPoint &point, uint32_t samples) {
+    if (!count || point.roomTemperatureMin.halfDegrees < roomMin) roomMin = point.roomTemperatureMin.halfDegrees;
+    if (!count || point.roomTemperatureMax.halfDegrees > roomMax) roomMax = point.roomTemperatureMax.halfDegrees;
+    if (point.compressorFrequencyMax > compressorMax) compressorMax = point.compressorFrequencyMax;
+    count += samples;
+    roomSum += point.roomTemperature.halfDegrees * (int32_t) samples;
+    setpoint = point.setpoint.halfDegrees;
+    operatingSum += point.operatingPercent * samples;
+    compressorSum += point.compressorFrequency * samples;
+}
+
+void HistoryStore::Aggregate::merge(const Aggregate &other) {
+    if (!other.count) return;
+    if (!count || other.roomMin < roomMin) roomMin = other.roomMin;
+    if (!count || other.roomMax > roomMax) roomMax = other.roomMax;
+    if (other.compressorMax > compressorMax) compressorMax = other.compressorMax;
+    count += other.count;
+    roomSum += other.roomSum;
+    setpoint = other.setpoint;
+    operatingSum += other.operatingSum;
+    compressorSum += other.compressorSum;
+}
+
+HistoryPoint HistoryStore::Aggregate::point() const {
+    const int32_t half = (int32_t) count / 2;
+    HistoryPoint point;
+    point.time = start;
+    point.roomTemperature.halfDegrees = (int16_t) ((roomSum + (roomSum < 0 ? -half : half)) / (int32_t) count);
+    point.roomTemperatureMin.halfDegrees = roomMin;
+    point.roomTemperatureMax.halfDegrees = roomMax;
+    point.setpoint.halfDegrees = setpoint;
+    point.operatingPercent = (uint8_t) ((operatingSum + count / 2) / count);
+    point.compressorFrequency = (uint8_t) ((compressorSum + count / 2) / count);
+    point.compressorFrequencyMax = compressorMax;
+    return point;
+}
+
+HistoryStore::HistoryStore(HistoryStorage &storage) : storage(storage) {
+    static_assert(sizeof(BlockHeader) == HEADER_LEN, "BlockHeader must not be padded");
+}
+
+HistoryStore::~HistoryStore() {
+    for (int tier = 0; tier < TIERS; tier++) {
+        delete[] rings[tier].info;
+        delete[] rings[tier].block;
+    }
+}
+
+size_t HistoryStore::sectorsNeeded() {
+    size_t sectors = 0;
+    for (int tier = 0; tier < TIERS; tier++) sectors += TIER_SECTORS[tier];
+    return sectors;
+}
+
+const char *HistoryStore::tierName(Tier tier) {
+    switch (tier) {
+        case SECONDS: return "seconds";
+        case MINUTES: return "minutes";
+        case HOURS: return "hours";
+        default: return "";
+    }
+}
+
+bool HistoryStore::parseTier(const char *name, Tier &tier) {
+    for (int candidate = SECONDS; candidate < TIERS; candidate++) {
+        if (strcmp(name, tierName((Tier) candidate)) == 0) {
+            tier = (Tier) candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool HistoryStore::isReady() const {
+    return ready;
+}
+
+bool HistoryStore::begin() {
+    if (ready) return true;
+    if (storage.sectorCount() < sectorsNeeded()) return false;
+
+    size_t firstSector = 0;
+    for (int tier = 0; tier < TIERS; tier++) {
+        Ring &ring = rings[tier];
+        ring.firstSector = firstSector;
+        ring.sectors = TIER_SECTORS[tier];
+        firstSector += ring.sectors;
+        ring.info = new SectorInfo[ring.sectors];
+        ring.block = new uint8_t[HistoryStorage::SECTOR_SIZE];
+
+        // the newest valid block decides where the tier carries on
+        bool found = false;
+        size_t newest = 0;
+        BlockHeader header;
+        for (size_t i = 0; i < ring.sectors; i++) {
+            SectorInfo &info = ring.info[i];
+            info.valid = loadSector((Tier) tier, i, header);
+            info.sequence = header.sequence;
+            info.firstTime = header.firstTime;
+            info.lastTime = header.lastTime;
+            if (info.valid && (!found || (int32_t) (info.sequence - ring.info[newest].sequence) > 0)) {
+                found = true;
+                newest = i;
+            }
+        }
+
+        if (!found) {
+            openBlock((Tier) tier, 0, 1);
+        } else if (loadSector((Tier) tier, newest, header) && !header.sealed) {
+            // continue the checkpointed block, its records set up the encoder
+            ring.current = newest;
+            ring.header = header;
+            ring.dirty = false;
+            memset(&ring.cursor, 0, sizeof(ring.cursor));
+            MemoryReader read(ring.block + HEADER_LEN, header.used);
+            decode(read, header.count, [](const HistoryPoint &) { return true; }, ring.cursor);
+            memset(ring.block + HEADER_LEN + header.used, 0, PAYLOAD_LEN - header.used);
+        } else {
+            openBlock((Tier) tier, (newest + 1) % ring.sectors, ring.info[newest].sequence + 1);
+        }
+    }
+    ready = true;
+    return true;
+}
+
+bool HistoryStore::loadSector(Tier tier, size_t index, BlockHeader &header) {
+    Ring &ring = rings[tier];
+    memset(&header, 0, sizeof(header));
+    if (!storage.read(ring.firstSector + index, 0, ring.block, HistoryStorage::SECTOR_SIZE)) return false;
+    memcpy(&header, ring.block, HEADER_LEN);
+    if (header.magic != BLOCK_MAGIC || header.tier != tier || header.used > PAYLOAD_LEN) return false;
+
+    const uint32_t crc = header.crc;
+    BlockHeader zeroed = header;
+    zeroed.crc = 0;
+    uint32_t check = crc32(0, (const uint8_t *) &zeroed, HEADER_LEN);
+    check = crc32(check, ring.block + HEADER_LEN, header.used);
+    return check == crc;
+}
+
+void HistoryStore::openBlock(Tier tier, size_t sector, uint32_t sequence) {
+    Ring &ring = rings[tier];
+    ring.current = sector;
+    ring.dirty = false;
+    ring.info[sector].valid = false; // the oldest block, given up for the open one
+    memset(&ring.header, 0, sizeof(ring.header));
+    ring.header.magic = BLOCK_MAGIC;
+    ring.header.sequence = sequence;
+    ring.header.tier = (uint8_t) tier;
+    memset(&ring.cursor, 0, sizeof(ring.cursor));
+    memset(ring.block, 0, HistoryStorage::SECTOR_SIZE);
+}
+
+void HistoryStore::writeBlock(Tier tier) {
+    Ring &ring = rings[tier];
+    ring.header.crc = 0;
+    uint32_t crc = crc32(0, (const uint8_t *) &ring.header, HEADER_LEN);
+    ring.header.crc = crc32(crc, ring.block + HEADER_LEN, ring.header.used);
+    memcpy(ring.block, &ring.header, HEADER_LEN);
+
+    SectorInfo &info = ring.info[ring.current];
+    info.valid = storage.writeSector(ring.firstSector + ring.current, ring.block);
+    info.sequence = ring.header.sequence;
+    info.firstTime = ring.header.firstTime;
+    info.lastTime = ring.header.lastTime;
+    ring.dirty = false;
+}
+
+void HistoryStore::toFields(const HistoryPoint &point, int32_t *fields) {
+    fields[0] = point.roomTemperature.halfDegrees;
+    fields[1] = point.roomTemperatureMin.halfDegrees;
+    fields[2] = point.roomTemperatureMax.halfDegrees;
+    fields[3] = point.setpoint.halfDegrees;
+    fields[4] = point.operatingPercent;
+    fields[5] = point.compressorFrequency;
+    fields[6] = point.compressorFrequencyMax;
+}
+
+HistoryPoint HistoryStore::fromFields(uint32_t time, const int32_t *fields) {
+    HistoryPoint point;
+    point.time = time;
+    point.roomTemperature.halfDegrees = (int16_t) fields[0];
+    point.roomTemperatureMin.halfDegrees = (int16_t) fields[1];
+    point.roomTemperatureMax.halfDegrees = (int16_t) fields[2];
+    point.setpoint.halfDegrees = (int16_t) fields[3];
+    point.operatingPercent = (uint8_t) fields[4];
+    point.compressorFrequency = (uint8_t) fields[5];
+    point.compressorFrequencyMax = (uint8_t) fields[6];
+    return point;
+}
+
+void HistoryStore::append(Tier tier, const HistoryPoint &point) {
+    Ring &ring = rings[tier];
+    if (ring.header.used + MAX_RECORD_LEN > PAYLOAD_LEN) {
+        ring.header.sealed = 1;
+        writeBlock(tier);
+        openBlock(tier, (ring.current + 1) % ring.sectors, ring.header.sequence + 1);
+    }
+
+    // flags, time delta, then the delta of each field whose flag is set
+    int32_t fields[FIELDS];
+    toFields(point, fields);
+    uint8_t *record = ring.block + HEADER_LEN + ring.header.used;
+    size_t length = 1;
+    length += putVarint(record + length, zigzag((int32_t) (point.time - ring.cursor.time)));
+    uint8_t flags = 0;
+    for (int field = 0; field < FIELDS; field++) {
+        const int32_t delta = fields[field] - ring.cursor.fields[field];
+        if (!delta) continue;
+        flags |= 1 << field;
+        length += putVarint(record + length, zigzag(delta));
+        ring.cursor.fields[field] = fields[field];
+    }
+    record[0] = flags;
+    ring.cursor.time = point.time;
+
+    if (!ring.header.count) ring.header.firstTime = point.time;
+    ring.header.lastTime = point.time;
+    ring.header.count++;
+    ring.header.used += (uint16_t) length;
+    ring.dirty = true;
+}
+
+template<typename Read>
+bool HistoryStore::decode(Read &read, uint16_t count, const Visitor &visit, Cursor &cursor) {
+    for (uint16_t i = 0; i < count; i++) {
+        uint8_t flags;
+        uint32_t value;
+        if (!read(flags) || !getVarint(read, value)) return false;
+        cursor.time += (uint32_t) unzigzag(value);
+        for (int field = 0; field < FIELDS; field++) {
+            if (!(flags & (1 << field))) continue;
+            if (!getVarint(read, value)) return false;
+            cursor.fields[field] += unzigzag(value);
+        }
+        if (!visit(fromFields(cursor.time, cursor.fields))) return false;
+    }
+    return true;
+}
+
+void HistoryStore::record(uint32_t now, const heatpumpStatus &status, const heatpumpSettings &settings) {
+    if (!ready) return;
+
+    HistoryPoint sample;
+    sample.time = now;
+    sample.roomTemperature = status.roomTemperature;
+    sample.roomTemperatureMin = status.roomTemperature;
+    sample.roomTemperatureMax = status.roomTemperature;
+    sample.setpoint = settings.temperature;
+    sample.operatingPercent = status.operating ? 100 : 0;
+    sample.compressorFrequency = (uint8_t) constrain(status.compressorFrequency, 0, 255);
+    sample.compressorFrequencyMax = sample.compressorFrequency;
+    append(SECONDS, sample);
+
+    const uint32_t minuteStart = now - now % TIER_INTERVAL[MINUTES];
+    const uint32_t hourStart = now - now % TIER_INTERVAL[HOURS];
+    if (!restored) {
+        // after a restart, pick up the minutes of this hour so its aggregate stays whole
+        restored = true;
+        lastCheckpoint = now;
+        hour.start = hourStart;
+        query(MINUTES, hourStart, now - 1, [this](const HistoryPoint &point) {
+            hour.add(point, TIER_INTERVAL[MINUTES]);
+            return true;
+        });
+    }
+
+    if (minute.count && minute.start != minuteStart) {
+        append(MINUTES, minute.point());
+        if (!hour.count) hour.start = minute.start - minute.start % TIER_INTERVAL[HOURS];
+        hour.merge(minute);
+        minute = Aggregate();
+    }
+    if (hour.count && hour.start != hourStart) {
+        append(HOURS, hour.point());
+        hour = Aggregate();
+    }
+    if (!minute.count) minute.start = minuteStart;
+    minute.add(sample, 1);
+
+    if (now - lastCheckpoint >= CHECKPOINT_SECONDS) {
+        lastCheckpoint = now;
+        flush();
+    }
+}
+
+void HistoryStore::flush() {
+    if (!ready) return;
+    for (int tier = 0; tier < TIERS; tier++) {
+        if (rings[tier].dirty) writeBlock((Tier) tier);
+    }
+}
+
+void HistoryStore::query(Tier tier, uint32_t from, uint32_t to, const Visitor &visit) {
+    if (!ready || tier >= TIERS || from > to) return;
+
+    bool stopped = false;
+    const Visitor inRange = [&](const HistoryPoint &point) {
+        if (point.time < from) return true;
+        if (point.time > to || !visit(point)) {
+            stopped = true;
+            return false;
+        }
+        return true;
+    };
+
+    // oldest first: the sector after the open block holds the oldest data, the open block the newest
+    Ring &ring = rings[tier];
+    for (size_t n = 1; n <= ring.sectors && !stopped; n++) {
+        const size_t sector = (ring.current + n) % ring.sectors;
+        Cursor cursor;
+        memset(&cursor, 0, sizeof(cursor));
+        if (sector == ring.current) {
+            if (!ring.header.count || ring.header.lastTime < from || ring.header.firstTime > to) continue;
+            MemoryReader read(ring.block + HEADER_LEN, ring.header.used);
+            decode(read, ring.header.count, inRange, cursor);
+        } else {
+            const SectorInfo &info = ring.info[sector];
+            if (!info.valid || info.lastTime < from || info.firstTime > to) continue;
+            BlockHeader header;
+            if (!storage.read(ring.firstSector + sector, 0, &header, HEADER_LEN) ||
+                header.sequence != info.sequence) {
+                continue;
+            }
+            SectorReader read(storage, ring.firstSector + sector, HEADER_LEN, HEADER_LEN + header.used);
+            decode(read, header.count, inRange, cursor);
+        }
+    }
+}
+
+uint32_t HistoryStore::crc32(uint32_t crc, const uint8_t *data, size_t length) {
+    crc = ~crc;
+    while (length--) {
+        crc ^= *data++;
+        for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+    return ~crc;
+}
@@ -0,0 +1,177 @@
+#pragma once
+#include <HeatPump.h>
+#include <functional>
+
+/**
+ * One history entry. Second samples carry the values as read. Minute and hour aggregates carry the mean
+ * room temperature with its min/max, the last setpoint, the share of the interval the unit was operating
+ * and the mean/max compressor frequency.
+ */
+struct HistoryPoint {
+    uint32_t time; // Unix seconds, the interval start for aggregates
+    heatpumpTemperature roomTemperature;
+    heatpumpTemperature roomTemperatureMin;
+    heatpumpTemperature roomTemperatureMax;
+    heatpumpTemperature setpoint;
+    uint8_t operatingPercent; // 0 or 100 for second samples
+    uint8_t compressorFrequency;
+    uint8_t compressorFrequencyMax;
+};
+
+/**
+ * Sector storage for HistoryStore: flash on the ESP32, a file on Linux. Sectors are only ever written
+ * whole, a write replaces (erases and programs) the sector.
+ */
+class HistoryStorage {
+public:
+    static const size_t SECTOR_SIZE = 4096;
+
+    virtual size_t sectorCount() = 0;
+    virtual bool read(size_t sector, size_t offset, void *data, size_t length) = 0;
+    virtual bool writeSector(size_t sector, const void *data) = 0;
+    virtual ~HistoryStorage() {}
+};
+
+#if defined(ESP32)
+#include <esp_partition.h>
+
+/**
+ * HistoryStorage on the flash partition with the given label, by default the "spiffs" data partition of
+ * the stock partition tables, which this firmware doesn't otherwise use.
+ */
+class FlashHistoryStorage : public HistoryStorage {
+public:
+    explicit FlashHistoryStorage(const char *label = "spiffs");
+
+    bool begin();
+    size_t sectorCount() override;
+    bool read(size_t sector, size_t offset, void *data, size_t length) override;
+    bool writeSector(size_t sector, const void *data) override;
+
+private:
+    const char *label;
+    const esp_partition_t *partition = nullptr;
+};
+#endif
+
+/**
+ * Tiered on-device history: second samples for the last hour, minute aggregates for a week and hour
+ * aggregates for a year.
+ *
+ * Each tier is a ring of sectors. Records are appended to a sector-sized block in RAM. A record is the
+ * zigzag varint delta of the time and a bitmask of the fields that changed, followed by their zigzag
+ * varint deltas. An unchanged second sample takes 2 bytes. A block that can't take another record is
+ * sealed and written to the tier's next sector. The open blocks are also written every
+ * CHECKPOINT_SECONDS, so a reboot loses at most that much of the aggregates. Every block starts from
+ * zero, so it decodes on its own. begin() finds the newest block of each tier by its sequence number and
+ * carries on from there.
+ *
+ * query() streams points from the blocks a few bytes at a time, nothing is materialized. All calls must
+ * come from one task.
+ */
+class HistoryStore {
+public:
+    enum Tier { SECONDS, MINUTES, HOURS, TIERS };
+    typedef std::function<bool(const HistoryPoint &point)> Visitor; // return false to stop
+
+    // sectors per tier, sized for ~8 bytes per record with room to spare: a hour, a week and a year
+    static const size_t TIER_SECTORS[TIERS];
+    static const uint32_t TIER_RETENTION[TIERS]; // seconds
+    static const uint32_t CHECKPOINT_SECONDS = 15 * 60;
+
+    explicit HistoryStore(HistoryStorage &storage);
+    ~HistoryStore();
+
+    static size_t sectorsNeeded();
+    static const char *tierName(Tier tier);
+    static bool parseTier(const char *name, Tier &tier);
+
+    bool begin(); // false if the storage is too small
+    bool isReady() const;
+
+    // feed once a second, `now` in Unix seconds
+    void record(uint32_t now, const heatpumpStatus &status, const heatpumpSettings &settings);
+    void query(Tier tier, uint32_t from, uint32_t to, const Visitor &visit);
+    void flush(); // writes the open blocks now, before a clean shutdown
+
+private:
+    static const int FIELDS = 7;
+    static const size_t HEADER_LEN = 28;
+    static const size_t PAYLOAD_LEN = HistoryStorage::SECTOR_SIZE - HEADER_LEN;
+    static const size_t MAX_RECORD_LEN = 1 + 5 + FIELDS * 5;
+
+    struct BlockHeader {
+        uint32_t magic;
+        uint32_t sequence; // per tier, the newest block has the highest
+        uint32_t firstTime;
+        uint32_t lastTime;
+        uint16_t count;
+        uint16_t used; // payload bytes
+        uint8_t tier;
+        uint8_t sealed; // full, later records go to the next sector
+        uint16_t reserved;
+        uint32_t crc; // CRC-32 of the header with crc = 0, and the payload
+    };
+
+    // what the ring knows about a sector without reading it
+    struct SectorInfo {
+        uint32_t sequence;
+        uint32_t firstTime;
+        uint32_t lastTime;
+        bool valid;
+    };
+
+    // running encoder/decoder state, a block starts from zeros
+    struct Cursor {
+        uint32_t time;
+        int32_t fields[FIELDS];
+    };
+
+    struct Aggregate {
+        uint32_t start = 0;
+        uint32_t count = 0; // second samples
+        int32_t roomSum = 0;
+        int16_t roomMin = 0;
+        int16_t roomMax = 0;
+        int16_t setpoint = 0;
+        uint32_t operatingSum = 0; // percent * samples
+        uint32_t compressorSum = 0;
+        uint8_t compressorMax = 0;
+
+        void add(const HistoryPoint &point, uint32_t samples);
+        void merge(const Aggregate &other);
+        HistoryPoint point() const;
+    };
+
+    struct Ring {
+        size_t firstSector = 0;
+        size_t sectors = 0;
+        size_t current = 0; // sector the open block goes to
+        bool dirty = false; // records since the last write
+        SectorInfo *info = nullptr;
+        BlockHeader header; // of the open block
+        uint8_t *block = nullptr; // SECTOR_SIZE, the header is copied in front of the payload when written
+        Cursor cursor;
+    };
+
+    HistoryStorage &storage;
+    Ring rings[TIERS];
+    Aggregate minute;
+    Aggregate hour;
+    uint32_t lastCheckpoint = 0;
+    bool restored = false; // the hour aggregate was rebuilt from the minute tier
+    bool ready = false;
+
+    void append(Tier tier, const HistoryPoint &point);
+    void writeBlock(Tier tier);
+    void openBlock(Tier tier, size_t sector, uint32_t sequence);
+    bool loadSector(Tier tier, size_t index, BlockHeader &header); // into the ring's block, false if invalid
+    template<typename Read> static bool decode(Read &read, uint16_t count, const Visitor &visit, Cursor &cursor);
+
+    static void toFields(const HistoryPoint &point, int32_t *fields);
+    static HistoryPoint fromFields(uint32_t time, const int32_t *fields);
+    static uint32_t crc32(uint32_t crc, const uint8_t *data, size_t length);
+
+    HistoryStore(const HistoryStore &) = delete;
+    HistoryStore &operator=(const HistoryStore &) = delete;
+};
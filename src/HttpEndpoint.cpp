@@ -0,0 +1,538 @@
+#include "HttpEndpoint.h"
+#include "Metrics.h"
+#include "History.h"
+#include "Schedule.h"
+#include "HeatPumpTrace.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#if defined(ESP32)
+#include <lwip/sockets.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#endif
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static const char *POWER_VALUES[] = {"OFF", "ON"};
+static const char *MODE_VALUES[] = {"HEAT", "DRY", "COOL", "FAN", "AUTO"};
+static const char *FAN_VALUES[] = {"AUTO", "QUIET", "1", "2", "3", "4"};
+static const char *VANE_VALUES[] = {"AUTO", "1", "2", "3", "4", "5", "SWING"};
+static const char *WIDEVANE_VALUES[] = {"<<", "<", "|", ">", ">>", "<>", "SWING"};
+
+// HTML view fragments, the dynamic parts are streamed in between
+static const char HTML_HEAD[] =
+        "<!DOCTYPE html><html><head><meta name='viewport' content='width=device-width, initial-scale=1'/>"
+        "<title>Heat Pump</title></head><body><h3>Heat Pump</h3><p>Room: ";
+static const char HTML_FORM_START[] = "&deg;C</p><form autocomplete='off' method='post' action='/'><table>";
+static const char HTML_ROW_START[] = "<tr><td>";
+static const char HTML_SELECT_START[] = "</td><td><select name='";
+static const char HTML_SELECT_END[] = "</select></td></tr>";
+static const char HTML_TEMP_ROW[] =
+        "<tr><td>Temp</td><td><input type='number' name='TEMP' min='10' max='31' step='0.5' value='";
+static const char HTML_TEMP_ROW_END[] = "'/></td></tr>";
+static const char HTML_FOOT[] = "</table><br/><input type='submit' value='Change Settings'/></form></body></html>";
+
+// Sending /////////////////////////////////////////////////////////////////////
+
+// The response being sent has this long in total, HttpEndpoint sends one at a time. 0 = no limit, for a
+// HttpChunkWriter on another socket.
+static unsigned long responseStart = 0;
+static unsigned long responseTimeout = 0;
+
+/**
+ * Sends all of it, each send blocking only for what is left of the response's time. After a send fails
+ * the socket is shut down, so the rest of the response fails at once instead of waiting again.
+ */
+static void sendAll(int socket, const char *data, size_t length) {
+    while (length > 0) {
+        if (responseTimeout) {
+            const unsigned long elapsed = millis() - responseStart;
+            // 1 ms once the time is up, a zero timeout would block for good
+            const unsigned long left = max(elapsed < responseTimeout ? responseTimeout - elapsed : 0UL, 1UL);
+            struct timeval timeout = {(time_t) (left / 1000), (long) (left % 1000) * 1000};
+            setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        }
+        const ssize_t sent = send(socket, data, length, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            shutdown(socket, SHUT_RDWR);
+            return;
+        }
+        data += sent;
+        length -= sent;
+    }
+}
+
+// HttpChunkWriter /////////////////////////////////////////////////////////////
+
+HttpChunkWriter::HttpChunkWriter(int socket) : socket(socket) {
+}
+
+void HttpChunkWriter::print(const char *text) {
+    print(text, strlen(text));
+}
+
+void HttpChunkWriter::print(const char *text, size_t length) {
+    while (length > 0) {
+        if (used == BUFFER_LEN) {
+            flush();
+        }
+        size_t count = min(length, BUFFER_LEN - used);
+        memcpy(buffer + used, text, count);
+        used += count;
+        text += count;
+        length -= count;
+    }
+}
+
+void HttpChunkWriter::printEscaped(const char *text) {
+    for (; *text; text++) {
+        switch (*text) {
+            case '<': print("&lt;", 4); break;
+            case '>': print("&gt;", 4); break;
+            case '&': print("&amp;", 5); break;
+            case '\'': print("&#39;", 5); break;
+            default: print(text, 1);
+        }
+    }
+}
+
+void HttpChunkWriter::printInt(long value) {
+    char number[12];
+    print(number, snprintf(number, sizeof(number), "%ld", value));
+}
+
+void HttpChunkWriter::printUnsigned(unsigned long value) {
+    char number[12];
+    print(number, snprintf(number, sizeof(number), "%lu", value));
+}
+
+void HttpChunkWriter::printTemperature(heatpumpTemperature temperature) {
+    char number[8];
+    print(number, temperature.toString(number, sizeof(number)));
+}
+
+void HttpChunkWriter::printBool(bool value) {
+    print(value ? "true" : "false");
+}
+
+void HttpChunkWriter::end() {
+    flush();
+    sendAll(socket, "0\r\n\r\n", 5);
+}
+
+void HttpChunkWriter::flush() {
+    if (used == 0) return;
+
+    char size[8];
+    sendAll(socket, size, snprintf(size, sizeof(size), "%x\r\n", (unsigned) used));
+    sendAll(socket, buffer, used);
+    sendAll(socket, "\r\n", 2);
+    used = 0;
+}
+
+// HttpEndpoint ////////////////////////////////////////////////////////////////
+
+HttpEndpoint::HttpEndpoint(HeatPump &heatPump) : heatPump(heatPump) {
+}
+
+void HttpEndpoint::setMetrics(MetricsExporter *metrics) {
+    this->metrics = metrics;
+}
+
+void HttpEndpoint::setHistory(HistoryStore *history) {
+    this->history = history;
+}
+
+void HttpEndpoint::setSchedule(WeeklySchedule *schedule) {
+    this->schedule = schedule;
+}
+
+void HttpEndpoint::setSettingsWriter(std::function<bool(const heatpumpSettingsChange &)> writer) {
+    settingsWriter = writer;
+}
+
+bool HttpEndpoint::begin(uint16_t port) {
+    listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenSocket < 0) return false;
+
+    int reuse = 1;
+    setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+
+    if (bind(listenSocket, (struct sockaddr *) &address, sizeof(address)) < 0 ||
+        listen(listenSocket, CONNECTIONS) < 0) {
+        close(listenSocket);
+        listenSocket = -1;
+        return false;
+    }
+
+    // poll() must never block the caller
+    fcntl(listenSocket, F_SETFL, fcntl(listenSocket, F_GETFL, 0) | O_NONBLOCK);
+    return true;
+}
+
+void HttpEndpoint::poll() {
+    if (listenSocket < 0) return;
+
+    for (Connection &connection : connections) {
+        if (connection.socket < 0) {
+            connection.socket = accept(listenSocket, nullptr, nullptr);
+            if (connection.socket < 0) break;
+            fcntl(connection.socket, F_SETFL, fcntl(connection.socket, F_GETFL, 0) | O_NONBLOCK);
+            connection.accepted = millis();
+            connection.length = 0;
+            connection.body = nullptr;
+            connection.contentLength = 0;
+        }
+    }
+    for (Connection &connection : connections) {
+        if (connection.socket < 0) continue;
+        // the rest on a later poll()
+        const bool complete = receive(connection);
+        if (complete || millis() - connection.accepted >= CLIENT_TIMEOUT_MS) serve(connection, complete);
+    }
+}
+
+bool HttpEndpoint::receive(Connection &connection) {
+    // read until the end of the headers, then whatever body fits
+    char *request = connection.request;
+    while (connection.length < REQUEST_LEN - 1) {
+        const int count = recv(connection.socket, request + connection.length, REQUEST_LEN - 1 - connection.length, 0);
+        if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return false;
+        if (count <= 0) return true; // closed, or failed
+        connection.length += count;
+        request[connection.length] = 0;
+
+        if (!connection.body) {
+            char *headersEnd = strstr(request, "\r\n\r\n");
+            if (!headersEnd) continue;
+            connection.body = headersEnd + 4;
+            headersEnd[2] = 0;
+
+            const char *header = strcasestr(request, "\r\nContent-Length:");
+            if (header) connection.contentLength = strtol(header + 17, nullptr, 10);
+        }
+        if (request + connection.length - connection.body >= connection.contentLength) return true;
+    }
+    return true;
+}
+
+void HttpEndpoint::serve(Connection &connection, bool complete) {
+    // the response blocks, for CLIENT_TIMEOUT_MS at most
+    fcntl(connection.socket, F_SETFL, fcntl(connection.socket, F_GETFL, 0) & ~O_NONBLOCK);
+    responseStart = millis();
+    responseTimeout = CLIENT_TIMEOUT_MS;
+    if (connection.body) {
+        handleClient(connection);
+    } else {
+        sendEmpty(connection.socket, complete ? "400 Bad Request" : "408 Request Timeout");
+    }
+    responseTimeout = 0;
+    close(connection.socket);
+    connection.socket = -1;
+}
+
+/**
+ * URL-decodes a form value in place.
+ */
+static void urlDecode(char *value) {
+    char *out = value;
+    for (char *in = value; *in; in++) {
+        if (*in == '+') {
+            *out++ = ' ';
+        } else if (*in == '%' && isxdigit((unsigned char) in[1]) && isxdigit((unsigned char) in[2])) {
+            char hex[3] = {in[1], in[2], 0};
+            *out++ = (char) strtol(hex, nullptr, 16);
+            in += 2;
+        } else {
+            *out++ = *in;
+        }
+    }
+    *out = 0;
+}
+
+void HttpEndpoint::handleClient(Connection &connection) {
+    HEATPUMP_TRACE_SPAN("HttpEndpoint::handleClient");
+    const int client = connection.socket;
+    char *request = connection.request;
+    char *body = connection.body;
+    const size_t length = connection.length;
+    const long contentLength = connection.contentLength;
+
+    // request line: METHOD /path?query HTTP/1.1
+    char *method = request;
+    char *path = strchr(method, ' ');
+    if (!path) {
+        sendEmpty(client, "400 Bad Request");
+        return;
+    }
+    *path++ = 0;
+    char *pathEnd = strpbrk(path, " \r");
+    if (pathEnd) *pathEnd = 0;
+    char *query = strchr(path, '?');
+    if (query) *query++ = 0;
+
+    const bool isGet = strcmp(method, "GET") == 0;
+    const bool isWrite = strcmp(method, "POST") == 0 || strcmp(method, "PUT") == 0;
+    const bool isSchedule = strcmp(path, "/schedule") == 0 && schedule;
+
+    // writes need a settings read first, createPacket() diffs against the current settings
+    if (isWrite && !isSchedule && (!heatPump.isConnected() || !heatPump.getSettings().power)) {
+        sendEmpty(client, "503 Service Unavailable");
+        return;
+    }
+    if (isWrite && !isSchedule && heatPump.isListenOnly()) {
+        sendEmpty(client, "403 Forbidden"); // another master owns the settings
+        return;
+    }
+
+    if (strcmp(path, "/") == 0) {
+        if (isGet) {
+            sendStatus(client, "200 OK", "text/html", true);
+            HttpChunkWriter out(client);
+            renderHtml(out);
+            out.end();
+        } else if (isWrite) {
+            heatpumpSettingsChange change = {};
+            if (!parseFields(body, change)) {
+                sendEmpty(client, "400 Bad Request");
+            } else if (change.fields && !write(change)) {
+                sendEmpty(client, "503 Service Unavailable");
+            } else {
+                sendEmpty(client, "303 See Other", "/");
+            }
+        } else {
+            sendEmpty(client, "405 Method Not Allowed");
+        }
+    } else if (strcmp(path, "/state") == 0) {
+        if (isWrite) {
+            heatpumpSettingsChange change = {};
+            if (!parseFields(query, change) || !parseFields(body, change) || !change.fields) {
+                sendEmpty(client, "400 Bad Request");
+                return;
+            }
+            if (!write(change)) {
+                sendEmpty(client, "503 Service Unavailable");
+                return;
+            }
+        } else if (!isGet) {
+            sendEmpty(client, "405 Method Not Allowed");
+            return;
+        }
+        sendStatus(client, isGet ? "200 OK" : "202 Accepted", "application/json", true);
+        HttpChunkWriter out(client);
+        renderJson(out);
+        out.end();
+    } else if (strcmp(path, "/metrics") == 0 && metrics) {
+        if (!isGet) {
+            sendEmpty(client, "405 Method Not Allowed");
+            return;
+        }
+        sendStatus(client, "200 OK", "text/plain; version=0.0.4", true);
+        HttpChunkWriter out(client);
+        metrics->render(out);
+        out.end();
+    } else if (strcmp(path, "/history") == 0 && history) {
+        if (!isGet) {
+            sendEmpty(client, "405 Method Not Allowed");
+            return;
+        }
+        serveHistory(client, query);
+    } else if (isSchedule) {
+        if (isWrite) {
+            // the table is replaced as a whole, so a body cut off at REQUEST_LEN isn't applied
+            if (request + length - body < contentLength) {
+                sendEmpty(client, "413 Payload Too Large");
+                return;
+            }
+            if (!schedule->parse(body)) {
+                sendEmpty(client, "400 Bad Request");
+                return;
+            }
+        } else if (!isGet) {
+            sendEmpty(client, "405 Method Not Allowed");
+            return;
+        }
+        sendStatus(client, "200 OK", "text/plain", true);
+        HttpChunkWriter out(client);
+        renderSchedule(out);
+        out.end();
+#ifdef HEATPUMP_TRACE
+    } else if (strcmp(path, "/trace") == 0) {
+        if (!isGet) {
+            sendEmpty(client, "405 Method Not Allowed");
+            return;
+        }
+        sendStatus(client, "200 OK", "application/json", true);
+        HttpChunkWriter out(client);
+        heatpumpTrace::write([&out](const char *text, size_t length) { out.print(text, length); });
+        out.end();
+#endif
+    } else {
+        sendEmpty(client, "404 Not Found");
+    }
+}
+
+bool HttpEndpoint::parseFields(char *fields, heatpumpSettingsChange &change) {
+    char *save = nullptr;
+    for (char *field = fields ? strtok_r(fields, "&", &save) : nullptr; field; field = strtok_r(nullptr, "&", &save)) {
+        char *value = strchr(field, '=');
+        if (!value) continue;
+        *value++ = 0;
+        urlDecode(value);
+        if (HeatPump::parseSettingsField(field, value, change) == HEATPUMP_FIELD_INVALID) return false;
+    }
+    return true;
+}
+
+bool HttpEndpoint::write(const heatpumpSettingsChange &change) {
+    if (settingsWriter) return settingsWriter(change);
+    heatPump.setSettings(change);
+    return true;
+}
+
+void HttpEndpoint::serveHistory(int client, char *query) {
+    HistoryStore::Tier tier = HistoryStore::MINUTES;
+    const uint32_t now = (uint32_t) time(nullptr);
+    uint32_t from = 0;
+    uint32_t to = now;
+    bool fromSet = false;
+    char *save = nullptr;
+    for (char *field = query ? strtok_r(query, "&", &save) : nullptr; field; field = strtok_r(nullptr, "&", &save)) {
+        char *value = strchr(field, '=');
+        if (!value) continue;
+        *value++ = 0;
+        if (strcasecmp(field, "tier") == 0 && !HistoryStore::parseTier(value, tier)) {
+            sendEmpty(client, "400 Bad Request");
+            return;
+        } else if (strcasecmp(field, "from") == 0) {
+            from = (uint32_t) strtoul(value, nullptr, 10);
+            fromSet = true;
+        } else if (strcasecmp(field, "to") == 0) {
+            to = (uint32_t) strtoul(value, nullptr, 10);
+        }
+    }
+    if (!fromSet) from = now - HistoryStore::TIER_RETENTION[tier];
+
+    sendStatus(client, "200 OK", "text/csv", true);
+    HttpChunkWriter out(client);
+    out.print("time,roomTemperature,roomTemperatureMin,roomTemperatureMax,setpoint,operatingPercent,"
+              "compressorFrequency,compressorFrequencyMax\n");
+    history->query(tier, from, to, [&out](const HistoryPoint &point) {
+        out.printUnsigned(point.time);
+        out.print(",", 1);
+        out.printTemperature(point.roomTemperature);
+        out.print(",", 1);
+        out.printTemperature(point.roomTemperatureMin);
+        out.print(",", 1);
+        out.printTemperature(point.roomTemperatureMax);
+        out.print(",", 1);
+        out.printTemperature(point.setpoint);
+        out.print(",", 1);
+        out.printUnsigned(point.operatingPercent);
+        out.print(",", 1);
+        out.printUnsigned(point.compressorFrequency);
+        out.print(",", 1);
+        out.printUnsigned(point.compressorFrequencyMax);
+        out.print("\n", 1);
+        return true;
+    });
+    out.end();
+}
+
+void HttpEndpoint::sendStatus(int client, const char *status, const char *contentType, bool chunked) {
+    char head[160];
+    int length = snprintf(head, sizeof(head), "HTTP/1.1 %s\r\nContent-Type: %s\r\n%sConnection: close\r\n\r\n",
+                          status, contentType, chunked ? "Transfer-Encoding: chunked\r\n" : "");
+    sendAll(client, head, length);
+}
+
+void HttpEndpoint::sendEmpty(int client, const char *status, const char *location) {
+    char head[160];
+    int length = snprintf(head, sizeof(head), "HTTP/1.1 %s\r\n%s%s%sContent-Length: 0\r\nConnection: close\r\n\r\n",
+                          status, location ? "Location: " : "", location ? location : "", location ? "\r\n" : "");
+    sendAll(client, head, length);
+}
+
+void HttpEndpoint::renderSchedule(HttpChunkWriter &out) {
+    char line[32];
+    for (size_t i = 0; i < schedule->size(); i++) {
+        const int length = schedule->entry(i).toString(line, sizeof(line));
+        out.print(line, (size_t) length);
+        out.print("\n");
+    }
+}
+
+void HttpEndpoint::renderJson(HttpChunkWriter &out) {
+    const heatpumpSettings settings = heatPump.getSettings();
+    const heatpumpStatus status = heatPump.getStatus();
+
+    out.print("{\"connected\":");
+    out.printBool(heatPump.isConnected());
+    out.print(",\"link\":\"");
+    out.print(heatpumpLinkStateName(heatPump.getLinkState()));
+    out.print("\",\"power\":\"");
+    out.print(settings.power ? settings.power : "");
+    out.print("\",\"mode\":\"");
+    out.print(settings.mode ? settings.mode : "");
+    out.print("\",\"temperature\":");
+    out.printTemperature(settings.temperature);
+    out.print(",\"fan\":\"");
+    out.print(settings.fan ? settings.fan : "");
+    out.print("\",\"vane\":\"");
+    out.print(settings.vane ? settings.vane : "");
+    out.print("\",\"wideVane\":\"");
+    out.print(settings.wideVane ? settings.wideVane : "");
+    out.print("\",\"iSee\":");
+    out.printBool(settings.iSee);
+    out.print(",\"roomTemperature\":");
+    out.printTemperature(status.roomTemperature);
+    out.print(",\"operating\":");
+    out.printBool(status.operating);
+    out.print(",\"compressorFrequency\":");
+    out.printInt(status.compressorFrequency);
+    out.print("}");
+}
+
+static void renderSelect(HttpChunkWriter &out, const char *label, const char *name,
+                         const char *values[], int len, const char *selected) {
+    out.print(HTML_ROW_START);
+    out.print(label);
+    out.print(HTML_SELECT_START);
+    out.print(name);
+    out.print("'>");
+    for (int i = 0; i < len; i++) {
+        out.print("<option value='");
+        out.printEscaped(values[i]);
+        out.print(selected && strcmp(values[i], selected) == 0 ? "' selected>" : "'>");
+        out.printEscaped(values[i]);
+        out.print("</option>");
+    }
+    out.print(HTML_SELECT_END);
+}
+
+void HttpEndpoint::renderHtml(HttpChunkWriter &out) {
+    const heatpumpSettings settings = heatPump.getSettings();
+
+    out.print(HTML_HEAD);
+    out.printTemperature(heatPump.getStatus().roomTemperature);
+    out.print(HTML_FORM_START);
+    renderSelect(out, "Power", "POWER", POWER_VALUES, 2, settings.power);
+    renderSelect(out, "Mode", "MODE", MODE_VALUES, 5, settings.mode);
+    out.print(HTML_TEMP_ROW);
+    out.printTemperature(settings.temperature);
+    out.print(HTML_TEMP_ROW_END);
+    renderSelect(out, "Fan", "FAN", FAN_VALUES, 6, settings.fan);
+    renderSelect(out, "Vane", "VANE", VANE_VALUES, 7, settings.vane);
+    renderSelect(out, "WideVane", "WIDEVANE", WIDEVANE_VALUES, 7, settings.wideVane);
+    out.print(HTML_FOOT);
+}
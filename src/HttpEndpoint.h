@@ -0,0 +1,110 @@
+#pragma once
+#include <HeatPump.h>
+#include <functional>
+
+class MetricsExporter;
+class HistoryStore;
+class WeeklySchedule;
+
+/**
+ * Buffers small writes and sends them to a socket as HTTP/1.1 chunks, so responses are
+ * streamed straight from the template fragments without building the page in memory.
+ */
+class HttpChunkWriter {
+public:
+    explicit HttpChunkWriter(int socket);
+
+    void print(const char *text);
+    void print(const char *text, size_t length);
+    void printEscaped(const char *text); // HTML-escapes <, >, & and '
+    void printInt(long value);
+    void printUnsigned(unsigned long value);
+    void printTemperature(heatpumpTemperature temperature); // "21.5"
+    void printBool(bool value);
+
+    // flushes the buffer and sends the terminating zero-length chunk
+    void end();
+
+private:
+    static const size_t BUFFER_LEN = 256;
+
+    int socket;
+    char buffer[BUFFER_LEN];
+    size_t used = 0;
+
+    void flush();
+};
+
+/**
+ * Local HTTP endpoint for the heat pump.
+ *
+ *   GET  /          HTML view with a settings form
+ *   POST /          queue form fields, then redirect back to /
+ *   GET  /state     JSON state
+ *   POST /state     queue form/query fields (PUT is accepted as well), 202 with the JSON state as it was
+ *   GET  /metrics   Prometheus metrics, if a MetricsExporter is set
+ *   GET  /history   CSV from the HistoryStore, if one is set: ?tier=seconds|minutes|hours&from=&to=
+ *                   with from/to in Unix seconds, by default the tier's whole retention
+ *   GET  /trace     recorded spans as Chrome trace JSON, in builds with -D HEATPUMP_TRACE
+ *   GET  /schedule  the WeeklySchedule, if one is set, as text with one transition per line
+ *   PUT  /schedule  replaces it with the text in the body (POST is accepted as well), 400 if it doesn't parse
+ *
+ * Fields are POWER, MODE, TEMP, FAN, VANE and WIDEVANE, see HeatPump::parseSettingsField(). A write with a
+ * value the unit doesn't take gets 400 and changes nothing. Settings writes get 403 when the heat pump is
+ * listen-only, and 503 when the settings writer turns them down. They are handed to the writer rather than
+ * sent from poll(), which would wait for the unit's ack.
+ * Requests are served from poll() using fixed buffers; nothing is allocated per request. poll() never waits
+ * for a request: it takes up to CONNECTIONS at once, reads what has arrived on each and comes back for the
+ * rest on a later call, up to CLIENT_TIMEOUT_MS after the accept (then 408), so a slow client holds up
+ * neither the caller nor the other clients. A response is sent within CLIENT_TIMEOUT_MS in total, however
+ * slowly the client reads it.
+ */
+class HttpEndpoint {
+public:
+    explicit HttpEndpoint(HeatPump &heatPump);
+
+    bool begin(uint16_t port);
+    void setMetrics(MetricsExporter *metrics);
+    void setHistory(HistoryStore *history);
+    void setSchedule(WeeklySchedule *schedule);
+    // queues a settings write for the heat pump, false if it doesn't take writes now. Without one, writes
+    // only go into the wanted settings, for the next sync() with autoUpdate.
+    void setSettingsWriter(std::function<bool(const heatpumpSettingsChange &)> writer);
+    void poll();
+
+private:
+    static const size_t REQUEST_LEN = 768;
+    static const int CONNECTIONS = 4;
+    static const unsigned long CLIENT_TIMEOUT_MS = 500;
+
+    // a client whose request is coming in
+    struct Connection {
+        int socket = -1;
+        unsigned long accepted = 0;
+        char request[REQUEST_LEN];
+        size_t length = 0;
+        char *body = nullptr; // after the headers, once they are in
+        long contentLength = 0;
+    };
+
+    HeatPump &heatPump;
+    MetricsExporter *metrics = nullptr;
+    HistoryStore *history = nullptr;
+    WeeklySchedule *schedule = nullptr;
+    std::function<bool(const heatpumpSettingsChange &)> settingsWriter;
+    int listenSocket = -1;
+    Connection connections[CONNECTIONS];
+
+    bool receive(Connection &connection);              // true once complete, or no more of it can come
+    void serve(Connection &connection, bool complete); // sends the response, 408 if incomplete, and closes
+    void handleClient(Connection &connection);
+    bool parseFields(char *fields, heatpumpSettingsChange &change); // false if a value is invalid
+    bool write(const heatpumpSettingsChange &change);
+
+    void sendStatus(int client, const char *status, const char *contentType, bool chunked);
+    void sendEmpty(int client, const char *status, const char *location = nullptr);
+    void renderJson(HttpChunkWriter &out);
+    void renderHtml(HttpChunkWriter &out);
+    void serveHistory(int client, char *query);
+    void renderSchedule(HttpChunkWriter &out);
+};
@@ -0,0 +1,357 @@
+#include "Metrics.h"
+#if defined(ESP32)
+#include <esp_timer.h>
+#endif
+
+static int histogramBucket(unsigned long value) {
+    if (value < 4) return (int) value;
+    const uint32_t clamped = value >= (1UL << 17) ? (1UL << 17) - 1 : (uint32_t) value;
+    const int power = 31 - __builtin_clz(clamped); // 2..16
+    return (power - 1) * 4 + (int) ((clamped >> (power - 2)) & 3);
+}
+
+static unsigned long histogramUpperBound(int bucket) {
+    if (bucket < 4) return (unsigned long) bucket;
+    const int power = bucket / 4 + 1;
+    return ((unsigned long) (5 + bucket % 4) << (power - 2)) - 1;
+}
+
+void LatencyHistogram::record(unsigned long value) {
+    counts[histogramBucket(value)]++;
+    total++;
+    valueSum += value;
+}
+
+unsigned long LatencyHistogram::count() const {
+    return total;
+}
+
+unsigned long long LatencyHistogram::sum() const {
+    return valueSum;
+}
+
+unsigned long LatencyHistogram::percentile(float share) const {
+    if (!total) return 0;
+    const unsigned long rank = max(1UL, (unsigned long) ceilf(share * total));
+    unsigned long seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += counts[i];
+        if (seen >= rank) return histogramUpperBound(i);
+    }
+    return histogramUpperBound(BUCKETS - 1);
+}
+
+MetricsExporter::MetricsExporter(HeatPump &heatPump) : heatPump(heatPump) {
+}
+
+void MetricsExporter::setClock(heatpumpClock *clock) {
+    this->clock = clock;
+}
+
+void MetricsExporter::setPollTask(TaskHandle_t task) {
+    pollTask = task;
+}
+
+void MetricsExporter::countHomeKitUpdate() {
+    homeKitUpdates++;
+}
+
+void MetricsExporter::countScheduleTransition(bool applied) {
+    if (applied) {
+        scheduleApplied++;
+    } else {
+        scheduleRejected++;
+    }
+}
+
+void MetricsExporter::markPoll() {
+    lastPoll = clock->millis();
+}
+
+void MetricsExporter::setCommandLimits(const CommandLatencyLimits &limits) {
+    commandLimits = limits;
+}
+
+unsigned long MetricsExporter::framesSent() const {
+    const heatpumpCounters &counters = heatPump.getCounters();
+    return counters.sentConnect + counters.sentSet + counters.sentInfo;
+}
+
+void MetricsExporter::commandWritten() {
+    if (commandActive) return;
+    const heatpumpCounters &counters = heatPump.getCounters();
+    commandActive = true;
+    commandStart = clock->millis();
+    framesAtStart = framesSent();
+    setsAtStart = counters.sentSet;
+    acksAtStart = counters.receivedSetAck;
+    setFrameSeen = false;
+    setAckSeen = false;
+}
+
+void MetricsExporter::commandApplied() {
+    if (!commandActive) return;
+    const heatpumpCounters &counters = heatPump.getCounters();
+    if (!setFrameSeen && counters.sentSet != setsAtStart) {
+        setFrameSeen = true;
+        setFrameLatency.record(counters.lastSetSentMs - commandStart);
+    }
+    if (!setAckSeen && counters.receivedSetAck != acksAtStart) {
+        setAckSeen = true;
+        setAckLatency.record(counters.lastSetAckMs - commandStart);
+    }
+}
+
+void MetricsExporter::commandConfirmed() {
+    if (!commandActive) return;
+    commandApplied();
+    commandActive = false;
+    confirmedLatency.record(clock->millis() - commandStart);
+    commandFrames.record(framesSent() - framesAtStart);
+}
+
+static void header(HttpChunkWriter &out, const char *name, const char *type, const char *help) {
+    out.print("# HELP ");
+    out.print(name);
+    out.print(" ");
+    out.print(help);
+    out.print("\n# TYPE ");
+    out.print(name);
+    out.print(" ");
+    out.print(type);
+    out.print("\n");
+}
+
+static void sample(HttpChunkWriter &out, const char *name, const char *labels, unsigned long value) {
+    out.print(name);
+    if (labels) {
+        out.print("{");
+        out.print(labels);
+        out.print("}");
+    }
+    out.print(" ");
+    out.printUnsigned(value);
+    out.print("\n");
+}
+
+static void single(HttpChunkWriter &out, const char *name, const char *type, const char *help, unsigned long value) {
+    header(out, name, type, help);
+    sample(out, name, nullptr, value);
+}
+
+static void seconds(HttpChunkWriter &out, const char *name, const char *labels, uint64_t ms) {
+    char value[28];
+    out.print(name);
+    if (labels) {
+        out.print("{");
+        out.print(labels);
+        out.print("}");
+    }
+    out.print(" ");
+    out.print(value, snprintf(value, sizeof(value), "%llu.%03u\n", (unsigned long long) (ms / 1000),
+                              (unsigned) (ms % 1000)));
+}
+
+static void gauge(HttpChunkWriter &out, const char *name, const char *labels, float value) {
+    char text[16];
+    out.print(name);
+    if (labels) {
+        out.print("{");
+        out.print(labels);
+        out.print("}");
+    }
+    out.print(" ");
+    out.print(text, snprintf(text, sizeof(text), "%.3f\n", value));
+}
+
+// window="5m", "1h", "24h"
+static void windowLabel(char *label, size_t size, unsigned long ms) {
+    if (ms % 3600000 == 0) {
+        snprintf(label, size, "window=\"%luh\"", ms / 3600000);
+    } else if (ms % 60000 == 0) {
+        snprintf(label, size, "window=\"%lum\"", ms / 60000);
+    } else {
+        snprintf(label, size, "window=\"%lus\"", ms / 1000);
+    }
+}
+
+void MetricsExporter::renderCommands(HttpChunkWriter &out) {
+    static const float QUANTILES[] = {0.5f, 0.95f, 0.99f};
+    static const char *const QUANTILE_NAMES[] = {"0.5", "0.95", "0.99"};
+    const struct {
+        const char *stage;
+        const LatencyHistogram &histogram;
+        unsigned long limit;
+    } stages[] = {
+        {"set_frame", setFrameLatency, commandLimits.setFrameMs},
+        {"set_ack", setAckLatency, commandLimits.setAckMs},
+        {"confirmed", confirmedLatency, commandLimits.confirmedMs},
+    };
+    char labels[48];
+
+    header(out, "controller_command_latency_seconds", "summary",
+           "Time from a HomeKit write to the set frame on the wire, its ack and the settings read back matching.");
+    for (const auto &stage : stages) {
+        for (int q = 0; q < 3; q++) {
+            snprintf(labels, sizeof(labels), "stage=\"%s\",quantile=\"%s\"", stage.stage, QUANTILE_NAMES[q]);
+            seconds(out, "controller_command_latency_seconds", labels, stage.histogram.percentile(QUANTILES[q]));
+        }
+        snprintf(labels, sizeof(labels), "stage=\"%s\"", stage.stage);
+        seconds(out, "controller_command_latency_seconds_sum", labels, (unsigned long) stage.histogram.sum());
+        sample(out, "controller_command_latency_seconds_count", labels, stage.histogram.count());
+    }
+
+    header(out, "controller_command_frames", "summary", "Frames sent from a HomeKit write until it was confirmed.");
+    for (int q = 0; q < 3; q++) {
+        snprintf(labels, sizeof(labels), "quantile=\"%s\"", QUANTILE_NAMES[q]);
+        sample(out, "controller_command_frames", labels, commandFrames.percentile(QUANTILES[q]));
+    }
+    sample(out, "controller_command_frames_sum", nullptr, (unsigned long) commandFrames.sum());
+    sample(out, "controller_command_frames_count", nullptr, commandFrames.count());
+
+    header(out, "controller_command_p95_over_limit", "gauge", "1 if a stage's p95 since boot is over its configured limit.");
+    for (const auto &stage : stages) {
+        snprintf(labels, sizeof(labels), "stage=\"%s\"", stage.stage);
+        sample(out, "controller_command_p95_over_limit", labels,
+               stage.limit && stage.histogram.percentile(0.95f) > stage.limit);
+    }
+    sample(out, "controller_command_p95_over_limit", "stage=\"frames\"",
+           commandLimits.frames && commandFrames.percentile(0.95f) > commandLimits.frames);
+}
+
+void MetricsExporter::renderStatistics(HttpChunkWriter &out, const heatpumpStatistics &statistics, uint32_t now) {
+    static const struct {
+        const char *name;
+        const char *help;
+    } gauges[] = {
+        {"heatpump_room_temperature_min_celsius", "Lowest room temperature, by window."},
+        {"heatpump_room_temperature_max_celsius", "Highest room temperature, by window."},
+        {"heatpump_room_temperature_mean_celsius", "Time weighted mean room temperature, by window."},
+        {"heatpump_compressor_duty_cycle_ratio", "Share of the time the compressor was operating, by window."},
+        {"heatpump_compressor_frequency_mean_hertz", "Time weighted mean compressor frequency, by window."},
+    };
+    heatpumpWindowStatistics windows[heatpumpStatistics::WINDOWS];
+    char labels[heatpumpStatistics::WINDOWS][32];
+    for (int i = 0; i < heatpumpStatistics::WINDOWS; i++) {
+        windows[i] = statistics.get(i);
+        windowLabel(labels[i], sizeof(labels[i]), statistics.windowLength(i));
+    }
+
+    for (size_t g = 0; g < sizeof(gauges) / sizeof(gauges[0]); g++) {
+        header(out, gauges[g].name, "gauge", gauges[g].help);
+        for (int i = 0; i < heatpumpStatistics::WINDOWS; i++) {
+            const heatpumpWindowStatistics &window = windows[i];
+            if (!window.valid) continue;
+            const float values[] = {window.roomTemperatureMin.toCelsius(), window.roomTemperatureMax.toCelsius(),
+                                    window.roomTemperatureMean, window.dutyCycle, window.compressorFrequencyMean};
+            gauge(out, gauges[g].name, labels[i], values[g]);
+        }
+    }
+
+    unsigned long modeAge;
+    if (statistics.timeSinceModeChange(now, modeAge)) {
+        header(out, "heatpump_mode_age_seconds", "gauge", "Time since the power or mode setting changed.");
+        seconds(out, "heatpump_mode_age_seconds", nullptr, modeAge);
+    }
+}
+
+void MetricsExporter::renderRuntime(HttpChunkWriter &out, const heatpumpRuntime &runtime) {
+    static const char *const MODES[5] = {"heat", "dry", "cool", "fan", "auto"}; // HeatPump::MODE_MAP order
+    const heatpumpRuntimeTotals &totals = runtime.totals();
+
+    header(out, "heatpump_accounted_seconds_total", "counter", "Time covered by status replies.");
+    seconds(out, "heatpump_accounted_seconds_total", nullptr, totals.accountedMs);
+    header(out, "heatpump_operating_seconds_total", "counter", "Time the unit reported operating.");
+    seconds(out, "heatpump_operating_seconds_total", nullptr, totals.operatingMs);
+    header(out, "heatpump_compressor_seconds_total", "counter", "Time the compressor ran, by mode setting.");
+    char labels[16];
+    for (int i = 0; i < 5; i++) {
+        snprintf(labels, sizeof(labels), "mode=\"%s\"", MODES[i]);
+        seconds(out, "heatpump_compressor_seconds_total", labels, totals.compressorModeMs[i]);
+    }
+    single(out, "heatpump_compressor_starts_total", "counter", "Compressor starts.", totals.compressorStarts);
+    single(out, "heatpump_compressor_stops_total", "counter", "Compressor stops.", totals.compressorStops);
+    if (runtime.curve().count) {
+        single(out, "heatpump_energy_estimated_watt_hours_total", "counter",
+               "Input energy estimated from the compressor frequency and the configured power curve.",
+               (unsigned long) (totals.energyWattMs / 3600000));
+    }
+}
+
+void MetricsExporter::render(HttpChunkWriter &out) {
+    const heatpumpCounters &counters = heatPump.getCounters();
+    const uint32_t now = clock->millis();
+
+    header(out, "heatpump_frames_sent_total", "counter", "CN105 frames sent, by type.");
+    sample(out, "heatpump_frames_sent_total", "type=\"connect\"", counters.sentConnect);
+    sample(out, "heatpump_frames_sent_total", "type=\"set\"", counters.sentSet);
+    sample(out, "heatpump_frames_sent_total", "type=\"info\"", counters.sentInfo);
+
+    header(out, "heatpump_frames_received_total", "counter", "Valid CN105 frames received, by type.");
+    sample(out, "heatpump_frames_received_total", "type=\"connect_ack\"", counters.receivedConnectAck);
+    sample(out, "heatpump_frames_received_total", "type=\"set_ack\"", counters.receivedSetAck);
+    sample(out, "heatpump_frames_received_total", "type=\"settings\"", counters.receivedSettings);
+    sample(out, "heatpump_frames_received_total", "type=\"room_temp\"", counters.receivedRoomTemp);
+    sample(out, "heatpump_frames_received_total", "type=\"timers\"", counters.receivedTimers);
+    sample(out, "heatpump_frames_received_total", "type=\"status\"", counters.receivedStatus);
+    sample(out, "heatpump_frames_received_total", "type=\"functions\"", counters.receivedFunctions);
+    sample(out, "heatpump_frames_received_total", "type=\"other\"", counters.receivedOther);
+
+    if (heatPump.isListenOnly()) {
+        header(out, "heatpump_frames_heard_total", "counter", "Requests from another master, by type (listen-only).");
+        sample(out, "heatpump_frames_heard_total", "type=\"connect\"", counters.heardConnect);
+        sample(out, "heatpump_frames_heard_total", "type=\"set\"", counters.heardSet);
+        sample(out, "heatpump_frames_heard_total", "type=\"info\"", counters.heardInfo);
+    }
+
+    single(out, "heatpump_checksum_failures_total", "counter", "Frames dropped for a bad checksum.",
+           counters.checksumFailures);
+    single(out, "heatpump_response_timeouts_total", "counter", "Requests that got no reply in time.",
+           counters.responseTimeouts);
+    single(out, "heatpump_connects_total", "counter", "Connect handshakes started.", counters.connects);
+    single(out, "heatpump_connected", "gauge", "1 if the heat pump link is connected.", heatPump.isConnected());
+    single(out, "heatpump_link_state", "gauge", "Link health: 0 down, 1 degraded, 2 healthy.", heatPump.getLinkState());
+
+    header(out, "heatpump_set_ack_latency_seconds", "summary", "Time from a set frame to its 0x61 ack.");
+    seconds(out, "heatpump_set_ack_latency_seconds_sum", nullptr, counters.setAckLatencySumMs);
+    sample(out, "heatpump_set_ack_latency_seconds_count", nullptr, counters.setAckCount);
+    header(out, "heatpump_set_ack_latency_max_seconds", "gauge", "Slowest set frame ack since boot.");
+    seconds(out, "heatpump_set_ack_latency_max_seconds", nullptr, counters.setAckLatencyMaxMs);
+
+    header(out, "heatpump_frame_gap_seconds", "gauge", "Current adaptive gap between info requests.");
+    seconds(out, "heatpump_frame_gap_seconds", nullptr, heatPump.getFrameGap());
+    header(out, "heatpump_reply_latency_seconds", "gauge", "Smoothed time from a request to its reply arriving.");
+    seconds(out, "heatpump_reply_latency_seconds", nullptr, heatPump.getReplyLatency());
+    header(out, "heatpump_last_frame_age_seconds", "gauge", "Time since the last valid frame.");
+    seconds(out, "heatpump_last_frame_age_seconds", nullptr, counters.lastRecvMs ? now - counters.lastRecvMs : now);
+    header(out, "controller_poll_age_seconds", "gauge", "Time since the controller last read the settings.");
+    seconds(out, "controller_poll_age_seconds", nullptr, now - lastPoll);
+
+    if (const heatpumpStatistics *statistics = heatPump.getStatistics()) {
+        renderStatistics(out, *statistics, now);
+    }
+    if (const heatpumpRuntime *runtime = heatPump.getRuntime()) {
+        renderRuntime(out, *runtime);
+    }
+
+    renderCommands(out);
+    single(out, "homekit_updates_total", "counter", "HomeKit characteristic write callbacks.", homeKitUpdates);
+    header(out, "schedule_transitions_total", "counter",
+           "Weekly schedule transitions written to HomeKit, or rejected while the heat pump took no writes.");
+    sample(out, "schedule_transitions_total", "result=\"applied\"", scheduleApplied);
+    sample(out, "schedule_transitions_total", "result=\"rejected\"", scheduleRejected);
+
+    single(out, "esp_free_heap_bytes", "gauge", "Free heap.", ESP.getFreeHeap());
+    single(out, "esp_min_free_heap_bytes", "gauge", "Lowest free heap since boot.", ESP.getMinFreeHeap());
+    if (pollTask) {
+        header(out, "task_stack_high_water_mark_bytes", "gauge", "Least free stack seen, by task.");
+        sample(out, "task_stack_high_water_mark_bytes", "task=\"HK_poll\"", uxTaskGetStackHighWaterMark(pollTask));
+    }
+    // from the 64-bit timer, millis() wraps after 49.7 days; a gauge, as it restarts from 0 on every boot
+#if defined(ESP32)
+    const uint64_t uptimeUs = (uint64_t) esp_timer_get_time();
+#else
+    const uint64_t uptimeUs = (uint64_t) now * 1000; // the clock, virtual in the Linux harnesses
+#endif
+    single(out, "uptime_seconds", "gauge", "Time since boot.", (unsigned long) (uptimeUs / 1000000));
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <HeatPump.h>
+#include <HttpEndpoint.h>
+
+/**
+ * Fixed-size histogram for percentiles: 4 buckets per power of two, so a percentile is within ~20%.
+ * Values from 0 to 3 are exact, anything above 2^17 lands in the last bucket.
+ */
+class LatencyHistogram {
+public:
+    static const int BUCKETS = 64;
+
+    void record(unsigned long value);
+    unsigned long count() const;
+    unsigned long long sum() const;
+    unsigned long percentile(float share) const; // upper bound of the bucket holding it, 0 when empty
+
+private:
+    uint32_t counts[BUCKETS] = {};
+    unsigned long total = 0;
+    unsigned long long valueSum = 0;
+};
+
+// p95 limits of the HomeKit change stages, 0 = none
+struct CommandLatencyLimits {
+    unsigned long setFrameMs;
+    unsigned long setAckMs;
+    unsigned long confirmedMs;
+    unsigned long frames;
+};
+
+/**
+ * Prometheus text exposition of protocol and controller health, served by HttpEndpoint at /metrics.
+ * Everything is read from fixed counters and streamed out as it is rendered, including the heat pump's
+ * rolling statistics and runtime totals when it keeps them.
+ */
+class MetricsExporter {
+public:
+    explicit MetricsExporter(HeatPump &heatPump);
+
+    void setClock(heatpumpClock *clock); // defaults to the system clock, pass the heat pump's
+    void setPollTask(TaskHandle_t task);
+    void countHomeKitUpdate();
+    void countScheduleTransition(bool applied); // not applied: the heat pump didn't take writes, it is retried
+    void markPoll(); // the controller read the heat pump settings
+
+    // a HomeKit change from its first write to the heat pump matching it, see render() for the stages
+    void setCommandLimits(const CommandLatencyLimits &limits);
+    void commandWritten();   // a HomeKit write, starts the clock unless a change is already in flight
+    void commandApplied();   // after HeatPump::update(), picks up the first set frame and ack of the change
+    void commandConfirmed(); // the settings read back match
+    bool commandInFlight() const { return commandActive; }
+
+    void render(HttpChunkWriter &out);
+
+private:
+    HeatPump &heatPump;
+    heatpumpClock *clock {&heatpumpClock::system()};
+    TaskHandle_t pollTask = nullptr;
+    unsigned long homeKitUpdates = 0;
+    unsigned long scheduleApplied = 0;
+    unsigned long scheduleRejected = 0;
+    uint32_t lastPoll = 0;
+
+    CommandLatencyLimits commandLimits {};
+    bool commandActive = false;
+    uint32_t commandStart = 0;
+    unsigned long framesAtStart = 0;
+    unsigned long setsAtStart = 0;
+    unsigned long acksAtStart = 0;
+    bool setFrameSeen = false;
+    bool setAckSeen = false;
+    LatencyHistogram setFrameLatency;
+    LatencyHistogram setAckLatency;
+    LatencyHistogram confirmedLatency;
+    LatencyHistogram commandFrames;
+
+    unsigned long framesSent() const;
+    void renderCommands(HttpChunkWriter &out);
+
+    void renderStatistics(HttpChunkWriter &out, const heatpumpStatistics &statistics, uint32_t now);
+    void renderRuntime(HttpChunkWriter &out, const heatpumpRuntime &runtime);
+};
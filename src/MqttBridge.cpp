@@ -0,0 +1,200 @@
+#include "MqttBridge.h"
+#include <config.h>
+
+// topic names, indexed by Field
+static const char *FIELD_NAMES[] = {
+        "connected",
+        "link",
+        "power",
+        "mode",
+        "temperature",
+        "fan",
+        "vane",
+        "wideVane",
+        "roomTemperature",
+        "operating",
+        "compressorFrequency"
+};
+
+MqttBridge::MqttBridge(HeatPump &heatPump, Client &client) : heatPump(heatPump), mqtt(client) {
+}
+
+void MqttBridge::begin(const char *server, uint16_t port, const char *topic) {
+    this->topic = topic;
+    snprintf(willTopic, sizeof(willTopic), "%s/online", topic);
+    mqtt.setServer(server, port);
+    mqtt.setBufferSize(384);
+    mqtt.setCallback([this](char *commandTopic, uint8_t *payload, unsigned int length) {
+        handleCommand(commandTopic, payload, length);
+    });
+    lastReconnect = millis() - MQTT_RECONNECT_INTERVAL_MS;
+}
+
+void MqttBridge::poll() {
+    if (!topic) return;
+
+    queue(FIELD_CONNECTED, heatPump.isConnected() ? "true" : "false");
+    queue(FIELD_LINK, heatpumpLinkStateName(heatPump.getLinkState()));
+    const unsigned long replies = heatPump.getCounters().receivedStatus;
+    if (replies != statusReplies) {
+        statusReplies = replies;
+        statusChanged(heatPump.getStatus()); // e.g. the compressor frequency, which doesn't fire the callback
+    }
+
+    switch (connectState.load()) {
+        case CONNECT_RUNNING:
+            return;
+        case CONNECT_DONE:
+            connectState = CONNECT_IDLE;
+            connected();
+            break;
+        case CONNECT_FAILED:
+            connectState = CONNECT_IDLE;
+            break;
+    }
+    if (!mqtt.connected()) {
+        if (millis() - lastReconnect < MQTT_RECONNECT_INTERVAL_MS) return;
+        lastReconnect = millis();
+        connectState = CONNECT_RUNNING;
+        if (connectTask) {
+            xTaskNotifyGive(connectTask);
+            return;
+        }
+        connect();
+        if (connectState.exchange(CONNECT_IDLE) != CONNECT_DONE) return;
+        connected();
+    }
+    mqtt.loop();
+
+    publishPending();
+
+    if (statePending || millis() - lastState >= MQTT_STATE_INTERVAL_MS) {
+        statePending = !publishState();
+        lastState = millis();
+    }
+}
+
+void MqttBridge::setConnectTask(TaskHandle_t task) {
+    connectTask = task;
+}
+
+void MqttBridge::setSettingsWriter(std::function<bool(const heatpumpSettingsChange &)> writer) {
+    settingsWriter = writer;
+}
+
+void MqttBridge::connect() {
+    if (connectState != CONNECT_RUNNING) return; // poll() didn't ask for it
+    const bool ok = mqtt.connect(MQTT_CLIENT_ID, MQTT_USER, MQTT_PASSWORD, willTopic, 0, true, "false");
+    connectState = ok ? CONNECT_DONE : CONNECT_FAILED;
+}
+
+void MqttBridge::settingsChanged(const heatpumpSettings &settings) {
+    if (!settings.power) return; // nothing read yet
+
+    queue(FIELD_POWER, settings.power);
+    queue(FIELD_MODE, settings.mode);
+    queue(FIELD_TEMPERATURE, settings.temperature);
+    queue(FIELD_FAN, settings.fan);
+    queue(FIELD_VANE, settings.vane);
+    queue(FIELD_WIDEVANE, settings.wideVane);
+}
+
+void MqttBridge::statusChanged(const heatpumpStatus &status) {
+    queue(FIELD_ROOM_TEMPERATURE, status.roomTemperature);
+    queue(FIELD_OPERATING, status.operating ? "true" : "false");
+    queue(FIELD_COMPRESSOR_FREQUENCY, status.compressorFrequency);
+}
+
+void MqttBridge::queue(Field field, const char *value) {
+    Slot &slot = slots[field];
+    if (strncmp(slot.queued, value, VALUE_LEN - 1) == 0) return;
+
+    snprintf(slot.queued, sizeof(slot.queued), "%s", value);
+    slot.pending = strcmp(slot.queued, slot.published) != 0;
+}
+
+void MqttBridge::queue(Field field, heatpumpTemperature value) {
+    char text[VALUE_LEN];
+    value.toString(text, sizeof(text));
+    queue(field, text);
+}
+
+void MqttBridge::queue(Field field, int value) {
+    char text[VALUE_LEN];
+    snprintf(text, sizeof(text), "%d", value);
+    queue(field, text);
+}
+
+void MqttBridge::connected() {
+    mqtt.publish(willTopic, "true", true);
+
+    char fullTopic[TOPIC_LEN];
+    snprintf(fullTopic, sizeof(fullTopic), "%s/set/+", topic);
+    mqtt.subscribe(fullTopic);
+
+    // the broker may have lost the retained values, send everything we have again
+    for (Slot &slot : slots) {
+        slot.published[0] = 0;
+        slot.pending = slot.queued[0] != 0;
+    }
+    statePending = true;
+}
+
+void MqttBridge::publishPending() {
+    char fullTopic[TOPIC_LEN];
+    for (int i = 0; i < FIELD_COUNT; i++) {
+        Slot &slot = slots[i];
+        if (!slot.pending) continue;
+
+        snprintf(fullTopic, sizeof(fullTopic), "%s/%s", topic, FIELD_NAMES[i]);
+        if (!mqtt.publish(fullTopic, slot.queued, true)) return; // try again on the next poll
+
+        memcpy(slot.published, slot.queued, VALUE_LEN);
+        slot.pending = false;
+    }
+}
+
+bool MqttBridge::publishState() {
+    char state[320];
+    size_t length = 0;
+    state[length++] = '{';
+    for (int i = 0; i < FIELD_COUNT; i++) {
+        const char *value = slots[i].queued;
+        if (!value[0]) continue;
+
+        // numbers and booleans go in bare, the rest are quoted
+        const bool bare = strcmp(value, "true") == 0 || strcmp(value, "false") == 0 ||
+                          strspn(value, "-.0123456789") == strlen(value);
+        length += snprintf(state + length, sizeof(state) - length, "%s\"%s\":%s%s%s", length > 1 ? "," : "",
+                           FIELD_NAMES[i], bare ? "" : "\"", value, bare ? "" : "\"");
+    }
+    snprintf(state + length, sizeof(state) - length, "}");
+
+    char fullTopic[TOPIC_LEN];
+    snprintf(fullTopic, sizeof(fullTopic), "%s/state", topic);
+    return mqtt.publish(fullTopic, state, false);
+}
+
+void MqttBridge::handleCommand(char *commandTopic, uint8_t *payload, unsigned int length) {
+    const char *field = strrchr(commandTopic, '/');
+    if (!field) return;
+    field++;
+
+    if (length >= VALUE_LEN) return; // longer than any valid value
+    char value[VALUE_LEN];
+    memcpy(value, payload, length);
+    value[length] = 0;
+    heatpumpSettingsChange change = {};
+    if (HeatPump::parseSettingsField(field, value, change) != HEATPUMP_FIELD_SET) return;
+
+    // createPacket() diffs against the current settings, so wait for the first settings read
+    if (!heatPump.isConnected() || !heatPump.getSettings().power) return;
+    // the unit wouldn't answer, or another master owns the settings
+    if (heatPump.getLinkState() == HEATPUMP_LINK_DOWN || heatPump.isListenOnly()) return;
+
+    if (settingsWriter) {
+        settingsWriter(change);
+    } else {
+        heatPump.setSettings(change);
+    }
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include <HeatPump.h>
+#include <PubSubClient.h>
+#include <atomic>
+#include <functional>
+
+/**
+ * Publishes the heat pump state to MQTT and feeds command topics into the settings write path.
+ *
+ *   <topic>/online        retained, "false" is the last will
+ *   <topic>/<field>       retained, published only when the value changes
+ *   <topic>/state         compact JSON of all fields, every MQTT_STATE_INTERVAL_MS
+ *   <topic>/set/<field>   commands: power, mode, temperature, fan, vane, wideVane
+ *
+ * Outbound values go through one fixed slot per field. A newer value overwrites a queued one
+ * (latest wins), so a broker outage can't grow memory; the latest values are sent on reconnect. The status
+ * fields are sampled after each status reply, the status callback only fires when `operating` or the room
+ * temperature changes.
+ *
+ * Commands take the values HeatPump::parseSettingsField() does, others are dropped. So are all commands while
+ * the heat pump link is down or the bridge is listen-only, like HomeKit writes. Valid ones go to the settings
+ * writer, not to update(), which would hold up poll() until the unit acks.
+ *
+ * PubSubClient's connect() blocks for the DNS lookup, the TCP connect and the CONNACK, seconds when the broker
+ * is unreachable. With setConnectTask() poll() hands it to that task and leaves the client alone until it is
+ * done, so the caller's loop keeps running; without one poll() connects itself.
+ */
+class MqttBridge {
+public:
+    MqttBridge(HeatPump &heatPump, Client &client);
+
+    void begin(const char *server, uint16_t port, const char *topic);
+    void poll();
+
+    void setConnectTask(TaskHandle_t task); // notified when a connect is due, it then runs connect()
+    void connect();                         // the blocking broker connect
+    // queues a settings write for the heat pump. Without one, commands only go into the wanted settings, for
+    // the next sync() with autoUpdate.
+    void setSettingsWriter(std::function<bool(const heatpumpSettingsChange &)> writer);
+
+    // wire these up to the HeatPump callbacks
+    void settingsChanged(const heatpumpSettings &settings);
+    void statusChanged(const heatpumpStatus &status);
+
+private:
+    enum Field {
+        FIELD_CONNECTED,
+        FIELD_LINK,
+        FIELD_POWER,
+        FIELD_MODE,
+        FIELD_TEMPERATURE,
+        FIELD_FAN,
+        FIELD_VANE,
+        FIELD_WIDEVANE,
+        FIELD_ROOM_TEMPERATURE,
+        FIELD_OPERATING,
+        FIELD_COMPRESSOR_FREQUENCY,
+        FIELD_COUNT
+    };
+
+    static const size_t VALUE_LEN = 12;
+    static const size_t TOPIC_LEN = 64;
+
+    enum ConnectState {
+        CONNECT_IDLE,
+        CONNECT_RUNNING, // the connect task has the client
+        CONNECT_DONE,
+        CONNECT_FAILED
+    };
+
+    struct Slot {
+        char queued[VALUE_LEN];
+        char published[VALUE_LEN];
+        bool pending;
+    };
+
+    HeatPump &heatPump;
+    PubSubClient mqtt;
+    const char *topic = nullptr;
+    char willTopic[TOPIC_LEN];
+    TaskHandle_t connectTask = nullptr;
+    std::function<bool(const heatpumpSettingsChange &)> settingsWriter;
+    std::atomic<int> connectState {CONNECT_IDLE};
+    Slot slots[FIELD_COUNT] = {};
+    unsigned long lastReconnect = 0;
+    unsigned long lastState = 0;
+    bool statePending = false;
+    unsigned long statusReplies = 0; // the heat pump's receivedStatus when the status was last sampled
+
+    void queue(Field field, const char *value);
+    void queue(Field field, heatpumpTemperature value);
+    void queue(Field field, int value);
+    void connected(); // announces the bridge and resends everything
+    void publishPending();
+    bool publishState();
+    void handleCommand(char *commandTopic, uint8_t *payload, unsigned int length);
+};
@@ -0,0 +1,330 @@
+#include "Schedule.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+static const char *const DAY_NAMES[7] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+static const char *const ACTION_NAMES[4] = {"", "OFF", "HEAT", "COOL"};
+static const int MINUTES_PER_DAY = 24 * 60;
+static const float MIN_SETPOINT = 10;
+static const float MAX_SETPOINT = 31;
+
+static bool byMinute(const ScheduleEntry &lhs, const ScheduleEntry &rhs) {
+    return lhs.minute < rhs.minute;
+}
+
+/**
+ * Local time minus UTC at `time`, in seconds. From localtime_r/gmtime_r as newlib has no tm_gmtoff.
+ */
+static long utcOffset(time_t time) {
+    struct tm local, utc;
+    localtime_r(&time, &local);
+    gmtime_r(&time, &utc);
+    int days = local.tm_yday - utc.tm_yday;
+    if (local.tm_year != utc.tm_year) days = local.tm_year > utc.tm_year ? 1 : -1;
+    const long minutes = (days * 24L + local.tm_hour - utc.tm_hour) * 60 + local.tm_min - utc.tm_min;
+    return minutes * 60 + local.tm_sec - utc.tm_sec;
+}
+
+static long floorDiv(long long value, long divisor) {
+    return (long) (value >= 0 ? value / divisor : -((-value + divisor - 1) / divisor));
+}
+
+int ScheduleEntry::toString(char *buffer, size_t length) const {
+    int written = snprintf(buffer, length, "%s %02d:%02d", DAY_NAMES[minute / MINUTES_PER_DAY],
+                           minute % MINUTES_PER_DAY / 60, minute % 60);
+    if (action != SETPOINT && written >= 0 && (size_t) written < length) {
+        written += snprintf(buffer + written, length - written, " %s", ACTION_NAMES[action]);
+    }
+    if (hasSetpoint() && written >= 0 && (size_t) written + 1 < length) {
+        buffer[written++] = ' ';
+        buffer[written] = 0;
+        written += temperature().toString(buffer + written, length - written);
+    }
+    return written;
+}
+
+#if defined(ESP32)
+#include <Preferences.h>
+
+size_t NvsScheduleStorage::load(uint8_t *data, size_t capacity) {
+    Preferences preferences;
+    if (!preferences.begin("schedule", true)) return 0;
+    const size_t length = preferences.getBytes("table", data, capacity);
+    preferences.end();
+    return length;
+}
+
+bool NvsScheduleStorage::save(const uint8_t *data, size_t length) {
+    Preferences preferences;
+    if (!preferences.begin("schedule", false)) return false;
+    const bool saved = preferences.putBytes("table", data, length) == length;
+    preferences.end();
+    return saved;
+}
+#endif
+
+// WeeklySchedule //////////////////////////////////////////////////////////////
+
+WeeklySchedule::WeeklySchedule(ScheduleStorage *storage) : storage(storage) {
+}
+
+bool WeeklySchedule::begin() {
+    uint8_t data[2 + MAX_ENTRIES * 4];
+    const size_t length = storage ? storage->load(data, sizeof(data)) : 0;
+    if (length < 2 || data[0] != FORMAT_VERSION || data[1] > MAX_ENTRIES || length != 2 + data[1] * 4u) return false;
+
+    ScheduleEntry loaded[MAX_ENTRIES];
+    for (size_t i = 0; i < data[1]; i++) {
+        const uint8_t *record = data + 2 + i * 4;
+        loaded[i] = ScheduleEntry{(uint16_t) (record[0] | record[1] << 8), record[2], record[3]};
+        if (loaded[i].minute >= WEEK_MINUTES || loaded[i].action > ScheduleEntry::COOL ||
+            (i > 0 && loaded[i].minute <= loaded[i - 1].minute)) {
+            return false;
+        }
+    }
+    memcpy(entries, loaded, data[1] * sizeof(ScheduleEntry));
+    count = data[1];
+    edits++;
+    return true;
+}
+
+void WeeklySchedule::clear() {
+    count = 0;
+    edits++;
+    save();
+}
+
+void WeeklySchedule::save() {
+    if (!storage) return;
+    uint8_t data[2 + MAX_ENTRIES * 4] = {FORMAT_VERSION, (uint8_t) count};
+    for (size_t i = 0; i < count; i++) {
+        uint8_t *record = data + 2 + i * 4;
+        record[0] = (uint8_t) entries[i].minute;
+        record[1] = (uint8_t) (entries[i].minute >> 8);
+        record[2] = entries[i].action;
+        record[3] = entries[i].setpoint;
+    }
+    storage->save(data, 2 + count * 4);
+}
+
+static bool parseDay(const char *&text, int &day) {
+    for (int i = 0; i < 7; i++) {
+        if (strncasecmp(text, DAY_NAMES[i], 3) == 0) {
+            day = i;
+            text += 3;
+            return true;
+        }
+    }
+    return false;
+}
+
+// "Daily", "Mon", "Mon-Fri", "Fri-Mon", "Sat,Sun" into a bitmask of days, bit 0 = Sunday
+static bool parseDays(const char *text, uint8_t &days) {
+    days = 0;
+    if (strcasecmp(text, "Daily") == 0) {
+        days = 0x7f;
+        return true;
+    }
+    for (;;) {
+        int first, last;
+        if (!parseDay(text, first)) return false;
+        last = first;
+        if (*text == '-' && !parseDay(++text, last)) return false;
+        for (int day = first;; day = (day + 1) % 7) {
+            days |= 1 << day;
+            if (day == last) break;
+        }
+        if (*text == 0) return true;
+        if (*text++ != ',') return false;
+    }
+}
+
+static bool parseTime(const char *text, int &minute) {
+    char *end;
+    const long hours = strtol(text, &end, 10);
+    if (end == text || *end != ':' || !isdigit((unsigned char) end[1])) return false;
+    const long minutes = strtol(end + 1, &end, 10);
+    if (*end != 0 || hours < 0 || hours > 23 || minutes < 0 || minutes > 59) return false;
+    minute = (int) (hours * 60 + minutes);
+    return true;
+}
+
+static bool parseSetpoint(const char *text, uint8_t &setpoint) {
+    char *end;
+    const float celsius = strtof(text, &end);
+    if (end == text || *end != 0 || celsius < MIN_SETPOINT || celsius > MAX_SETPOINT) return false;
+    setpoint = heatpumpTemperature::fromCelsius(celsius).toWire();
+    return true;
+}
+
+bool WeeklySchedule::parse(const char *text) {
+    ScheduleEntry parsed[MAX_ENTRIES];
+    size_t parsedCount = 0;
+
+    while (*text) {
+        const size_t lineLength = strcspn(text, "\n;");
+        const char *lineEnd = text + lineLength;
+
+        // up to 4 tokens: days, time, action and/or setpoint
+        char tokens[4][16];
+        int tokenCount = 0;
+        for (const char *p = text; p < lineEnd;) {
+            if (isspace((unsigned char) *p)) {
+                p++;
+                continue;
+            }
+            const char *tokenEnd = p;
+            while (tokenEnd < lineEnd && !isspace((unsigned char) *tokenEnd)) tokenEnd++;
+            if (tokenCount == 4 || tokenEnd - p >= (long) sizeof(tokens[0])) return false;
+            memcpy(tokens[tokenCount], p, tokenEnd - p);
+            tokens[tokenCount++][tokenEnd - p] = 0;
+            p = tokenEnd;
+        }
+        text = *lineEnd ? lineEnd + 1 : lineEnd;
+        if (tokenCount == 0 || tokens[0][0] == '#') continue;
+        if (tokenCount < 3) return false;
+
+        uint8_t days;
+        int minute;
+        if (!parseDays(tokens[0], days) || !parseTime(tokens[1], minute)) return false;
+        ScheduleEntry entry = {0, ScheduleEntry::SETPOINT, 0};
+        int action;
+        for (action = ScheduleEntry::OFF; action <= ScheduleEntry::COOL; action++) {
+            if (strcasecmp(tokens[2], ACTION_NAMES[action]) == 0) break;
+        }
+        if (action <= ScheduleEntry::COOL) {
+            entry.action = (uint8_t) action;
+            if (tokenCount == 4 && (action == ScheduleEntry::OFF || !parseSetpoint(tokens[3], entry.setpoint))) {
+                return false;
+            }
+        } else if (tokenCount != 3 || !parseSetpoint(tokens[2], entry.setpoint)) {
+            return false;
+        }
+
+        for (int day = 0; day < 7; day++) {
+            if (!(days & (1 << day))) continue;
+            if (parsedCount == MAX_ENTRIES) return false;
+            entry.minute = (uint16_t) (day * MINUTES_PER_DAY + minute);
+            parsed[parsedCount++] = entry;
+        }
+    }
+
+    std::sort(parsed, parsed + parsedCount, byMinute);
+    for (size_t i = 1; i < parsedCount; i++) {
+        if (parsed[i].minute == parsed[i - 1].minute) return false; // two transitions at the same time
+    }
+    memcpy(entries, parsed, parsedCount * sizeof(ScheduleEntry));
+    count = parsedCount;
+    edits++;
+    save();
+    return true;
+}
+
+uint16_t WeeklySchedule::weekMinute(time_t time) {
+    struct tm local;
+    localtime_r(&time, &local);
+    return (uint16_t) (local.tm_wday * MINUTES_PER_DAY + local.tm_hour * 60 + local.tm_min);
+}
+
+bool WeeklySchedule::next(time_t now, size_t &index, time_t &at) const {
+    if (count == 0) return false;
+    struct tm local;
+    localtime_r(&now, &local);
+    const uint16_t minute = (uint16_t) (local.tm_wday * MINUTES_PER_DAY + local.tm_hour * 60 + local.tm_min);
+
+    const ScheduleEntry key = {minute, 0, 0};
+    const ScheduleEntry *found = std::upper_bound(entries, entries + count, key, byMinute);
+    index = found == entries + count ? 0 : (size_t) (found - entries);
+    long delta = (long) entries[index].minute - minute;
+    if (delta <= 0) delta += WEEK_MINUTES;
+
+    // the local time that far ahead, corrected for a DST change in between
+    const time_t sameOffset = now - local.tm_sec + delta * 60;
+    at = sameOffset + utcOffset(now) - utcOffset(sameOffset);
+    if (weekMinute(at) != entries[index].minute) at = sameOffset; // skipped when DST started
+    return true;
+}
+
+bool WeeklySchedule::active(time_t now, size_t &index) const {
+    if (count == 0) return false;
+    const ScheduleEntry key = {weekMinute(now), 0, 0};
+    const ScheduleEntry *found = std::upper_bound(entries, entries + count, key, byMinute);
+    index = found == entries ? count - 1 : (size_t) (found - entries) - 1;
+    return true;
+}
+
+// ScheduleRunner //////////////////////////////////////////////////////////////
+
+ScheduleRunner::ScheduleRunner(WeeklySchedule &schedule, heatpumpClock &clock)
+    : schedule(schedule), clock(clock), seenRevision(schedule.revision()), wakeAt(heatpumpDeadline::after(clock, 0)) {
+}
+
+heatpumpDeadline ScheduleRunner::deadline() const {
+    if (clockChanges.load(std::memory_order_relaxed) != seenClockChanges || schedule.revision() != seenRevision) {
+        return heatpumpDeadline::after(clock, 0);
+    }
+    return wakeAt;
+}
+
+void ScheduleRunner::clockChanged() {
+    clockChanges.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool ScheduleRunner::poll(time_t now, ScheduleEntry &apply) {
+    seenClockChanges = clockChanges.load(std::memory_order_relaxed);
+    const bool edited = schedule.revision() != seenRevision;
+    seenRevision = schedule.revision();
+
+    // due, or the clock jumped past it: apply what is in effect now. An edit only takes effect from the
+    // next transition.
+    bool due = false;
+    size_t index;
+    if (armed && !edited && now >= armedAt && schedule.active(now, index)) {
+        const ScheduleEntry &entry = schedule.entry(index);
+        const long sinceEntry = (WeeklySchedule::weekMinute(now) - entry.minute + WeeklySchedule::WEEK_MINUTES) %
+                                WeeklySchedule::WEEK_MINUTES;
+        const time_t entryAt = now - sinceEntry * 60;
+        if (!isApplied(entry, entryAt)) {
+            apply = entry;
+            markApplied(entry, entryAt);
+            due = true;
+        }
+    }
+    arm(now);
+    return due;
+}
+
+void ScheduleRunner::arm(time_t now) {
+    armed = false;
+    size_t index;
+    time_t at;
+    if (now >= CLOCK_SET_AFTER && schedule.next(now, index, at)) {
+        // the same local time again, when DST ends or the clock is set back
+        if (!isApplied(schedule.entry(index), at) || schedule.next(at, index, at)) {
+            armed = true;
+            armedIndex = index;
+            armedAt = at;
+        }
+    }
+
+    unsigned long waitMs = MAX_WAIT_MS;
+    if (armed && (unsigned long) (armedAt - now) < MAX_WAIT_MS / 1000) waitMs = (unsigned long) (armedAt - now) * 1000;
+    wakeAt = heatpumpDeadline::after(clock, waitMs);
+}
+
+int ScheduleRunner::localDay(time_t time) {
+    return (int) floorDiv((long long) time + utcOffset(time), 24 * 3600);
+}
+
+void ScheduleRunner::markApplied(const ScheduleEntry &entry, time_t at) {
+    applied = true;
+    appliedMinute = entry.minute;
+    appliedDay = localDay(at);
+}
+
+bool ScheduleRunner::isApplied(const ScheduleEntry &entry, time_t at) const {
+    return applied && appliedMinute == entry.minute && appliedDay == localDay(at);
+}
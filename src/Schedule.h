@@ -0,0 +1,136 @@
+#pragma once
+#include <HeatPump.h>
+#include <HeatPumpClock.h>
+#include <atomic>
+#include <time.h>
+
+/**
+ * One weekly transition, 4 bytes: at `minute` of the local week (Sunday 00:00 = 0), switch to `action`
+ * and, unless it is 0, the setpoint in the heat pump's wire encoding.
+ */
+struct ScheduleEntry {
+    enum Action : uint8_t { SETPOINT, OFF, HEAT, COOL }; // SETPOINT keeps power and mode
+
+    uint16_t minute;
+    uint8_t action;
+    uint8_t setpoint;
+
+    bool hasSetpoint() const { return setpoint != 0; }
+    heatpumpTemperature temperature() const { return heatpumpTemperature::fromWire(setpoint); }
+    int toString(char *buffer, size_t length) const; // "Mon 07:00 HEAT 21.5", returns the snprintf length
+};
+
+/**
+ * Where WeeklySchedule keeps its table: NVS on the ESP32. A save replaces the whole blob.
+ */
+class ScheduleStorage {
+public:
+    virtual size_t load(uint8_t *data, size_t capacity) = 0; // bytes read, 0 if there is nothing stored
+    virtual bool save(const uint8_t *data, size_t length) = 0;
+    virtual ~ScheduleStorage() {}
+};
+
+#if defined(ESP32)
+/**
+ * ScheduleStorage as one blob in the "schedule" NVS namespace.
+ */
+class NvsScheduleStorage : public ScheduleStorage {
+public:
+    size_t load(uint8_t *data, size_t capacity) override;
+    bool save(const uint8_t *data, size_t length) override;
+};
+#endif
+
+/**
+ * A weekly table of setpoint/mode transitions in local time (see TIMEZONE in config.h).
+ *
+ * Entries are kept sorted by minute of the week, so the transition after a given time, and the one in
+ * effect at it, are binary searches. The table is edited as text, one entry per line or ';':
+ *
+ *   Mon-Fri 06:30 HEAT 21.5
+ *   Mon-Fri 08:00 18
+ *   Sat,Sun 08:00 HEAT 21
+ *   Daily 23:00 OFF
+ *
+ * Days are Sun..Sat, ranges (which may wrap, Fri-Mon), comma lists or Daily. The action is OFF, HEAT or
+ * COOL with an optional setpoint, or just a setpoint. A day range expands to one entry per day, up to
+ * MAX_ENTRIES in all. Each edit is saved to the storage and bumps revision().
+ */
+class WeeklySchedule {
+public:
+    static const size_t MAX_ENTRIES = 32;
+    static const uint16_t WEEK_MINUTES = 7 * 24 * 60;
+
+    explicit WeeklySchedule(ScheduleStorage *storage = nullptr);
+
+    bool begin(); // loads the stored table, false if there was none or it was unreadable
+    bool parse(const char *text); // replaces the table and saves it, false (table unchanged) on a syntax error
+    void clear();
+
+    size_t size() const { return count; }
+    const ScheduleEntry &entry(size_t index) const { return entries[index]; }
+    uint32_t revision() const { return edits; }
+
+    /**
+     * The first transition after `now` (an earlier one in the same minute counts as done). `at` is when
+     * the wall clock first reads its time; one in the hour skipped when DST starts comes an hour late.
+     */
+    bool next(time_t now, size_t &index, time_t &at) const;
+    bool active(time_t now, size_t &index) const; // the last transition at or before `now`, week wrapping
+
+    static uint16_t weekMinute(time_t time); // in local time
+
+private:
+    static const uint8_t FORMAT_VERSION = 1;
+
+    ScheduleStorage *storage;
+    ScheduleEntry entries[MAX_ENTRIES];
+    size_t count = 0;
+    uint32_t edits = 0;
+
+    void save();
+};
+
+/**
+ * Runs a WeeklySchedule on one timer: deadline() is when the next transition is due, on the controller's
+ * monotonic clock. poll() is called when it expires and returns the transition to apply, if any.
+ *
+ * The deadline comes due at once after an edit or clockChanged(), e.g. from the SNTP sync callback.
+ * poll() then re-arms from the wall clock. A transition the clock jumped past is applied: the one in
+ * effect at the new time. Transitions already applied aren't applied again when the clock goes back,
+ * including in the hour repeated when DST ends. Nothing runs until the wall clock is set.
+ */
+class ScheduleRunner {
+public:
+    static const time_t CLOCK_SET_AFTER = 1577836800; // 2020-01-01, earlier means SNTP hasn't set it
+    static const unsigned long MAX_WAIT_MS = 6 * 3600 * 1000UL; // re-checked at least this often
+
+    ScheduleRunner(WeeklySchedule &schedule, heatpumpClock &clock);
+
+    heatpumpDeadline deadline() const;
+    bool poll(time_t now, ScheduleEntry &apply);
+    void clockChanged(); // from any task
+
+    bool isArmed() const { return armed; }
+    time_t nextAt() const { return armedAt; } // wall clock time of the armed transition
+
+private:
+    WeeklySchedule &schedule;
+    heatpumpClock &clock;
+    std::atomic<uint32_t> clockChanges {0};
+    uint32_t seenClockChanges = 0;
+    uint32_t seenRevision = 0;
+    bool armed = false;
+    size_t armedIndex = 0;
+    time_t armedAt = 0;
+    heatpumpDeadline wakeAt = {0};
+    // the last transition applied, by entry and local date, so a repeated local time doesn't apply it again
+    bool applied = false;
+    uint16_t appliedMinute = 0;
+    int appliedDay = 0;
+
+    void arm(time_t now);
+    void markApplied(const ScheduleEntry &entry, time_t at);
+    bool isApplied(const ScheduleEntry &entry, time_t at) const;
+    static int localDay(time_t time);
+};
@@ -0,0 +1,242 @@
+#include "Telemetry.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#if defined(ESP32)
+#include <lwip/sockets.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#endif
+
+static const uint8_t FLAG_FREQUENCY = 1;
+static const uint8_t FLAG_ROOM = 2;
+static const uint8_t FLAG_OPERATING = 4;
+static const int FLAG_BITS = 3;
+
+static inline uint32_t zigzag(int32_t value) {
+    return ((uint32_t) value << 1) ^ (uint32_t) (value >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t value) {
+    return (int32_t) (value >> 1) ^ -(int32_t) (value & 1);
+}
+
+static inline size_t putVarint(uint8_t *out, uint32_t value) {
+    size_t length = 0;
+    while (value >= 0x80) {
+        out[length++] = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+    out[length++] = (uint8_t) value;
+    return length;
+}
+
+// 1 = read, 0 = runs past end, -1 = longer than 5 bytes
+static inline int getVarint(const uint8_t *&in, const uint8_t *end, uint32_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (in == end) return 0;
+        const uint8_t byte = *in++;
+        value |= (uint32_t) (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return 1;
+    }
+    return -1;
+}
+
+// TelemetryEncoder ////////////////////////////////////////////////////////////
+
+void TelemetryEncoder::reset() {
+    synced = false;
+}
+
+size_t TelemetryEncoder::encode(const TelemetrySample &sample, uint8_t *out) {
+    size_t length = 0;
+    if (!synced || sample.timeMs < last.timeMs || sample.timeMs - lastSync >= SYNC_INTERVAL_MS ||
+        sample.timeMs - last.timeMs >= (1u << (32 - FLAG_BITS))) {
+        out[length++] = 0;
+        length += putVarint(out + length, (uint32_t) (sample.timeMs / 1000));
+        length += putVarint(out + length, (uint32_t) (sample.timeMs % 1000));
+        length += putVarint(out + length, sample.compressorFrequency);
+        out[length++] = sample.operating ? 1 : 0;
+        length += putVarint(out + length, zigzag(sample.roomTemperature.halfDegrees));
+        synced = true;
+        lastSync = sample.timeMs;
+        last = sample;
+        return length;
+    }
+
+    uint8_t flags = 0;
+    if (sample.compressorFrequency != last.compressorFrequency) flags |= FLAG_FREQUENCY;
+    if (sample.roomTemperature != last.roomTemperature) flags |= FLAG_ROOM;
+    if (sample.operating != last.operating) flags |= FLAG_OPERATING;
+    const uint32_t elapsed = (uint32_t) (sample.timeMs - last.timeMs);
+    if (!elapsed && !flags) return 0;
+
+    length += putVarint(out + length, elapsed << FLAG_BITS | flags);
+    if (flags & FLAG_FREQUENCY) {
+        length += putVarint(out + length, zigzag(sample.compressorFrequency - last.compressorFrequency));
+    }
+    if (flags & FLAG_ROOM) {
+        length += putVarint(out + length, zigzag(sample.roomTemperature.halfDegrees - last.roomTemperature.halfDegrees));
+    }
+    last = sample;
+    return length;
+}
+
+// TelemetryDecoder ////////////////////////////////////////////////////////////
+
+int TelemetryDecoder::parse(TelemetrySample &sample) {
+    const uint8_t *in = pending;
+    const uint8_t *end = pending + used;
+    uint32_t value;
+    int read;
+
+    if (pending[0] == 0) {
+        uint32_t seconds, ms, frequency, room;
+        in++;
+        if ((read = getVarint(in, end, seconds)) <= 0 || (read = getVarint(in, end, ms)) <= 0 ||
+            (read = getVarint(in, end, frequency)) <= 0) {
+            return read;
+        }
+        if (in == end) return 0;
+        const uint8_t operating = *in++;
+        if ((read = getVarint(in, end, room)) <= 0) return read;
+        if (ms > 999 || frequency > 255 || operating > 1) return -1;
+        sample.timeMs = (uint64_t) seconds * 1000 + ms;
+        sample.compressorFrequency = (uint8_t) frequency;
+        sample.operating = operating;
+        sample.roomTemperature = heatpumpTemperature::fromHalfDegrees(unzigzag(room));
+        synced = true;
+    } else {
+        if ((read = getVarint(in, end, value)) <= 0) return read;
+        sample = last;
+        sample.timeMs += value >> FLAG_BITS;
+        if (value & FLAG_FREQUENCY) {
+            uint32_t delta;
+            if ((read = getVarint(in, end, delta)) <= 0) return read;
+            sample.compressorFrequency = (uint8_t) (sample.compressorFrequency + unzigzag(delta));
+        }
+        if (value & FLAG_ROOM) {
+            uint32_t delta;
+            if ((read = getVarint(in, end, delta)) <= 0) return read;
+            sample.roomTemperature.halfDegrees = (int16_t) (sample.roomTemperature.halfDegrees + unzigzag(delta));
+        }
+        if (value & FLAG_OPERATING) sample.operating = !sample.operating;
+    }
+    last = sample;
+    return 1;
+}
+
+bool TelemetryDecoder::decode(const uint8_t *data, size_t length, const Sink &sink) {
+    bool valid = true;
+    for (size_t i = 0; i < length; i++) {
+        if (!synced && used == 0 && data[i] != 0) continue; // wait for a sync
+        pending[used++] = data[i];
+
+        TelemetrySample sample;
+        const int result = parse(sample);
+        if (result == 0 && used < sizeof(pending)) continue;
+        used = 0;
+        if (result == 1) {
+            sink(sample);
+        } else {
+            valid = false;
+            synced = false;
+        }
+    }
+    return valid;
+}
+
+// TelemetryStream /////////////////////////////////////////////////////////////
+
+TelemetryStream::TelemetryStream(HeatPump &heatPump, unsigned long statusIntervalMs)
+        : heatPump(heatPump), statusIntervalMs(statusIntervalMs) {
+}
+
+bool TelemetryStream::begin(uint16_t port) {
+    listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenSocket < 0) return false;
+
+    int reuse = 1;
+    setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+
+    if (bind(listenSocket, (struct sockaddr *) &address, sizeof(address)) < 0 || listen(listenSocket, 1) < 0) {
+        close(listenSocket);
+        listenSocket = -1;
+        return false;
+    }
+    fcntl(listenSocket, F_SETFL, fcntl(listenSocket, F_GETFL, 0) | O_NONBLOCK);
+    return true;
+}
+
+bool TelemetryStream::isActive() const {
+    return subscriber >= 0;
+}
+
+void TelemetryStream::poll() {
+    if (listenSocket < 0) return;
+    accept();
+    if (subscriber < 0) return;
+
+    // the subscriber only listens, a read of 0 means it went away
+    char discard[16];
+    const int received = recv(subscriber, discard, sizeof(discard), MSG_DONTWAIT);
+    if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        drop();
+        return;
+    }
+
+    const unsigned long replies = heatPump.getCounters().receivedStatus;
+    if (replies != statusReplies) {
+        statusReplies = replies;
+        sample();
+    }
+}
+
+void TelemetryStream::accept() {
+    const int client = ::accept(listenSocket, nullptr, nullptr);
+    if (client < 0) return;
+    if (subscriber >= 0) close(subscriber);
+    subscriber = client;
+    fcntl(subscriber, F_SETFL, fcntl(subscriber, F_GETFL, 0) | O_NONBLOCK);
+    statusReplies = heatPump.getCounters().receivedStatus;
+    encoder.reset();
+    heatPump.setStatusPollInterval(statusIntervalMs);
+}
+
+void TelemetryStream::sample() {
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    if (now.tv_sec < 1577836800 || heatPump.getLinkState() == HEATPUMP_LINK_DOWN) return; // clock not set (< 2020)
+
+    const heatpumpStatus status = heatPump.getStatus();
+    TelemetrySample sample;
+    sample.timeMs = (uint64_t) now.tv_sec * 1000 + now.tv_usec / 1000;
+    sample.compressorFrequency = (uint8_t) constrain(status.compressorFrequency, 0, 255);
+    sample.operating = status.operating;
+    sample.roomTemperature = status.roomTemperature;
+
+    uint8_t record[TelemetryEncoder::MAX_RECORD_LEN];
+    const size_t length = encoder.encode(sample, record);
+    if (!length) return;
+    const int sent = send(subscriber, record, length, MSG_DONTWAIT);
+    if (sent == (int) length) return;
+    if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        encoder.reset(); // the sample is lost, resync the reader with the next one
+    } else {
+        drop();
+    }
+}
+
+void TelemetryStream::drop() {
+    close(subscriber);
+    subscriber = -1;
+    heatPump.setStatusPollInterval(0);
+}
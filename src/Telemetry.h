@@ -0,0 +1,84 @@
+#pragma once
+#include <HeatPump.h>
+#include <functional>
+
+struct TelemetrySample {
+    uint64_t timeMs; // Unix time
+    uint8_t compressorFrequency;
+    bool operating;
+    heatpumpTemperature roomTemperature;
+};
+
+/**
+ * Delta encoding for a stream of status samples, a few bytes per sample.
+ *
+ *   sync    00, varint Unix seconds, varint ms, varint frequency, operating byte, zigzag varint room temperature
+ *   sample  varint (ms since the previous sample << 3 | flags), then a zigzag varint delta per flag:
+ *           1 = compressor frequency, 2 = room temperature (half degrees); flag 4 toggles operating
+ *
+ * A steady sample a second apart takes 2 bytes. A sample's first byte is never 0, samples with no time
+ * and no change are dropped. A sync starts the stream, follows reset() and comes at least every
+ * SYNC_INTERVAL_MS, so a reader can join at any sync.
+ */
+class TelemetryEncoder {
+public:
+    static const size_t MAX_RECORD_LEN = 1 + 5 + 2 + 5 + 1 + 5;
+    static const uint32_t SYNC_INTERVAL_MS = 60000;
+
+    void reset(); // the next record is a sync
+    size_t encode(const TelemetrySample &sample, uint8_t *out); // bytes written, 0 if the sample was dropped
+
+private:
+    TelemetrySample last {};
+    uint64_t lastSync = 0;
+    bool synced = false;
+};
+
+/**
+ * Reads a TelemetryEncoder stream in chunks of any size. Bytes before the first sync are skipped.
+ */
+class TelemetryDecoder {
+public:
+    typedef std::function<void(const TelemetrySample &sample)> Sink;
+
+    // false if the stream is malformed, the decoder then waits for the next sync
+    bool decode(const uint8_t *data, size_t length, const Sink &sink);
+
+private:
+    uint8_t pending[TelemetryEncoder::MAX_RECORD_LEN];
+    size_t used = 0;
+    TelemetrySample last {};
+    bool synced = false;
+
+    int parse(TelemetrySample &sample); // 1 = a sample, 0 = needs more bytes, -1 = malformed
+};
+
+/**
+ * Opt-in telemetry for one heat pump: serves the encoded status stream to one TCP subscriber at a time,
+ * a new connection replaces the previous one.
+ *
+ * While a subscriber is connected the heat pump's status is requested every statusIntervalMs (see
+ * HeatPump::setStatusPollInterval()) and each status reply becomes a sample. The caller keeps the bus
+ * pumped fast enough, at least two info requests per interval. Samples need the wall clock, none are
+ * sent before it is set.
+ */
+class TelemetryStream {
+public:
+    TelemetryStream(HeatPump &heatPump, unsigned long statusIntervalMs);
+
+    bool begin(uint16_t port);
+    bool isActive() const; // a subscriber is connected
+    void poll();
+
+private:
+    HeatPump &heatPump;
+    const unsigned long statusIntervalMs;
+    int listenSocket = -1;
+    int subscriber = -1;
+    unsigned long statusReplies = 0;
+    TelemetryEncoder encoder;
+
+    void accept();
+    void sample();
+    void drop();
+};
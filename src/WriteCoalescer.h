@@ -0,0 +1,46 @@
+#pragma once
+#include <HeatPumpClock.h>
+
+/**
+ * Merges a burst of writes (e.g. dragging a HomeKit slider) into one.
+ *
+ * Each write pushes the deadline out to `debounceMs` after it (trailing edge), but never past
+ * `maxLatencyMs` after the first write of the burst, so a long drag still reaches the heat pump.
+ */
+class WriteCoalescer {
+public:
+    WriteCoalescer(heatpumpClock &clock, unsigned long debounceMs, unsigned long maxLatencyMs)
+            : clock(clock), debounceMs(debounceMs), maxLatencyMs(maxLatencyMs) {
+    }
+
+    void write() {
+        const heatpumpDeadline trailing = heatpumpDeadline::after(clock, debounceMs);
+        if (!isPending) {
+            isPending = true;
+            latest = heatpumpDeadline::after(clock, maxLatencyMs);
+        }
+        due = trailing.before(latest) ? trailing : latest;
+    }
+
+    bool pending() const {
+        return isPending;
+    }
+
+    // when the pending writes should be applied
+    heatpumpDeadline deadline() const {
+        return due;
+    }
+
+    // the caller is applying the pending writes, later writes start a new burst
+    void take() {
+        isPending = false;
+    }
+
+private:
+    heatpumpClock &clock;
+    const unsigned long debounceMs;
+    const unsigned long maxLatencyMs;
+    bool isPending = false;
+    heatpumpDeadline latest = {0};
+    heatpumpDeadline due = {0};
+};
@@ -5,4 +5,57 @@
 #define HP_POLL_TIME_MS 10000
 #define HP_POLL_DELAY 10000
 #define HP_TEMP_POLL_DELAY 5000
+// how often the bus is pumped between the polls above, keeps link loss detection under ~5s. A reply is read
+// as soon as it comes in, the next request goes out this long after.
+#define HP_SYNC_INTERVAL 500
+// 1 for a unit that already has a wired remote (MHK1/MHK2) polling it: the controller never transmits and
+// follows that traffic, HomeKit and HTTP writes are refused
+#define LISTEN_ONLY 0
 #define HK_UPDATE_DEBOUNCE 1000
+// a burst of HomeKit writes is sent to the heat pump at most this long after it started
+#define HK_UPDATE_MAX_LATENCY 3000
+// longest the HomeSpan task sleeps between polls
+#define HK_MAX_IDLE_MS 20
+// p95 limits for HomeKit changes, /metrics flags a stage whose p95 since boot is over its limit:
+// write to set frame on the wire (includes the debounce), to its 0x61 ack, to the settings read back
+// matching, and the frames sent per change
+#define HK_SET_FRAME_P95_LIMIT_MS 3300
+#define HK_SET_ACK_P95_LIMIT_MS 3400
+#define HK_CONFIRMED_P95_LIMIT_MS 6100
+#define HK_FRAMES_P95_LIMIT 16
+
+#define HTTP_PORT 80
+
+// leave MQTT_SERVER empty to disable the MQTT bridge
+#define MQTT_SERVER ""
+#define MQTT_PORT 1883
+#define MQTT_CLIENT_ID "heatpump"
+#define MQTT_USER nullptr
+#define MQTT_PASSWORD nullptr
+#define MQTT_TOPIC "heatpump"
+#define MQTT_STATE_INTERVAL_MS 60000
+#define MQTT_RECONNECT_INTERVAL_MS 5000
+
+// tiered history (HistoryStore) in this data partition, served on /history; leave empty to disable it
+#define HISTORY_PARTITION "spiffs"
+#define HISTORY_SAMPLE_INTERVAL 1000
+// history samples are timestamped from SNTP, none are taken until the clock is set
+#define NTP_SERVER "pool.ntp.org"
+// POSIX TZ rule for local time, which the weekly schedule (/schedule) runs in, e.g. "CET-1CEST,M3.5.0,M10.5.0/3"
+// or "EST5EDT,M3.2.0,M11.1.0"
+#define TIMEZONE "UTC0"
+// a schedule transition the heat pump didn't take (link down, listen-only) is tried again this often
+#define SCHEDULE_RETRY_INTERVAL 5000
+
+// opt-in compressor telemetry (TelemetryStream) on this TCP port, 0 disables it. While a subscriber is
+// connected, status is requested every TELEMETRY_STATUS_INTERVAL and the bus is pumped every
+// TELEMETRY_SYNC_INTERVAL: 2 requests a second (send and read alternate), every other one a status request
+#define TELEMETRY_PORT 0
+#define TELEMETRY_STATUS_INTERVAL 1000
+#define TELEMETRY_SYNC_INTERVAL 250
+
+// runtime and energy totals (heatpumpRuntime) in /metrics, saved to NVS this often, so a reboot loses at most that
+#define RUNTIME_SAVE_INTERVAL (15 * 60 * 1000UL)
+// estimated input power for the energy total: standby W, on with the compressor stopped W, then up to 8
+// {compressor Hz, W} points from your model's data sheet. Roughly a 2.5 kW wall unit; {0, 0, 0} estimates nothing
+#define POWER_CURVE {3, 20, 3, {{20, 250}, {50, 600}, {90, 1250}}}
@@ -0,0 +1,20 @@
+#include <Arduino.h>
+#include <time.h>
+
+static unsigned long long monotonicMs() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static const unsigned long long started = monotonicMs();
+
+unsigned long millis() {
+    return (unsigned long) (monotonicMs() - started);
+}
+
+void delay(unsigned long ms) {
+    timespec duration = {(time_t) (ms / 1000), (long) (ms % 1000) * 1000000};
+    while (nanosleep(&duration, &duration) != 0) {
+    }
+}
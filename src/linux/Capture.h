@@ -0,0 +1,38 @@
+#pragma once
+#include <stdint.h>
+
+/**
+ * CN105 capture format, as written by the gateway's -c option and read by heatpump-analyzer.
+ *
+ * A capture is the CN105 byte stream itself: frames back to back, so a raw UART tap reads the same way.
+ * The gateway puts a mark frame before each frame it sends or receives. A mark carries the unit index and
+ * the gateway's millis() at that moment:
+ *
+ *   fc 00 01 30 05 <unit> <ms, 4 bytes little endian> <checksum>
+ *
+ * Type 0x00 isn't used by the units, and a mark frame has a valid CN105 checksum, so a scanner finds it
+ * like any other frame.
+ */
+static const uint8_t CAPTURE_MARK_TYPE = 0x00;
+static const int CAPTURE_MARK_DATA_LEN = 5;
+static const int CAPTURE_MARK_LEN = CAPTURE_MARK_DATA_LEN + 6;
+
+inline void captureMark(uint8_t *out, int unit, uint32_t ms) {
+    const uint8_t mark[CAPTURE_MARK_LEN - 1] = {0xfc, CAPTURE_MARK_TYPE, 0x01, 0x30, CAPTURE_MARK_DATA_LEN,
+                                                (uint8_t) unit, (uint8_t) ms, (uint8_t) (ms >> 8),
+                                                (uint8_t) (ms >> 16), (uint8_t) (ms >> 24)};
+    int sum = 0;
+    for (int i = 0; i < CAPTURE_MARK_LEN - 1; i++) {
+        out[i] = mark[i];
+        sum += mark[i];
+    }
+    out[CAPTURE_MARK_LEN - 1] = (0xfc - sum) & 0xff;
+}
+
+inline bool isCaptureMark(const uint8_t *frame, int length) {
+    return length == CAPTURE_MARK_LEN && frame[1] == CAPTURE_MARK_TYPE;
+}
+
+inline uint32_t captureMarkTime(const uint8_t *frame) {
+    return frame[6] | (uint32_t) frame[7] << 8 | (uint32_t) frame[8] << 16 | (uint32_t) frame[9] << 24;
+}
@@ -0,0 +1,32 @@
+#include "FileHistoryStorage.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+FileHistoryStorage::FileHistoryStorage(size_t sectors) : sectors(sectors) {
+}
+
+FileHistoryStorage::~FileHistoryStorage() {
+    if (fd >= 0) close(fd);
+}
+
+bool FileHistoryStorage::open(const char *path) {
+    fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) return false;
+    // a new file reads as zeros, which no block header matches
+    const off_t size = (off_t) (sectors * SECTOR_SIZE);
+    return info.st_size >= size || ftruncate(fd, size) == 0;
+}
+
+size_t FileHistoryStorage::sectorCount() {
+    return fd >= 0 ? sectors : 0;
+}
+
+bool FileHistoryStorage::read(size_t sector, size_t offset, void *data, size_t length) {
+    return fd >= 0 && pread(fd, data, length, (off_t) (sector * SECTOR_SIZE + offset)) == (ssize_t) length;
+}
+
+bool FileHistoryStorage::writeSector(size_t sector, const void *data) {
+    return fd >= 0 && pwrite(fd, data, SECTOR_SIZE, (off_t) (sector * SECTOR_SIZE)) == (ssize_t) SECTOR_SIZE;
+}
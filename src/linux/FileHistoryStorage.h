@@ -0,0 +1,23 @@
+#pragma once
+#include "../History.h"
+
+/**
+ * HistoryStorage in a file of sectors, created and sized on open(). A sector is replaced with one pwrite.
+ */
+class FileHistoryStorage : public HistoryStorage {
+public:
+    explicit FileHistoryStorage(size_t sectors = HistoryStore::sectorsNeeded());
+    ~FileHistoryStorage();
+
+    bool open(const char *path);
+    size_t sectorCount() override;
+    bool read(size_t sector, size_t offset, void *data, size_t length) override;
+    bool writeSector(size_t sector, const void *data) override;
+
+private:
+    size_t sectors;
+    int fd = -1;
+
+    FileHistoryStorage(const FileHistoryStorage &) = delete;
+    FileHistoryStorage &operator=(const FileHistoryStorage &) = delete;
+};
@@ -0,0 +1,645 @@
+#include "Gateway.h"
+#include "Capture.h"
+#include "FileHistoryStorage.h"
+#include <errno.h>
+#include <signal.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+static const int MAX_EVENTS = 16;
+static const size_t MAX_LINE = 512;
+static const unsigned long FRAME_TIMEOUT_MS = 150; // a partial frame is handed over after this anyway
+static const unsigned long TELEMETRY_STATUS_INTERVAL_MS = 1000;
+
+/**
+ * One indoor unit: its serial port, HeatPump and timer. It is also the unit's HeatPump clock, so
+ * HeatPump's waits run the loop for the other units.
+ */
+struct Gateway::Unit : heatpumpClock {
+    struct Source : Handler {
+        Unit &unit;
+        void (Unit::*handle)(uint32_t events);
+
+        Source(Unit &unit, void (Unit::*handle)(uint32_t)) : unit(unit), handle(handle) {
+        }
+
+        void onEvent(uint32_t events) override {
+            (unit.*handle)(events);
+        }
+    };
+
+    Gateway &gateway;
+    const int index;
+    HardwareSerial serial;
+    HeatPump heatPump;
+    int timer = -1;
+    Source serialSource {*this, &Unit::onSerial};
+    Source timerSource {*this, &Unit::onTimer};
+    bool connected = false; // connect() has been attempted
+    bool busy = false;      // inside sync()/update(), its events are masked meanwhile
+    bool updatePending = false;
+    FileHistoryStorage historyStorage;
+    HistoryStore history {historyStorage};
+    TelemetryEncoder telemetry;
+    int telemetrySubscribers = 0;
+    heatpumpStatistics statistics;
+    unsigned long statusReplies = 0;
+
+    Unit(Gateway &gateway, int index, const char *device) : gateway(gateway), index(index), serial(device) {
+    }
+
+    ~Unit() {
+        history.flush();
+        if (timer >= 0) close(timer);
+    }
+
+    bool start() {
+        timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (timer < 0 || !serial.open()) return false;
+        if (!gateway.historyDirectory.empty()) {
+            const std::string path = gateway.historyDirectory + "/unit" + std::to_string(index) + ".history";
+            if (!historyStorage.open(path.c_str()) || !history.begin()) return false;
+        }
+
+        heatPump.setClock(this);
+        heatPump.setStatistics(&statistics);
+        heatPump.setSettingsChangedCallback([this]() { gateway.publish(*this); });
+        heatPump.setStatusChangedCallback([this](heatpumpStatus) { gateway.publish(*this); });
+        heatPump.setLinkStateChangedCallback([this](heatpumpLinkState) { gateway.publish(*this); });
+#ifndef HEATPUMP_NO_PACKET_CALLBACK
+        if (gateway.captureFile) {
+            heatPump.setPacketCallback([this](byte *packet, unsigned int length, char *) {
+                gateway.record(*this, packet, length);
+            });
+        }
+#endif
+        heatPump.enableExternalUpdate();
+        if (gateway.unitsListenOnly) heatPump.enableListenOnly();
+
+        gateway.watch(serial.fd(), &serialSource, EPOLLIN);
+        gateway.watch(timer, &timerSource, EPOLLIN);
+        arm(0);
+        return true;
+    }
+
+    void delay(uint32_t ms) override {
+        gateway.runFor(ms, this);
+    }
+
+    void suspend() {
+        gateway.modify(serial.fd(), &serialSource, 0);
+        gateway.modify(timer, &timerSource, 0);
+    }
+
+    void resume() {
+        gateway.modify(serial.fd(), &serialSource, EPOLLIN);
+        gateway.modify(timer, &timerSource, EPOLLIN);
+    }
+
+    void arm(unsigned long ms) {
+        itimerspec when = {};
+        when.it_value.tv_sec = ms / 1000;
+        when.it_value.tv_nsec = (ms % 1000) * 1000000 + 1; // 0 would disarm it
+        timerfd_settime(timer, 0, &when, nullptr);
+    }
+
+    // a whole frame (or something readPacket() will discard) is buffered
+    bool frameReady() {
+        const int available = serial.available();
+        if (available == 0) return false;
+        if (serial.peek(0) != 0xfc || available < 5) return serial.peek(0) != 0xfc;
+        const int length = serial.peek(4);
+        return length >= 22 || available >= length + 6;
+    }
+
+    void onSerial(uint32_t) {
+        if (busy) return;
+        if (frameReady()) {
+            service();
+        } else {
+            arm(FRAME_TIMEOUT_MS);
+        }
+    }
+
+    void onTimer(uint32_t) {
+        uint64_t expirations;
+        if (read(timer, &expirations, sizeof(expirations)) < 0 || busy) return;
+        service();
+    }
+
+    void service() {
+        busy = true;
+        if (!connected) {
+            connected = true;
+            heatPump.connect(&serial);
+        } else if (updatePending && heatPump.isConnected()) {
+            updatePending = false;
+            heatPump.update();
+        } else {
+            heatPump.sync();
+        }
+        busy = false;
+        arm(updatePending ? 0 : heatPump.timeUntilSync());
+        if (gateway.captureFile) fflush(gateway.captureFile);
+        if (telemetrySubscribers && heatPump.getCounters().receivedStatus != statusReplies) {
+            statusReplies = heatPump.getCounters().receivedStatus;
+            gateway.streamTelemetry(*this);
+        }
+    }
+
+    std::string json() {
+        const heatpumpSettings settings = heatPump.getSettings();
+        const heatpumpStatus status = heatPump.getStatus();
+        char temperature[12];
+        char roomTemperature[12];
+        settings.temperature.toString(temperature, sizeof(temperature));
+        status.roomTemperature.toString(roomTemperature, sizeof(roomTemperature));
+
+        char line[384];
+        snprintf(line, sizeof(line),
+                 "{\"unit\":%d,\"device\":\"%s\",\"connected\":%s,\"link\":\"%s\",\"power\":\"%s\",\"mode\":\"%s\","
+                 "\"temperature\":%s,\"fan\":\"%s\",\"vane\":\"%s\",\"wideVane\":\"%s\",\"roomTemperature\":%s,"
+                 "\"operating\":%s,\"compressorFrequency\":%d}\n",
+                 index, serial.device(), heatPump.isConnected() ? "true" : "false",
+                 heatpumpLinkStateName(heatPump.getLinkState()), settings.power ? settings.power : "",
+                 settings.mode ? settings.mode : "", temperature, settings.fan ? settings.fan : "",
+                 settings.vane ? settings.vane : "", settings.wideVane ? settings.wideVane : "", roomTemperature,
+                 status.operating ? "true" : "false", status.compressorFrequency);
+        return line;
+    }
+
+    std::string statisticsJson() {
+        std::string json;
+        char part[256];
+        unsigned long modeAge;
+        if (statistics.timeSinceModeChange(millis(), modeAge)) {
+            snprintf(part, sizeof(part), "{\"unit\":%d,\"modeAgeSeconds\":%lu,\"windows\":[", index, modeAge / 1000);
+        } else {
+            snprintf(part, sizeof(part), "{\"unit\":%d,\"modeAgeSeconds\":null,\"windows\":[", index);
+        }
+        json = part;
+        for (int i = 0; i < heatpumpStatistics::WINDOWS; i++) {
+            const heatpumpWindowStatistics window = statistics.get(i);
+            int length = snprintf(part, sizeof(part), "%s{\"windowSeconds\":%lu,\"spanSeconds\":%lu", i ? "," : "",
+                                  statistics.windowLength(i) / 1000, window.spanMs / 1000);
+            if (window.valid) {
+                snprintf(part + length, sizeof(part) - length,
+                         ",\"roomTemperatureMin\":%.1f,\"roomTemperatureMax\":%.1f,\"roomTemperatureMean\":%.2f,"
+                         "\"dutyCycle\":%.3f,\"compressorFrequencyMean\":%.1f",
+                         window.roomTemperatureMin.toCelsius(), window.roomTemperatureMax.toCelsius(),
+                         window.roomTemperatureMean, window.dutyCycle, window.compressorFrequencyMean);
+            }
+            json += part;
+            json += "}";
+        }
+        return json + "]}\n";
+    }
+};
+
+/**
+ * A socket connection. Output is queued and flushed as the socket allows.
+ */
+struct Gateway::Client : Handler {
+    Gateway &gateway;
+    const int fd;
+    std::string input;
+    std::string output;
+    bool watching = false;
+    int telemetryUnit = -1; // streaming this unit's telemetry, commands are ignored
+    bool closed = false;
+
+    Client(Gateway &gateway, int fd) : gateway(gateway), fd(fd) {
+    }
+
+    ~Client() {
+        close(fd);
+    }
+
+    void onEvent(uint32_t events) override {
+        if (closed) return;
+        if (events & (EPOLLHUP | EPOLLERR)) {
+            closed = true;
+            return;
+        }
+        if (events & EPOLLOUT) flush();
+        if (events & EPOLLIN) receive();
+    }
+
+    void receive() {
+        char chunk[256];
+        const ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+        if (received <= 0) {
+            if (received == 0 || (errno != EAGAIN && errno != EINTR)) closed = true;
+            return;
+        }
+        input.append(chunk, received);
+
+        size_t end;
+        while (!closed && (end = input.find('\n')) != std::string::npos) {
+            std::string line = input.substr(0, end);
+            input.erase(0, end + 1);
+            if (!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+            if (telemetryUnit < 0) gateway.command(*this, &line[0]);
+        }
+        if (input.size() > MAX_LINE) closed = true;
+    }
+
+    void send(const std::string &text) {
+        if (closed) return;
+        output += text;
+        flush();
+    }
+
+    void flush() {
+        while (!output.empty()) {
+            const ssize_t sent = ::send(fd, output.data(), output.size(), MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                closed = true;
+                return;
+            }
+            output.erase(0, sent);
+        }
+        gateway.modify(fd, this, (uint32_t) EPOLLIN | (output.empty() ? (uint32_t) 0 : (uint32_t) EPOLLOUT));
+    }
+};
+
+struct Gateway::Listener : Handler {
+    Gateway &gateway;
+    const int fd;
+
+    Listener(Gateway &gateway, int fd) : gateway(gateway), fd(fd) {
+    }
+
+    ~Listener() {
+        close(fd);
+    }
+
+    void onEvent(uint32_t) override {
+        const int client = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client < 0) return;
+        gateway.clients.push_back(new Client(gateway, client));
+        gateway.watch(client, gateway.clients.back(), EPOLLIN);
+    }
+};
+
+struct Gateway::Signals : Handler {
+    Gateway &gateway;
+    int fd = -1;
+
+    explicit Signals(Gateway &gateway) : gateway(gateway) {
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGINT);
+        sigaddset(&mask, SIGTERM);
+        sigprocmask(SIG_BLOCK, &mask, nullptr);
+        fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    }
+
+    ~Signals() {
+        if (fd >= 0) close(fd);
+    }
+
+    void onEvent(uint32_t) override {
+        signalfd_siginfo info;
+        while (read(fd, &info, sizeof(info)) > 0) {
+        }
+        gateway.stopping = true;
+    }
+};
+
+/**
+ * Feeds the units' history once a second.
+ */
+struct Gateway::Sampler : Handler {
+    Gateway &gateway;
+    int fd = -1;
+
+    explicit Sampler(Gateway &gateway) : gateway(gateway) {
+        fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        itimerspec every = {};
+        every.it_value.tv_sec = 1;
+        every.it_interval.tv_sec = 1;
+        timerfd_settime(fd, 0, &every, nullptr);
+    }
+
+    ~Sampler() {
+        if (fd >= 0) close(fd);
+    }
+
+    void onEvent(uint32_t) override {
+        uint64_t expirations;
+        if (read(fd, &expirations, sizeof(expirations)) > 0) gateway.sample();
+    }
+};
+
+Gateway::Gateway() {
+    epoll = epoll_create1(EPOLL_CLOEXEC);
+    signals = new Signals(*this);
+    watch(signals->fd, signals, EPOLLIN);
+}
+
+Gateway::~Gateway() {
+    for (Client *client : clients) delete client;
+    for (Unit *unit : units) delete unit;
+    delete listener;
+    delete signals;
+    delete sampler;
+    if (!socketPath.empty()) unlink(socketPath.c_str());
+    if (captureFile) fclose(captureFile);
+#ifdef HEATPUMP_TRACE
+    if (traceFile) {
+        heatpumpTrace::write([this](const char *text, size_t length) { fwrite(text, 1, length, traceFile); });
+        fclose(traceFile);
+    }
+#endif
+    close(epoll);
+}
+
+bool Gateway::addUnit(const char *device) {
+    Unit *unit = new Unit(*this, (int) units.size(), device);
+    if (!unit->start()) {
+        delete unit;
+        return false;
+    }
+    units.push_back(unit);
+    return true;
+}
+
+bool Gateway::listen(const char *path) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) return false;
+    strcpy(address.sun_path, path);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return false;
+    unlink(path); // a stale socket from a previous run
+    if (bind(fd, (sockaddr *) &address, sizeof(address)) != 0 || ::listen(fd, 8) != 0) {
+        close(fd);
+        return false;
+    }
+    socketPath = path;
+    listener = new Listener(*this, fd);
+    watch(fd, listener, EPOLLIN);
+    return true;
+}
+
+bool Gateway::capture(const char *path) {
+#ifdef HEATPUMP_NO_PACKET_CALLBACK
+    (void) path;
+    return false; // frames are only seen through the packet callback
+#else
+    captureFile = fopen(path, "ab");
+    return captureFile != nullptr;
+#endif
+}
+
+bool Gateway::trace(const char *path) {
+#ifdef HEATPUMP_TRACE
+    traceFile = fopen(path, "w");
+    return traceFile != nullptr;
+#else
+    (void) path;
+    return false; // spans are only recorded with HEATPUMP_TRACE
+#endif
+}
+
+void Gateway::history(const char *directory) {
+    historyDirectory = directory;
+    if (sampler) return;
+    sampler = new Sampler(*this);
+    watch(sampler->fd, sampler, EPOLLIN);
+}
+
+void Gateway::listenOnly() {
+    unitsListenOnly = true;
+}
+
+void Gateway::sample() {
+    const uint32_t now = (uint32_t) time(nullptr);
+    for (Unit *unit : units) {
+        if (!unit->history.isReady() || !unit->heatPump.isConnected() || !unit->heatPump.getSettings().power) {
+            continue;
+        }
+        unit->history.record(now, unit->heatPump.getStatus(), unit->heatPump.getSettings());
+    }
+}
+
+void Gateway::run() {
+    while (!stopping) {
+        dispatch(-1);
+        reapClients();
+    }
+}
+
+void Gateway::watch(int fd, Handler *handler, uint32_t events) {
+    epoll_event event = {};
+    event.events = events;
+    event.data.ptr = handler;
+    epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event);
+}
+
+void Gateway::modify(int fd, Handler *handler, uint32_t events) {
+    epoll_event event = {};
+    event.events = events;
+    event.data.ptr = handler;
+    epoll_ctl(epoll, EPOLL_CTL_MOD, fd, &event);
+}
+
+void Gateway::dispatch(int timeoutMs) {
+    epoll_event events[MAX_EVENTS];
+    depth++;
+    const int count = epoll_wait(epoll, events, MAX_EVENTS, timeoutMs);
+    for (int i = 0; i < count; i++) {
+        static_cast<Handler *>(events[i].data.ptr)->onEvent(events[i].events);
+    }
+    depth--;
+}
+
+void Gateway::runFor(unsigned long ms, Unit *busy) {
+    busy->suspend();
+    const heatpumpDeadline until = heatpumpDeadline::after(*busy, ms);
+    while (!until.expired(*busy)) {
+        dispatch((int) until.remaining(*busy));
+    }
+    busy->resume();
+}
+
+void Gateway::publish(Unit &unit) {
+    std::string line;
+    for (Client *client : clients) {
+        if (!client->watching) continue;
+        if (line.empty()) line = unit.json();
+        client->send(line);
+    }
+}
+
+void Gateway::record(Unit &unit, const byte *packet, unsigned int length) {
+    // received frames are handed over at full PACKET_LEN, keep only the bytes on the wire
+    const unsigned int frameLength = (unsigned int) packet[4] + 6;
+    if (frameLength < length) length = frameLength;
+
+    uint8_t mark[CAPTURE_MARK_LEN];
+    captureMark(mark, unit.index, (uint32_t) unit.millis());
+    fwrite(mark, 1, sizeof(mark), captureFile);
+    fwrite(packet, 1, length, captureFile);
+}
+
+void Gateway::streamTelemetry(Unit &unit) {
+    if (unit.heatPump.getLinkState() == HEATPUMP_LINK_DOWN) return;
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    const heatpumpStatus status = unit.heatPump.getStatus();
+    TelemetrySample sample;
+    sample.timeMs = (uint64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    sample.compressorFrequency = (uint8_t) constrain(status.compressorFrequency, 0, 255);
+    sample.operating = status.operating;
+    sample.roomTemperature = status.roomTemperature;
+
+    uint8_t record[TelemetryEncoder::MAX_RECORD_LEN];
+    const size_t length = unit.telemetry.encode(sample, record);
+    if (!length) return;
+    const std::string bytes((const char *) record, length);
+    for (Client *client : clients) {
+        if (client->telemetryUnit == unit.index) client->send(bytes);
+    }
+}
+
+void Gateway::unsubscribe(Client &client) {
+    if (client.telemetryUnit < 0) return;
+    Unit &unit = *units[client.telemetryUnit];
+    client.telemetryUnit = -1;
+    if (--unit.telemetrySubscribers == 0) unit.heatPump.setStatusPollInterval(0);
+}
+
+// FIELD=value pairs into the change, false if a value is invalid
+static bool parseFields(char *fields, heatpumpSettingsChange &change) {
+    char *save = nullptr;
+    for (char *field = strtok_r(fields, "&", &save); field; field = strtok_r(nullptr, "&", &save)) {
+        char *value = strchr(field, '=');
+        if (!value) continue;
+        *value++ = 0;
+        if (HeatPump::parseSettingsField(field, value, change) == HEATPUMP_FIELD_INVALID) return false;
+    }
+    return true;
+}
+
+void Gateway::command(Client &client, char *line) {
+    char *save = nullptr;
+    const char *name = strtok_r(line, " ", &save);
+    if (!name) return;
+
+    if (strcmp(name, "state") == 0) {
+        std::string reply;
+        for (Unit *unit : units) reply += unit->json();
+        client.send(reply + "\n");
+    } else if (strcmp(name, "watch") == 0) {
+        client.watching = true;
+        client.send("ok\n");
+    } else if (strcmp(name, "set") == 0) {
+        const char *index = strtok_r(nullptr, " ", &save);
+        char *fields = strtok_r(nullptr, " ", &save);
+        const int unit = index ? atoi(index) : -1;
+        heatpumpSettingsChange change = {};
+        if (unit < 0 || unit >= (int) units.size() || !fields) {
+            client.send("error usage: set <unit> FIELD=value[&FIELD=value]\n");
+        } else if (units[unit]->heatPump.isListenOnly()) {
+            client.send("error listen-only\n");
+        } else if (!units[unit]->heatPump.isConnected() || !units[unit]->heatPump.getSettings().power) {
+            client.send("error unit not connected\n"); // nothing to merge the change into yet
+        } else if (!parseFields(fields, change)) {
+            client.send("error invalid value\n"); // nothing was changed
+        } else if (!change.fields) {
+            client.send("error no known fields\n");
+        } else {
+            units[unit]->heatPump.setSettings(change);
+            // applied from the unit's own turn in the loop, it may be mid-exchange right now
+            units[unit]->updatePending = true;
+            if (!units[unit]->busy) units[unit]->arm(0);
+            client.send("ok\n");
+        }
+    } else if (strcmp(name, "stats") == 0) {
+        const char *index = strtok_r(nullptr, " ", &save);
+        const int unit = index ? atoi(index) : -1;
+        if (unit < 0 || unit >= (int) units.size()) {
+            client.send("error usage: stats <unit>\n");
+        } else {
+            client.send(units[unit]->statisticsJson());
+        }
+    } else if (strcmp(name, "history") == 0) {
+        queryHistory(client, save);
+    } else if (strcmp(name, "telemetry") == 0) {
+        const char *index = strtok_r(nullptr, " ", &save);
+        const int unit = index ? atoi(index) : -1;
+        if (unit < 0 || unit >= (int) units.size()) {
+            client.send("error usage: telemetry <unit>\n");
+            return;
+        }
+        client.send("ok\n");
+        client.watching = false;
+        client.telemetryUnit = unit;
+        Unit &subscribed = *units[unit];
+        subscribed.telemetrySubscribers++;
+        subscribed.telemetry.reset(); // the newcomer starts at a sync, the others just see an extra one
+        subscribed.statusReplies = subscribed.heatPump.getCounters().receivedStatus;
+        subscribed.heatPump.setStatusPollInterval(TELEMETRY_STATUS_INTERVAL_MS);
+    } else {
+        client.send("error unknown command\n");
+    }
+}
+
+void Gateway::queryHistory(Client &client, char *arguments) {
+    char *save = nullptr;
+    const char *index = strtok_r(arguments, " ", &save);
+    const char *tierName = strtok_r(nullptr, " ", &save);
+    const char *from = strtok_r(nullptr, " ", &save);
+    const char *to = strtok_r(nullptr, " ", &save);
+    const int unit = index ? atoi(index) : -1;
+    HistoryStore::Tier tier;
+    if (unit < 0 || unit >= (int) units.size() || !tierName || !HistoryStore::parseTier(tierName, tier)) {
+        client.send("error usage: history <unit> seconds|minutes|hours [from [to]]\n");
+        return;
+    }
+    if (!units[unit]->history.isReady()) {
+        client.send("error no history, start the gateway with -H\n");
+        return;
+    }
+
+    const uint32_t now = (uint32_t) time(nullptr);
+    const uint32_t start = from ? (uint32_t) strtoul(from, nullptr, 10) : now - HistoryStore::TIER_RETENTION[tier];
+    const uint32_t end = to ? (uint32_t) strtoul(to, nullptr, 10) : now;
+    std::string reply = "time,roomTemperature,roomTemperatureMin,roomTemperatureMax,setpoint,operatingPercent,"
+                        "compressorFrequency,compressorFrequencyMax\n";
+    units[unit]->history.query(tier, start, end, [&reply](const HistoryPoint &point) {
+        char room[12], low[12], high[12], setpoint[12];
+        point.roomTemperature.toString(room, sizeof(room));
+        point.roomTemperatureMin.toString(low, sizeof(low));
+        point.roomTemperatureMax.toString(high, sizeof(high));
+        point.setpoint.toString(setpoint, sizeof(setpoint));
+        char line[96];
+        snprintf(line, sizeof(line), "%u,%s,%s,%s,%s,%u,%u,%u\n", (unsigned) point.time, room, low, high, setpoint,
+                 point.operatingPercent, point.compressorFrequency, point.compressorFrequencyMax);
+        reply += line;
+        return true;
+    });
+    client.send(reply + "\n");
+}
+
+void Gateway::reapClients() {
+    for (size_t i = 0; i < clients.size();) {
+        if (clients[i]->closed) {
+            unsubscribe(*clients[i]);
+            delete clients[i]; // closing the fd removes it from the epoll set
+            clients.erase(clients.begin() + i);
+        } else {
+            i++;
+        }
+    }
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include <HeatPump.h>
+#include <HeatPumpTrace.h>
+#include "../History.h"
+#include "../Telemetry.h"
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+/**
+ * Linux gateway: drives CN105 units over termios serial ports from one epoll loop and serves their
+ * state on a local Unix socket.
+ *
+ * Each unit has its serial fd and a timerfd in the loop. The timer is armed with HeatPump::timeUntilSync(),
+ * and serial data only triggers sync() once a whole frame is buffered. Whenever HeatPump waits on its clock
+ * (the connect settle, the reply to a write), the unit's clock keeps running the loop for the other units,
+ * so one slow or disconnected unit doesn't stall the rest.
+ *
+ * Socket protocol, one command per line:
+ *   state                         one JSON line per unit, then an empty line
+ *   set <unit> FIELD=value[&...]  POWER, MODE, TEMP, FAN, VANE, WIDEVANE (see HeatPump::parseSettingsField());
+ *                                 answers "ok" or "error <reason>", "error invalid value" changes nothing
+ *   watch                         pushes a unit's JSON line whenever its settings, status or link change
+ *   history <unit> <tier> [from [to]]
+ *                                 CSV lines of the unit's history, then an empty line (see HistoryStore);
+ *                                 tier is seconds, minutes or hours, from/to in Unix seconds
+ *   stats <unit>                  one JSON line of the unit's rolling statistics (see heatpumpStatistics)
+ *   telemetry <unit>              answers "ok", then the connection carries the unit's binary
+ *                                 TelemetryEncoder stream; status is polled every second meanwhile
+ *
+ * With capture() set, every frame sent or received is appended to a capture file (see Capture.h). With
+ * history() set, each unit keeps a HistoryStore in <dir>/unit<N>.history, sampled every second while
+ * its link is up. With trace() set, the last HEATPUMP_TRACE_EVENTS spans (see HeatPumpTrace.h) are
+ * written out on exit. With listenOnly() set, the units never transmit: they follow the traffic of
+ * another master on their bus (see HeatPump::enableListenOnly()), and set is refused.
+ */
+class Gateway {
+public:
+    Gateway();
+    ~Gateway();
+
+    bool addUnit(const char *device);
+    bool listen(const char *socketPath);
+    bool capture(const char *path);
+    bool trace(const char *path); // the spans are written there as Chrome trace JSON on exit
+    void history(const char *directory); // before addUnit()
+    void listenOnly();                   // before addUnit()
+    void run(); // until SIGINT or SIGTERM
+
+private:
+    struct Handler {
+        virtual void onEvent(uint32_t events) = 0;
+        virtual ~Handler() {}
+    };
+    struct Unit;
+    struct Client;
+    struct Listener;
+    struct Signals;
+    struct Sampler;
+
+    int epoll = -1;
+    bool stopping = false;
+    int depth = 0; // nesting of dispatch(), clients are only freed at the top level
+    std::vector<Unit *> units;
+    std::vector<Client *> clients;
+    Listener *listener = nullptr;
+    Signals *signals = nullptr;
+    std::string socketPath;
+    FILE *captureFile = nullptr;
+    FILE *traceFile = nullptr;
+    std::string historyDirectory;
+    bool unitsListenOnly = false;
+    Sampler *sampler = nullptr;
+
+    void watch(int fd, Handler *handler, uint32_t events);
+    void modify(int fd, Handler *handler, uint32_t events);
+    void dispatch(int timeoutMs);
+    void runFor(unsigned long ms, Unit *busy);
+    void publish(Unit &unit);
+    void record(Unit &unit, const byte *packet, unsigned int length);
+    void sample();
+    void streamTelemetry(Unit &unit);
+    void unsubscribe(Client &client);
+    void command(Client &client, char *line);
+    void queryHistory(Client &client, char *arguments);
+    void reapClients();
+};
@@ -0,0 +1,84 @@
+#include <HardwareSerial.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+HardwareSerial::HardwareSerial(const char *device) : path(device) {
+}
+
+HardwareSerial::~HardwareSerial() {
+    end();
+}
+
+bool HardwareSerial::open() {
+    if (descriptor < 0) {
+        descriptor = ::open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    }
+    return descriptor >= 0;
+}
+
+void HardwareSerial::begin(unsigned long baud, uint32_t config) {
+    (void) config; // always 8E1 for CN105
+    if (!open()) return;
+
+    termios tty;
+    if (tcgetattr(descriptor, &tty) != 0) return;
+    cfmakeraw(&tty);
+    tty.c_cflag |= CLOCAL | CREAD | PARENB;
+    tty.c_cflag &= ~(PARODD | CSTOPB);
+    tty.c_cc[VMIN] = 0;
+    tty.c_cc[VTIME] = 0;
+    const speed_t speed = baud == 9600 ? B9600 : B2400;
+    cfsetispeed(&tty, speed);
+    cfsetospeed(&tty, speed);
+    tcsetattr(descriptor, TCSANOW, &tty);
+    tcflush(descriptor, TCIOFLUSH);
+    head = count = 0;
+}
+
+void HardwareSerial::end() {
+    if (descriptor >= 0) {
+        close(descriptor);
+        descriptor = -1;
+    }
+}
+
+void HardwareSerial::fill() {
+    if (descriptor < 0 || count == BUFFER_LEN) return;
+    if (head > 0) {
+        memmove(buffer, buffer + head, count);
+        head = 0;
+    }
+    const ssize_t received = ::read(descriptor, buffer + count, BUFFER_LEN - count);
+    if (received > 0) {
+        count += received;
+    }
+}
+
+int HardwareSerial::available() {
+    fill();
+    return count;
+}
+
+int HardwareSerial::read() {
+    if (count == 0) fill();
+    if (count == 0) return -1;
+    count--;
+    return buffer[head++];
+}
+
+int HardwareSerial::peek(int offset) {
+    if (offset >= count) fill();
+    return offset < count ? buffer[head + offset] : -1;
+}
+
+size_t HardwareSerial::write(uint8_t b) {
+    if (descriptor < 0) return 0;
+    for (;;) {
+        const ssize_t written = ::write(descriptor, &b, 1);
+        if (written == 1) return 1;
+        if (written < 0 && errno != EAGAIN && errno != EINTR) return 0;
+        ::delay(1); // the tty output buffer is full, frames are tiny so this is rare
+    }
+}
@@ -0,0 +1,171 @@
+#include "Analysis.h"
+#include "../Capture.h"
+#include <string.h>
+
+static const char *typeName(int type) {
+    switch (type) {
+        case CAPTURE_MARK_TYPE: return "gateway mark";
+        case 0x5a: return "connect";
+        case 0x7a: return "connect ack";
+        case 0x41: return "set";
+        case 0x61: return "set ack";
+        case 0x42: return "info request";
+        case 0x62: return "info reply";
+        default: return "unknown";
+    }
+}
+
+static const char *infoName(int code) {
+    switch (code) {
+        case 0x02: return "settings";
+        case 0x03: return "room temperature";
+        case 0x04: return "unknown";
+        case 0x05: return "timers";
+        case 0x06: return "status";
+        case 0x09: return "standby";
+        case 0x20:
+        case 0x22: return "functions";
+        default: return "other";
+    }
+}
+
+void Analysis::Histogram::add(uint32_t ms) {
+    buckets[ms < (uint32_t) MAX_LATENCY_MS ? ms : MAX_LATENCY_MS]++;
+    count++;
+    sum += ms;
+    if (ms > max) max = ms;
+}
+
+uint32_t Analysis::Histogram::percentile(double fraction) const {
+    const uint64_t rank = (uint64_t) (fraction * (double) (count - 1));
+    uint64_t seen = 0;
+    for (int ms = 0; ms <= MAX_LATENCY_MS; ms++) {
+        seen += buckets[ms];
+        if (seen > rank) return ms == MAX_LATENCY_MS ? max : (uint32_t) ms;
+    }
+    return max;
+}
+
+Analysis::Analysis() : units(1) {
+}
+
+void Analysis::add(const FrameScanner::Frame *batch, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        addFrame(batch[i].data, batch[i].length);
+    }
+}
+
+void Analysis::addFrame(const uint8_t *frame, int length) {
+    const int type = frame[1];
+    typeCounts[type]++;
+
+    if (isCaptureMark(frame, length)) {
+        const uint32_t time = captureMarkTime(frame);
+        now = timed ? now + (uint32_t) (time - lastMark) : 0;
+        lastMark = time;
+        timed = true;
+        marked = true;
+        unit = frame[5];
+        if (unit >= (int) units.size()) units.resize(unit + 1);
+        marks++;
+        return;
+    }
+
+    frames++;
+    const bool frameTimed = marked;
+    const int frameUnit = marked ? unit : 0;
+    marked = false;
+    UnitState &state = units[frameUnit];
+
+    switch (type) {
+        case 0x5a:
+        case 0x41:
+        case 0x42: {
+            int kind = type == 0x5a ? KIND_CONNECT : KIND_SET;
+            if (type == 0x42) {
+                requestInfoCounts[frame[5]]++;
+                kind = KIND_INFO + frame[5];
+            }
+            state.pending = kind;
+            state.sentAt = now;
+            state.sentTimed = frameTimed;
+            break;
+        }
+        case 0x7a:
+        case 0x61:
+        case 0x62: {
+            if (state.pending >= 0 && state.sentTimed && frameTimed) {
+                std::unique_ptr<Histogram> &histogram = latency[state.pending];
+                if (!histogram) histogram.reset(new Histogram());
+                histogram->add((uint32_t) (now - state.sentAt));
+            }
+            state.pending = -1;
+
+            if (type != 0x62) break;
+            replyInfoCounts[frame[5]]++;
+            const uint8_t *data = frame + 5;
+            if (data[0] != 0x02 || length != 22) break;
+            if (state.haveSettings && memcmp(state.settingsBytes, data, 16) == 0) break;
+            memcpy(state.settingsBytes, data, 16);
+
+            const heatpumpSettings settings = HeatPump::parseSettings(data);
+            if (!state.haveSettings || settings != state.settings) {
+                changes.push_back(Change{frameTimed ? now : frames, frameTimed, frameUnit, settings});
+            }
+            state.settings = settings;
+            state.haveSettings = true;
+            break;
+        }
+    }
+}
+
+const char *Analysis::kindName(int kind, char *buffer, size_t size) {
+    if (kind == KIND_CONNECT) return "connect";
+    if (kind == KIND_SET) return "set";
+    snprintf(buffer, size, "info %02x %s", kind - KIND_INFO, infoName(kind - KIND_INFO));
+    return buffer;
+}
+
+void Analysis::report(FILE *out) const {
+    fprintf(out, "\nframes by type\n");
+    for (int type = 0; type < 256; type++) {
+        if (!typeCounts[type]) continue;
+        fprintf(out, "  %02x %-20s %12llu\n", type, typeName(type), (unsigned long long) typeCounts[type]);
+        const uint64_t *byCode = type == 0x42 ? requestInfoCounts : type == 0x62 ? replyInfoCounts : nullptr;
+        for (int code = 0; byCode && code < 256; code++) {
+            if (byCode[code]) {
+                fprintf(out, "     %02x %-17s %12llu\n", code, infoName(code), (unsigned long long) byCode[code]);
+            }
+        }
+    }
+
+    fprintf(out, "\nreply latency (ms)\n");
+    if (!marks) {
+        fprintf(out, "  no gateway marks, a raw capture has no timing\n");
+    } else {
+        fprintf(out, "  %-24s %10s %6s %6s %6s %6s %6s\n", "request", "replies", "mean", "p50", "p90", "p99", "max");
+        char name[40];
+        for (int kind = 0; kind < KINDS; kind++) {
+            const Histogram *histogram = latency[kind].get();
+            if (!histogram) continue;
+            fprintf(out, "  %-24s %10llu %6llu %6u %6u %6u %6u\n", kindName(kind, name, sizeof(name)),
+                    (unsigned long long) histogram->count, (unsigned long long) (histogram->sum / histogram->count),
+                    histogram->percentile(0.5), histogram->percentile(0.9), histogram->percentile(0.99),
+                    histogram->max);
+        }
+    }
+
+    fprintf(out, "\nsettings changes\n");
+    for (const Change &change : changes) {
+        char temperature[12];
+        change.settings.temperature.toString(temperature, sizeof(temperature));
+        if (change.timed) {
+            fprintf(out, "  %+12.3fs", change.at / 1000.0);
+        } else {
+            fprintf(out, "  frame %8llu", (unsigned long long) change.at);
+        }
+        fprintf(out, "  unit %d  power=%s mode=%s temp=%s fan=%s vane=%s wideVane=%s%s\n", change.unit,
+                change.settings.power, change.settings.mode, temperature, change.settings.fan, change.settings.vane,
+                change.settings.wideVane, change.settings.iSee ? " iSee" : "");
+    }
+}
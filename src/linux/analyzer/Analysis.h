@@ -0,0 +1,73 @@
+#pragma once
+#include "FrameScanner.h"
+#include <HeatPump.h>
+#include <stdio.h>
+#include <memory>
+#include <vector>
+
+/**
+ * Statistics over the frames of one or more captures, fed in order by FrameScanner.
+ *
+ * Counts frames by type (and by info code for 0x42/0x62). With gateway captures, the mark before each frame
+ * gives the unit and time. That yields per-request reply latency histograms and a timeline of settings
+ * changes. Raw UART captures have no marks: every frame is unit 0, latencies are skipped and the timeline
+ * is positioned by frame number. Settings replies are only decoded, with HeatPump::parseSettings(), when
+ * their bytes differ from the unit's previous reply.
+ */
+class Analysis {
+public:
+    Analysis();
+
+    void add(const FrameScanner::Frame *frames, size_t count);
+    void report(FILE *out) const;
+
+private:
+    static const int MAX_LATENCY_MS = 4000; // the last bucket holds everything slower
+    static const int MAX_UNITS = 256;
+    enum { KIND_CONNECT, KIND_SET, KIND_INFO, KINDS = KIND_INFO + 256 }; // KIND_INFO + info code
+
+    struct Histogram {
+        uint64_t buckets[MAX_LATENCY_MS + 1] = {};
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        uint32_t max = 0;
+
+        void add(uint32_t ms);
+        uint32_t percentile(double fraction) const;
+    };
+
+    struct UnitState {
+        int pending = -1; // kind of the request awaiting its reply
+        uint64_t sentAt = 0;
+        bool sentTimed = false;
+        uint8_t settingsBytes[16];
+        bool haveSettings = false;
+        heatpumpSettings settings;
+    };
+
+    struct Change {
+        uint64_t at; // ms since the first mark, or the frame number without marks
+        bool timed;
+        int unit;
+        heatpumpSettings settings;
+    };
+
+    uint64_t frames = 0;
+    uint64_t marks = 0;
+    uint64_t typeCounts[256] = {};
+    uint64_t requestInfoCounts[256] = {};
+    uint64_t replyInfoCounts[256] = {};
+    std::unique_ptr<Histogram> latency[KINDS];
+    std::vector<UnitState> units;
+    std::vector<Change> changes;
+
+    // the mark just seen applies to the next frame only
+    bool marked = false;
+    int unit = 0;
+    bool timed = false; // a mark has been seen, now is valid
+    uint32_t lastMark = 0;
+    uint64_t now = 0;   // ms since the first mark, carried across the 32 bit millis() wrap
+
+    void addFrame(const uint8_t *frame, int length);
+    static const char *kindName(int kind, char *buffer, size_t size);
+};
@@ -0,0 +1,238 @@
+#include "FrameScanner.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FRAME_SCANNER_X86
+#endif
+
+static const uint8_t START = 0xfc;
+static const int MAX_DATA_LEN = 16; // the longest frame the library sends or reads is 22 bytes
+static const int MAX_FRAME_LEN = MAX_DATA_LEN + 6;
+static const int SUM_WINDOW = 32;   // bytes loaded per candidate by the vector checksums
+
+// masks[n] keeps the first n bytes of a 32 byte window
+struct WindowMasks {
+    alignas(32) uint8_t masks[MAX_FRAME_LEN + 1][SUM_WINDOW];
+
+    WindowMasks() {
+        for (int n = 0; n <= MAX_FRAME_LEN; n++) {
+            for (int i = 0; i < SUM_WINDOW; i++) masks[n][i] = i < n ? 0xff : 0x00;
+        }
+    }
+};
+static const WindowMasks windowMasks;
+
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+// the fc ?? 01 30 header prefix, checked with one 32 bit load
+static const bool LITTLE_ENDIAN_HOST = __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+static const uint32_t HEADER_MASK = LITTLE_ENDIAN_HOST ? 0xffff00ff : 0xff00ffff;
+static const uint32_t HEADER_WORD = LITTLE_ENDIAN_HOST ? 0x300100fc : 0xfc000130;
+
+// Collect kernels: write the offset of every 0xfc in p[begin, end) to out, return the count.
+
+static ALWAYS_INLINE size_t collectScalar(const uint8_t *p, size_t begin, size_t end, uint32_t *out) {
+    size_t count = 0;
+    for (size_t i = begin; i < end; i++) {
+        out[count] = (uint32_t) i;
+        count += p[i] == START; // branchless, starts are frequent in real traffic
+    }
+    return count;
+}
+
+static ALWAYS_INLINE size_t emitBits(uint64_t bits, size_t base, uint32_t *out, size_t count) {
+    while (bits) {
+        out[count++] = (uint32_t) (base + __builtin_ctzll(bits));
+        bits &= bits - 1;
+    }
+    return count;
+}
+
+// Checksums: a frame is valid when all its bytes, checksum included, sum to 0xfc (mod 256).
+
+struct ScalarSum {
+    static ALWAYS_INLINE unsigned sum(const uint8_t *frame, int length) {
+        unsigned sum = 0;
+        for (int i = 0; i < length; i++) sum += frame[i];
+        return sum;
+    }
+};
+
+/**
+ * Checks the candidates of one block in order and writes the valid frames to frames. Frames don't overlap,
+ * so a candidate inside the previous frame is skipped; next is the first byte after the last frame and
+ * carries over between blocks. A frame may run past the block but not past end.
+ */
+template<class Sum>
+static ALWAYS_INLINE size_t validate(const uint8_t *block, const uint8_t *end, const uint32_t *candidates,
+                                     size_t count, const uint8_t *&next, FrameScanner::Frame *frames,
+                                     FrameScanner::Totals &totals) {
+    // work on locals, the uint8_t stores into frames could alias next and totals and force reloads
+    const uint8_t *after = next;
+    uint64_t badChecksums = 0;
+    uint64_t strayBytes = 0;
+    size_t found = 0;
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t *frame = block + candidates[i];
+        if (frame < after) continue;
+        const size_t left = (size_t) (end - frame);
+        if (left < 6) break;
+        uint32_t header;
+        memcpy(&header, frame, sizeof(header));
+        if ((header & HEADER_MASK) != HEADER_WORD || frame[4] > MAX_DATA_LEN) continue;
+        const int length = frame[4] + 6;
+        if (left < (size_t) length) continue;
+
+        const unsigned sum = left >= (size_t) SUM_WINDOW ? Sum::sum(frame, length) : ScalarSum::sum(frame, length);
+        if ((sum & 0xff) != START) {
+            badChecksums++;
+            continue;
+        }
+        strayBytes += (uint64_t) (frame - after);
+        after = frame + length;
+        frames[found].data = frame;
+        frames[found].length = (uint8_t) length;
+        found++;
+    }
+    next = after;
+    totals.badChecksums += badChecksums;
+    totals.strayBytes += strayBytes;
+    return found;
+}
+
+static size_t collectBlockScalar(const uint8_t *p, size_t n, uint32_t *out) {
+    return collectScalar(p, 0, n, out);
+}
+
+static size_t validateBlockScalar(const uint8_t *block, const uint8_t *end, const uint32_t *candidates, size_t count,
+                                  const uint8_t *&next, FrameScanner::Frame *frames, FrameScanner::Totals &totals) {
+    return validate<ScalarSum>(block, end, candidates, count, next, frames, totals);
+}
+
+#ifdef FRAME_SCANNER_X86
+#define SSE2_TARGET __attribute__((target("sse2")))
+#define AVX2_TARGET __attribute__((target("avx2")))
+// the validate template can't carry a target, flatten pulls it and the checksum into the targeted caller
+#define FLATTEN __attribute__((flatten))
+
+SSE2_TARGET static ALWAYS_INLINE uint64_t startBits16(const uint8_t *p, __m128i start) {
+    return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) p), start));
+}
+
+SSE2_TARGET static size_t collectBlockSse2(const uint8_t *p, size_t n, uint32_t *out) {
+    const __m128i start = _mm_set1_epi8((char) START);
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        const uint64_t bits = startBits16(p + i, start) | startBits16(p + i + 16, start) << 16 |
+                              startBits16(p + i + 32, start) << 32 | startBits16(p + i + 48, start) << 48;
+        count = emitBits(bits, i, out, count);
+    }
+    return count + collectScalar(p, i, n, out + count);
+}
+
+struct Sse2Sum {
+    SSE2_TARGET static inline unsigned sum(const uint8_t *frame, int length) {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i low = _mm_and_si128(_mm_loadu_si128((const __m128i *) frame),
+                                          _mm_load_si128((const __m128i *) windowMasks.masks[length]));
+        const __m128i high = _mm_and_si128(_mm_loadu_si128((const __m128i *) (frame + 16)),
+                                           _mm_load_si128((const __m128i *) (windowMasks.masks[length] + 16)));
+        const __m128i sums = _mm_add_epi64(_mm_sad_epu8(low, zero), _mm_sad_epu8(high, zero));
+        return (unsigned) (_mm_cvtsi128_si32(sums) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(sums, sums)));
+    }
+};
+
+SSE2_TARGET FLATTEN static size_t validateBlockSse2(const uint8_t *block, const uint8_t *end,
+                                                   const uint32_t *candidates, size_t count, const uint8_t *&next,
+                                                   FrameScanner::Frame *frames, FrameScanner::Totals &totals) {
+    return validate<Sse2Sum>(block, end, candidates, count, next, frames, totals);
+}
+
+AVX2_TARGET static ALWAYS_INLINE uint64_t startBits32(const uint8_t *p, __m256i start) {
+    return (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) p), start));
+}
+
+AVX2_TARGET static size_t collectBlockAvx2(const uint8_t *p, size_t n, uint32_t *out) {
+    const __m256i start = _mm256_set1_epi8((char) START);
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        const uint64_t bits = startBits32(p + i, start) | startBits32(p + i + 32, start) << 32;
+        count = emitBits(bits, i, out, count);
+    }
+    return count + collectScalar(p, i, n, out + count);
+}
+
+struct Avx2Sum {
+    AVX2_TARGET static inline unsigned sum(const uint8_t *frame, int length) {
+        const __m256i bytes = _mm256_and_si256(_mm256_loadu_si256((const __m256i *) frame),
+                                               _mm256_load_si256((const __m256i *) windowMasks.masks[length]));
+        const __m256i lanes = _mm256_sad_epu8(bytes, _mm256_setzero_si256());
+        const __m128i sums = _mm_add_epi64(_mm256_castsi256_si128(lanes), _mm256_extracti128_si256(lanes, 1));
+        return (unsigned) (_mm_cvtsi128_si32(sums) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(sums, sums)));
+    }
+};
+
+AVX2_TARGET FLATTEN static size_t validateBlockAvx2(const uint8_t *block, const uint8_t *end,
+                                                   const uint32_t *candidates, size_t count, const uint8_t *&next,
+                                                   FrameScanner::Frame *frames, FrameScanner::Totals &totals) {
+    return validate<Avx2Sum>(block, end, candidates, count, next, frames, totals);
+}
+#endif
+
+FrameScanner::Level FrameScanner::best() {
+#ifdef FRAME_SCANNER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return AVX2;
+    if (__builtin_cpu_supports("sse2")) return SSE2;
+#endif
+    return SCALAR;
+}
+
+const char *FrameScanner::name(Level level) {
+    switch (level) {
+        case AVX2: return "avx2";
+        case SSE2: return "sse2";
+        default: return "scalar";
+    }
+}
+
+FrameScanner::FrameScanner(Level level) : level(level > best() ? best() : level) {
+    candidates = new uint32_t[BLOCK];
+    frames = new Frame[BLOCK / 6 + 1];
+}
+
+FrameScanner::~FrameScanner() {
+    delete[] candidates;
+    delete[] frames;
+}
+
+FrameScanner::Totals FrameScanner::scan(const uint8_t *data, size_t length, const Sink &sink) {
+    size_t (*collect)(const uint8_t *, size_t, uint32_t *) = collectBlockScalar;
+    size_t (*check)(const uint8_t *, const uint8_t *, const uint32_t *, size_t, const uint8_t *&, Frame *, Totals &) =
+            validateBlockScalar;
+#ifdef FRAME_SCANNER_X86
+    if (level == AVX2) {
+        collect = collectBlockAvx2;
+        check = validateBlockAvx2;
+    } else if (level == SSE2) {
+        collect = collectBlockSse2;
+        check = validateBlockSse2;
+    }
+#endif
+
+    Totals totals;
+    const uint8_t *end = data + length;
+    const uint8_t *next = data;
+    for (size_t offset = 0; offset < length; offset += BLOCK) {
+        const size_t size = length - offset < BLOCK ? length - offset : BLOCK;
+        const size_t count = collect(data + offset, size, candidates);
+        const size_t found = check(data + offset, end, candidates, count, next, frames, totals);
+        totals.frames += found;
+        if (found) sink(frames, found);
+    }
+    totals.strayBytes += (uint64_t) (end - next);
+    return totals;
+}
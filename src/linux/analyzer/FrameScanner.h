@@ -0,0 +1,50 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+
+/**
+ * Finds the CN105 frames in a byte buffer: a 0xfc start, the 01 30 header bytes, a length that fits a
+ * frame and a matching checksum. Bytes outside valid frames are counted as stray.
+ *
+ * The buffer is scanned in blocks. For each block a kernel first collects every 0xfc offset, comparing
+ * 16 or 32 bytes at a time with SSE2/AVX2. The candidates are then checked in one pass that skips those
+ * inside the previous frame; the checksum is one masked SAD over the frame's bytes. Keeping the two
+ * passes apart keeps the compare loop free of the frame-to-frame dependency. Valid frames are handed
+ * over a block at a time.
+ */
+class FrameScanner {
+public:
+    enum Level { SCALAR, SSE2, AVX2 };
+
+    struct Frame {
+        const uint8_t *data;
+        uint8_t length;
+    };
+
+    struct Totals {
+        uint64_t frames = 0;
+        uint64_t badChecksums = 0; // plausible header, wrong checksum
+        uint64_t strayBytes = 0;   // not part of any valid frame
+    };
+
+    typedef std::function<void(const Frame *frames, size_t count)> Sink;
+
+    static Level best(); // the widest level this CPU supports
+    static const char *name(Level level);
+
+    explicit FrameScanner(Level level = best());
+    ~FrameScanner();
+
+    Totals scan(const uint8_t *data, size_t length, const Sink &sink);
+
+private:
+    static const size_t BLOCK = 64 * 1024;
+
+    Level level;
+    uint32_t *candidates; // BLOCK entries, one per byte at worst
+    Frame *frames;        // BLOCK / 6 + 1 entries, frames are at least 6 bytes and may start in the block
+
+    FrameScanner(const FrameScanner &) = delete;
+    FrameScanner &operator=(const FrameScanner &) = delete;
+};
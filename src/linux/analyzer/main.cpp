@@ -0,0 +1,258 @@
+/*
+ * Offline analysis of recorded CN105 traffic.
+ *
+ *   heatpump-analyzer [-l scalar|sse2|avx2] capture...
+ *   heatpump-analyzer -b [-m MiB]
+ *
+ * Captures are memory-mapped and scanned with FrameScanner, see Analysis for what is reported. They are
+ * read in the given order as one stream, e.g. a week of rotated gateway captures. -b runs the throughput
+ * benchmark on a synthetic capture held in memory.
+ */
+#include "Analysis.h"
+#include "../Capture.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static double seconds() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static bool parseLevel(const char *name, FrameScanner::Level &level) {
+    for (int candidate = FrameScanner::SCALAR; candidate <= FrameScanner::AVX2; candidate++) {
+        if (strcmp(name, FrameScanner::name((FrameScanner::Level) candidate)) == 0) {
+            level = (FrameScanner::Level) candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool analyze(const char *path, FrameScanner &scanner, Analysis &analysis, FrameScanner::Totals &totals,
+                    uint64_t &bytes) {
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    const size_t length = (size_t) info.st_size;
+    if (length == 0) {
+        close(fd);
+        return true;
+    }
+
+    void *mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) return false;
+    madvise(mapping, length, MADV_SEQUENTIAL | MADV_WILLNEED);
+
+    const FrameScanner::Totals file = scanner.scan((const uint8_t *) mapping, length,
+            [&analysis](const FrameScanner::Frame *frames, size_t count) { analysis.add(frames, count); });
+    totals.frames += file.frames;
+    totals.badChecksums += file.badChecksums;
+    totals.strayBytes += file.strayBytes;
+    bytes += length;
+
+    munmap(mapping, length);
+    return true;
+}
+
+// Benchmark ////
+
+static void appendFrame(std::vector<uint8_t> &out, uint8_t type, const uint8_t *data, int length) {
+    const uint8_t header[5] = {0xfc, type, 0x01, 0x30, (uint8_t) length};
+    int sum = 0;
+    for (int i = 0; i < 5; i++) {
+        out.push_back(header[i]);
+        sum += header[i];
+    }
+    for (int i = 0; i < length; i++) {
+        out.push_back(data[i]);
+        sum += data[i];
+    }
+    out.push_back((uint8_t) ((0xfc - sum) & 0xff));
+}
+
+static void appendMark(std::vector<uint8_t> &out, int unit, uint32_t ms) {
+    uint8_t mark[CAPTURE_MARK_LEN];
+    captureMark(mark, unit, ms);
+    out.insert(out.end(), mark, mark + CAPTURE_MARK_LEN);
+}
+
+/*
+ * Two units polled like the gateway does: marked info request/reply pairs cycling through settings, room
+ * temperature and status, a set every 1000 exchanges and a few stray bytes every 500.
+ */
+static std::vector<uint8_t> syntheticCapture(size_t size) {
+    std::vector<uint8_t> capture;
+    capture.reserve(size + 256);
+    static const uint8_t CODES[3] = {0x02, 0x03, 0x06};
+    uint32_t ms = 0xfff00000; // crosses the millis() wrap
+    uint32_t random = 1;
+    uint8_t temperature = 22 * 2 + 128;
+
+    for (uint64_t exchange = 0; capture.size() < size; exchange++) {
+        random = random * 1103515245 + 12345;
+        const int unit = (int) (exchange & 1);
+        uint8_t data[16] = {};
+
+        if (exchange % 1000 == 999) {
+            temperature = (uint8_t) (temperature == 22 * 2 + 128 ? 23 * 2 + 128 : 22 * 2 + 128);
+            data[0] = 0x01;
+            data[1] = 0x04;
+            data[14] = temperature;
+            appendMark(capture, unit, ms);
+            appendFrame(capture, 0x41, data, 16);
+            appendMark(capture, unit, ms + 120 + (random >> 28));
+            memset(data, 0, sizeof(data));
+            appendFrame(capture, 0x61, data, 16);
+        } else {
+            const uint8_t code = CODES[exchange % 3];
+            data[0] = code;
+            appendMark(capture, unit, ms);
+            appendFrame(capture, 0x42, data, 16);
+            if (code == 0x02) {
+                data[3] = 0x01;
+                data[4] = 0x01;
+                data[10] = 0x03;
+                data[11] = temperature;
+            } else if (code == 0x03) {
+                data[3] = 0x0b;
+                data[6] = 21 * 2 + 128;
+            } else {
+                data[3] = 30;
+                data[4] = 1;
+            }
+            appendMark(capture, unit, ms + 60 + (random >> 26));
+            appendFrame(capture, 0x62, data, 16);
+        }
+        if (exchange % 500 == 250) {
+            capture.push_back((uint8_t) (random >> 8));
+            capture.push_back(0xfc);
+        }
+        ms += 300;
+    }
+    capture.resize(size);
+    return capture;
+}
+
+static void benchmark(size_t mib) {
+    const size_t size = mib << 20;
+    const std::vector<uint8_t> capture = syntheticCapture(size);
+    const uint8_t *data = capture.data();
+    const int RUNS = 3;
+
+    printf("synthetic capture: %zu MiB\n", mib);
+    printf("  %-28s %8s %8s\n", "pass", "GB/s", "ms");
+    const auto print = [size](const char *pass, double best) {
+        printf("  %-28s %8.2f %8.1f\n", pass, size / best / 1e9, best * 1e3);
+    };
+
+    // memory bandwidth reference: read every byte once
+    double best = 1e9;
+    uint64_t checksum = 0;
+    for (int run = 0; run < RUNS; run++) {
+        const double start = seconds();
+        uint64_t sum = 0;
+        const uint64_t *words = (const uint64_t *) data;
+        for (size_t i = 0; i < size / 8; i++) sum += words[i];
+        best = std::min(best, seconds() - start);
+        checksum += sum;
+    }
+    print("read (memory bandwidth)", best);
+
+    FrameScanner::Totals totals;
+    for (int level = FrameScanner::SCALAR; level <= FrameScanner::best(); level++) {
+        FrameScanner scanner((FrameScanner::Level) level);
+        best = 1e9;
+        for (int run = 0; run < RUNS; run++) {
+            uint64_t frames = 0;
+            const double start = seconds();
+            totals = scanner.scan(data, size, [&frames](const FrameScanner::Frame *, size_t count) { frames += count; });
+            best = std::min(best, seconds() - start);
+            checksum += frames;
+        }
+        char pass[40];
+        snprintf(pass, sizeof(pass), "scan %s", FrameScanner::name((FrameScanner::Level) level));
+        print(pass, best);
+    }
+
+    FrameScanner scanner;
+    best = 1e9;
+    for (int run = 0; run < RUNS; run++) {
+        Analysis analysis;
+        const double start = seconds();
+        scanner.scan(data, size, [&analysis](const FrameScanner::Frame *frames, size_t count) {
+            analysis.add(frames, count);
+        });
+        best = std::min(best, seconds() - start);
+    }
+    char pass[40];
+    snprintf(pass, sizeof(pass), "scan %s + analysis", FrameScanner::name(FrameScanner::best()));
+    print(pass, best);
+
+    printf("  %llu frames, %llu bad checksums, %llu stray bytes (check %llx)\n", (unsigned long long) totals.frames,
+           (unsigned long long) totals.badChecksums, (unsigned long long) totals.strayBytes,
+           (unsigned long long) (checksum & 0xff));
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "usage: %s [-l scalar|sse2|avx2] capture...\n"
+                    "       %s -b [-m MiB]   throughput benchmark on a synthetic capture (default 1024 MiB)\n",
+            program, program);
+}
+
+int main(int argc, char **argv) {
+    FrameScanner::Level level = FrameScanner::best();
+    bool bench = false;
+    size_t benchMib = 1024;
+    int option;
+    while ((option = getopt(argc, argv, "l:bm:h")) != -1) {
+        if (option == 'l' && parseLevel(optarg, level)) {
+            continue;
+        } else if (option == 'b') {
+            bench = true;
+        } else if (option == 'm') {
+            benchMib = strtoul(optarg, nullptr, 10);
+        } else {
+            usage(argv[0]);
+            return option == 'h' ? 0 : 2;
+        }
+    }
+
+    if (bench) {
+        benchmark(benchMib ? benchMib : 1);
+        return 0;
+    }
+    if (optind == argc) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    FrameScanner scanner(level);
+    Analysis analysis;
+    FrameScanner::Totals totals;
+    uint64_t bytes = 0;
+    const double start = seconds();
+    for (int i = optind; i < argc; i++) {
+        if (!analyze(argv[i], scanner, analysis, totals, bytes)) {
+            fprintf(stderr, "can't read %s\n", argv[i]);
+            return 1;
+        }
+    }
+    const double elapsed = seconds() - start;
+
+    printf("%llu bytes in %.3f s (%.2f GB/s, %s): %llu frames, %llu bad checksums, %llu stray bytes\n",
+           (unsigned long long) bytes, elapsed, elapsed > 0 ? bytes / elapsed / 1e9 : 0.0,
+           FrameScanner::name(level > FrameScanner::best() ? FrameScanner::best() : level),
+           (unsigned long long) totals.frames, (unsigned long long) totals.badChecksums,
+           (unsigned long long) totals.strayBytes);
+    analysis.report(stdout);
+    return 0;
+}
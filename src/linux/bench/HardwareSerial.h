@@ -0,0 +1,58 @@
+#pragma once
+/*
+ * In-memory HardwareSerial for the codec benchmark, found before the termios one in linux/compat.
+ * A complete request frame written to it is answered at once by a SimulatedUnit, so HeatPump never
+ * waits on the wire and a benchmark loop only measures the library.
+ */
+#include <Arduino.h>
+#include "../simulator/SimulatedUnit.h"
+
+#define SERIAL_8E1 0x800001e
+
+class HardwareSerial {
+public:
+    SimulatedUnit unit;
+    unsigned long long nowMs = 0; // for the status reply's compressor cycle
+    unsigned long bytesWritten = 0;
+    unsigned long calls = 0; // available(), read() and write(), what a template transport would inline
+
+    void begin(unsigned long baud, uint32_t config) {
+        (void) baud;
+        (void) config;
+    }
+    void end() {
+    }
+
+    int available() {
+        calls++;
+        return count - head;
+    }
+
+    int read() {
+        calls++;
+        return head < count ? reply[head++] : -1;
+    }
+
+    size_t write(uint8_t b) {
+        calls++;
+        bytesWritten++;
+        if (received == 0 && b != 0xfc) return 1;
+        request[received++] = b;
+        if (received >= 5 && received == request[4] + 6) {
+            // the previous reply is consumed by now, HeatPump reads a reply before the next request
+            count = unit.reply(request, reply, nowMs);
+            head = 0;
+            received = 0;
+        } else if (received == (int) sizeof(request)) {
+            received = 0;
+        }
+        return 1;
+    }
+
+private:
+    uint8_t request[FRAME_LEN + 2];
+    int received = 0;
+    uint8_t reply[FRAME_LEN + 2];
+    int head = 0;
+    int count = 0;
+};
@@ -0,0 +1,468 @@
+/*
+ * Codec microbenchmarks for the HeatPump protocol paths, against an in-memory unit (see HardwareSerial.h).
+ *
+ *   heatpump-bench [-n scale] [filter]
+ *
+ * Prints ns/op and heap allocations/op for each case whose name contains filter. Time is virtual, so
+ * the library never sleeps; -n multiplies the iteration counts. The private encoders (createPacket,
+ * createInfoPacket, prepareSetPacket, checkSum) and the lookupByteMap helpers are measured through the
+ * public calls that use them. The "float" temperature cases are the conversions heatpumpTemperature replaced,
+ * kept here to compare against; on the ESP32 their double math (the 1.8) runs in software. The coroutine
+ * cases resume workflows shaped like ThermostatController's, see Workflows.
+ *
+ * It prints which build of HeatPump it runs: pio run -e linux_bench is the full one, -e linux_bench_minimal
+ * the controller's, with the HEATPUMP_NO_* flags. The "calls" cases count what a frame exchange calls through
+ * heatpumpClock (virtual) and the serial, and time one virtual clock call, for what inlining them would save.
+ */
+#include <HeatPump.h>
+#include <Coroutine.h>
+#include <chrono>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static unsigned long allocations = 0;
+
+void *operator new(size_t size) {
+    allocations++;
+    if (void *p = malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+#if defined(HEATPUMP_NO_FUNCTIONS) && defined(HEATPUMP_NO_CUSTOM_PACKET) && defined(HEATPUMP_NO_PACKET_CALLBACK)
+static const char BUILD[] = "minimal (HEATPUMP_NO_FUNCTIONS, HEATPUMP_NO_CUSTOM_PACKET, HEATPUMP_NO_PACKET_CALLBACK)";
+#elif defined(HEATPUMP_NO_FUNCTIONS) || defined(HEATPUMP_NO_CUSTOM_PACKET) || defined(HEATPUMP_NO_PACKET_CALLBACK)
+static const char BUILD[] = "partial";
+#else
+static const char BUILD[] = "full";
+#endif
+
+static unsigned long scale = 1;
+static const char *filter = nullptr;
+static volatile int sink; // keeps results from being optimized away
+
+template<typename Op>
+static void run(const char *name, unsigned long iterations, Op op) {
+    if (filter && !strstr(name, filter)) return;
+    iterations *= scale;
+    for (unsigned long i = 0; i < iterations / 10 + 1; i++) op(i); // warm up
+
+    const unsigned long allocationsBefore = allocations;
+    const auto start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < iterations; i++) op(i);
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    const double ns = std::chrono::duration<double, std::nano>(elapsed).count();
+    printf("%-36s %10.1f ns/op %8.2f allocs/op %10lu ops\n", name, ns / iterations,
+           (double) (allocations - allocationsBefore) / iterations, iterations);
+}
+
+// the virtual clock, counting the calls HeatPump makes through heatpumpClock
+struct CountingClock : heatpumpVirtualClock {
+    unsigned long calls = 0;
+
+    explicit CountingClock(uint32_t start) : heatpumpVirtualClock(start) {}
+
+    uint32_t millis() override {
+        calls++;
+        return heatpumpVirtualClock::millis();
+    }
+    void delay(uint32_t ms) override {
+        calls++;
+        heatpumpVirtualClock::delay(ms);
+    }
+};
+
+/*
+ * A connected HeatPump on the in-memory unit, with the settings read once. Each exchange first moves
+ * the virtual clock past the frame gap, so requests go out without waiting.
+ */
+struct Bench {
+    CountingClock clock {0xfffff000}; // runs through the millis() wrap
+    HardwareSerial serial;
+    HeatPump heatPump;
+
+    Bench() {
+        heatPump.setClock(&clock);
+        heatPump.connect(&serial);
+        exchange(heatPump.RQST_PKT_SETTINGS);
+    }
+
+    void settle() {
+        clock.advance(heatPump.getFrameGap() + 1);
+        serial.nowMs += heatPump.getFrameGap() + 1;
+    }
+
+    // an info request and its reply: createInfoPacket, writePacket, readPacket
+    void exchange(byte packetType) {
+        settle();
+        heatPump.sync(packetType); // sends
+        heatPump.sync(packetType); // reads the reply
+    }
+};
+
+static const int SET_FIELDS = 6;
+static const char *const SET_FIELD_NAMES[SET_FIELDS] = {"power", "mode", "temp", "fan", "vane", "wideVane"};
+
+static void benchInfo() {
+    static const struct {
+        const char *name;
+        int type;
+    } infos[] = {
+        {"info 0x02 settings", 0},
+        {"info 0x03 room temperature", 1},
+        {"info 0x05 timers", 3},
+        {"info 0x06 status", 4},
+        {"info 0x09 standby", 5},
+    };
+    for (const auto &info : infos) {
+        Bench bench;
+        run(info.name, 200000, [&](unsigned long) {
+            bench.exchange((byte) info.type);
+            // replies are cached raw until read, the getters decode them
+            sink = bench.heatPump.getSettings().temperature.halfDegrees + bench.heatPump.getStatus().compressorFrequency;
+        });
+    }
+}
+
+static void benchSteadyState() {
+    // the firmware's polling of an idle unit, with change callbacks registered like main.cpp's: a reply equal
+    // to the last one of its type is one memcmp, a changed one is decoded for the callbacks
+    static const struct {
+        const char *name;
+        int type;
+        bool changed;
+    } frames[] = {
+        {"steady 0x02 settings unchanged", 0, false},
+        {"steady 0x02 settings changed", 0, true},
+        {"steady 0x03 room temp unchanged", 1, false},
+        {"steady 0x03 room temp changed", 1, true},
+        {"steady 0x06 status unchanged", 4, false},
+        {"steady 0x06 status changed", 4, true},
+    };
+    for (const auto &frame : frames) {
+        Bench bench;
+        unsigned long callbacks = 0;
+        bench.heatPump.setSettingsChangedCallback([&]() { callbacks++; });
+        bench.heatPump.setStatusChangedCallback([&](heatpumpStatus) { callbacks++; });
+        SimulatedUnit &unit = bench.serial.unit;
+        run(frame.name, 200000, [&](unsigned long i) {
+            bench.settle();
+            // the status reply follows the compressor's minute-long cycle, hold it or step it
+            bench.serial.nowMs = frame.changed ? (i % 30) * 1000 : 55000;
+            if (frame.changed) {
+                unit.fan = (uint8_t) (i % 2);
+                unit.roomTemperature = (uint8_t) (21 * 2 + 128 + i % 2);
+            }
+            bench.heatPump.sync((byte) frame.type);
+            bench.heatPump.sync((byte) frame.type);
+            sink = (int) callbacks;
+        });
+    }
+
+    // sync()'s own rotation through the info requests, all of them unchanged
+    Bench bench;
+    bench.heatPump.setSettingsChangedCallback([]() {});
+    bench.heatPump.setStatusChangedCallback([](heatpumpStatus) {});
+    run("steady sync rotation unchanged", 200000, [&](unsigned long) {
+        bench.settle();
+        bench.serial.nowMs = 55000;
+        bench.heatPump.sync();
+        bench.heatPump.sync();
+        sink = (int) bench.serial.bytesWritten;
+    });
+}
+
+static void benchSet() {
+    // every combination of changed fields: createPacket, prepareSetPacket, checkSum, the 0x61 ack
+    for (int mask = 1; mask < (1 << SET_FIELDS); mask++) {
+        char name[80] = "set";
+        for (int field = 0; field < SET_FIELDS; field++) {
+            if (mask & (1 << field)) {
+                strcat(name, " ");
+                strcat(name, SET_FIELD_NAMES[field]);
+            }
+        }
+
+        Bench bench;
+        run(name, 20000, [&](unsigned long) {
+            // the unit's settings are never read back, so the same values differ from them every time
+            HeatPump &heatPump = bench.heatPump;
+            if (mask & 1) heatPump.setPowerSetting("OFF");
+            if (mask & 2) heatPump.setModeSetting("COOL");
+            if (mask & 4) heatPump.setTemperature(heatpumpTemperature::fromCelsius(24.5f));
+            if (mask & 8) heatPump.setFanSpeed("3");
+            if (mask & 16) heatPump.setVaneSetting("SWING");
+            if (mask & 32) heatPump.setWideVaneSetting("<<");
+            bench.settle();
+            sink = heatPump.update();
+        });
+    }
+}
+
+static void benchParse() {
+    byte settings[22], room[22], timers[22];
+    SimulatedUnit unit;
+    const byte settingsRequest[22] = {0xfc, 0x42, 0x01, 0x30, 0x10, 0x02};
+    const byte roomRequest[22] = {0xfc, 0x42, 0x01, 0x30, 0x10, 0x03};
+    const byte timersRequest[22] = {0xfc, 0x42, 0x01, 0x30, 0x10, 0x05};
+    unit.reply(settingsRequest, settings, 0);
+    unit.reply(roomRequest, room, 0);
+    unit.reply(timersRequest, timers, 0);
+
+    // the payload decoders on their own, these do the lookupByteMap* searches
+    run("parseSettings", 2000000, [&](unsigned long i) {
+        settings[5 + 4] = (byte) (1 + i % 3); // mode
+        sink = HeatPump::parseSettings(settings + 5).temperature.halfDegrees;
+    });
+    run("parseRoomTemperature", 2000000, [&](unsigned long i) {
+        room[5 + 6] = (byte) (128 + 40 + i % 8); // the half-degree byte
+        sink = HeatPump::parseRoomTemperature(room + 5).halfDegrees;
+    });
+    run("parseTimers", 2000000, [&](unsigned long i) {
+        timers[5 + 4] = (byte) (i % 64); // on minutes set, in 10 minute steps
+        sink = HeatPump::parseTimers(timers + 5).onMinutesSet;
+    });
+}
+
+// the float conversions before heatpumpTemperature, as HeatPump.cpp had them
+static byte floatToWire(float setting) {
+    setting = setting * 2;
+    setting = round(setting);
+    setting = setting / 2;
+    float temp = (setting * 2) + 128;
+    return (byte) (int) temp;
+}
+
+static float floatFromWire(byte encoded) {
+    int temp = encoded;
+    temp -= 128;
+    return (float) temp / 2;
+}
+
+static float floatFahrenheitToCelsius(int tempF) {
+    float temp = (tempF - 32) / 1.8;
+    return ((float) round(temp * 2)) / 2;
+}
+
+static int floatCelsiusToFahrenheit(float tempC) {
+    float temp = (tempC * 1.8) + 32;
+    return (int) (temp + 0.5);
+}
+
+static void benchTemperature() {
+    Bench bench;
+    HeatPump &heatPump = bench.heatPump;
+    // setpoints from 16 to 31.5, as HomeKit hands them over
+    run("temperature encode", 2000000, [&](unsigned long i) {
+        sink = heatpumpTemperature::fromCelsius(16 + (i % 32) * 0.5f).toWire();
+    });
+    run("temperature encode float", 2000000, [&](unsigned long i) {
+        sink = floatToWire(16 + (i % 32) * 0.5f);
+    });
+    run("temperature decode", 2000000, [&](unsigned long i) {
+        sink = heatpumpTemperature::fromWire((byte) (160 + i % 32)).halfDegrees;
+    });
+    run("temperature decode float", 2000000, [&](unsigned long i) {
+        sink = (int) (floatFromWire((byte) (160 + i % 32)) * 2);
+    });
+    run("temperature F to C", 2000000, [&](unsigned long i) {
+        sink = (int) (heatPump.FahrenheitToCelsius(60 + (int) (i % 30)) * 2);
+    });
+    run("temperature F to C float", 2000000, [&](unsigned long i) {
+        sink = (int) (floatFahrenheitToCelsius(60 + (int) (i % 30)) * 2);
+    });
+    run("temperature C to F", 2000000, [&](unsigned long i) {
+        sink = heatPump.CelsiusToFahrenheit(16 + (i % 32) * 0.5f);
+    });
+    run("temperature C to F float", 2000000, [&](unsigned long i) {
+        sink = floatCelsiusToFahrenheit(16 + (i % 32) * 0.5f);
+    });
+    run("temperature toString", 2000000, [&](unsigned long i) {
+        char text[8];
+        sink = heatpumpTemperature::fromHalfDegrees(32 + (int) (i % 32)).toString(text, sizeof(text));
+    });
+
+    // the whole set path for the remote temperature: convert, prepareSetPacket, checkSum, the write
+    run("setRemoteTemperature", 200000, [&](unsigned long i) {
+        bench.settle();
+        heatPump.setRemoteTemperature(heatpumpTemperature::fromHalfDegrees(32 + (int) (i % 32)));
+        sink = (int) bench.serial.bytesWritten;
+    });
+}
+
+/*
+ * ThermostatController's seven workflows (main.cpp) by what they wait on: timers, a HomeKit write, deadlines.
+ * A pass resumes each of them like its loop() does; most find their wait unchanged and return at once.
+ */
+struct Workflows {
+    heatpumpVirtualClock clock;
+    Coroutine busSync, roomTemperaturePoll, userChange, settingsPoll, historySample, scheduleTransition,
+            runtimeCheckpoint;
+    heatpumpDeadline nextPoll = heatpumpDeadline::after(clock, 60000);
+    heatpumpDeadline nextSchedule = heatpumpDeadline::after(clock, 60000);
+    bool pending = false; // a HomeKit write
+    unsigned long steps = 0;
+
+    void sleeper(Coroutine &co, unsigned long ms) {
+        CO_BEGIN(co);
+        for (;;) {
+            steps++;
+            CO_SLEEP(co, clock, ms);
+        }
+        CO_END(co);
+    }
+
+    void awaiter(Coroutine &co) {
+        CO_BEGIN(co);
+        for (;;) {
+            CO_AWAIT(co, pending);
+            pending = false;
+            steps++;
+            CO_SLEEP(co, clock, 1000); // the verify delay
+        }
+        CO_END(co);
+    }
+
+    void deadliner(Coroutine &co, heatpumpDeadline &next, unsigned long ms) {
+        CO_BEGIN(co);
+        for (;;) {
+            CO_AWAIT_DEADLINE(co, clock, next);
+            next = heatpumpDeadline::after(clock, ms);
+            steps++;
+        }
+        CO_END(co);
+    }
+
+    // kept out of line, like the controller's loop() behind HomeSpan's virtual call
+    __attribute__((noinline)) void pass() {
+        sleeper(busSync, 200);
+        sleeper(roomTemperaturePoll, 10000);
+        awaiter(userChange);
+        deadliner(settingsPoll, nextPoll, 60000);
+        sleeper(historySample, 1000);
+        deadliner(scheduleTransition, nextSchedule, 60000);
+        sleeper(runtimeCheckpoint, 600000);
+    }
+
+    __attribute__((noinline)) unsigned long idleTime() {
+        unsigned long idle = 20;
+        for (const Coroutine *co : {&busSync, &roomTemperaturePoll, &userChange, &settingsPoll, &historySample,
+                                    &scheduleTransition, &runtimeCheckpoint}) {
+            idle = co->idleTime(clock, idle);
+        }
+        return idle;
+    }
+};
+
+static void benchCoroutines() {
+    Workflows workflows;
+    workflows.pass(); // all of them suspended once
+    run("coroutines pass, nothing due", 2000000, [&](unsigned long) {
+        workflows.pass();
+        sink = (int) workflows.steps;
+    });
+    run("coroutines pass, bus sync due", 2000000, [&](unsigned long) {
+        workflows.clock.advance(200); // the others come due every 5th to 3000th pass
+        workflows.pass();
+        sink = (int) workflows.steps;
+    });
+    run("coroutines HomeKit write, 2 passes", 2000000, [&](unsigned long) {
+        workflows.pending = true;
+        workflows.pass(); // the write, into the verify sleep
+        workflows.clock.advance(1000);
+        workflows.pass(); // back to awaiting the next write
+        sink = (int) workflows.steps;
+    });
+    run("coroutines idleTime", 2000000, [&](unsigned long) {
+        sink = (int) workflows.idleTime();
+    });
+}
+
+static void benchCalls() {
+    // sync()'s rotation, like the firmware's steady polling
+    Bench bench;
+    const unsigned long frames = 10000;
+    const unsigned long clockBefore = bench.clock.calls;
+    const unsigned long serialBefore = bench.serial.calls;
+    for (unsigned long i = 0; i < frames; i++) {
+        bench.settle();
+        bench.heatPump.sync();
+        bench.heatPump.sync();
+    }
+    if (!filter || strstr("calls per frame", filter)) {
+        printf("%-36s %10.1f clock %8.1f serial calls/frame\n", "calls per frame",
+               (double) (bench.clock.calls - clockBefore) / frames,
+               (double) (bench.serial.calls - serialBefore) / frames);
+    }
+
+    heatpumpClock *volatile clock = &bench.clock; // volatile, so the call stays virtual
+    run("calls heatpumpClock::millis()", 20000000, [&](unsigned long) {
+        sink = (int) clock->millis();
+    });
+}
+
+static void benchConnect() {
+    Bench bench;
+    run("connect 0x5a/0x7a", 20000, [&](unsigned long) {
+        sink = bench.heatPump.connect(nullptr); // includes the 2 s settle, which is virtual here
+    });
+}
+
+#ifndef HEATPUMP_NO_FUNCTIONS
+static void benchFunctions() {
+    Bench bench;
+    run("functions get 0x20/0x22", 20000, [&](unsigned long) {
+        bench.settle();
+        sink = bench.heatPump.getFunctions().isValid();
+    });
+
+    heatpumpFunctions functions = bench.heatPump.getFunctions();
+    run("heatpumpFunctions::getValue", 2000000, [&](unsigned long i) {
+        sink = functions.getValue(101 + (int) (i % 28));
+    });
+    run("heatpumpFunctions::setValue", 2000000, [&](unsigned long i) {
+        sink = functions.setValue(101 + (int) (i % 28), 1 + (int) (i % 3));
+    });
+    run("heatpumpFunctions::getAllCodes", 200000, [&](unsigned long) {
+        sink = functions.getAllCodes().code[7];
+    });
+}
+#endif
+
+int main(int argc, char **argv) {
+    int option;
+    while ((option = getopt(argc, argv, "n:h")) != -1) {
+        if (option == 'n') {
+            scale = max(1UL, strtoul(optarg, nullptr, 10));
+        } else {
+            fprintf(stderr, "usage: %s [-n scale] [filter]\n", argv[0]);
+            return option == 'h' ? 0 : 2;
+        }
+    }
+    if (optind < argc) filter = argv[optind];
+    printf("HeatPump %s build, sizeof(HeatPump) %zu bytes\n", BUILD, sizeof(HeatPump));
+
+    benchParse();
+    benchTemperature();
+    benchCoroutines();
+    benchInfo();
+    benchSteadyState();
+    benchSet();
+    benchCalls();
+    benchConnect();
+#ifndef HEATPUMP_NO_FUNCTIONS
+    benchFunctions();
+#endif
+    return 0;
+}
@@ -0,0 +1,21 @@
+#pragma once
+/*
+ * The part of the Arduino core the HeatPump library uses, so it builds on Linux for the gateway.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+typedef uint8_t byte;
+
+using std::min;
+using std::max;
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+// CLOCK_MONOTONIC milliseconds since the process started
+unsigned long millis();
+void delay(unsigned long ms);
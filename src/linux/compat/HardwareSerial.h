@@ -0,0 +1,39 @@
+#pragma once
+#include <Arduino.h>
+
+#define SERIAL_8E1 0x800001e
+
+/**
+ * HardwareSerial on a termios tty (a USB-CN105 adapter, or a pty for the simulator).
+ *
+ * Reads are buffered so the gateway can tell a complete frame from a partial one before handing
+ * the port to HeatPump, which keeps HeatPump from waiting on the wire inside the event loop.
+ */
+class HardwareSerial {
+public:
+    explicit HardwareSerial(const char *device);
+    ~HardwareSerial();
+
+    bool open();
+    void begin(unsigned long baud, uint32_t config);
+    void end();
+
+    int available();
+    int read();
+    int peek(int offset = 0);
+    size_t write(uint8_t b);
+
+    int fd() const { return descriptor; }
+    const char *device() const { return path; }
+
+private:
+    static const int BUFFER_LEN = 256;
+
+    const char *path;
+    int descriptor = -1;
+    uint8_t buffer[BUFFER_LEN];
+    int head = 0;
+    int count = 0;
+
+    void fill();
+};
@@ -0,0 +1,3 @@
+#pragma once
+// pre-1.0 name of Arduino.h, which HeatPump.h falls back to when ARDUINO isn't defined
+#include <Arduino.h>
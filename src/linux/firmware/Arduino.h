@@ -0,0 +1,72 @@
+#pragma once
+/*
+ * The ESP32 Arduino core as the controller firmware (src/main.cpp) uses it, on Linux: the compat core plus
+ * String, ESP, configTzTime() and the FreeRTOS task calls. Firmware.cpp implements them on a virtual clock.
+ */
+#include "../compat/Arduino.h"
+#include <stdarg.h>
+#include <string>
+
+typedef bool boolean;
+
+/**
+ * Arduino's String, as far as main.cpp builds and compares log lines with it.
+ */
+class String {
+public:
+    String(const char *text = "") : text(text ? text : "") {}
+    explicit String(int value) : text(std::to_string(value)) {}
+    explicit String(float value) : text(format("%.2f", value)) {}
+    explicit String(double value) : text(format("%.2f", value)) {}
+
+    const char *c_str() const { return text.c_str(); }
+    bool operator==(const char *other) const { return text == other; }
+    String operator+(const String &other) const { return String(text + other.text); }
+    friend String operator+(const char *lhs, const String &rhs) { return String(lhs) + rhs; }
+
+private:
+    std::string text;
+
+    explicit String(const std::string &text) : text(text) {}
+
+    static std::string format(const char *format, double value) {
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), format, value);
+        return buffer;
+    }
+};
+
+// the USB console, main.cpp only starts it
+struct ConsoleSerial {
+    void begin(unsigned long baud) { (void) baud; }
+};
+extern ConsoleSerial Serial;
+
+// Serial2 is the virtual-time SimulatedUnit serial of linux/soak/HardwareSerial.h
+class HardwareSerial;
+extern HardwareSerial Serial2;
+
+struct EspClass {
+    uint32_t getFreeHeap();
+    uint32_t getMinFreeHeap();
+};
+extern EspClass ESP;
+
+void configTzTime(const char *timezone, const char *server);
+
+// FreeRTOS with one tick per millisecond, like the ESP32 Arduino core. The harness runs the one task
+// main.cpp creates, HK_poll; ulTaskNotifyTake() is where virtual time passes (see Firmware.h).
+typedef void *TaskHandle_t;
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+#define pdTRUE 1
+#define pdPASS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t) (ms))
+#define portMAX_DELAY ((TickType_t) 0xffffffff)
+
+BaseType_t xTaskCreatePinnedToCore(void (*task)(void *), const char *name, uint32_t stackDepth, void *parameter,
+                                   unsigned priority, TaskHandle_t *handle, int core);
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticksToWait);
+void xTaskNotifyGive(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+unsigned uxTaskGetStackHighWaterMark(TaskHandle_t task);
@@ -0,0 +1,197 @@
+#include "Firmware.h"
+#include <esp_sntp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// main.cpp
+void setup();
+
+heatpumpVirtualClock Firmware::clock;
+HardwareSerial Serial2(Firmware::clock);
+ConsoleSerial Serial;
+EspClass ESP;
+Span homeSpan;
+
+// thrown out of the HK_poll task's sleep when run() is done, the next run() starts the task over
+struct RunDone {
+};
+
+static uint64_t elapsedMs = 0;
+static uint64_t runEnd = 0;
+static std::function<bool()> stopWhen;
+static bool stopped = false;
+static int64_t wallClockMs = 0; // at elapsedMs 0
+static void (*pollTask)(void *) = nullptr;
+static void *pollTaskParameter = nullptr;
+static bool notified = false;
+static unsigned long taskWakeups = 0;
+static sntp_sync_time_cb_t sntpCallback = nullptr;
+
+static void advance(uint32_t ms) {
+    Firmware::clock.advance(ms);
+    elapsedMs += ms;
+    Serial2.poll();
+}
+
+// the platform's time, for the heatpumpClock::system() main.cpp runs on
+
+unsigned long millis() {
+    return Firmware::clock.millis();
+}
+
+void delay(unsigned long ms) {
+    advance((uint32_t) ms);
+}
+
+time_t time(time_t *result) noexcept {
+    const time_t now = (time_t) ((wallClockMs + (int64_t) elapsedMs) / 1000);
+    if (result) *result = now;
+    return now;
+}
+
+void configTzTime(const char *timezone, const char *server) {
+    (void) server;
+    Firmware::setTimezone(timezone);
+}
+
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t callback) {
+    sntpCallback = callback;
+}
+
+// FreeRTOS, for the HK_poll task
+
+BaseType_t xTaskCreatePinnedToCore(void (*task)(void *), const char *name, uint32_t stackDepth, void *parameter,
+                                   unsigned priority, TaskHandle_t *handle, int core) {
+    (void) stackDepth, (void) priority, (void) core;
+    if (strcmp(name, "HK_poll") != 0) return pdPASS; // only HK_poll runs, MQTT_SERVER is empty in config.h
+    pollTask = task;
+    pollTaskParameter = parameter;
+    if (handle) *handle = (TaskHandle_t) &pollTask;
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticksToWait) {
+    if (stopWhen && stopWhen()) {
+        stopped = true;
+        throw RunDone();
+    }
+    if (!notified) {
+        if (elapsedMs >= runEnd) throw RunDone();
+        uint64_t sleep = min((uint64_t) ticksToWait, runEnd - elapsedMs);
+        // a reply that can be read already woke the task when it came in
+        if (!Serial2.available()) sleep = Serial2.timeUntilReply((unsigned long) sleep);
+        advance((uint32_t) sleep);
+    }
+    taskWakeups++;
+    const uint32_t taken = notified ? 1 : 0;
+    if (clearOnExit) notified = false;
+    return taken;
+}
+
+void xTaskNotifyGive(TaskHandle_t task) {
+    if (task == (TaskHandle_t) &pollTask) notified = true;
+}
+
+void vTaskDelay(TickType_t ticks) {
+    advance(ticks);
+}
+
+unsigned uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+    (void) task;
+    return 0;
+}
+
+uint32_t EspClass::getFreeHeap() {
+    return 0;
+}
+
+uint32_t EspClass::getMinFreeHeap() {
+    return 0;
+}
+
+void spanLog(const char *format, ...) {
+    if (!homeSpan.log) return;
+    va_list arguments;
+    va_start(arguments, format);
+    vfprintf(homeSpan.log, format, arguments);
+    va_end(arguments);
+}
+
+void spanLog(const String &text) {
+    if (homeSpan.log) fputs(text.c_str(), homeSpan.log);
+}
+
+// Firmware ////////////////////////////////////////////////////////////////////
+
+void Firmware::begin(time_t wallClock, uint32_t start) {
+    clock = heatpumpVirtualClock(start);
+    wallClockMs = (int64_t) wallClock * 1000;
+    setup();
+    if (homeSpan.wifiCallback) homeSpan.wifiCallback();
+}
+
+void Firmware::run(uint64_t ms) {
+    runUntil(nullptr, ms);
+}
+
+bool Firmware::runUntil(std::function<bool()> condition, uint64_t limitMs) {
+    runEnd = elapsedMs + limitMs;
+    stopWhen = condition;
+    stopped = false;
+    while (!stopped && elapsedMs < runEnd) {
+        try {
+            pollTask(pollTaskParameter);
+        } catch (const RunDone &) {
+        }
+    }
+    stopWhen = nullptr;
+    return stopped;
+}
+
+uint64_t Firmware::elapsed() {
+    return elapsedMs;
+}
+
+unsigned long Firmware::wakeups() {
+    return taskWakeups;
+}
+
+void Firmware::setWallClock(time_t now) {
+    wallClockMs = (int64_t) now * 1000 - (int64_t) elapsedMs;
+    if (sntpCallback) {
+        timeval synced = {now, 0};
+        sntpCallback(&synced);
+    }
+}
+
+void Firmware::setTimezone(const char *timezone) {
+    setenv("TZ", timezone, 1);
+    tzset();
+}
+
+std::string Firmware::metricsText() {
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) return "";
+    HttpChunkWriter out(sockets[0]);
+    metrics.render(out);
+    out.end();
+    shutdown(sockets[0], SHUT_WR);
+
+    // drop the chunk framing
+    std::string chunked;
+    char buffer[4096];
+    ssize_t length;
+    while ((length = read(sockets[1], buffer, sizeof(buffer))) > 0) chunked.append(buffer, length);
+    close(sockets[0]);
+    close(sockets[1]);
+    std::string text;
+    size_t at = 0;
+    for (;;) {
+        const size_t size = strtoul(chunked.c_str() + at, nullptr, 16);
+        at = chunked.find("\r\n", at);
+        if (size == 0 || at == std::string::npos) break;
+        text.append(chunked, at + 2, size);
+        at += 2 + size + 2;
+    }
+    return text;
+}
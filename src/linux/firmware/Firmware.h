@@ -0,0 +1,53 @@
+#pragma once
+/*
+ * The controller firmware, src/main.cpp, built for Linux with the stand-ins in this directory: HomeSpan,
+ * WiFi, NVS and FreeRTOS. The heat pump is a SimulatedUnit behind Serial2 (linux/soak/HardwareSerial.h) and
+ * time is a heatpumpVirtualClock, so tests and benchmarks run the real controller code hours ahead in
+ * seconds:
+ *
+ *   Firmware::begin(wallClock);   // setup() and the WiFi callback, as at boot
+ *   homeSpan.write(targetTemperature, 23);
+ *   Firmware::run(5000);          // the HK_poll task for 5 s of virtual time
+ *
+ * run() runs HK_poll as main.cpp wrote it. Time passes in its ulTaskNotifyTake(), up to the sleep it asks
+ * for, and in delay(). A reply from the unit ends the sleep early through Serial2's receive callback, like
+ * the UART interrupt on the ESP32. time() is the wall clock, which moves with the virtual clock from
+ * wherever setWallClock() put it.
+ */
+#include <HomeSpan.h>
+#include <HeatPump.h>
+#include <HardwareSerial.h>
+#include <Metrics.h>
+#include <Schedule.h>
+#include <functional>
+#include <string>
+
+class Firmware {
+public:
+    static heatpumpVirtualClock clock;
+
+    static void begin(time_t wallClock, uint32_t start = 0);
+    static void run(uint64_t ms); // ms of virtual time, from where the last run() stopped
+    // runs until the condition holds, checked each time the task goes to sleep, false if it didn't within the limit
+    static bool runUntil(std::function<bool()> condition, uint64_t limitMs);
+    static uint64_t elapsed();    // virtual ms since begin()
+    static unsigned long wakeups(); // times the HK_poll task came out of its sleep, one loop pass each
+
+    // sets time() and runs the SNTP sync callback, if it is registered yet
+    static void setWallClock(time_t now);
+    static void setTimezone(const char *timezone); // a POSIX TZ rule, instead of TIMEZONE in config.h
+
+    // the text /metrics would serve
+    static std::string metricsText();
+};
+
+// main.cpp's globals
+extern HeatPump heatPump;
+extern MetricsExporter metrics;
+extern WeeklySchedule schedule;
+extern SpanCharacteristic *currentTemperature;
+extern SpanCharacteristic *targetTemperature;
+extern SpanCharacteristic *targetHeatingCoolingState;
+extern SpanCharacteristic *fanRotationSpeed;
+extern SpanCharacteristic *swingMode;
+extern SpanCharacteristic *targetTiltAngle;
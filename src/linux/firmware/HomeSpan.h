@@ -0,0 +1,135 @@
+#pragma once
+/*
+ * HomeSpan as main.cpp uses it, so the controller runs on Linux. A characteristic holds its value and the
+ * value being written. homeSpan.write() does what a HomeKit controller's write does: it sets the new value
+ * and calls update() on the characteristic's service, which keeps it or rolls it back. homeSpan.poll()
+ * runs every service's loop(). LOG0 goes to homeSpan.log, nowhere by default.
+ */
+#include <Arduino.h>
+#include <vector>
+
+struct SpanService;
+
+struct SpanCharacteristic {
+    SpanService *service;
+    double value;
+    double newValue;
+
+    explicit SpanCharacteristic(double value = 0);
+    virtual ~SpanCharacteristic() {}
+
+    template <typename T = int> T getVal() const { return (T) value; }
+    template <typename T = int> T getNewVal() const { return (T) newValue; }
+    void setVal(double value) { this->value = newValue = value; }
+    SpanCharacteristic *setRange(double min, double max, double step = 0) {
+        (void) min;
+        (void) max;
+        (void) step;
+        return this;
+    }
+};
+
+struct SpanService {
+    std::vector<SpanCharacteristic *> characteristics;
+
+    SpanService();
+    virtual ~SpanService() {}
+
+    virtual boolean update() { return true; }
+    virtual void loop() {}
+};
+
+struct SpanAccessory {
+};
+
+struct SpanUserCommand {
+    SpanUserCommand(char c, const char *description, void (*command)(const char *)) {
+        (void) c;
+        (void) description;
+        (void) command;
+    }
+};
+
+enum class Category { Thermostats };
+
+class Span {
+public:
+    FILE *log = nullptr;
+    void (*wifiCallback)() = nullptr;
+    std::vector<SpanService *> services;
+
+    void setLogLevel(int level) { (void) level; }
+    void setStatusPin(int pin) { (void) pin; }
+    void setControlPin(int pin) { (void) pin; }
+    void setWifiCallback(void (*callback)()) { wifiCallback = callback; }
+    void begin(Category category) { (void) category; }
+
+    void poll() {
+        for (SpanService *service : services) service->loop();
+    }
+
+    // a HomeKit write of one characteristic, false if the service rejected it
+    bool write(SpanCharacteristic *characteristic, double value) {
+        characteristic->newValue = value;
+        if (characteristic->service->update()) {
+            characteristic->value = value;
+            return true;
+        }
+        characteristic->newValue = characteristic->value;
+        return false;
+    }
+};
+extern Span homeSpan;
+
+inline SpanService::SpanService() {
+    homeSpan.services.push_back(this);
+}
+
+// a characteristic belongs to the service created last, like in HomeSpan
+inline SpanCharacteristic::SpanCharacteristic(double value) : service(homeSpan.services.back()), value(value),
+                                                              newValue(value) {
+    service->characteristics.push_back(this);
+}
+
+void spanLog(const char *format, ...) __attribute__((format(printf, 1, 2)));
+void spanLog(const String &text);
+#define LOG0(...) spanLog(__VA_ARGS__)
+
+#define SPAN_SERVICE(name) struct name : SpanService {};
+#define SPAN_CHARACTERISTIC(name, initial) \
+    struct name : SpanCharacteristic { explicit name(double value = initial) : SpanCharacteristic(value) {} };
+#define SPAN_STRING_CHARACTERISTIC(name) \
+    struct name : SpanCharacteristic { explicit name(const char *text = "") : SpanCharacteristic(0) { (void) text; } };
+
+namespace Service {
+SPAN_SERVICE(AccessoryInformation)
+SPAN_SERVICE(HAPProtocolInformation)
+SPAN_SERVICE(Thermostat)
+SPAN_SERVICE(Fan)
+SPAN_SERVICE(Slat)
+}
+
+// initial values as in HomeSpan
+namespace Characteristic {
+SPAN_STRING_CHARACTERISTIC(Name)
+SPAN_STRING_CHARACTERISTIC(Manufacturer)
+SPAN_STRING_CHARACTERISTIC(SerialNumber)
+SPAN_STRING_CHARACTERISTIC(Model)
+SPAN_STRING_CHARACTERISTIC(FirmwareRevision)
+SPAN_STRING_CHARACTERISTIC(Version)
+SPAN_CHARACTERISTIC(Identify, 0)
+SPAN_CHARACTERISTIC(TemperatureDisplayUnits, 0)
+SPAN_CHARACTERISTIC(CurrentTemperature, 0)
+SPAN_CHARACTERISTIC(TargetTemperature, 16)
+SPAN_CHARACTERISTIC(CurrentHeatingCoolingState, 0)
+SPAN_CHARACTERISTIC(TargetHeatingCoolingState, 0)
+SPAN_CHARACTERISTIC(CoolingThresholdTemperature, 10)
+SPAN_CHARACTERISTIC(HeatingThresholdTemperature, 16)
+SPAN_CHARACTERISTIC(Active, 0)
+SPAN_CHARACTERISTIC(RotationSpeed, 0)
+SPAN_CHARACTERISTIC(CurrentSlatState, 0)
+SPAN_CHARACTERISTIC(SlatType, 0)
+SPAN_CHARACTERISTIC(SwingMode, 0)
+SPAN_CHARACTERISTIC(CurrentTiltAngle, 0)
+SPAN_CHARACTERISTIC(TargetTiltAngle, 0)
+}
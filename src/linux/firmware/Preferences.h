@@ -0,0 +1,72 @@
+#pragma once
+/*
+ * NVS Preferences in memory, for the process's lifetime. Also the ESP32-only storages main.cpp declares:
+ * NvsScheduleStorage on these Preferences, and a FlashHistoryStorage without a partition, so begin() fails
+ * and the history is off as on a device without one.
+ */
+#include <Arduino.h>
+#include <History.h>
+#include <Schedule.h>
+#include <map>
+#include <string>
+#include <vector>
+
+class Preferences {
+public:
+    bool begin(const char *name, bool readOnly = false) {
+        (void) readOnly;
+        space = name;
+        return true;
+    }
+    void end() {}
+
+    size_t getBytesLength(const char *key) {
+        const auto found = values().find(space + "/" + key);
+        return found == values().end() ? 0 : found->second.size();
+    }
+    size_t getBytes(const char *key, void *data, size_t capacity) {
+        const auto found = values().find(space + "/" + key);
+        if (found == values().end() || found->second.size() > capacity) return 0;
+        memcpy(data, found->second.data(), found->second.size());
+        return found->second.size();
+    }
+    size_t putBytes(const char *key, const void *data, size_t length) {
+        values()[space + "/" + key].assign((const uint8_t *) data, (const uint8_t *) data + length);
+        return length;
+    }
+
+private:
+    std::string space;
+
+    static std::map<std::string, std::vector<uint8_t>> &values() {
+        static std::map<std::string, std::vector<uint8_t>> stored;
+        return stored;
+    }
+};
+
+class NvsScheduleStorage : public ScheduleStorage {
+public:
+    size_t load(uint8_t *data, size_t capacity) override {
+        Preferences preferences;
+        preferences.begin("schedule", true);
+        return preferences.getBytes("table", data, capacity);
+    }
+    bool save(const uint8_t *data, size_t length) override {
+        Preferences preferences;
+        preferences.begin("schedule", false);
+        return preferences.putBytes("table", data, length) == length;
+    }
+};
+
+class FlashHistoryStorage : public HistoryStorage {
+public:
+    explicit FlashHistoryStorage(const char *label) { (void) label; }
+
+    bool begin() { return false; }
+    size_t sectorCount() override { return 0; }
+    bool read(size_t sector, size_t offset, void *data, size_t length) override {
+        (void) sector, (void) offset, (void) data, (void) length;
+        return false;
+    }
+    bool writeSector(size_t sector, const void *data) override { (void) sector, (void) data; return false; }
+};
@@ -0,0 +1,26 @@
+#pragma once
+/*
+ * The WiFi client main.cpp hands the MQTT bridge. It never connects: MQTT_SERVER is empty in config.h.
+ */
+#include <Arduino.h>
+
+class Client {
+public:
+    virtual int connect(const char *host, uint16_t port) = 0;
+    virtual size_t write(const uint8_t *data, size_t length) = 0;
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual void stop() = 0;
+    virtual uint8_t connected() = 0;
+    virtual ~Client() {}
+};
+
+class WiFiClient : public Client {
+public:
+    int connect(const char *host, uint16_t port) override { (void) host; (void) port; return 0; }
+    size_t write(const uint8_t *data, size_t length) override { (void) data; (void) length; return 0; }
+    int available() override { return 0; }
+    int read() override { return -1; }
+    void stop() override {}
+    uint8_t connected() override { return 0; }
+};
@@ -0,0 +1,364 @@
+/*
+ * Loopback load test of HttpEndpoint. It serves a HeatPump on a SimulatedUnit (the virtual-time serial of
+ * linux/soak) from one loop, like HK_poll on the device, while client threads hit it:
+ *
+ *   heatpump-http [-s seconds] [-c clients] [-d slow clients] [-i idle ms] [-p port]
+ *
+ *   - -c clients (4) request /, /state, /metrics, /schedule and POST /state back to back
+ *   - -d slow clients (2) send a request a byte every 50 ms, too slow to finish in CLIENT_TIMEOUT_MS
+ *   - one client connects and sends nothing, one asks for /metrics and doesn't read the response
+ * Between passes the loop sleeps -i ms (HK_MAX_IDLE_MS by default, like the device; 0 for the endpoint's own
+ * throughput). Writes are queued and applied by the loop after poll(), like main.cpp's applyUserChanges().
+ * Then, with the unit replying WRITE_REPLY_DELAY_MS late, a few POST /state are sent one at a time: each is
+ * answered 202 and its temperature reaches the unit. A poll()'s time includes the virtual time the heat pump
+ * spent in it, which a write waiting for the unit's ack would. It reports requests/s, response times, the
+ * longest poll() and the peak heap in use (glibc's mallinfo2()). Exits with 1 if a request failed, a poll()
+ * held the loop longer than POLL_LIMIT_MS, a slow client got anything but 408, a write wasn't accepted or
+ * applied, or the loop allocated while serving.
+ */
+#include <HeatPump.h>
+#include <HttpEndpoint.h>
+#include <Metrics.h>
+#include <Schedule.h>
+#include <config.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <malloc.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static const double POLL_LIMIT_MS = 600; // a response's sends share CLIENT_TIMEOUT_MS (500)
+static const useconds_t DRIP_INTERVAL_US = 50000;
+static const uint32_t LOOP_ADVANCE_MS = 5; // virtual time per loop pass, for the heat pump
+static const uint32_t WRITE_REPLY_DELAY_MS = 700;
+static const int WRITE_PASSES = 2000; // for a write to be answered and reach the unit
+
+// operator new on the serving loop, the endpoint shouldn't allocate per request
+static thread_local bool serving = false;
+static std::atomic<unsigned long> servingAllocations {0};
+
+void *operator new(size_t size) {
+    if (serving) servingAllocations++;
+    if (void *p = malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+// Metrics.cpp's ESP32 calls, the heap gauges read glibc's
+EspClass ESP;
+
+uint32_t EspClass::getFreeHeap() {
+    return 0;
+}
+
+uint32_t EspClass::getMinFreeHeap() {
+    return 0;
+}
+
+unsigned uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+    (void) task;
+    return 0;
+}
+
+static uint16_t port = 18080;
+static std::atomic<bool> running {true};
+
+static const char *const REQUESTS[] = {
+    "GET / HTTP/1.1\r\nHost: test\r\n\r\n",
+    "GET /state HTTP/1.1\r\nHost: test\r\n\r\n",
+    "GET /metrics HTTP/1.1\r\nHost: test\r\n\r\n",
+    "GET /schedule HTTP/1.1\r\nHost: test\r\n\r\n",
+    "POST /state HTTP/1.1\r\nHost: test\r\nContent-Type: application/x-www-form-urlencoded\r\n"
+    "Content-Length: 9\r\n\r\nTEMP=22.5",
+};
+
+static int connectEndpoint(int receiveBuffer = 0) {
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (receiveBuffer) setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &receiveBuffer, sizeof(receiveBuffer));
+    struct timeval timeout = {5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if (connect(fd, (struct sockaddr *) &address, sizeof(address)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// the response's status code once the endpoint closed the connection, 0 if there was none
+static int readStatus(int fd) {
+    char buffer[4096];
+    int status = 0;
+    bool first = true;
+    ssize_t count;
+    while ((count = recv(fd, buffer, sizeof(buffer) - 1, 0)) > 0) {
+        if (first && count >= 12) {
+            buffer[count] = 0;
+            status = atoi(buffer + 9); // "HTTP/1.1 200"
+        }
+        first = false;
+    }
+    return count == 0 ? status : 0;
+}
+
+struct ClientStats {
+    unsigned long ok = 0;
+    unsigned long failed = 0;
+    std::vector<double> ms;
+};
+
+static void fastClient(int index, ClientStats &stats) {
+    for (int n = index; running; n++) {
+        const char *request = REQUESTS[n % (sizeof(REQUESTS) / sizeof(REQUESTS[0]))];
+        const auto start = std::chrono::steady_clock::now();
+        const int fd = connectEndpoint();
+        int status = 0;
+        if (fd >= 0 && send(fd, request, strlen(request), MSG_NOSIGNAL) == (ssize_t) strlen(request)) {
+            status = readStatus(fd);
+        }
+        if (fd >= 0) close(fd);
+        if (!running) break; // the loop may have stopped serving mid-request
+        if (status >= 200 && status < 400) {
+            stats.ok++;
+            stats.ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+                               .count());
+        } else {
+            stats.failed++;
+        }
+    }
+}
+
+struct SlowStats {
+    std::atomic<unsigned long> timedOut {0}; // 408
+    std::atomic<unsigned long> other {0};
+};
+
+static void slowClient(SlowStats &stats) {
+    static const char request[] = "GET /state HTTP/1.1\r\nHost: test\r\nUser-Agent: a-very-slow-client\r\n\r\n";
+    while (running) {
+        const int fd = connectEndpoint();
+        if (fd < 0) continue;
+        size_t sent = 0;
+        while (running && sent < sizeof(request) - 1 && send(fd, request + sent, 1, MSG_NOSIGNAL) == 1) {
+            sent++;
+            usleep(DRIP_INTERVAL_US);
+        }
+        const int status = readStatus(fd);
+        close(fd);
+        if (!running) break;
+        if (status == 408) {
+            stats.timedOut++;
+        } else {
+            stats.other++;
+        }
+    }
+}
+
+// connects and says nothing, then asks for /metrics and doesn't read
+static void rudeClient() {
+    while (running) {
+        int fd = connectEndpoint();
+        if (fd >= 0) {
+            readStatus(fd);
+            close(fd);
+        }
+        fd = connectEndpoint(1024);
+        if (fd >= 0) {
+            send(fd, REQUESTS[2], strlen(REQUESTS[2]), MSG_NOSIGNAL);
+            usleep(1000000);
+            close(fd);
+        }
+    }
+}
+
+static double percentile(std::vector<double> &values, int percent) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    return values[std::max((values.size() * percent + 99) / 100, (size_t) 1) - 1];
+}
+
+int main(int argc, char **argv) {
+    double seconds = 5;
+    int clients = 4;
+    int slowClients = 2;
+    unsigned idleMs = HK_MAX_IDLE_MS;
+    int option;
+    while ((option = getopt(argc, argv, "s:c:d:i:p:h")) != -1) {
+        if (option == 's') {
+            seconds = atof(optarg);
+        } else if (option == 'c') {
+            clients = atoi(optarg);
+        } else if (option == 'd') {
+            slowClients = atoi(optarg);
+        } else if (option == 'i') {
+            idleMs = (unsigned) atoi(optarg);
+        } else if (option == 'p') {
+            port = (uint16_t) atoi(optarg);
+        } else {
+            fprintf(stderr, "usage: %s [-s seconds] [-c clients] [-d slow clients] [-i idle ms] [-p port]\n", argv[0]);
+            return option == 'h' ? 0 : 2;
+        }
+    }
+
+    heatpumpVirtualClock clock;
+    HardwareSerial serial(clock);
+    HeatPump heatPump;
+    MetricsExporter metrics(heatPump);
+    WeeklySchedule schedule;
+    HttpEndpoint endpoint(heatPump);
+    heatPump.setClock(&clock);
+    metrics.setClock(&clock);
+    heatPump.connect(&serial);
+    schedule.parse("mon-fri 07:00 heat 21\nmon-fri 22:30 heat 18\n");
+    endpoint.setMetrics(&metrics);
+    endpoint.setSchedule(&schedule);
+    heatpumpSettingsChange queued = {};
+    endpoint.setSettingsWriter([&queued](const heatpumpSettingsChange &change) {
+        change.applyTo(queued.settings);
+        queued.fields |= change.fields;
+        return true;
+    });
+    if (!endpoint.begin(port)) {
+        fprintf(stderr, "can't listen on port %u\n", (unsigned) port);
+        return 2;
+    }
+    // the settings are in before the first write
+    for (int i = 0; i < 2000 && !heatPump.getSettings().power; i++) {
+        heatPump.sync();
+        clock.advance(LOOP_ADVANCE_MS);
+    }
+
+    std::vector<ClientStats> stats(clients);
+    // the clients' samples don't count toward the heap in use while serving
+    for (ClientStats &client : stats) client.ms.reserve((size_t) (seconds * 10000) + 1000);
+    SlowStats slow;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < clients; i++) threads.emplace_back(fastClient, i, std::ref(stats[i]));
+    for (int i = 0; i < slowClients; i++) threads.emplace_back(slowClient, std::ref(slow));
+    threads.emplace_back(rudeClient);
+
+    double pollMaxMs = 0;
+    // one loop pass: poll(), then the heat pump, with a queued write applied outside poll()
+    auto pass = [&]() {
+        const auto start = std::chrono::steady_clock::now();
+        const uint32_t virtualStart = clock.millis();
+        endpoint.poll();
+        const auto polled = std::chrono::steady_clock::now() - start;
+        pollMaxMs = std::max(pollMaxMs, std::chrono::duration<double, std::milli>(polled).count() +
+                                        (clock.millis() - virtualStart));
+        heatPump.sync();
+        if (queued.fields) {
+            heatPump.setSettings(queued);
+            queued.fields = 0;
+            heatPump.update();
+        }
+        clock.advance(LOOP_ADVANCE_MS);
+    };
+
+    const size_t heapBefore = mallinfo2().uordblks;
+    size_t heapPeak = heapBefore;
+    unsigned long passes = 0;
+    const auto began = std::chrono::steady_clock::now();
+    const auto end = began + std::chrono::microseconds((long long) (seconds * 1e6));
+    serving = true;
+    while (std::chrono::steady_clock::now() < end) {
+        pass();
+        heapPeak = std::max(heapPeak, mallinfo2().uordblks);
+        passes++;
+        if (idleMs) usleep(idleMs * 1000);
+    }
+    serving = false;
+    running = false;
+    // a client blocked on a request still gets its answer
+    const auto drain = std::chrono::steady_clock::now() + std::chrono::seconds(3);
+    while (std::chrono::steady_clock::now() < drain) pass();
+    for (std::thread &thread : threads) thread.join();
+
+    // one write at a time to a slow unit
+    serial.replyDelayMs = WRITE_REPLY_DELAY_MS;
+    const double loadPollMaxMs = pollMaxMs;
+    pollMaxMs = 0;
+    int writesAccepted = 0;
+    int writesApplied = 0;
+    static const char *const WRITE_TEMPERATURES[] = {"19", "24.5", "21"};
+    for (const char *temperature : WRITE_TEMPERATURES) {
+        char request[160];
+        snprintf(request, sizeof(request), "POST /state HTTP/1.1\r\nHost: test\r\nContent-Length: %zu\r\n\r\nTEMP=%s",
+                 strlen(temperature) + 5, temperature);
+        std::atomic<int> status {-1};
+        std::thread writer([&request, &status]() {
+            const int fd = connectEndpoint();
+            int received = 0;
+            if (fd >= 0 && send(fd, request, strlen(request), MSG_NOSIGNAL) == (ssize_t) strlen(request)) {
+                received = readStatus(fd);
+            }
+            if (fd >= 0) close(fd);
+            status = received;
+        });
+        const byte wanted = heatpumpTemperature::fromCelsius((float) atof(temperature)).toWire();
+        for (int i = 0; i < WRITE_PASSES && (status < 0 || serial.unit.temperature != wanted); i++) {
+            pass();
+            usleep(1000);
+        }
+        writer.join();
+        if (status == 202) writesAccepted++;
+        if (serial.unit.temperature == wanted) writesApplied++;
+    }
+    const int writes = sizeof(WRITE_TEMPERATURES) / sizeof(WRITE_TEMPERATURES[0]);
+
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - began).count() - 3;
+    ClientStats total;
+    for (ClientStats &client : stats) {
+        total.ok += client.ok;
+        total.failed += client.failed;
+        total.ms.insert(total.ms.end(), client.ms.begin(), client.ms.end());
+    }
+    printf("%.1f s, %d clients, %d slow, %u ms idle between %lu loop passes\n", elapsed, clients, slowClients, idleMs,
+           passes);
+    printf("  requests    %lu ok (%.1f/s), %lu failed\n", total.ok, total.ok / elapsed, total.failed);
+    const double p50 = percentile(total.ms, 50), p95 = percentile(total.ms, 95), p99 = percentile(total.ms, 99);
+    printf("  response    p50 %.1f ms, p95 %.1f ms, p99 %.1f ms\n", p50, p95, p99);
+    printf("  slow        %lu answered 408, %lu otherwise\n", slow.timedOut.load(), slow.other.load());
+    printf("  poll()      %.1f ms at most\n", loadPollMaxMs);
+    printf("  writes      %d of %d answered 202, %d applied, with replies %u ms late; poll() %.1f ms at most\n",
+           writesAccepted, writes, writesApplied, (unsigned) WRITE_REPLY_DELAY_MS, pollMaxMs);
+    printf("  heap        %zu bytes peak in use, %zd over the start, %lu allocations while serving\n", heapPeak,
+           (ssize_t) (heapPeak - heapBefore), servingAllocations.load());
+
+    int failures = 0;
+    if (total.ok == 0 || total.failed) {
+        printf("FAIL  %lu of %lu requests failed\n", total.failed, total.ok + total.failed);
+        failures++;
+    }
+    if (std::max(loadPollMaxMs, pollMaxMs) > POLL_LIMIT_MS) {
+        printf("FAIL  poll() held the loop for %.1f ms\n", std::max(loadPollMaxMs, pollMaxMs));
+        failures++;
+    }
+    if (writesAccepted < writes || writesApplied < writes) {
+        printf("FAIL  writes: %d of %d answered 202, %d applied\n", writesAccepted, writes, writesApplied);
+        failures++;
+    }
+    if (slowClients && (slow.timedOut == 0 || slow.other)) {
+        printf("FAIL  slow clients: %lu answered 408, %lu otherwise\n", slow.timedOut.load(), slow.other.load());
+        failures++;
+    }
+    if (servingAllocations) {
+        printf("FAIL  %lu allocations while serving\n", servingAllocations.load());
+        failures++;
+    }
+    printf(failures ? "FAILED\n" : "passed\n");
+    return failures ? 1 : 0;
+}
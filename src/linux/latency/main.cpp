@@ -0,0 +1,402 @@
+/*
+ * HomeKit change latency benchmark: the controller firmware (linux/firmware) against a SimulatedUnit on a
+ * virtual clock, driven by scripted HomeKit writes.
+ *
+ *   heatpump-latency [-n changes] [-r reply ms] [-w] [-b bursts.txt]... [-o results.json]
+ *                    [-l [workload:]stage.pNN=limit]... [-v]
+ *
+ * Each workload makes -n changes (100 by default) through homeSpan.write(), as the Home app would, 5 to 40 s
+ * apart so they land at every phase of the controller's polls. A change is one write or a burst of them: the
+ * drag workloads move a slider, -b replays the bursts in a file, one write per line as
+ * "<ms after the first write> <temperature|mode|fan|swing|tilt> <value>" with a blank line between changes
+ * (bursts.txt here has some). A change is timed from its first write to
+ *   set_frame   its first set frame on the wire (heatpumpCounters::lastSetSentMs)
+ *   set_ack     that frame's 0x61 ack (lastSetAckMs)
+ *   confirmed   the controller reading back matching settings, when MetricsExporter stops timing it
+ * and `frames` and `set_frames` count the frames and set frames sent until then: the stages /metrics exports
+ * on the device, and how well a burst was coalesced. p50, p95 and p99 of each workload are printed and
+ * written to the results file (latency.json by default) with the limits they were held to. Before the
+ * workloads, ten idle minutes show how often the task wakes, the frames it sends, and how long a reply waits
+ * before it is read.
+ *
+ * The limits are the p95 limits in config.h; -l adds or replaces one, e.g. -l confirmed.p99=9000, or with a
+ * workload prefix only for that workload, e.g. -l drag:set_frames.p95=1. A drag held past the maximum latency
+ * is applied twice, the second time after the writes that came in while the first set frame blocked the
+ * task, all within the same limits. Exits with 1 if a workload is over a limit or a change was never
+ * confirmed. -w runs against a unit that only takes whole degrees, so odd_temp's setpoints are rounded
+ * and clamped on the way out and must still be confirmed. -v prints the firmware's log.
+ */
+#include "../firmware/Firmware.h"
+#include <config.h>
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <unistd.h>
+
+static const uint64_t SETTLE_MS = 15000;
+static const uint64_t IDLE_MS = 600000;
+static const uint64_t CHANGE_LIMIT_MS = 60000; // a change not confirmed by then failed
+static const uint64_t MIN_GAP_MS = 5000;
+static const uint64_t GAP_SPREAD_MS = 35000;
+
+enum Stage { SET_FRAME, SET_ACK, CONFIRMED, FRAMES, SET_FRAMES, STAGES };
+static const char *const STAGE_NAMES[STAGES] = {"set_frame", "set_ack", "confirmed", "frames", "set_frames"};
+static const int PERCENTILES[] = {50, 95, 99};
+
+struct Limit {
+    std::string workload; // all of them if empty
+    int stage;
+    int percentile;
+    unsigned long value;
+};
+
+struct Write {
+    uint32_t at; // ms after the change's first write
+    SpanCharacteristic *characteristic;
+    double value;
+};
+
+typedef std::vector<Write> Change;
+
+struct Workload {
+    std::string name;
+    std::function<Change(int change)> change;
+};
+
+// a slider dragged from `from` to `to` in `steps`, one write every `interval` ms
+static Change drag(SpanCharacteristic *characteristic, double from, double to, int steps, uint32_t interval) {
+    Change change;
+    for (int step = 0; step <= steps; step++) {
+        change.push_back({step * interval, characteristic, from + (to - from) * step / steps});
+    }
+    return change;
+}
+
+static std::vector<Workload> builtinWorkloads() {
+    return {
+        {"setpoint", [](int change) { return Change {{0, targetTemperature, 18.0 + change % 8}}; }},
+        // half degrees, and below the 16 a unit without half degrees takes
+        {"odd_temp", [](int change) {
+            return Change {{0, targetTemperature, change % 4 == 3 ? 10.0 + change % 5 : 17.5 + change % 8}};
+        }},
+        {"mode", [](int change) { return Change {{0, targetHeatingCoolingState, change % 2 ? 1.0 : 2.0}}; }},
+        {"fan", [](int change) { return Change {{0, fanRotationSpeed, 2.0 + change % 4}}; }},
+        // a Home scene: the thermostat and the fan at once
+        {"scene", [](int change) {
+            return Change {
+                {0, targetHeatingCoolingState, change % 2 ? 1.0 : 2.0},
+                {0, targetTemperature, 26.0 - change % 8},
+                {0, fanRotationSpeed, 5.0 - change % 4},
+            };
+        }},
+        // under the debounce between writes, so it ends before the maximum latency
+        {"drag", [](int change) {
+            return change % 2 ? drag(targetTemperature, 24, 19, 10, 80) : drag(targetTemperature, 19, 24, 10, 80);
+        }},
+        // held past the maximum latency, the set frame must not wait for the end
+        {"long_drag", [](int change) {
+            Change writes = drag(targetTemperature, change % 2 ? 24 : 18, change % 2 ? 18 : 24, 12, 300);
+            const Change fan = drag(fanRotationSpeed, 2, 5, 3, 1200);
+            writes.insert(writes.end(), fan.begin(), fan.end());
+            return writes;
+        }},
+    };
+}
+
+static SpanCharacteristic *characteristicNamed(const char *name) {
+    if (strcmp(name, "temperature") == 0) return targetTemperature;
+    if (strcmp(name, "mode") == 0) return targetHeatingCoolingState;
+    if (strcmp(name, "fan") == 0) return fanRotationSpeed;
+    if (strcmp(name, "swing") == 0) return swingMode;
+    if (strcmp(name, "tilt") == 0) return targetTiltAngle;
+    return nullptr;
+}
+
+// the bursts in a -b file, replayed in turn
+static bool loadBursts(const char *path, std::vector<Workload> &workloads) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        perror(path);
+        return false;
+    }
+    std::vector<Change> changes(1);
+    char line[128];
+    int number = 0;
+    bool valid = true;
+    while (valid && fgets(line, sizeof(line), file)) {
+        number++;
+        unsigned long at;
+        char name[16];
+        double value;
+        if (line[0] == '#') continue;
+        if (sscanf(line, "%lu %15s %lf", &at, name, &value) == 3 && characteristicNamed(name)) {
+            changes.back().push_back({(uint32_t) at, characteristicNamed(name), value});
+        } else if (strspn(line, " \t\r\n") == strlen(line)) {
+            if (!changes.back().empty()) changes.emplace_back();
+        } else {
+            fprintf(stderr, "%s:%d: expected \"<ms> <temperature|mode|fan|swing|tilt> <value>\"\n", path, number);
+            valid = false;
+        }
+    }
+    fclose(file);
+    if (changes.back().empty()) changes.pop_back();
+    if (!valid || changes.empty()) return false;
+    for (Change &change : changes) {
+        std::stable_sort(change.begin(), change.end(), [](const Write &a, const Write &b) { return a.at < b.at; });
+    }
+    const char *base = strrchr(path, '/');
+    workloads.push_back({base ? base + 1 : path, [changes](int change) { return changes[change % changes.size()]; }});
+    return true;
+}
+
+struct Idle {
+    double wakeupsPerMinute;
+    double framesPerMinute;
+    double pickupMeanMs; // from a reply being readable to its first byte read
+    uint32_t pickupMaxMs;
+};
+
+struct Result {
+    std::string name;
+    std::vector<unsigned long> samples[STAGES];
+    unsigned long unconfirmed = 0;
+
+    // nearest rank
+    unsigned long percentile(int stage, int percent) const {
+        std::vector<unsigned long> sorted = samples[stage];
+        if (sorted.empty()) return 0;
+        std::sort(sorted.begin(), sorted.end());
+        const size_t rank = (sorted.size() * percent + 99) / 100;
+        return sorted[max(rank, (size_t) 1) - 1];
+    }
+};
+
+static unsigned long framesSent() {
+    const heatpumpCounters &counters = heatPump.getCounters();
+    return counters.sentConnect + counters.sentSet + counters.sentInfo;
+}
+
+static void runWorkload(const Workload &workload, int changes, Result &result) {
+    const heatpumpCounters &counters = heatPump.getCounters();
+    result.name = workload.name;
+    for (int index = 0; index < changes; index++) {
+        const Change change = workload.change(index);
+        const heatpumpCounters before = counters;
+        const unsigned long frames = framesSent();
+        const uint32_t start = Firmware::clock.millis();
+        bool sent = false;
+        bool acked = false;
+        size_t next = 0;
+
+        // runs to each write of a burst in turn and on until confirmed, stopping for the first set frame and
+        // ack on the way; each stamps its own time, so stopping doesn't skew the next
+        for (;;) {
+            const uint32_t elapsed = Firmware::clock.millis() - start;
+            while (next < change.size() && change[next].at <= elapsed) {
+                homeSpan.write(change[next].characteristic, change[next].value);
+                next++;
+            }
+            const bool written = next == change.size();
+            const bool stopped = Firmware::runUntil([&] {
+                return (!sent && counters.sentSet != before.sentSet) ||
+                       (!acked && counters.receivedSetAck != before.receivedSetAck) ||
+                       (written && !metrics.commandInFlight());
+            }, written ? CHANGE_LIMIT_MS - min<uint64_t>(elapsed, CHANGE_LIMIT_MS) : change[next].at - elapsed);
+            if (!sent && counters.sentSet != before.sentSet) {
+                sent = true;
+                result.samples[SET_FRAME].push_back(counters.lastSetSentMs - start);
+            }
+            if (!acked && counters.receivedSetAck != before.receivedSetAck) {
+                acked = true;
+                result.samples[SET_ACK].push_back(counters.lastSetAckMs - start);
+            }
+            if (written && !metrics.commandInFlight()) {
+                result.samples[CONFIRMED].push_back(Firmware::clock.millis() - start);
+                result.samples[FRAMES].push_back(framesSent() - frames);
+                result.samples[SET_FRAMES].push_back(counters.sentSet - before.sentSet);
+                break;
+            }
+            if (written && !stopped) {
+                result.unconfirmed++;
+                break;
+            }
+        }
+        Firmware::run(MIN_GAP_MS + (uint64_t) index * 7919 % GAP_SPREAD_MS);
+    }
+}
+
+static Idle runIdle() {
+    const unsigned long wakeups = Firmware::wakeups();
+    const unsigned long frames = framesSent();
+    const unsigned long pickups = Serial2.pickups;
+    const uint64_t pickupTotalMs = Serial2.pickupTotalMs;
+    Serial2.pickupMaxMs = 0;
+    Firmware::run(IDLE_MS);
+    const double minutes = IDLE_MS / 60000.0;
+    const unsigned long read = Serial2.pickups - pickups;
+    return {(Firmware::wakeups() - wakeups) / minutes, (framesSent() - frames) / minutes,
+            read ? (double) (Serial2.pickupTotalMs - pickupTotalMs) / read : 0, Serial2.pickupMaxMs};
+}
+
+static bool parseLimit(const char *text, std::vector<Limit> &limits) {
+    const char *colon = strchr(text, ':');
+    const std::string workload = colon ? std::string(text, colon) : std::string();
+    if (colon) text = colon + 1;
+    for (int stage = 0; stage < STAGES; stage++) {
+        const size_t length = strlen(STAGE_NAMES[stage]);
+        int percentile;
+        unsigned long value;
+        if (strncmp(text, STAGE_NAMES[stage], length) != 0 ||
+            sscanf(text + length, ".p%d=%lu", &percentile, &value) != 2 ||
+            std::find(std::begin(PERCENTILES), std::end(PERCENTILES), percentile) == std::end(PERCENTILES)) {
+            continue;
+        }
+        for (Limit &limit : limits) {
+            if (limit.workload == workload && limit.stage == stage && limit.percentile == percentile) {
+                limit.value = value;
+                return true;
+            }
+        }
+        limits.push_back({workload, stage, percentile, value});
+        return true;
+    }
+    return false;
+}
+
+// a workload is held to its own limit for a stage and percentile, or else to the one for all workloads
+static bool holds(const Limit &limit, const std::vector<Limit> &limits, const std::string &workload) {
+    if (!limit.workload.empty()) return limit.workload == workload;
+    for (const Limit &other : limits) {
+        if (other.workload == workload && other.stage == limit.stage && other.percentile == limit.percentile) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void writeResults(FILE *file, const Idle &idle, const std::vector<Result> &results,
+                         const std::vector<Limit> &limits, int changes, uint32_t replyDelayMs, bool passed) {
+    fprintf(file, "{\n  \"changes\": %d,\n  \"reply_delay_ms\": %u,\n", changes, (unsigned) replyDelayMs);
+    fprintf(file, "  \"idle\": {\"wakeups_per_min\": %.1f, \"frames_per_min\": %.1f, \"reply_pickup_mean_ms\": %.1f, "
+                  "\"reply_pickup_max_ms\": %u},\n", idle.wakeupsPerMinute, idle.framesPerMinute, idle.pickupMeanMs,
+            (unsigned) idle.pickupMaxMs);
+    fprintf(file, "  \"workloads\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result &result = results[i];
+        fprintf(file, "    {\"name\": \"%s\", \"unconfirmed\": %lu", result.name.c_str(), result.unconfirmed);
+        for (int stage = 0; stage < STAGES; stage++) {
+            fprintf(file, ",\n     \"%s\": {\"count\": %zu", STAGE_NAMES[stage], result.samples[stage].size());
+            for (int percent : PERCENTILES) fprintf(file, ", \"p%d\": %lu", percent, result.percentile(stage, percent));
+            fprintf(file, "}");
+        }
+        fprintf(file, "}%s\n", i + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "  ],\n  \"limits\": [\n");
+    for (size_t i = 0; i < limits.size(); i++) {
+        const Limit &limit = limits[i];
+        unsigned long worst = 0;
+        for (const Result &result : results) {
+            if (holds(limit, limits, result.name)) worst = max(worst, result.percentile(limit.stage, limit.percentile));
+        }
+        fprintf(file, "    {\"workload\": \"%s\", \"stage\": \"%s\", \"percentile\": %d, \"limit\": %lu, "
+                      "\"worst\": %lu, \"passed\": %s}%s\n",
+                limit.workload.empty() ? "*" : limit.workload.c_str(), STAGE_NAMES[limit.stage], limit.percentile,
+                limit.value, worst, worst <= limit.value ? "true" : "false", i + 1 < limits.size() ? "," : "");
+    }
+    fprintf(file, "  ],\n  \"passed\": %s\n}\n", passed ? "true" : "false");
+}
+
+int main(int argc, char **argv) {
+    int changes = 100;
+    uint32_t replyDelayMs = 60;
+    bool wholeDegrees = false;
+    const char *output = "latency.json";
+    std::vector<const char *> burstFiles;
+    std::vector<Limit> limits = {
+        {"", SET_FRAME, 95, HK_SET_FRAME_P95_LIMIT_MS},
+        {"", SET_ACK, 95, HK_SET_ACK_P95_LIMIT_MS},
+        {"", CONFIRMED, 95, HK_CONFIRMED_P95_LIMIT_MS},
+        {"", FRAMES, 95, HK_FRAMES_P95_LIMIT},
+    };
+    int option;
+    while ((option = getopt(argc, argv, "n:r:wb:o:l:vh")) != -1) {
+        if (option == 'n') {
+            changes = max(atoi(optarg), 1);
+        } else if (option == 'r') {
+            replyDelayMs = (uint32_t) atoi(optarg);
+        } else if (option == 'w') {
+            wholeDegrees = true;
+        } else if (option == 'b') {
+            burstFiles.push_back(optarg);
+        } else if (option == 'o') {
+            output = optarg;
+        } else if (option == 'l' && parseLimit(optarg, limits)) {
+        } else if (option == 'v') {
+            homeSpan.log = stdout;
+        } else {
+            fprintf(stderr, "usage: %s [-n changes] [-r reply ms] [-w] [-b bursts.txt]... [-o results.json]\n"
+                            "  [-l [workload:]stage.pNN=limit]... [-v]\n"
+                            "  stages: set_frame, set_ack, confirmed (ms), frames and set_frames;"
+                            " percentiles p50, p95, p99\n",
+                    argv[0]);
+            return option == 'h' ? 0 : 2;
+        }
+    }
+
+    Serial2.unit.halfDegrees = !wholeDegrees; // before the first settings read
+    Firmware::begin(1792850400); // 2026-10-25
+    Serial2.replyDelayMs = replyDelayMs;
+    // after begin(), which creates the characteristics
+    std::vector<Workload> workloads = builtinWorkloads();
+    for (const char *path : burstFiles) {
+        if (!loadBursts(path, workloads)) return 2;
+    }
+    Firmware::run(SETTLE_MS);
+    const Idle idle = runIdle();
+
+    std::vector<Result> results(workloads.size());
+    for (size_t i = 0; i < results.size(); i++) runWorkload(workloads[i], changes, results[i]);
+
+    printf("idle: %.0f task wakeups/min, %.1f frames/min, replies read %.1f ms (at most %u ms) after they came in\n\n",
+           idle.wakeupsPerMinute, idle.framesPerMinute, idle.pickupMeanMs, (unsigned) idle.pickupMaxMs);
+    printf("%-10s %14s %14s %14s %12s %12s\n", "", "set_frame ms", "set_ack ms", "confirmed ms", "frames",
+           "set_frames");
+    printf("%-10s %14s %14s %14s %12s %12s\n", "workload", "p50/p95/p99", "p50/p95/p99", "p50/p95/p99",
+           "p50/p95/p99", "p50/p95/p99");
+    bool passed = true;
+    for (const Result &result : results) {
+        printf("%-10s", result.name.c_str());
+        for (int stage = 0; stage < STAGES; stage++) {
+            char text[40];
+            snprintf(text, sizeof(text), "%lu/%lu/%lu", result.percentile(stage, 50), result.percentile(stage, 95),
+                     result.percentile(stage, 99));
+            printf(" %*s", stage >= FRAMES ? 12 : 14, text);
+        }
+        printf("\n");
+        if (result.unconfirmed) {
+            printf("FAIL  %s: %lu of %d changes never confirmed\n", result.name.c_str(), result.unconfirmed, changes);
+            passed = false;
+        }
+    }
+    for (const Limit &limit : limits) {
+        for (const Result &result : results) {
+            const unsigned long value = result.percentile(limit.stage, limit.percentile);
+            if (!holds(limit, limits, result.name) || value <= limit.value) continue;
+            printf("FAIL  %s: %s p%d %lu over the limit of %lu\n", result.name.c_str(), STAGE_NAMES[limit.stage],
+                   limit.percentile, value, limit.value);
+            passed = false;
+        }
+    }
+
+    FILE *file = fopen(output, "w");
+    if (!file) {
+        perror(output);
+        return 2;
+    }
+    writeResults(file, idle, results, limits, changes, replyDelayMs, passed);
+    fclose(file);
+    printf("%s, results in %s\n", passed ? "passed" : "FAILED", output);
+    return passed ? 0 : 1;
+}
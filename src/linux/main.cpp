@@ -0,0 +1,68 @@
+#include "Gateway.h"
+#include <unistd.h>
+
+static const char *DEFAULT_SOCKET = "/tmp/heatpump-gateway.sock";
+
+static void usage(const char *program) {
+    fprintf(stderr, "usage: %s [-s socket] [-c capture] [-H directory] [-T trace] [-l] device...\n"
+                    "  drives CN105 units on the given serial devices, state is served on the socket (%s)\n"
+                    "  -c appends every frame to a capture file for heatpump-analyzer\n"
+                    "  -H keeps each unit's history in <directory>/unit<N>.history\n"
+                    "  -T writes the last library spans as Chrome trace JSON on exit\n"
+                    "  -l listen-only: never transmit, follow another master (MHK1/MHK2) on each bus\n",
+            program, DEFAULT_SOCKET);
+}
+
+int main(int argc, char **argv) {
+    const char *socketPath = DEFAULT_SOCKET;
+    const char *capturePath = nullptr;
+    const char *historyDirectory = nullptr;
+    const char *tracePath = nullptr;
+    bool listenOnly = false;
+    int option;
+    while ((option = getopt(argc, argv, "s:c:H:T:lh")) != -1) {
+        if (option == 's') {
+            socketPath = optarg;
+        } else if (option == 'c') {
+            capturePath = optarg;
+        } else if (option == 'H') {
+            historyDirectory = optarg;
+        } else if (option == 'T') {
+            tracePath = optarg;
+        } else if (option == 'l') {
+            listenOnly = true;
+        } else {
+            usage(argv[0]);
+            return option == 'h' ? 0 : 2;
+        }
+    }
+    if (optind == argc) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    Gateway gateway;
+    if (capturePath && !gateway.capture(capturePath)) {
+        fprintf(stderr, "can't write %s\n", capturePath);
+        return 1;
+    }
+    if (tracePath && !gateway.trace(tracePath)) {
+        fprintf(stderr, "can't write %s\n", tracePath);
+        return 1;
+    }
+    if (historyDirectory) gateway.history(historyDirectory);
+    if (listenOnly) gateway.listenOnly();
+    for (int i = optind; i < argc; i++) {
+        if (!gateway.addUnit(argv[i])) {
+            fprintf(stderr, "can't open %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (!gateway.listen(socketPath)) {
+        fprintf(stderr, "can't listen on %s\n", socketPath);
+        return 1;
+    }
+
+    gateway.run();
+    return 0;
+}
@@ -0,0 +1,206 @@
+#pragma once
+/*
+ * PubSubClient's interface as MqttBridge and the integration test use it, speaking MQTT 3.1.1 at QoS 0 over
+ * a Client (see WiFi.h). It behaves like the library where the bridge can tell: connect() blocks until the
+ * CONNACK or the socket timeout, publish() and subscribe() write at once and fail while disconnected, loop()
+ * sends the keepalive and hands each received PUBLISH to the callback with the topic NUL-terminated in place.
+ */
+#include <WiFi.h>
+#include <functional>
+#include <vector>
+
+class PubSubClient {
+public:
+    explicit PubSubClient(Client &client) : client(client), buffer(256) {}
+
+    PubSubClient &setServer(const char *domain, uint16_t port) {
+        this->domain = domain;
+        this->port = port;
+        return *this;
+    }
+    PubSubClient &setCallback(std::function<void(char *, uint8_t *, unsigned int)> callback) {
+        this->callback = callback;
+        return *this;
+    }
+    bool setBufferSize(uint16_t size) {
+        buffer.resize(size);
+        return true;
+    }
+    PubSubClient &setSocketTimeout(uint16_t seconds) {
+        socketTimeoutMs = seconds * 1000UL;
+        return *this;
+    }
+
+    bool connect(const char *id) {
+        return connect(id, nullptr, nullptr, nullptr, 0, false, nullptr);
+    }
+
+    bool connect(const char *id, const char *user, const char *pass, const char *willTopic, uint8_t willQos,
+                 bool willRetain, const char *willMessage) {
+        if (!client.connect(domain, port)) return false;
+        size_t length = 0;
+        static const uint8_t protocol[] = {0, 4, 'M', 'Q', 'T', 'T', 4};
+        memcpy(&buffer[0], protocol, sizeof(protocol));
+        length = sizeof(protocol);
+        uint8_t flags = 0x02; // clean session
+        if (willTopic) flags |= 0x04 | (uint8_t) (willQos << 3) | (willRetain ? 0x20 : 0);
+        if (user) flags |= 0x80;
+        if (pass) flags |= 0x40;
+        buffer[length++] = flags;
+        buffer[length++] = (uint8_t) (KEEPALIVE_S >> 8);
+        buffer[length++] = (uint8_t) KEEPALIVE_S;
+        bool fits = putString(length, id);
+        if (willTopic) fits = fits && putString(length, willTopic) && putString(length, willMessage);
+        if (user) fits = fits && putString(length, user);
+        if (pass) fits = fits && putString(length, pass);
+        if (!fits || !send(0x10, length)) {
+            client.stop();
+            return false;
+        }
+        uint8_t type;
+        // anything but an accepting CONNACK closes the connection
+        if (!readPacket(type, length) || type != 0x20 || length != 2 || buffer[1] != 0) {
+            client.stop();
+            return false;
+        }
+        lastIn = lastOut = millis();
+        pingOutstanding = false;
+        return true;
+    }
+
+    void disconnect() {
+        buffer[0] = 0xe0;
+        buffer[1] = 0;
+        client.write(&buffer[0], 2);
+        client.stop();
+    }
+
+    bool connected() {
+        return client.connected() != 0;
+    }
+
+    bool loop() {
+        if (!connected()) return false;
+        const unsigned long now = millis();
+        if (now - lastIn > KEEPALIVE_S * 1000UL || now - lastOut > KEEPALIVE_S * 1000UL) {
+            if (pingOutstanding) {
+                client.stop(); // the broker stopped answering
+                return false;
+            }
+            if (!send(0xc0, 0)) return false;
+            pingOutstanding = true;
+        }
+        while (client.available()) {
+            uint8_t type;
+            size_t length;
+            if (!readPacket(type, length)) {
+                client.stop();
+                return false;
+            }
+            lastIn = millis();
+            if ((type & 0xf0) == 0x30 && length >= 2) {
+                // PUBLISH at QoS 0: topic length, topic, payload. The topic's NUL goes where its length was
+                const size_t topicLength = ((size_t) buffer[0] << 8) | buffer[1];
+                if (topicLength + 2 > length || !callback) continue;
+                memmove(&buffer[0], &buffer[2], topicLength);
+                buffer[topicLength] = 0;
+                callback((char *) &buffer[0], &buffer[topicLength + 2], (unsigned int) (length - topicLength - 2));
+            } else if (type == 0xd0) {
+                pingOutstanding = false;
+            }
+        }
+        return true;
+    }
+
+    bool publish(const char *topic, const char *payload, bool retained) {
+        if (!connected()) return false;
+        size_t length = 0;
+        const size_t payloadLength = strlen(payload);
+        if (!putString(length, topic) || length + payloadLength > buffer.size()) return false;
+        memcpy(&buffer[length], payload, payloadLength);
+        return send(retained ? 0x31 : 0x30, length + payloadLength);
+    }
+
+    bool subscribe(const char *topic) {
+        if (!connected()) return false;
+        size_t length = 0;
+        if (++nextId == 0) nextId = 1; // 0 isn't a packet id
+        buffer[length++] = (uint8_t) (nextId >> 8);
+        buffer[length++] = (uint8_t) nextId;
+        if (!putString(length, topic) || length == buffer.size()) return false;
+        buffer[length++] = 0; // QoS 0
+        return send(0x82, length);
+    }
+
+private:
+    static const unsigned KEEPALIVE_S = 15;
+
+    Client &client;
+    const char *domain = nullptr;
+    uint16_t port = 1883;
+    std::vector<uint8_t> buffer; // a packet's variable header and payload
+    std::function<void(char *, uint8_t *, unsigned int)> callback;
+    unsigned long socketTimeoutMs = 15000;
+    unsigned long lastIn = 0;
+    unsigned long lastOut = 0;
+    bool pingOutstanding = false;
+    uint16_t nextId = 0;
+
+    bool putString(size_t &length, const char *text) {
+        const size_t textLength = strlen(text);
+        if (length + 2 + textLength > buffer.size()) return false;
+        buffer[length++] = (uint8_t) (textLength >> 8);
+        buffer[length++] = (uint8_t) textLength;
+        memcpy(&buffer[length], text, textLength);
+        length += textLength;
+        return true;
+    }
+
+    // the fixed header, then `length` bytes of the buffer
+    bool send(uint8_t type, size_t length) {
+        uint8_t header[5] = {type};
+        size_t headerLength = 1;
+        size_t remaining = length;
+        do {
+            header[headerLength] = (uint8_t) (remaining & 0x7f);
+            remaining >>= 7;
+            if (remaining) header[headerLength] |= 0x80;
+            headerLength++;
+        } while (remaining);
+        if (client.write(header, headerLength) != headerLength) return false;
+        if (length && client.write(&buffer[0], length) != length) return false;
+        lastOut = millis();
+        return true;
+    }
+
+    // waits up to the socket timeout for the next byte
+    bool readByte(uint8_t &b) {
+        const unsigned long start = millis();
+        int value;
+        while ((value = client.read()) < 0) {
+            if (!client.connected() || millis() - start >= socketTimeoutMs) return false;
+            delay(1);
+        }
+        b = (uint8_t) value;
+        return true;
+    }
+
+    // a whole packet into the buffer, one that doesn't fit is read and dropped with an empty length
+    bool readPacket(uint8_t &type, size_t &length) {
+        uint8_t b;
+        if (!readByte(type)) return false;
+        length = 0;
+        for (int shift = 0; shift < 28; shift += 7) {
+            if (!readByte(b)) return false;
+            length |= (size_t) (b & 0x7f) << shift;
+            if (!(b & 0x80)) break;
+        }
+        const bool fits = length <= buffer.size();
+        for (size_t i = 0; i < length; i++) {
+            if (!readByte(b)) return false;
+            if (fits) buffer[i] = b;
+        }
+        if (!fits) length = 0;
+        return true;
+    }
+};
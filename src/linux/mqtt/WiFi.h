@@ -0,0 +1,89 @@
+#pragma once
+/*
+ * Client and WiFiClient as the MQTT bridge uses them, over a TCP socket, found before the never-connecting ones
+ * in linux/firmware. connect() blocks like the ESP32's: for the lookup and the TCP handshake.
+ */
+#include <Arduino.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+class Client {
+public:
+    virtual int connect(const char *host, uint16_t port) = 0;
+    virtual size_t write(const uint8_t *data, size_t length) = 0;
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual void stop() = 0;
+    virtual uint8_t connected() = 0;
+    virtual ~Client() {}
+};
+
+class WiFiClient : public Client {
+public:
+    ~WiFiClient() override {
+        stop();
+    }
+
+    int connect(const char *host, uint16_t port) override {
+        stop();
+        char service[8];
+        snprintf(service, sizeof(service), "%u", (unsigned) port);
+        struct addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        struct addrinfo *addresses = nullptr;
+        if (getaddrinfo(host, service, &hints, &addresses) != 0) return 0;
+        for (struct addrinfo *address = addresses; address && fd < 0; address = address->ai_next) {
+            fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+            if (fd < 0) continue;
+            if (::connect(fd, address->ai_addr, address->ai_addrlen) < 0) stop();
+        }
+        freeaddrinfo(addresses);
+        if (fd < 0) return 0;
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        return 1;
+    }
+
+    size_t write(const uint8_t *data, size_t length) override {
+        if (fd < 0) return 0;
+        const ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+        return sent > 0 ? (size_t) sent : 0;
+    }
+
+    int available() override {
+        int count = 0;
+        if (fd < 0 || ioctl(fd, FIONREAD, &count) < 0) return 0;
+        return count;
+    }
+
+    int read() override {
+        uint8_t b;
+        return fd >= 0 && recv(fd, &b, 1, MSG_DONTWAIT) == 1 ? b : -1;
+    }
+
+    void stop() override {
+        if (fd >= 0) close(fd);
+        fd = -1;
+    }
+
+    // like the ESP32's, still true while received data is left to read
+    uint8_t connected() override {
+        if (fd < 0) return 0;
+        uint8_t b;
+        const ssize_t count = recv(fd, &b, 1, MSG_PEEK | MSG_DONTWAIT);
+        if (count == 0 || (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            stop();
+            return 0;
+        }
+        return 1;
+    }
+
+private:
+    int fd = -1;
+};
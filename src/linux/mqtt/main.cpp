@@ -0,0 +1,294 @@
+/*
+ * Integration test of MqttBridge against a real broker, e.g. mosquitto on this machine:
+ *
+ *   mosquitto -p 1883 &
+ *   heatpump-mqtt [-h host] [-p port] [-t topic]
+ *
+ * The bridge serves a HeatPump on a SimulatedUnit (the virtual-time serial of linux/soak) from one loop, like
+ * HK_poll on the device, and connects on a thread of its own, like the MQTT_connect task. It checks that
+ *   - a broker that accepts the TCP connection but never answers holds up the connect thread, not poll()
+ *   - the bridge comes online and publishes the retained fields and the state JSON
+ *   - set/temperature reaches the unit and comes back on <topic>/temperature
+ *   - values the unit doesn't take are dropped
+ *   - <topic>/compressorFrequency follows the unit's ramp, which doesn't fire the status callback
+ *   - commands are dropped while the link is down and while listen-only
+ *   - the will marks the bridge offline when its connection drops, and it reconnects
+ * and that no poll() took longer than POLL_LIMIT_MS. The topic defaults to heatpump-test-<pid>, its retained
+ * values are cleared at the end. Exits with 1 if a check failed, 2 if the broker can't be reached.
+ */
+#include <MqttBridge.h>
+#include <HardwareSerial.h>
+#include <config.h>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <arpa/inet.h>
+
+static const double POLL_LIMIT_MS = 50;
+static const useconds_t PASS_INTERVAL_US = 5000;
+static const uint32_t PASS_ADVANCE_MS = 20; // virtual time per loop pass, for the heat pump
+
+/**
+ * main.cpp's MQTT_connect task as a thread: runs the bridge's connect() each time poll() notifies it.
+ */
+class ConnectTask {
+public:
+    double longestMs = 0; // the longest connect()
+
+    explicit ConnectTask(MqttBridge &bridge) : bridge(bridge), thread(&ConnectTask::run, this) {
+        bridge.setConnectTask(this);
+    }
+
+    ~ConnectTask() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        thread.join();
+    }
+
+    void notify() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            notified = true;
+        }
+        wake.notify_one();
+    }
+
+private:
+    MqttBridge &bridge;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool notified = false;
+    bool stopping = false;
+    std::thread thread;
+
+    void run() {
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this]() { return notified || stopping; });
+                if (stopping) return;
+                notified = false;
+            }
+            const auto start = std::chrono::steady_clock::now();
+            bridge.connect();
+            const auto connecting = std::chrono::steady_clock::now() - start;
+            longestMs = std::max(longestMs, std::chrono::duration<double, std::milli>(connecting).count());
+        }
+    }
+};
+
+void xTaskNotifyGive(TaskHandle_t task) {
+    static_cast<ConnectTask *>(task)->notify();
+}
+
+/**
+ * The heat pump and a bridge, served from one loop, and an observer client subscribed to the bridge's topics.
+ */
+struct Rig {
+    heatpumpVirtualClock clock;
+    HardwareSerial serial {clock};
+    HeatPump heatPump;
+    WiFiClient bridgeClient;
+    MqttBridge bridge {heatPump, bridgeClient};
+    WiFiClient observerClient;
+    PubSubClient observer {observerClient};
+    std::map<std::string, std::string> values; // what the observer got, by topic
+    std::set<std::string> frequencies;         // every <topic>/compressorFrequency it got
+    double pollMaxMs = 0;
+
+    Rig() {
+        heatPump.setClock(&clock);
+        heatPump.setSettingsChangedCallback([this]() { bridge.settingsChanged(heatPump.getSettings()); });
+        heatPump.setStatusChangedCallback([this](heatpumpStatus status) { bridge.statusChanged(status); });
+        heatPump.connect(&serial);
+        heatPump.enableExternalUpdate(); // like main.cpp, wanted settings outlive a settings read
+        observer.setCallback([this](char *topic, uint8_t *payload, unsigned int length) {
+            values[topic] = std::string((const char *) payload, length);
+            const char *field = strrchr(topic, '/');
+            if (field && strcmp(field, "/compressorFrequency") == 0) frequencies.insert(values[topic]);
+        });
+    }
+
+    void pass() {
+        const auto start = std::chrono::steady_clock::now();
+        bridge.poll();
+        const auto polled = std::chrono::steady_clock::now() - start;
+        pollMaxMs = std::max(pollMaxMs, std::chrono::duration<double, std::milli>(polled).count());
+        heatPump.sync();
+        clock.advance(PASS_ADVANCE_MS);
+        if (observer.connected()) observer.loop();
+        usleep(PASS_INTERVAL_US);
+    }
+
+    // passes until the condition holds, false if it didn't within the limit
+    bool runUntil(std::function<bool()> condition, unsigned long limitMs) {
+        const unsigned long start = millis();
+        while (!condition()) {
+            if (millis() - start >= limitMs) return false;
+            pass();
+        }
+        return true;
+    }
+
+    void run(unsigned long ms) {
+        runUntil([]() { return false; }, ms);
+    }
+
+    std::string value(const std::string &topic) {
+        auto it = values.find(topic);
+        return it == values.end() ? "" : it->second;
+    }
+};
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+    printf("%s  %s\n", ok ? "ok  " : "FAIL", what);
+    if (!ok) failures++;
+}
+
+// the unit's setpoint byte for whole and half degrees
+static uint8_t unitTemperature(float degrees) {
+    return (uint8_t) (degrees * 2 + 128);
+}
+
+/**
+ * A listener that completes the TCP handshake and then says nothing, so a connect waits for the CONNACK until
+ * PubSubClient's socket timeout. Returns the port.
+ */
+static uint16_t silentBroker(int &fd) {
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (bind(fd, (struct sockaddr *) &address, length) < 0 || listen(fd, 1) < 0 ||
+        getsockname(fd, (struct sockaddr *) &address, &length) < 0) {
+        return 0;
+    }
+    return ntohs(address.sin_port);
+}
+
+int main(int argc, char **argv) {
+    const char *host = "localhost";
+    uint16_t port = 1883;
+    char topic[48];
+    snprintf(topic, sizeof(topic), "heatpump-test-%d", (int) getpid());
+    int option;
+    while ((option = getopt(argc, argv, "h:p:t:")) != -1) {
+        if (option == 'h') {
+            host = optarg;
+        } else if (option == 'p') {
+            port = (uint16_t) atoi(optarg);
+        } else if (option == 't') {
+            snprintf(topic, sizeof(topic), "%s", optarg);
+        } else {
+            fprintf(stderr, "usage: %s [-h host] [-p port] [-t topic]\n", argv[0]);
+            return 2;
+        }
+    }
+    const std::string base = topic;
+
+    {
+        int listener;
+        const uint16_t silentPort = silentBroker(listener);
+        Rig rig;
+        ConnectTask connectTask(rig.bridge);
+        rig.bridge.begin("127.0.0.1", silentPort, topic);
+        rig.run(3000);
+        close(listener); // resets the connection, the pending connect() fails
+        rig.run(100);
+        printf("silent broker: connect() held up for %.0f ms, poll() %.1f ms at most\n", connectTask.longestMs,
+               rig.pollMaxMs);
+        check(silentPort && connectTask.longestMs >= 3000 && rig.pollMaxMs < POLL_LIMIT_MS,
+              "poll() doesn't wait for a silent broker");
+    }
+
+    Rig rig;
+    rig.observer.setServer(host, port);
+    if (!rig.observer.connect("heatpump-test-observer") || !rig.observer.subscribe((base + "/#").c_str())) {
+        fflush(stdout);
+        fprintf(stderr, "no MQTT broker at %s:%u\n", host, (unsigned) port);
+        return 2;
+    }
+    ConnectTask connectTask(rig.bridge);
+    rig.bridge.begin(host, port, topic);
+
+    check(rig.runUntil([&]() { return rig.value(base + "/online") == "true"; }, 10000), "online");
+    check(rig.runUntil([&]() {
+        for (const char *field : {"power", "mode", "temperature", "fan", "roomTemperature", "link", "state"}) {
+            if (rig.value(base + "/" + field).empty()) return false;
+        }
+        return true;
+    }, 10000), "fields and state published");
+
+    rig.observer.publish((base + "/set/temperature").c_str(), "23.5", false);
+    check(rig.runUntil([&]() {
+        return rig.serial.unit.temperature == unitTemperature(23.5) && rig.value(base + "/temperature") == "23.5";
+    }, 5000), "set/temperature reaches the unit and comes back");
+
+    for (const char *invalid : {"temperature=45", "temperature=nan", "temperature=22abc", "temperature=23.50000000001",
+                                "fan=9", "mode=TURBO", "vane=", "wideVane=^"}) {
+        const char *value = strchr(invalid, '=');
+        rig.observer.publish((base + "/set/" + std::string(invalid, value - invalid)).c_str(), value + 1, false);
+    }
+    rig.run(2000);
+    check(rig.serial.unit.temperature == unitTemperature(23.5) && rig.value(base + "/fan") == "AUTO" &&
+          rig.value(base + "/mode") == "HEAT" && rig.value(base + "/vane") == "AUTO" &&
+          rig.value(base + "/wideVane") == "|", "invalid values dropped");
+
+    // the unit ramps its compressor up over 30 s of every minute while it keeps operating
+    check(rig.runUntil([&]() { return rig.frequencies.size() >= 4; }, 15000), "compressorFrequency follows the unit");
+
+    // a dropped command mustn't be sent now, nor once the link is back or another master lets go
+    rig.serial.silence(rig.clock.millis(), rig.clock.millis() + 600000);
+    const bool down = rig.runUntil([&]() { return rig.heatPump.getLinkState() == HEATPUMP_LINK_DOWN; }, 20000);
+    rig.observer.publish((base + "/set/temperature").c_str(), "25", false);
+    rig.run(1000);
+    rig.serial.silence(0, 0);
+    const bool up = rig.runUntil([&]() {
+        return rig.heatPump.getLinkState() == HEATPUMP_LINK_HEALTHY && rig.value(base + "/link") == "healthy";
+    }, 20000);
+    rig.observer.publish((base + "/set/fan").c_str(), "2", false);
+    rig.run(2000);
+    check(down && up && rig.serial.unit.temperature == unitTemperature(23.5) && rig.value(base + "/fan") == "2",
+          "commands dropped while the link is down");
+
+    rig.heatPump.enableListenOnly();
+    rig.run(500);
+    rig.observer.publish((base + "/set/temperature").c_str(), "26", false);
+    rig.run(1000);
+    rig.heatPump.disableListenOnly();
+    rig.run(1000);
+    rig.observer.publish((base + "/set/fan").c_str(), "3", false);
+    rig.run(2000);
+    check(rig.serial.unit.temperature == unitTemperature(23.5) && rig.value(base + "/fan") == "3",
+          "commands dropped while listen-only");
+
+    rig.bridgeClient.stop(); // no DISCONNECT, the broker sends the will
+    check(rig.runUntil([&]() { return rig.value(base + "/online") == "false"; }, 5000), "will marks it offline");
+    check(rig.runUntil([&]() { return rig.value(base + "/online") == "true"; }, MQTT_RECONNECT_INTERVAL_MS + 5000),
+          "reconnects");
+
+    printf("state %s\n", rig.value(base + "/state").c_str());
+    printf("poll() %.1f ms at most, connect() %.1f ms at most\n", rig.pollMaxMs, connectTask.longestMs);
+    check(rig.pollMaxMs < POLL_LIMIT_MS, "poll() stays short");
+
+    // a clean DISCONNECT, so no will, then leave nothing retained behind
+    static const uint8_t disconnect[] = {0xe0, 0};
+    rig.bridgeClient.write(disconnect, sizeof(disconnect));
+    rig.bridgeClient.stop();
+    for (auto &value : rig.values) rig.observer.publish(value.first.c_str(), "", true);
+    rig.observer.disconnect();
+
+    printf(failures ? "FAILED\n" : "passed\n");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,55 @@
+#pragma once
+/*
+ * In-memory HardwareSerial for heatpump-replay, found before the termios one in linux/compat. Each complete
+ * frame HeatPump writes goes to onFrame; the replay puts the recorded replies into the receive buffer with
+ * deliver() when they are due.
+ */
+#include <Arduino.h>
+#include <deque>
+#include <functional>
+
+#define SERIAL_8E1 0x800001e
+
+class HardwareSerial {
+public:
+    std::function<void(const uint8_t *frame, int length)> onFrame;
+
+    void begin(unsigned long baud, uint32_t config) {
+        (void) baud;
+        (void) config;
+    }
+    void end() {
+    }
+
+    int available() {
+        return (int) received.size();
+    }
+
+    int read() {
+        if (received.empty()) return -1;
+        const uint8_t b = received.front();
+        received.pop_front();
+        return b;
+    }
+
+    size_t write(uint8_t b) {
+        if (length == 0 && b != 0xfc) return 1;
+        frame[length++] = b;
+        if (length >= 5 && length == frame[4] + 6) {
+            length = 0;
+            if (onFrame) onFrame(frame, frame[4] + 6);
+        } else if (length == (int) sizeof(frame)) {
+            length = 0;
+        }
+        return 1;
+    }
+
+    void deliver(const uint8_t *data, int count) {
+        received.insert(received.end(), data, data + count);
+    }
+
+private:
+    std::deque<uint8_t> received;
+    uint8_t frame[24];
+    int length = 0;
+};
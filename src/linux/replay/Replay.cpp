@@ -0,0 +1,271 @@
+#include "Replay.h"
+#include "../Capture.h"
+#include <string.h>
+#include <time.h>
+
+static double seconds() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static const char *linkStateName(heatpumpLinkState state) {
+    switch (state) {
+        case HEATPUMP_LINK_DOWN: return "down";
+        case HEATPUMP_LINK_DEGRADED: return "degraded";
+        default: return "healthy";
+    }
+}
+
+Replay::Replay(int unit, double speed, bool verbose, FILE *out)
+    : unit(unit), speed(speed), verbose(verbose), out(out) {
+    serial.onFrame = [this](const uint8_t *data, int length) { onFrame(data, length); };
+
+    // like a gateway unit, see Gateway::Unit::start()
+    heatPump.setClock(this);
+    heatPump.enableExternalUpdate();
+    heatPump.setSettingsChangedCallback([this]() {
+        const heatpumpSettings settings = heatPump.getSettings();
+        char temperature[12];
+        settings.temperature.toString(temperature, sizeof(temperature));
+        settingsChanges++;
+        fprintf(this->out, "  %+12.3fs  settings    power=%s mode=%s temp=%s fan=%s vane=%s wideVane=%s%s\n",
+                now / 1000.0, settings.power, settings.mode, temperature, settings.fan, settings.vane,
+                settings.wideVane, settings.iSee ? " iSee" : "");
+    });
+    heatPump.setLinkStateChangedCallback([this](heatpumpLinkState state) {
+        fprintf(this->out, "  %+12.3fs  link        %s\n", now / 1000.0, linkStateName(state));
+    });
+}
+
+void Replay::add(const FrameScanner::Frame *frames, size_t count) {
+    for (size_t i = 0; i < count; i++) addFrame(frames[i].data, frames[i].length);
+}
+
+void Replay::addFrame(const uint8_t *data, int length) {
+    if (isCaptureMark(data, length)) {
+        const uint32_t time = captureMarkTime(data);
+        markMs = timed ? markMs + (uint32_t) (time - lastMark) : 0;
+        lastMark = time;
+        timed = true;
+        marked = true;
+        markUnit = data[5];
+        return;
+    }
+
+    const bool frameTimed = marked;
+    const int frameUnit = marked ? markUnit : 0;
+    marked = false;
+    if (frameUnit != unit || length > MAX_FRAME_LEN) return;
+
+    Frame frame;
+    frame.atMs = markMs;
+    frame.timed = frameTimed;
+    frame.length = (uint8_t) length;
+    memcpy(frame.data, data, length);
+
+    switch (data[1]) {
+        case 0x5a:
+        case 0x41:
+        case 0x42:
+            recording.push_back(Exchange{frame, replies.size(), 0});
+            break;
+        default:
+            // replies, and anything else the unit sent, until the next request; none before the first
+            if (recording.empty()) return;
+            replies.push_back(frame);
+            recording.back().replies++;
+            break;
+    }
+}
+
+bool Replay::run() {
+    wallStart = seconds();
+    heatPump.connect(&serial);
+
+    while (next < recording.size()) {
+        uint64_t wait = heatPump.timeUntilSync();
+
+        const Exchange &expected = recording[next];
+        if (expected.request.data[1] == 0x41 && setApplied != next) {
+            // a set goes out when it was recorded, or sooner if the library would poll first
+            const uint64_t due = firstSent && expected.request.timed
+                                 ? firstSentMs + (expected.request.atMs - firstRecordedMs) : now;
+            if (due <= now || wait == 0) {
+                setApplied = next;
+                if (!applySet(expected)) {
+                    missing++;
+                    printFrame("missing", next, expected.request.data, expected.request.length);
+                    next++;
+                }
+                continue;
+            }
+            wait = min(wait, due - now);
+        }
+
+        if (!pending.empty()) wait = min(wait, pending.front().dueMs - now);
+        // when nothing arrived, look again first: a set may have become due
+        if (!advance(now + wait) && wait > 0) continue;
+        heatPump.sync();
+    }
+
+    // let the library read the last replies, what it sends after that isn't compared
+    if (!pending.empty()) {
+        advance(pending.back().dueMs);
+        heatPump.sync();
+    }
+    return missing + differing + unexpected == 0;
+}
+
+bool Replay::advance(uint64_t to) {
+    // marks are taken when the gateway read a frame, at one of the library's polls, so a reply is handed
+    // over at the first poll here that is within a poll step of that. Otherwise a reply the live library
+    // read as its response timeout ran out could miss a timeout that runs out a few ms earlier here.
+    bool delivered = false;
+    while (!pending.empty() && pending.front().dueMs <= to + READ_SLACK_MS) {
+        const Frame &reply = replies[pending.front().reply];
+        if (pending.front().dueMs > now) now = min(pending.front().dueMs, to);
+        serial.deliver(reply.data, reply.length);
+        pending.erase(pending.begin());
+        delivered = true;
+    }
+    if (to > now) now = to;
+
+    if (speed > 0) {
+        const double ahead = wallStart + now / 1000.0 / speed - seconds();
+        if (ahead > 0) {
+            const timespec pause = {(time_t) ahead, (long) ((ahead - (time_t) ahead) * 1e9)};
+            nanosleep(&pause, nullptr);
+        }
+    }
+    return delivered;
+}
+
+void Replay::onFrame(const uint8_t *data, int length) {
+    if (next >= recording.size()) return; // past the end of the recording
+
+    for (size_t i = next; i < recording.size() && i < next + LOOKAHEAD; i++) {
+        const Frame &request = recording[i].request;
+        if (request.length != length || memcmp(request.data, data, length) != 0) continue;
+        for (; next < i; next++) {
+            if (matched + differing == 0) {
+                skipped++; // a capture that starts mid-cycle, the library starts from its first request
+                continue;
+            }
+            missing++;
+            printFrame("missing", next, recording[next].request.data, recording[next].request.length);
+        }
+        matched++;
+        if (verbose) printFrame("match", i, data, length);
+        answer(i);
+        next = i + 1;
+        return;
+    }
+
+    const Frame &expected = recording[next].request;
+    if (data[1] == expected.data[1] && (data[1] == 0x5a || data[5] == expected.data[5])) {
+        differing++;
+        printFrame("differs", next, expected.data, expected.length);
+        printFrame("sent", SIZE_MAX, data, length);
+        answer(next);
+        next++;
+        return;
+    }
+
+    if (data[1] == 0x5a) {
+        // a capture that starts mid-stream has no connect to answer from, the unit would have acked it
+        static const uint8_t CONNECT_ACK[] = {0xfc, 0x7a, 0x01, 0x30, 0x01, 0x00, 0x54};
+        if (matched + differing > 0) {
+            unexpected++;
+            printFrame("unexpected", SIZE_MAX, data, length);
+        } else {
+            synthesized++;
+        }
+        serial.deliver(CONNECT_ACK, sizeof(CONNECT_ACK));
+        return;
+    }
+
+    unexpected++;
+    printFrame("unexpected", SIZE_MAX, data, length);
+    if (++unexpectedInRow >= MAX_UNEXPECTED) {
+        missing++;
+        printFrame("missing", next, expected.data, expected.length);
+        next++;
+        unexpectedInRow = 0;
+    }
+}
+
+void Replay::answer(size_t exchange) {
+    const Exchange &recorded = recording[exchange];
+    unexpectedInRow = 0;
+
+    if (recorded.request.timed) {
+        if (!firstSent) {
+            firstSent = true;
+            firstSentMs = now;
+            firstRecordedMs = recorded.request.atMs;
+        }
+        const int64_t drift = (int64_t) (now - firstSentMs) - (int64_t) (recorded.request.atMs - firstRecordedMs);
+        if (drift > maxDriftMs || -drift > maxDriftMs) maxDriftMs = drift < 0 ? -drift : drift;
+    }
+
+    for (size_t i = recorded.firstReply; i < recorded.firstReply + recorded.replies; i++) {
+        const Frame &reply = replies[i];
+        const uint64_t delayMs = recorded.request.timed && reply.timed ? reply.atMs - recorded.request.atMs
+                                                                      : REPLY_DELAY_MS;
+        const Pending delivery = {now + delayMs, i};
+        auto at = pending.end();
+        while (at != pending.begin() && (at - 1)->dueMs > delivery.dueMs) at--;
+        pending.insert(at, delivery);
+    }
+}
+
+bool Replay::applySet(const Exchange &exchange) {
+    const uint8_t *set = exchange.request.data + 5;
+    if (exchange.request.length < 22 || set[0] != 0x01) return false; // function settings aren't replayed
+
+    // the set fields sit where parseSettings() finds them in a settings reply
+    byte settingsData[16] = {};
+    settingsData[3] = set[3];
+    settingsData[4] = set[4];
+    settingsData[5] = set[5];
+    settingsData[6] = set[6];
+    settingsData[7] = set[7];
+    settingsData[10] = set[13];
+    settingsData[11] = set[14];
+    const heatpumpSettings settings = HeatPump::parseSettings(settingsData);
+
+    if (set[1] & 0x01) heatPump.setPowerSetting(settings.power);
+    if (set[1] & 0x02) heatPump.setModeSetting(settings.mode);
+    if (set[1] & 0x04) heatPump.setTemperature(settings.temperature);
+    if (set[1] & 0x08) heatPump.setFanSpeed(settings.fan);
+    if (set[1] & 0x10) heatPump.setVaneSetting(settings.vane);
+    if (set[2] & 0x01) heatPump.setWideVaneSetting(settings.wideVane);
+    heatPump.update();
+    return true;
+}
+
+void Replay::printFrame(const char *label, size_t exchange, const uint8_t *data, int length) {
+    fprintf(out, "  %+12.3fs  %-10s ", now / 1000.0, label);
+    if (exchange == SIZE_MAX) {
+        fprintf(out, "%28s", "");
+    } else if (recording[exchange].request.timed) {
+        fprintf(out, " #%-8zu recorded %+10.3fs", exchange, recording[exchange].request.atMs / 1000.0);
+    } else {
+        fprintf(out, " #%-8zu %19s", exchange, "");
+    }
+    for (int i = 0; i < length; i++) fprintf(out, " %02x", data[i]);
+    fputc('\n', out);
+}
+
+void Replay::report() const {
+    const double wall = seconds() - wallStart;
+    fprintf(out, "replayed %zu of %zu recorded requests, %.3f s of bus time in %.3f s (%.0fx)\n", next,
+            recording.size(), now / 1000.0, wall, wall > 0 ? now / 1000.0 / wall : 0.0);
+    fprintf(out, "  match %llu  differs %llu  missing %llu  unexpected %llu\n", (unsigned long long) matched,
+            (unsigned long long) differing, (unsigned long long) missing, (unsigned long long) unexpected);
+    if (synthesized) fprintf(out, "  connect acked without a recorded one: %llu\n", (unsigned long long) synthesized);
+    if (skipped) fprintf(out, "  recorded requests before the library's first: %llu\n", (unsigned long long) skipped);
+    if (firstSent) fprintf(out, "  max timing drift from the recording: %lld ms\n", (long long) maxDriftMs);
+    fprintf(out, "  settings changes: %llu\n", (unsigned long long) settingsChanges);
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include "../analyzer/FrameScanner.h"
+#include <HeatPump.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+/**
+ * Drives a HeatPump from one unit's frames in a capture, on a virtual clock.
+ *
+ * The capture is cut into exchanges: a request (0x5a, 0x41, 0x42) and the frames received after it, each
+ * with its delay from the request's mark. Every frame the library writes is compared with the next recorded
+ * request:
+ *
+ *   match       identical bytes; the recorded replies arrive after their recorded delays
+ *   missing     recorded requests skipped over to find one identical to the library's frame further on;
+ *               not counted before the first match, a capture may start mid-cycle or without a connect
+ *   differs     same type and info code, other bytes; the recorded replies are delivered anyway
+ *   unexpected  nothing like it in the recording; it isn't answered and the library times out
+ *
+ * Recorded sets (0x41) are decoded and applied with the setters and update(), the way the gateway's set
+ * command does, once they are the next recorded request. The library is set up like a gateway unit
+ * (external update), so settings changed on the IR remote follow the recorded settings replies. Without
+ * marks (raw UART captures) every frame is unit 0 and replies arrive after REPLY_DELAY_MS.
+ *
+ * At speed 0 time only moves when the library waits, so a day of traffic replays in seconds. Otherwise
+ * virtual time is paced to the wall clock, at speed 1 with the original timing.
+ */
+class Replay : public heatpumpClock {
+public:
+    static const unsigned long REPLY_DELAY_MS = 50;
+
+    Replay(int unit, double speed, bool verbose, FILE *out);
+
+    void add(const FrameScanner::Frame *frames, size_t count); // in capture order
+    bool run();                                               // false when the library diverged
+    void report() const;
+
+    size_t exchanges() const { return recording.size(); }
+
+    uint32_t millis() override { return (uint32_t) now; }
+    void delay(uint32_t ms) override { advance(now + ms); }
+
+private:
+    static const int MAX_FRAME_LEN = 22;
+    static const size_t LOOKAHEAD = 8; // recorded requests searched for the library's frame
+    static const int MAX_UNEXPECTED = 8; // in a row, before the expected request is given up as missing
+    static const uint64_t READ_SLACK_MS = 10; // the library's poll step, see advance()
+
+    struct Frame {
+        uint64_t atMs; // ms since the first mark, carried across the millis() wrap
+        bool timed;    // had a mark
+        uint8_t length;
+        uint8_t data[MAX_FRAME_LEN];
+    };
+
+    struct Exchange {
+        Frame request;
+        size_t firstReply;
+        size_t replies;
+    };
+
+    struct Pending {
+        uint64_t dueMs;
+        size_t reply;
+    };
+
+    const int unit;
+    const double speed;
+    const bool verbose;
+    FILE *out;
+
+    // the recording
+    std::vector<Exchange> recording;
+    std::vector<Frame> replies;
+    bool marked = false;
+    int markUnit = 0;
+    bool timed = false;
+    uint32_t lastMark = 0;
+    uint64_t markMs = 0;
+
+    // the replay
+    HardwareSerial serial;
+    HeatPump heatPump;
+    uint64_t now = 0;
+    double wallStart = 0;
+    size_t next = 0;           // the next recorded request
+    size_t setApplied = SIZE_MAX; // the recorded set last handed to update()
+    int unexpectedInRow = 0;
+    std::vector<Pending> pending; // replies in flight, by due time
+    bool firstSent = false;
+    uint64_t firstSentMs = 0;
+    uint64_t firstRecordedMs = 0;
+    int64_t maxDriftMs = 0;
+
+    uint64_t matched = 0;
+    uint64_t missing = 0;
+    uint64_t differing = 0;
+    uint64_t unexpected = 0;
+    uint64_t synthesized = 0;
+    uint64_t skipped = 0;
+    uint64_t settingsChanges = 0;
+
+    void addFrame(const uint8_t *data, int length);
+    bool advance(uint64_t to); // true when a reply was delivered
+    void onFrame(const uint8_t *data, int length);
+    void answer(size_t exchange);
+    bool applySet(const Exchange &exchange);
+    void printFrame(const char *label, size_t exchange, const uint8_t *data, int length);
+    static bool sameKind(const uint8_t *a, const uint8_t *b);
+};
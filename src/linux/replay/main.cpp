@@ -0,0 +1,84 @@
+/*
+ * Replays recorded CN105 traffic through the HeatPump library.
+ *
+ *   heatpump-replay [-u unit] [-x speed] [-v] capture...
+ *
+ * The captures are memory-mapped and scanned with FrameScanner, in the given order as one stream. The
+ * library then runs against the unit's recorded replies, see Replay for how its frames are checked. -x 1
+ * keeps the original timing, -x 10 runs ten times faster; the default 0 runs as fast as the library goes.
+ * -v also lists the requests that matched. Exits with 1 when the library diverged from the recording.
+ */
+#include "Replay.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void usage(const char *program) {
+    fprintf(stderr, "usage: %s [-u unit] [-x speed] [-v] capture...\n", program);
+}
+
+static bool load(const char *path, FrameScanner &scanner, Replay &replay) {
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    const size_t length = (size_t) info.st_size;
+    if (length == 0) {
+        close(fd);
+        return true;
+    }
+
+    void *mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) return false;
+    madvise(mapping, length, MADV_SEQUENTIAL | MADV_WILLNEED);
+
+    scanner.scan((const uint8_t *) mapping, length,
+                 [&replay](const FrameScanner::Frame *frames, size_t count) { replay.add(frames, count); });
+    munmap(mapping, length);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    int unit = 0;
+    double speed = 0;
+    bool verbose = false;
+    int option;
+    while ((option = getopt(argc, argv, "u:x:vh")) != -1) {
+        if (option == 'u') {
+            unit = atoi(optarg);
+        } else if (option == 'x') {
+            speed = atof(optarg);
+        } else if (option == 'v') {
+            verbose = true;
+        } else {
+            usage(argv[0]);
+            return option == 'h' ? 0 : 2;
+        }
+    }
+    if (optind == argc) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    FrameScanner scanner;
+    Replay replay(unit, speed, verbose, stdout);
+    for (int i = optind; i < argc; i++) {
+        if (!load(argv[i], scanner, replay)) {
+            fprintf(stderr, "can't read %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (replay.exchanges() == 0) {
+        fprintf(stderr, "no requests for unit %d\n", unit);
+        return 1;
+    }
+
+    const bool same = replay.run();
+    replay.report();
+    return same ? 0 : 1;
+}
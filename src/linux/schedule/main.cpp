@@ -0,0 +1,180 @@
+/*
+ * Weekly schedule test: the controller firmware (linux/firmware) on a virtual clock, with the wall clock
+ * in CET/CEST, across clock changes.
+ *
+ *   heatpump-schedule [-v]
+ *
+ * Each step sets the schedule and the wall clock, runs the firmware for minutes to an hour of virtual
+ * time and compares the settings changes the SimulatedUnit received with the ones expected, each within
+ * APPLY_LIMIT_S of when it was due:
+ *   - nothing runs before SNTP has set the clock
+ *   - a transition is applied when due, and the one in effect when the clock jumps past transitions
+ *   - nothing is applied again when the clock is set back
+ *   - one in the hour skipped when DST starts is applied an hour late, one in the hour repeated when it
+ *     ends is applied once
+ *   - one due while the link is down changes nothing in HomeKit, and is applied once the link is back
+ * and that /metrics counts the transitions apart from HomeKit updates. Exits with 1 if any check fails,
+ * -v prints the firmware's log.
+ */
+#include "../firmware/Firmware.h"
+#include <config.h>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <unistd.h>
+
+static const char *TIMEZONE_RULE = "CET-1CEST,M3.5.0,M10.5.0/3";
+static const time_t APPLY_LIMIT_S = 5; // debounce, the set frame and its ack
+// link loss detection, a link check, the schedule retry and then as above
+static const time_t RETRY_LIMIT_S = 5 + 5 + SCHEDULE_RETRY_INTERVAL / 1000 + APPLY_LIMIT_S;
+
+static int failures = 0;
+
+#define CHECK(condition, ...) \
+    do { if (!(condition)) { failures++; printf("FAIL  " __VA_ARGS__); printf("\n"); } } while (0)
+
+struct Change {
+    time_t at;
+    uint8_t mode;
+    uint8_t temperature; // wire encoding
+};
+
+static std::vector<Change> changes; // the unit's settings changes, by wall clock time
+static Change last;
+
+static time_t utc(int year, int month, int day, int hour, int minute, int second = 0) {
+    tm fields = {};
+    fields.tm_year = year - 1900;
+    fields.tm_mon = month - 1;
+    fields.tm_mday = day;
+    fields.tm_hour = hour;
+    fields.tm_min = minute;
+    fields.tm_sec = second;
+    return timegm(&fields);
+}
+
+static void observe() {
+    const SimulatedUnit &unit = Serial2.unit;
+    if (unit.mode == last.mode && unit.temperature == last.temperature) return;
+    last = {time(nullptr), unit.mode, unit.temperature};
+    changes.push_back(last);
+}
+
+// runs until the wall clock reads `until`, a second at a time
+static void runUntil(time_t until) {
+    while (time(nullptr) < until) {
+        Firmware::run(1000);
+        observe();
+    }
+}
+
+static void setSchedule(const char *text) {
+    CHECK(schedule.parse(text), "schedule doesn't parse: %s", text);
+}
+
+// the changes since `from`, against {due, mode, setpoint}
+static void expect(const char *step, size_t from, std::vector<Change> expected, time_t limit = APPLY_LIMIT_S) {
+    const size_t count = changes.size() - from;
+    CHECK(count == expected.size(), "%s: %zu changes, expected %zu", step, count, expected.size());
+    for (size_t i = 0; i < min(count, expected.size()); i++) {
+        const Change &got = changes[from + i];
+        const Change &want = expected[i];
+        char wanted[12], received[12];
+        heatpumpTemperature::fromWire(want.temperature).toString(wanted, sizeof(wanted));
+        heatpumpTemperature::fromWire(got.temperature).toString(received, sizeof(received));
+        CHECK(got.mode == want.mode && got.temperature == want.temperature,
+              "%s: change %zu to mode %u at %s, expected mode %u at %s", step, i, got.mode, received, want.mode, wanted);
+        CHECK(got.at >= want.at && got.at <= want.at + limit, "%s: change %zu %+ld s from when it was due", step, i,
+              (long) (got.at - want.at));
+    }
+    printf("%-40s %zu change(s)\n", step, count);
+}
+
+// the first sample of a metric with these labels, -1 if there is none
+static long metric(const std::string &text, const char *name) {
+    const size_t at = text.find(std::string("\n") + name + " ");
+    return at == std::string::npos ? -1 : atol(text.c_str() + at + strlen(name) + 2);
+}
+
+static uint8_t wire(float celsius) {
+    return heatpumpTemperature::fromCelsius(celsius).toWire();
+}
+
+int main(int argc, char **argv) {
+    int option;
+    while ((option = getopt(argc, argv, "vh")) != -1) {
+        if (option == 'v') {
+            homeSpan.log = stdout;
+        } else {
+            fprintf(stderr, "usage: %s [-v]\n", argv[0]);
+            return option == 'h' ? 0 : 2;
+        }
+    }
+
+    const uint8_t HEAT = 0x01, COOL = 0x03; // the unit's mode bytes
+    Firmware::begin(0); // SNTP hasn't set the clock
+    Firmware::setTimezone(TIMEZONE_RULE);
+    last = {time(nullptr), Serial2.unit.mode, Serial2.unit.temperature};
+
+    size_t from = changes.size();
+    setSchedule("Daily 00:01 HEAT 25");
+    runUntil(time(nullptr) + 180);
+    expect("clock not set", from, {});
+
+    // Monday 23 March 2026, CET
+    from = changes.size();
+    setSchedule("Mon 06:30 HEAT 21\nMon 08:00 18\nMon 10:00 COOL 24");
+    Firmware::setWallClock(utc(2026, 3, 23, 5, 29, 30));
+    runUntil(utc(2026, 3, 23, 5, 31));
+    expect("due", from, {{utc(2026, 3, 23, 5, 30), HEAT, wire(21)}});
+    CHECK(targetTemperature->getVal<float>() == 21 && targetHeatingCoolingState->getVal() == 1,
+          "HomeKit shows %.1f, mode %d", targetTemperature->getVal<float>(), targetHeatingCoolingState->getVal());
+
+    from = changes.size();
+    Firmware::setWallClock(utc(2026, 3, 23, 9, 30));
+    runUntil(utc(2026, 3, 23, 9, 31));
+    expect("clock set forward past 08:00 and 10:00", from, {{utc(2026, 3, 23, 9, 30), COOL, wire(24)}});
+
+    from = changes.size();
+    Firmware::setWallClock(utc(2026, 3, 23, 8, 59, 30));
+    runUntil(utc(2026, 3, 23, 9, 2));
+    expect("clock set back before 10:00", from, {});
+
+    // Sunday 29 March 2026, 02:00 CET is 03:00 CEST
+    from = changes.size();
+    setSchedule("Sun 02:30 23\nSun 04:00 19");
+    Firmware::setWallClock(utc(2026, 3, 29, 0, 59));
+    runUntil(utc(2026, 3, 29, 1, 31));
+    expect("DST starts, 02:30 is skipped", from, {{utc(2026, 3, 29, 1, 30), COOL, wire(23)}});
+
+    // Sunday 25 October 2026, 03:00 CEST is 02:00 CET
+    from = changes.size();
+    setSchedule("Sun 02:30 HEAT 24\nSun 05:00 18");
+    Firmware::setWallClock(utc(2026, 10, 25, 0, 29));
+    runUntil(utc(2026, 10, 25, 1, 32));
+    expect("DST ends, 02:30 is repeated", from, {{utc(2026, 10, 25, 0, 30), HEAT, wire(24)}});
+
+    // the unit goes silent from 30 s before a transition until a minute after it
+    from = changes.size();
+    setSchedule("Sun 12:00 20");
+    Firmware::setWallClock(utc(2026, 10, 25, 10, 59));
+    const uint32_t now = Firmware::clock.millis();
+    Serial2.silence(now + 30000, now + 120000);
+    runUntil(utc(2026, 10, 25, 11, 0, 10));
+    CHECK(targetTemperature->getVal<float>() == 24, "HomeKit shows %.1f while the link is down",
+          targetTemperature->getVal<float>());
+    runUntil(utc(2026, 10, 25, 11, 3));
+    expect("due while the link is down", from, {{utc(2026, 10, 25, 11, 1), HEAT, wire(20)}}, RETRY_LIMIT_S);
+
+    const std::string text = Firmware::metricsText();
+    const long applied = metric(text, "schedule_transitions_total{result=\"applied\"}");
+    const long rejected = metric(text, "schedule_transitions_total{result=\"rejected\"}");
+    const long homeKit = metric(text, "homekit_updates_total");
+    printf("schedule transitions: %ld applied, %ld rejected; HomeKit updates: %ld\n", applied, rejected, homeKit);
+    CHECK(applied == 5, "%ld schedule transitions counted as applied", applied);
+    CHECK(rejected >= 1, "%ld schedule transitions counted as rejected", rejected);
+    CHECK(homeKit == 0, "%ld schedule transitions counted as HomeKit updates", homeKit);
+
+    printf(failures ? "FAILED\n" : "passed\n");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,90 @@
+#pragma once
+/*
+ * The in-memory indoor unit behind the simulator, also used by the codec benchmark: answers connect,
+ * set, info and functions requests like a CN105 unit.
+ */
+#include <stdint.h>
+#include <string.h>
+
+static const int FRAME_LEN = 22;
+
+static inline int frame(uint8_t *out, uint8_t type, const uint8_t *data, int length) {
+    const uint8_t header[5] = {0xfc, type, 0x01, 0x30, (uint8_t) length};
+    int sum = 0;
+    memcpy(out, header, 5);
+    memcpy(out + 5, data, length);
+    for (int i = 0; i < 5 + length; i++) sum += out[i];
+    out[5 + length] = (0xfc - sum) & 0xff;
+    return length + 6;
+}
+
+struct SimulatedUnit {
+    uint8_t power = 0x01;     // ON
+    uint8_t mode = 0x01;      // HEAT
+    uint8_t temperature = 22 * 2 + 128;
+    uint8_t fan = 0x00;       // AUTO
+    uint8_t vane = 0x00;      // AUTO
+    uint8_t wideVane = 0x03;  // |
+    uint8_t roomTemperature = 21 * 2 + 128;
+    bool halfDegrees = true;  // reports its setpoint in half degrees, otherwise only the whole-degree byte
+    uint8_t functions[30];    // function settings, code 101 + i with value 1 until set
+
+    SimulatedUnit() {
+        for (int i = 0; i < 30; i++) functions[i] = (uint8_t) (((i + 1) << 2) | 1);
+    }
+
+    // builds the reply to a complete request frame, returns its length or 0 for none. nowMs drives
+    // the compressor cycle in the status reply
+    int reply(const uint8_t *request, uint8_t *out, unsigned long long nowMs) {
+        uint8_t data[16] = {};
+        switch (request[1]) {
+            case 0x5a:
+                return frame(out, 0x7a, data, 0);
+            case 0x41: {
+                const uint8_t *set = request + 5;
+                if (set[0] == 0x01) {
+                    if (set[1] & 0x01) power = set[3];
+                    if (set[1] & 0x02) mode = set[4];
+                    if (set[1] & 0x04) temperature = set[14] ? set[14] : (uint8_t) ((31 - set[5]) * 2 + 128);
+                    if (set[1] & 0x08) fan = set[6];
+                    if (set[1] & 0x10) vane = set[7];
+                    if (set[2] & 0x01) wideVane = set[13];
+                } else if (set[0] == 0x1f || set[0] == 0x21) {
+                    memcpy(functions + (set[0] == 0x1f ? 0 : 15), set + 1, 15);
+                }
+                return frame(out, 0x61, data, 16);
+            }
+            case 0x42:
+                data[0] = request[5];
+                switch (request[5]) {
+                    case 0x02:
+                        data[3] = power;
+                        data[4] = mode;
+                        data[5] = (uint8_t) (31 - (temperature - 128) / 2);
+                        data[6] = fan;
+                        data[7] = vane;
+                        data[10] = wideVane;
+                        data[11] = halfDegrees ? temperature : 0;
+                        break;
+                    case 0x03:
+                        data[3] = (uint8_t) ((roomTemperature - 128) / 2 - 10);
+                        data[6] = roomTemperature;
+                        break;
+                    case 0x06: {
+                        // a minute-long cycle: ramp up, hold, then 10 s stopped like a defrost
+                        const unsigned long long second = nowMs / 1000 % 60;
+                        const bool running = power && second < 50;
+                        data[3] = running ? (uint8_t) (second < 30 ? 30 + second : 60) : 0; // compressor frequency
+                        data[4] = running;                                                 // operating
+                        break;
+                    }
+                    case 0x20:
+                    case 0x22:
+                        memcpy(data + 1, functions + (request[5] == 0x20 ? 0 : 15), 15);
+                        break;
+                }
+                return frame(out, 0x62, data, 16);
+        }
+        return 0;
+    }
+};
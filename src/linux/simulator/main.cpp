@@ -0,0 +1,134 @@
+/*
+ * Simulated CN105 indoor unit on a pty, for trying the Linux gateway without hardware.
+ *
+ *   heatpump-simulator [-l latency_ms] [-d drop_percent] [-m interval_ms]
+ *
+ * Prints the pty slave to pass to the gateway, then answers connect, set and info requests from an
+ * in-memory unit (SimulatedUnit.h) after the given latency, dropping the given share of requests.
+ *
+ * -m also plays a wall thermostat (MHK1/MHK2) as the bus master, for the gateway's listen-only mode (-l):
+ * every interval it sends the next info request, and every SET_EVERY-th a setpoint change between 21 and
+ * 23 C. Its requests and the unit's replies both go out on the pty. Anything written to the pty meanwhile
+ * is a second master on the bus, it is answered and reported on stderr.
+ */
+#include <errno.h>
+#include <poll.h>
+#include <pty.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "SimulatedUnit.h"
+
+static const unsigned long SET_EVERY = 15;
+
+// the wall thermostat's request number `count`: settings, room temperature, timers and status in turn
+static int masterRequest(uint8_t *out, unsigned long count) {
+    static const uint8_t INFO[] = {0x02, 0x03, 0x05, 0x06};
+    uint8_t data[16] = {};
+    if (count % SET_EVERY == SET_EVERY - 1) {
+        data[0] = 0x01;
+        data[1] = 0x04; // temperature
+        data[14] = (uint8_t) ((count / SET_EVERY % 2 ? 21 : 23) * 2 + 128);
+        return frame(out, 0x41, data, 16);
+    }
+    data[0] = INFO[count % sizeof(INFO)];
+    return frame(out, 0x42, data, 16);
+}
+
+static unsigned long long nowMs() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+int main(int argc, char **argv) {
+    unsigned long latency = 150;
+    int dropPercent = 0;
+    unsigned long masterInterval = 0;
+    int option;
+    while ((option = getopt(argc, argv, "l:d:m:")) != -1) {
+        if (option == 'l') latency = strtoul(optarg, nullptr, 10);
+        else if (option == 'd') dropPercent = atoi(optarg);
+        else if (option == 'm') masterInterval = strtoul(optarg, nullptr, 10);
+        else {
+            fprintf(stderr, "usage: %s [-l latency_ms] [-d drop_percent] [-m interval_ms]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    int master, slave;
+    char name[64];
+    if (openpty(&master, &slave, name, nullptr, nullptr) != 0) {
+        perror("openpty");
+        return 1;
+    }
+    // raw until the gateway configures its end, and keep the slave open so the pty outlives it
+    termios tty;
+    tcgetattr(slave, &tty);
+    cfmakeraw(&tty);
+    tcsetattr(slave, TCSANOW, &tty);
+    printf("%s\n", name);
+    fflush(stdout);
+
+    SimulatedUnit unit;
+    uint8_t request[64];
+    int received = 0;
+    uint8_t pending[32];
+    int pendingLength = 0;
+    unsigned long long sendAt = 0;
+    unsigned long masterRequests = 0;
+    unsigned long long masterAt = nowMs();
+    unsigned long long contention = 0;
+
+    for (;;) {
+        // the pending reply, or with -m the wall thermostat's next request, or just the pty
+        const bool timed = pendingLength || masterInterval;
+        const long wait = timed ? (long) ((pendingLength ? sendAt : masterAt) - nowMs()) : -1;
+        pollfd fd = {master, POLLIN, 0};
+        if (poll(&fd, 1, timed ? (wait > 0 ? (int) wait : 0) : -1) < 0 && errno != EINTR) return 1;
+
+        if (pendingLength && nowMs() >= sendAt) {
+            if (write(master, pending, pendingLength) < 0) return 1;
+            pendingLength = 0;
+        }
+        if (masterInterval && !pendingLength && nowMs() >= masterAt) {
+            // the wall thermostat's request, then the unit's reply to it
+            uint8_t frameOut[FRAME_LEN];
+            const int length = masterRequest(frameOut, masterRequests++);
+            if (write(master, frameOut, length) < 0) return 1;
+            if (frameOut[1] == 0x41) fprintf(stderr, "master: set temperature %d\n", (frameOut[19] - 128) / 2);
+            pendingLength = unit.reply(frameOut, pending, nowMs());
+            sendAt = nowMs() + latency;
+            masterAt = nowMs() + masterInterval;
+        }
+        if (!(fd.revents & POLLIN)) continue;
+
+        const ssize_t count = read(master, request + received, sizeof(request) - received);
+        if (count <= 0) continue;
+        received += count;
+        if (masterInterval) {
+            contention += count;
+            fprintf(stderr, "second master on the bus: %llu bytes so far\n", contention);
+        }
+
+        // drop bytes until a frame start, then wait for the whole frame
+        while (received > 0 && request[0] != 0xfc) memmove(request, request + 1, --received);
+        if (received < 5) continue;
+        const int length = request[4] + 6;
+        if (length > FRAME_LEN || received < length) {
+            if (length > FRAME_LEN) received = 0;
+            continue;
+        }
+
+        if (rand() % 100 >= dropPercent) {
+            pendingLength = unit.reply(request, pending, nowMs());
+            sendAt = nowMs() + latency;
+        }
+        memmove(request, request + length, received - length);
+        received -= length;
+    }
+}
@@ -0,0 +1,133 @@
+#pragma once
+/*
+ * HardwareSerial on a SimulatedUnit in virtual time, found before the termios one in linux/compat. A
+ * complete request frame is answered replyDelayMs later on the heatpumpVirtualClock, or not at all while
+ * the unit is silent. It counts what crossed the wire so a run can check the library's counters against it.
+ * Also Serial2 of the firmware harness (linux/firmware), which wants the receive callback.
+ */
+#include <HeatPumpClock.h>
+#include <functional>
+#include "../simulator/SimulatedUnit.h"
+
+#define SERIAL_8E1 0x800001e
+
+class HardwareSerial {
+public:
+    SimulatedUnit unit;
+    uint32_t replyDelayMs = 60;
+
+    // requests by type: 0x5a, 0x41, 0x42
+    unsigned long connectRequests = 0;
+    unsigned long setRequests = 0;
+    unsigned long infoRequests = 0;
+    unsigned long replies = 0; // delivered to the receive buffer
+    unsigned long dropped = 0; // requests while silent
+    unsigned long overwritten = 0; // replies the next request replaced before they were read
+    // how long replies sat readable before their first byte was read
+    unsigned long pickups = 0;
+    uint64_t pickupTotalMs = 0;
+    uint32_t pickupMaxMs = 0;
+
+    explicit HardwareSerial(heatpumpVirtualClock &clock) : clock(clock) {
+    }
+
+    void begin(unsigned long baud, uint32_t config) {
+        (void) baud;
+        (void) config;
+    }
+    void end() {
+    }
+
+    int available() {
+        return due() ? count - head : 0;
+    }
+
+    int read() {
+        if (!due() || head == count) return -1;
+        if (head == 0) {
+            const uint32_t waited = clock.millis() - replyAt;
+            pickups++;
+            pickupTotalMs += waited;
+            pickupMaxMs = max(pickupMaxMs, waited);
+        }
+        return reply[head++];
+    }
+
+    size_t write(uint8_t b) {
+        if (received == 0 && b != 0xfc) return 1;
+        request[received++] = b;
+        if (received >= 5 && received == request[4] + 6) {
+            answer();
+            received = 0;
+        } else if (received == (int) sizeof(request)) {
+            received = 0;
+        }
+        return 1;
+    }
+
+    // the unit drops requests from `from` until `until` on the clock, like a pulled cable
+    void silence(uint32_t from, uint32_t until) {
+        silentFrom = from;
+        silentUntil = until;
+    }
+
+    // like the ESP32 UART's receive callback, run from poll() once per reply as it becomes readable
+    void onReceive(std::function<void()> callback) {
+        receiveCallback = callback;
+    }
+
+    // call after moving the clock
+    void poll() {
+        if (receiveCallback && !signalled && head < count && due()) {
+            signalled = true;
+            receiveCallback();
+        }
+    }
+
+    bool replyPending() const {
+        return head < count;
+    }
+
+    // ms until a pending reply can be read, or `idle` if none is on its way
+    unsigned long timeUntilReply(unsigned long idle) {
+        if (head == count) return idle;
+        const int32_t left = (int32_t) (replyAt - clock.millis());
+        return left > 0 ? min(idle, (unsigned long) left) : 0;
+    }
+
+private:
+    heatpumpVirtualClock &clock;
+    uint8_t request[FRAME_LEN + 2];
+    int received = 0;
+    uint8_t reply[FRAME_LEN + 2];
+    int head = 0;
+    int count = 0;
+    uint32_t replyAt = 0;
+    uint32_t silentFrom = 0;
+    uint32_t silentUntil = 0;
+    std::function<void()> receiveCallback;
+    bool signalled = false;
+
+    bool due() {
+        return (int32_t) (clock.millis() - replyAt) >= 0;
+    }
+
+    void answer() {
+        switch (request[1]) {
+            case 0x5a: connectRequests++; break;
+            case 0x41: setRequests++; break;
+            case 0x42: infoRequests++; break;
+        }
+        if (head < count) overwritten++;
+        head = count = 0;
+        signalled = false;
+        const uint32_t now = clock.millis();
+        if ((int32_t) (now - silentFrom) >= 0 && (int32_t) (now - silentUntil) < 0) {
+            dropped++;
+            return;
+        }
+        count = unit.reply(request, reply, now);
+        if (count) replies++;
+        replyAt = now + replyDelayMs;
+    }
+};
@@ -0,0 +1,327 @@
+/*
+ * Long-uptime soak: HeatPump against a SimulatedUnit on a heatpumpVirtualClock (see HardwareSerial.h).
+ *
+ *   heatpump-soak [-d days] [-s start] [-v]
+ *
+ * Runs 30 days by default in seconds of real time. The clock starts so the 32 bit millis() wrap falls
+ * inside the first write burst, -s sets another start (hex or decimal). The loop drives the library like
+ * the controller and the gateway do: sync() whenever timeUntilSync() says so, sleeping in between to the
+ * next timer or reply. Around it:
+ *   - every hour at :30 a burst of four setpoint writes 300 ms apart goes through a WriteCoalescer
+ *     (1 s debounce, 3 s at most) and update()
+ *   - every 6 hours, starting at 3:00, the unit goes silent for 20 s
+ *   - a coroutine sleeps 10 s at a time
+ *   - reply latency varies between 40 and 80 ms
+ *
+ * At the end it checks, and exits with 1 if any fails:
+ *   - the library's sent counters match the requests the unit saw, its received counters plus timeouts
+ *     the unit's replies and dropped requests, with no checksum failures
+ *   - each burst was applied when the coalescer was due and reached the unit, acked within ACK_LIMIT_MS
+ *   - the link went down in each outage within DOWN_LIMIT_MS and was healthy RECOVERY_LIMIT_MS after it
+ *   - the 10 s coroutine never woke early or stopped, and was late only by a blocking library call
+ *   - the library's smoothed reply latency is the unit's 40 to 80 ms
+ *   - the runtime totals account for the whole run and count one compressor start per simulated cycle,
+ *     and the 24 h statistics window spans a day
+ * -v prints each burst and outage.
+ */
+#include <Coroutine.h>
+#include <HeatPump.h>
+#include <WriteCoalescer.h>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static const uint64_t HOUR_MS = 3600000ULL;
+static const uint64_t WRITE_AT_MS = HOUR_MS / 2; // into each hour
+static const int WRITES_PER_BURST = 4;
+static const uint32_t WRITE_SPACING_MS = 300;
+static const unsigned long DEBOUNCE_MS = 1000;
+static const unsigned long MAX_LATENCY_MS = 3000;
+static const uint64_t OUTAGE_EVERY_MS = 6 * HOUR_MS;
+static const uint64_t OUTAGE_AT_MS = 3 * HOUR_MS;
+static const uint64_t OUTAGE_MS = 20000;
+static const uint32_t TICK_MS = 10000;
+static const uint64_t TICK_LATE_LIMIT_MS = 6500; // a failed connect() blocks for 2 s + a reply timeout, twice
+static const unsigned long ACK_LIMIT_MS = 500;
+static const uint64_t DOWN_LIMIT_MS = 5000;
+static const uint64_t RECOVERY_LIMIT_MS = 5000;
+static const uint64_t CYCLE_MS = 60000; // SimulatedUnit's compressor cycle
+
+static int failures = 0;
+
+#define CHECK(condition, ...) \
+    do { if (!(condition)) { failures++; printf("FAIL  " __VA_ARGS__); printf("\n"); } } while (0)
+
+struct Soak {
+    heatpumpVirtualClock clock;
+    HardwareSerial serial {clock};
+    HeatPump heatPump;
+    heatpumpStatistics statistics;
+    heatpumpRuntime runtime {heatpumpPowerCurve {1, 10, 2, {{20, 300}, {90, 1500}}}};
+    WriteCoalescer writes {clock, DEBOUNCE_MS, MAX_LATENCY_MS};
+    bool verbose = false;
+
+    // virtual time since the start, carried across the wrap
+    uint64_t elapsed = 0;
+    uint32_t lastMillis = 0;
+
+    Coroutine ticker;
+    uint64_t nextTick = 0;
+    unsigned long ticks = 0;
+    unsigned long lateTicks = 0;
+    unsigned long earlyTicks = 0;
+    uint64_t maxLateness = 0;
+
+    Coroutine writer;
+    uint64_t burstStart = 0;
+    int burstWrites = 0;
+    heatpumpTemperature wanted {};
+    unsigned long bursts = 0;
+    unsigned long applied = 0;
+    unsigned long mistimed = 0;    // not applied when the coalescer was due
+    unsigned long unconfirmed = 0; // the unit didn't end up at the setpoint
+    unsigned long slowAcks = 0;
+
+    // link changes around the outages, counted by the link state callback
+    unsigned long downs = 0;           // within DOWN_LIMIT_MS of an outage's start
+    unsigned long recoveries = 0;      // healthy within RECOVERY_LIMIT_MS of its end
+    unsigned long unexpectedDowns = 0; // anywhere else
+    uint64_t lastRecovered = 0;        // start of the outage last recovered from
+
+    explicit Soak(uint32_t start) : clock(start), lastMillis(start) {
+    }
+
+    void tick() {
+        const uint32_t now = clock.millis();
+        elapsed += (uint32_t) (now - lastMillis);
+        lastMillis = now;
+    }
+
+    void begin() {
+        heatPump.setClock(&clock);
+        heatPump.setStatistics(&statistics);
+        heatPump.setRuntime(&runtime);
+        heatPump.setStatusPollInterval(1000);
+        heatPump.setLinkStateChangedCallback([this](heatpumpLinkState state) { linkChanged(state); });
+        heatPump.connect(&serial);
+        heatPump.enableExternalUpdate();
+        tick();
+    }
+
+    // start of the last outage that began at or before `at`, false before the first
+    static bool lastOutage(uint64_t at, uint64_t &start) {
+        if (at < OUTAGE_AT_MS) return false;
+        start = at - (at - OUTAGE_AT_MS) % OUTAGE_EVERY_MS;
+        return true;
+    }
+
+    void linkChanged(heatpumpLinkState state) {
+        tick();
+        uint64_t outage = 0;
+        const bool after = lastOutage(elapsed, outage);
+        if (state == HEATPUMP_LINK_DOWN) {
+            if (after && elapsed - outage <= DOWN_LIMIT_MS) {
+                downs++;
+            } else {
+                unexpectedDowns++;
+            }
+            if (verbose) printf("%10.3f s  link down\n", elapsed / 1000.0);
+        } else if (state == HEATPUMP_LINK_HEALTHY && after && outage != lastRecovered &&
+                   elapsed >= outage + OUTAGE_MS && elapsed - (outage + OUTAGE_MS) <= RECOVERY_LIMIT_MS) {
+            recoveries++;
+            lastRecovered = outage;
+            if (verbose) printf("%10.3f s  link healthy %llu ms after the outage\n", elapsed / 1000.0,
+                                (unsigned long long) (elapsed - outage - OUTAGE_MS));
+        }
+    }
+
+    void runTicker() {
+        CO_BEGIN(ticker);
+        nextTick = elapsed + TICK_MS;
+        for (;;) {
+            CO_SLEEP(ticker, clock, TICK_MS);
+            tick();
+            ticks++;
+            if (elapsed < nextTick) {
+                earlyTicks++;
+                CO_AWAIT(ticker, false); // a deadline that doesn't hold would spin here, park it instead
+            }
+            if (elapsed > nextTick) {
+                lateTicks++;
+                maxLateness = max(maxLateness, elapsed - nextTick);
+            }
+            nextTick = elapsed + TICK_MS;
+        }
+        CO_END(ticker);
+    }
+
+    // a slider drag: writes land in the coalescer, the burst is applied once when it is due
+    void runWriter() {
+        CO_BEGIN(writer);
+        for (;;) {
+            CO_AWAIT(writer, elapsed % HOUR_MS >= WRITE_AT_MS && elapsed / HOUR_MS + 1 > bursts);
+            bursts++;
+            burstStart = elapsed;
+            for (burstWrites = 0; burstWrites < WRITES_PER_BURST; burstWrites++) {
+                wanted = heatpumpTemperature::fromHalfDegrees(40 + (int) ((bursts * 7 + burstWrites) % 12));
+                writes.write();
+                if (burstWrites + 1 < WRITES_PER_BURST) CO_SLEEP(writer, clock, WRITE_SPACING_MS);
+            }
+            CO_AWAIT_DEADLINE(writer, clock, writes.deadline());
+            apply();
+        }
+        CO_END(writer);
+    }
+
+    void apply() {
+        tick();
+        writes.take();
+        const uint64_t due = burstStart + (WRITES_PER_BURST - 1) * WRITE_SPACING_MS + DEBOUNCE_MS;
+        if (elapsed != min(due, burstStart + MAX_LATENCY_MS)) mistimed++;
+
+        const unsigned long acks = heatPump.getCounters().setAckCount;
+        heatPump.setTemperature(wanted);
+        heatPump.update();
+        applied++;
+        const heatpumpCounters &counters = heatPump.getCounters();
+        if (counters.setAckCount != acks + 1 || serial.unit.temperature != wanted.toWire()) unconfirmed++;
+        const unsigned long ackMs = counters.lastSetAckMs - counters.lastSetSentMs;
+        if (ackMs > ACK_LIMIT_MS) slowAcks++;
+        if (verbose) {
+            char text[12];
+            wanted.toString(text, sizeof(text));
+            printf("%10.3f s  burst %lu to %s at millis() %08x, acked in %lu ms\n", elapsed / 1000.0, bursts, text,
+                   (unsigned) clock.millis(), ackMs);
+        }
+    }
+
+    // the unit's next (or current) outage and reply latency, in clock time
+    void script() {
+        uint64_t outage = OUTAGE_AT_MS;
+        if (lastOutage(elapsed, outage) && elapsed >= outage + OUTAGE_MS) outage += OUTAGE_EVERY_MS;
+        const uint32_t from = clock.millis() + (uint32_t) (outage - min(outage, elapsed));
+        serial.silence(from, from + (uint32_t) (outage + OUTAGE_MS - max(outage, elapsed)));
+        serial.replyDelayMs = 40 + (uint32_t) ((elapsed * 7919) % 41);
+    }
+
+    // ms until the next scripted write
+    uint64_t untilWrite() const {
+        const uint64_t intoHour = elapsed % HOUR_MS;
+        return intoHour < WRITE_AT_MS ? WRITE_AT_MS - intoHour : HOUR_MS - intoHour + WRITE_AT_MS;
+    }
+
+    void run(uint64_t durationMs) {
+        while (elapsed < durationMs) {
+            script();
+            heatPump.sync();
+            tick();
+            runTicker();
+            runWriter();
+            tick();
+
+            unsigned long idle = heatPump.timeUntilSync();
+            idle = serial.timeUntilReply(idle);
+            idle = ticker.idleTime(clock, idle);
+            idle = writer.idleTime(clock, idle);
+            idle = (unsigned long) min((uint64_t) idle, untilWrite());
+            idle = (unsigned long) min((uint64_t) idle, durationMs - min(durationMs, elapsed));
+            clock.advance((uint32_t) max(idle, 1UL));
+            tick();
+        }
+    }
+
+    void report(uint64_t durationMs, double seconds) {
+        const heatpumpCounters &c = heatPump.getCounters();
+        const heatpumpRuntimeTotals &totals = runtime.totals();
+        const unsigned long sent = c.sentConnect + c.sentSet + c.sentInfo;
+        // outages begun before the end, and those whose recovery window ended before it
+        const uint64_t outages = durationMs > OUTAGE_AT_MS ? (durationMs - OUTAGE_AT_MS - 1) / OUTAGE_EVERY_MS + 1 : 0;
+        const uint64_t recoverable = durationMs > OUTAGE_AT_MS + OUTAGE_MS + RECOVERY_LIMIT_MS
+                                     ? (durationMs - OUTAGE_AT_MS - OUTAGE_MS - RECOVERY_LIMIT_MS - 1) / OUTAGE_EVERY_MS + 1 : 0;
+        const unsigned long received = c.receivedConnectAck + c.receivedSetAck + c.receivedSettings +
+                                       c.receivedRoomTemp + c.receivedTimers + c.receivedStatus +
+                                       c.receivedFunctions + c.receivedOther;
+
+        printf("%.1f days of virtual time in %.2f s (%.0fx), millis() now %08x\n", durationMs / 86400000.0,
+               seconds, durationMs / 1000.0 / seconds, (unsigned) clock.millis());
+        printf("  requests    %lu (connect %lu, set %lu, info %lu), %.2f/s\n", sent, c.sentConnect, c.sentSet,
+               c.sentInfo, sent * 1000.0 / durationMs);
+        printf("  replies     %lu, timeouts %lu, checksum failures %lu, connects %lu\n", received,
+               c.responseTimeouts, c.checksumFailures, c.connects);
+        printf("  bursts      %lu applied, %lu mistimed, %lu unconfirmed, %lu acked slower than %lu ms\n", applied,
+               mistimed, unconfirmed, slowAcks, ACK_LIMIT_MS);
+        printf("  outages     %llu, link down in %lu, recovered from %lu, %lu other downs\n",
+               (unsigned long long) outages, downs, recoveries, unexpectedDowns);
+        printf("  latency     %lu ms smoothed reply latency, %lu ms frame gap\n", heatPump.getReplyLatency(),
+               heatPump.getFrameGap());
+        printf("  timer       %lu ticks, %lu early, %lu late by up to %llu ms\n", ticks, earlyTicks, lateTicks,
+               (unsigned long long) maxLateness);
+        printf("  runtime     %.3f h accounted, %u compressor starts, %.2f kWh\n", totals.accountedMs / 3.6e6,
+               (unsigned) totals.compressorStarts, totals.energyKWh());
+
+        CHECK(serial.connectRequests == c.sentConnect && serial.setRequests == c.sentSet &&
+              serial.infoRequests == c.sentInfo, "sent counters differ from the requests the unit saw");
+        const unsigned long delivered = serial.replies - serial.overwritten - (serial.replyPending() ? 1 : 0);
+        CHECK(received == delivered, "received %lu of %lu replies", received, delivered);
+        CHECK(c.responseTimeouts == serial.dropped + serial.overwritten, "%lu timeouts for %lu dropped requests",
+              c.responseTimeouts, serial.dropped);
+        CHECK(c.checksumFailures == 0, "%lu checksum failures", c.checksumFailures);
+        CHECK(applied == durationMs / HOUR_MS + (durationMs % HOUR_MS > WRITE_AT_MS + MAX_LATENCY_MS),
+              "%lu bursts applied", applied);
+        CHECK(mistimed == 0, "%lu bursts not applied when due", mistimed);
+        CHECK(unconfirmed == 0, "%lu bursts didn't reach the unit", unconfirmed);
+        CHECK(slowAcks == 0, "%lu acks slower than %lu ms", slowAcks, ACK_LIMIT_MS);
+        CHECK(downs == outages && unexpectedDowns == 0, "the link went down in %lu of %llu outages, %lu times otherwise",
+              downs, (unsigned long long) outages, unexpectedDowns);
+        CHECK(recoveries == recoverable, "recovered from %lu of %llu outages within %llu ms", recoveries,
+              (unsigned long long) recoverable, (unsigned long long) RECOVERY_LIMIT_MS);
+        CHECK(heatPump.getReplyLatency() >= 40 && heatPump.getReplyLatency() <= 80, "reply latency %lu ms",
+              heatPump.getReplyLatency());
+        CHECK(earlyTicks == 0 && maxLateness <= TICK_LATE_LIMIT_MS, "%lu ticks early, late by up to %llu ms",
+              earlyTicks, (unsigned long long) maxLateness);
+        CHECK(nextTick >= durationMs, "the timer stopped %llu ms before the end",
+              (unsigned long long) (durationMs - nextTick));
+        // the first status reply only starts the accounting, an outage stops it for at most MAX_SAMPLE_GAP_MS
+        CHECK(totals.accountedMs + 10000 >= durationMs && totals.accountedMs <= durationMs,
+              "%llu ms accounted", (unsigned long long) totals.accountedMs);
+        const uint64_t cycles = durationMs / CYCLE_MS;
+        CHECK(totals.compressorStarts + 1 >= cycles - outages && totals.compressorStarts <= cycles + 1,
+              "%u compressor starts over %llu cycles", (unsigned) totals.compressorStarts, (unsigned long long) cycles);
+        if (durationMs >= 24 * HOUR_MS) {
+            const heatpumpWindowStatistics day = statistics.get(2);
+            CHECK(day.valid && day.spanMs >= statistics.windowLength(2) * 29 / 30 - 60000 &&
+                  day.spanMs <= statistics.windowLength(2), "24 h window spans %lu ms", day.spanMs);
+        }
+    }
+};
+
+int main(int argc, char **argv) {
+    double days = 30;
+    uint32_t start = 0 - (uint32_t) (WRITE_AT_MS + 500); // wraps half a second into the first burst
+    bool verbose = false;
+    int option;
+    while ((option = getopt(argc, argv, "d:s:vh")) != -1) {
+        if (option == 'd') {
+            days = atof(optarg);
+        } else if (option == 's') {
+            start = (uint32_t) strtoul(optarg, nullptr, 0);
+        } else if (option == 'v') {
+            verbose = true;
+        } else {
+            fprintf(stderr, "usage: %s [-d days] [-s start] [-v]\n", argv[0]);
+            return option == 'h' ? 0 : 2;
+        }
+    }
+
+    Soak soak(start);
+    soak.verbose = verbose;
+    const uint64_t durationMs = (uint64_t) (days * 86400000.0);
+    const auto began = std::chrono::steady_clock::now();
+    soak.begin();
+    soak.run(durationMs);
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - began).count();
+    soak.report(durationMs, seconds);
+    printf(failures ? "FAILED\n" : "passed\n");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,113 @@
+/*
+ * Prints a telemetry stream (see TelemetryEncoder) as CSV.
+ *
+ *   heatpump-telemetry [-s socket] unit    from the gateway's Unix socket
+ *   heatpump-telemetry -t host:port        from a controller with TELEMETRY_PORT set
+ */
+#include "../../Telemetry.h"
+#include <netdb.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <string>
+
+static const char *DEFAULT_SOCKET = "/tmp/heatpump-gateway.sock";
+
+static int connectUnix(const char *path) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) return -1;
+    strcpy(address.sun_path, path);
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && connect(fd, (sockaddr *) &address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int connectTcp(const char *hostPort) {
+    std::string host = hostPort;
+    const size_t colon = host.rfind(':');
+    if (colon == std::string::npos) return -1;
+    const std::string port = host.substr(colon + 1);
+    host.erase(colon);
+
+    addrinfo hints = {};
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *addresses = nullptr;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0) return -1;
+    int fd = -1;
+    for (addrinfo *address = addresses; address && fd < 0; address = address->ai_next) {
+        fd = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+        if (fd >= 0 && connect(fd, address->ai_addr, address->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    return fd;
+}
+
+// reads the gateway's answer to the telemetry command, byte by byte so no stream data is consumed
+static bool subscribe(int fd, const char *unit) {
+    const std::string command = std::string("telemetry ") + unit + "\n";
+    if (send(fd, command.data(), command.size(), MSG_NOSIGNAL) != (ssize_t) command.size()) return false;
+    std::string answer;
+    char c;
+    while (recv(fd, &c, 1, 0) == 1 && c != '\n') answer += c;
+    if (answer != "ok") fprintf(stderr, "%s\n", answer.c_str());
+    return answer == "ok";
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "usage: %s [-s socket] unit\n"
+                    "       %s -t host:port\n"
+                    "  prints a heat pump telemetry stream as CSV, from the gateway (%s) or a controller\n",
+            program, program, DEFAULT_SOCKET);
+}
+
+int main(int argc, char **argv) {
+    const char *socketPath = DEFAULT_SOCKET;
+    const char *tcp = nullptr;
+    int option;
+    while ((option = getopt(argc, argv, "s:t:h")) != -1) {
+        if (option == 's') {
+            socketPath = optarg;
+        } else if (option == 't') {
+            tcp = optarg;
+        } else {
+            usage(argv[0]);
+            return option == 'h' ? 0 : 2;
+        }
+    }
+    if (!tcp && optind != argc - 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    const int fd = tcp ? connectTcp(tcp) : connectUnix(socketPath);
+    if (fd < 0) {
+        fprintf(stderr, "can't connect to %s\n", tcp ? tcp : socketPath);
+        return 1;
+    }
+    if (!tcp && !subscribe(fd, argv[optind])) return 1;
+
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+    printf("timeMs,compressorFrequency,operating,roomTemperature\n");
+    TelemetryDecoder decoder;
+    uint8_t buffer[512];
+    ssize_t received;
+    while ((received = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+        const bool valid = decoder.decode(buffer, (size_t) received, [](const TelemetrySample &sample) {
+            char room[12];
+            sample.roomTemperature.toString(room, sizeof(room));
+            printf("%llu,%u,%d,%s\n", (unsigned long long) sample.timeMs, sample.compressorFrequency,
+                   sample.operating ? 1 : 0, room);
+        });
+        if (!valid) fprintf(stderr, "malformed stream, waiting for the next sync\n");
+    }
+    close(fd);
+    return 0;
+}
@@ -1,19 +1,45 @@
 #include <Arduino.h>
 #include <HomeSpan.h>
+#include <WiFi.h>
 #include <HeatPump.h>
+#include <HeatPumpTrace.h>
+#include <HttpEndpoint.h>
+#include <History.h>
+#include <MqttBridge.h>
+#include <Metrics.h>
+#include <Schedule.h>
+#include <Telemetry.h>
+#include <Coroutine.h>
+#include <WriteCoalescer.h>
 #include <config.h>
+#include <esp_sntp.h>
+#include <Preferences.h>
 #include <map>
+#include <time.h>
 
 // Pairing Code: 466-37-726
 
+// time source for the controller and the heat pump library
+heatpumpClock &controllerClock = heatpumpClock::system();
 HeatPump heatPump;
+HttpEndpoint httpEndpoint(heatPump);
+WiFiClient mqttClient;
+MqttBridge mqttBridge(heatPump, mqttClient);
+MetricsExporter metrics(heatPump);
+FlashHistoryStorage historyStorage(HISTORY_PARTITION);
+HistoryStore history(historyStorage);
+TelemetryStream telemetry(heatPump, TELEMETRY_STATUS_INTERVAL);
+heatpumpStatistics statistics;
+heatpumpRuntime runtime(heatpumpPowerCurve POWER_CURVE);
+NvsScheduleStorage scheduleStorage;
+WeeklySchedule schedule(&scheduleStorage);
+ScheduleRunner scheduleRunner(schedule, controllerClock);
 
 // boolean isUpdating = false;
 // nextUpdateTime tracks a timestamp for when the homekit update cycle should run
 // unsigned long nextUpdateTime = millis();
 // nextPollTime tracks a timestamp for when the next heatpump settings poll should run
-unsigned long nextPollTime = millis();
-unsigned long nextTempPollTime = millis();
+heatpumpDeadline nextPollTime = heatpumpDeadline::after(controllerClock, 0);
 
 // Thermostat
 /*
@@ -72,15 +98,17 @@ SpanCharacteristic *targetTiltAngle;
 
 int getCurrentHeatingCoolingState(const String &powerSetting, const String &modeSetting) {
     if (powerSetting == "OFF") return 0;
+    // "currently heating" is off while the unit idles at its target: no compressor time in the short window
+    const heatpumpWindowStatistics recent = statistics.get(0);
+    if (recent.valid && recent.dutyCycle == 0) return 0;
     if (modeSetting == "HEAT") return 1;
     if (modeSetting == "COOL") return 2;
     return 0;
 }
 
-float getTargetTemperature() {
-    const auto rawTemp = targetTemperature->getNewVal<float>();
+heatpumpTemperature getTargetTemperature() {
     // Round to nearest 0.5
-    return round(rawTemp * 2) / 2.0f;
+    return heatpumpTemperature::fromCelsius(targetTemperature->getNewVal<float>());
 }
 
 int getTargetHeatingCoolingState(const String &powerSetting, const String &modeSetting) {
@@ -175,7 +203,7 @@ void printHPValues(const heatpumpSettings &settings) {
     LOG0("current heatpump settings:\n");
     LOG0("  power=" + String(settings.power) + "\n");
     LOG0("  mode=" + String(settings.mode) + "\n");
-    LOG0("  target temperature=" + String(settings.temperature) + "\n");
+    LOG0("  target temperature=" + String(settings.temperature.toCelsius()) + "\n");
     LOG0("  fan=" + String(settings.fan) + "\n");
     LOG0("  vane=" + String(settings.vane) + "\n");
 }
@@ -203,7 +231,7 @@ void printHKValues() {
  * @param settings Heat pump settings object
  */
 void updateValues(const heatpumpSettings &settings) {
-    targetTemperature->setVal(max(10.0f, settings.temperature));
+    targetTemperature->setVal(max(10.0f, settings.temperature.toCelsius()));
     currentHeatingCoolingState->setVal(getCurrentHeatingCoolingState(settings.power, settings.mode));
     targetHeatingCoolingState->setVal(getTargetHeatingCoolingState(settings.power, settings.mode));
 
@@ -215,45 +243,318 @@ void updateValues(const heatpumpSettings &settings) {
 
 void delayHPPolling() {
     // delay next polling so it doesn't overwrite new settings
-    nextPollTime = millis() + HP_POLL_DELAY;
+    nextPollTime = heatpumpDeadline::after(controllerClock, HP_POLL_DELAY);
 }
 
 struct DeviceState {
+    // a HomeKit change is waiting to be applied or verified
     boolean isUpdating;
-    boolean isVerifying;
     const char *power;
     const char *mode;
-    float targetTemperature;
+    heatpumpTemperature targetTemperature;
     const char *fanSpeed;
     const char *vane;
-    unsigned long nextUpdateTime;
+    const char *wideVane; // nullptr leaves it as it is, HomeKit has no wide vane
 };
 
 DeviceState deviceState = {};
 
-void handleUpdate() {
-    LOG0("handling update\n");
+// HTTP and MQTT writes since the change in flight began, applied over the HK values until it is confirmed
+heatpumpSettingsChange remoteChange = {};
+
+// HomeKit writes from the thermostat, fan and slat services, merged into one settings change
+WriteCoalescer hkWrites(controllerClock, HK_UPDATE_DEBOUNCE, HK_UPDATE_MAX_LATENCY);
+
+/**
+ * Whether the heat pump takes writes now, logs why not.
+ */
+bool acceptsWrites(const char *source) {
+    if (heatPump.getLinkState() == HEATPUMP_LINK_DOWN) {
+        LOG0("rejecting %s, heat pump link is down\n", source);
+        return false;
+    }
+    if (heatPump.isListenOnly()) {
+        LOG0("rejecting %s, listen-only\n", source);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Queues the HK values for the heat pump, see applyUserChanges().
+ */
+void queueUpdate() {
     delayHPPolling();
 
     // pin fan speed to set value
     fanRotationSpeed->setVal(getFanRotationSpeed(getFanSpeed()));
 
-    // update device state from HK values
+    // the HK values are read once the burst settles, see readDeviceState()
+    deviceState.isUpdating = true;
+    hkWrites.write();
+}
+
+/**
+ * Queues a HomeKit write for the heat pump.
+ *
+ * @return false while the heat pump link is down, so HomeKit reports "No Response" instead of accepting it
+ */
+bool handleUpdate() {
+    HEATPUMP_TRACE_SPAN("HomeKit update");
+    if (!acceptsWrites("update")) return false;
+    LOG0("handling update\n");
+    metrics.countHomeKitUpdate();
+    metrics.commandWritten();
+    queueUpdate();
+    return true;
+}
+
+/**
+ * Queues a settings write from the HTTP endpoint or the MQTT bridge. It takes the HomeKit write path, so it
+ * is coalesced with HomeKit writes, applied and verified by applyUserChanges() instead of blocking the caller.
+ *
+ * @return false while the heat pump doesn't take writes
+ */
+bool queueSettingsChange(const heatpumpSettingsChange &change) {
+    HEATPUMP_TRACE_SPAN("queueSettingsChange");
+    if (!acceptsWrites("settings change")) return false;
+    metrics.commandWritten();
+    change.applyTo(remoteChange.settings);
+    remoteChange.fields |= change.fields;
+    delayHPPolling();
     deviceState.isUpdating = true;
-    deviceState.isVerifying = false;
+    hkWrites.write();
+    return true;
+}
+
+/**
+ * Snapshots the HK values and the HTTP/MQTT writes over them into deviceState, taking all pending writes.
+ */
+void readDeviceState() {
+    hkWrites.take();
     deviceState.power = getPowerSetting();
     deviceState.mode = getModeSetting();
     deviceState.targetTemperature = getTargetTemperature();
     deviceState.fanSpeed = getFanSpeed();
     deviceState.vane = getVaneSetting();
-    deviceState.nextUpdateTime = millis() + HK_UPDATE_DEBOUNCE;
+
+    const heatpumpSettings &remote = remoteChange.settings;
+    const uint8_t fields = remoteChange.fields;
+    if (fields & heatpumpSettingsChange::POWER) deviceState.power = remote.power;
+    if (fields & heatpumpSettingsChange::MODE) deviceState.mode = remote.mode;
+    if (fields & heatpumpSettingsChange::TEMPERATURE) deviceState.targetTemperature = remote.temperature;
+    if (fields & heatpumpSettingsChange::FAN) deviceState.fanSpeed = remote.fan;
+    if (fields & heatpumpSettingsChange::VANE) deviceState.vane = remote.vane;
+    deviceState.wideVane = fields & heatpumpSettingsChange::WIDEVANE ? remote.wideVane : nullptr;
+}
+
+/**
+ * Reads the room temperature from the heat pump into HomeKit.
+ */
+void readRoomTemperature() {
+    HEATPUMP_TRACE_SPAN("readRoomTemperature");
+    // read current state from heat pump
+    heatPump.sync();
+    if (heatPump.getLinkState() == HEATPUMP_LINK_DOWN) return; // keep HomeKit from showing stale values as fresh
+
+    // get current room temperature (this value is not part of settings)
+    const float roomTemperature = heatPump.getRoomTemperature();
+    LOG0("roomTemperature=%f\n", roomTemperature);
+
+    if (roomTemperature > 0.0) {
+        // save the current temperature
+        currentTemperature->setVal(roomTemperature);
+    }
+}
+
+/**
+ * Reads the heat pump settings into HomeKit, picking up changes made by a remote.
+ */
+void readSettings() {
+    HEATPUMP_TRACE_SPAN("readSettings");
+    LOG0("-- start heatpump update--\n");
+    delayHPPolling();
+
+    // read current state from heat pump
+    heatPump.sync();
+    if (heatPump.getLinkState() == HEATPUMP_LINK_DOWN) {
+        LOG0("heat pump link is down, skipping\n");
+        return;
+    }
+    // get heat pump settings
+    const heatpumpSettings settings = heatPump.getSettings();
+    metrics.markPoll();
+
+    LOG0("updating HK values from heat pump\n");
+    updateValues(settings);
+
+    LOG0("read HP Settings:\n");
+    printHPValues(settings);
+
+    printHKValues();
+    LOG0("-- end heatpump update--\n");
+}
+
+/**
+ * Adds the current status to the history.
+ */
+void recordHistory() {
+    HEATPUMP_TRACE_SPAN("recordHistory");
+    const time_t now = time(nullptr);
+    if (now < 1577836800 || heatPump.getLinkState() == HEATPUMP_LINK_DOWN) return; // clock not set yet (< 2020)
+    const heatpumpSettings settings = heatPump.getSettings();
+    if (!settings.power) return; // no settings read yet
+    history.record((uint32_t) now, heatPump.getStatus(), settings);
+}
+
+/**
+ * Loads the runtime totals saved by saveRuntime(), so they count on across reboots.
+ */
+void restoreRuntime() {
+    Preferences preferences;
+    if (!preferences.begin("runtime", true)) return;
+    heatpumpRuntimeTotals totals;
+    if (preferences.getBytesLength("totals") == sizeof(totals) &&
+        preferences.getBytes("totals", &totals, sizeof(totals)) == sizeof(totals)) {
+        runtime.restore(totals);
+    }
+    preferences.end();
+}
+
+/**
+ * Saves the runtime totals to NVS, unless nothing was accounted since the last save.
+ */
+void saveRuntime() {
+    static uint64_t savedMs = 0;
+    const heatpumpRuntimeTotals &totals = runtime.totals();
+    if (totals.accountedMs == savedMs) return;
+    Preferences preferences;
+    if (!preferences.begin("runtime", false)) return;
+    if (preferences.putBytes("totals", &totals, sizeof(totals)) == sizeof(totals)) savedMs = totals.accountedMs;
+    preferences.end();
+}
+
+/**
+ * Applies a schedule transition through the HomeKit characteristics, so HomeKit shows it and it takes
+ * the same write path as a change made in the Home app.
+ *
+ * @return false if the heat pump doesn't take writes now, the characteristics are left alone then
+ */
+bool applyScheduleEntry(const ScheduleEntry &entry) {
+    HEATPUMP_TRACE_SPAN("applyScheduleEntry");
+    char text[32];
+    entry.toString(text, sizeof(text));
+    LOG0("schedule: %s\n", text);
+    if (!acceptsWrites("schedule transition")) {
+        metrics.countScheduleTransition(false);
+        return false;
+    }
+    if (entry.action != ScheduleEntry::SETPOINT) {
+        const int state = entry.action == ScheduleEntry::HEAT ? 1 : (entry.action == ScheduleEntry::COOL ? 2 : 0);
+        targetHeatingCoolingState->setVal(state);
+    }
+    if (entry.hasSetpoint()) targetTemperature->setVal(entry.temperature().toCelsius());
+    metrics.countScheduleTransition(true);
+    queueUpdate();
+    return true;
+}
+
+/**
+ * Sends the HomeKit values in deviceState to the heat pump.
+ */
+void applyDeviceState() {
+    HEATPUMP_TRACE_SPAN("applyDeviceState");
+    LOG0("updating\n");
+    delayHPPolling();
+
+    // read current state from heat pump
+    heatPump.sync();
+    // get heat pump settings
+    heatpumpSettings settings = heatPump.getSettings();
+
+    LOG0("-- start HK Update--\n");
+    printHKValues();
+
+    settings.power = deviceState.power;
+    settings.mode = deviceState.mode;
+    settings.temperature = deviceState.targetTemperature;
+    settings.fan = deviceState.fanSpeed;
+    settings.vane = deviceState.vane;
+    if (deviceState.wideVane) settings.wideVane = deviceState.wideVane;
+
+    LOG0("new HP Settings:\n");
+    printHPValues(settings);
+
+    heatPump.setSettings(settings);
+    // verify against what is sent: a unit without half degrees gets whole ones, within 16-31
+    deviceState.targetTemperature = heatPump.getWantedSettings().temperature;
+    heatPump.update();
+    metrics.commandApplied();
+    LOG0("-- end HK update --\n");
+}
+
+/**
+ * Checks the heat pump took the values in deviceState.
+ *
+ * @return true if they match, otherwise a retry is scheduled
+ */
+bool verifyDeviceState() {
+    HEATPUMP_TRACE_SPAN("verifyDeviceState");
+    LOG0("verifying\n");
+    heatPump.sync();
+    const heatpumpSettings settings = heatPump.getSettings();
+
+    LOG0("Comparing settings vs deviceState:\n");
+    LOG0("  power: '%s' vs '%s' - %s\n", settings.power, deviceState.power,
+         (strcmp(settings.power, deviceState.power) == 0 ? "match" : "MISMATCH"));
+    LOG0("  mode: '%s' vs '%s' - %s\n", settings.mode, deviceState.mode,
+         (strcmp(settings.mode, deviceState.mode) == 0 ? "match" : "MISMATCH"));
+    LOG0("  temperature: %.1f vs %.1f - %s\n", settings.temperature.toCelsius(),
+         deviceState.targetTemperature.toCelsius(),
+         (settings.temperature == deviceState.targetTemperature ? "match" : "MISMATCH"));
+    LOG0("  fan: '%s' vs '%s' - %s\n", settings.fan, deviceState.fanSpeed,
+         (strcmp(settings.fan, deviceState.fanSpeed) == 0 ? "match" : "MISMATCH"));
+    LOG0("  vane: '%s' vs '%s' - %s\n", settings.vane, deviceState.vane,
+         (strcmp(settings.vane, deviceState.vane) == 0 ? "match" : "MISMATCH"));
+    const boolean wideVaneMatches = !deviceState.wideVane || strcmp(settings.wideVane, deviceState.wideVane) == 0;
+    if (deviceState.wideVane) {
+        LOG0("  wideVane: '%s' vs '%s' - %s\n", settings.wideVane, deviceState.wideVane,
+             (wideVaneMatches ? "match" : "MISMATCH"));
+    }
+
+    const boolean configsMatch =
+            strcmp(settings.power, deviceState.power) == 0 &&
+            strcmp(settings.mode, deviceState.mode) == 0 &&
+            settings.temperature == deviceState.targetTemperature &&
+            strcmp(settings.fan, deviceState.fanSpeed) == 0 &&
+            strcmp(settings.vane, deviceState.vane) == 0 &&
+            wideVaneMatches;
+
+    if (!configsMatch) {
+        LOG0("configs don't match, updating again\n");
+        hkWrites.write();
+    }
+    return configsMatch;
 }
 
 struct ThermostatController final : Service::Thermostat {
+    // the controller workflows, resumed from loop()
+    Coroutine busSync;
+    Coroutine roomTemperaturePoll;
+    Coroutine settingsPoll;
+    Coroutine userChange;
+    Coroutine historySample;
+    Coroutine scheduleTransition;
+    Coroutine runtimeCheckpoint;
+    ScheduleEntry scheduledEntry = {};
+    bool schedulePending = false; // scheduledEntry was rejected, retried at scheduleRetry
+    heatpumpDeadline scheduleRetry = {0};
+
     ThermostatController() {
         temperatureDisplayUnits = new Characteristic::TemperatureDisplayUnits(1); // 1 = Fahrenheit
         currentTemperature = new Characteristic::CurrentTemperature();
         targetTemperature = new Characteristic::TargetTemperature();
+        targetTemperature->setRange(10, 31, 0.5); // what the heat pump takes
         currentHeatingCoolingState = new Characteristic::CurrentHeatingCoolingState();
         targetHeatingCoolingState = new Characteristic::TargetHeatingCoolingState();
         targetHeatingCoolingState->setRange(0, 2);
@@ -262,115 +563,139 @@ struct ThermostatController final : Service::Thermostat {
     }
 
     boolean update() override {
-        handleUpdate();
+        return handleUpdate();
+    }
 
-        return true;
+    /**
+     * Time until loop() next has work to do, so the HomeSpan task can sleep in between.
+     */
+    unsigned long idleTime() {
+        unsigned long idle = HP_POLL_DELAY;
+        idle = busSync.idleTime(controllerClock, idle);
+        idle = roomTemperaturePoll.idleTime(controllerClock, idle);
+        idle = settingsPoll.idleTime(controllerClock, idle);
+        idle = userChange.idleTime(controllerClock, idle);
+        idle = historySample.idleTime(controllerClock, idle);
+        idle = scheduleTransition.idleTime(controllerClock, idle);
+        idle = runtimeCheckpoint.idleTime(controllerClock, idle);
+        return idle;
     }
 
     /**
      * This loop handles the update logic for the thermostat and all accessories (fan and slat).
      */
     void loop() override {
-        // if it is time to poll temperature
-        if (nextTempPollTime < millis()) {
-            // schedule next update time
-            nextTempPollTime = millis() + HP_TEMP_POLL_DELAY;
+        HEATPUMP_TRACE_SPAN("ThermostatController::loop");
+        syncBus();
+        pollRoomTemperature();
+        applyUserChanges();
+        pollSettings();
+        sampleHistory();
+        runSchedule();
+        checkpointRuntime();
+    }
 
-            // read current state from heat pump
+    /**
+     * Keeps requests going to the heat pump so the link health is current, and reconnects when it goes down.
+     * A reply is read as soon as it comes in: Serial2's receive callback wakes the task and this resumes.
+     */
+    void syncBus() {
+        CO_BEGIN(busSync);
+        for (;;) {
             heatPump.sync();
-
-            // get current room temperature (this value is not part of settings)
-            const float roomTemperature = heatPump.getRoomTemperature();
-            LOG0("roomTemperature=%f\n", roomTemperature);
-
-            if (roomTemperature > 0.0) {
-                // save the current temperature
-                currentTemperature->setVal(roomTemperature);
-            }
+            CO_SLEEP_OR(busSync, controllerClock, telemetry.isActive() ? TELEMETRY_SYNC_INTERVAL : HP_SYNC_INTERVAL,
+                        Serial2.available() > 0);
         }
+        CO_END(busSync);
+    }
 
-        if (deviceState.isUpdating && deviceState.nextUpdateTime < millis()) {
-            LOG0("updating\n");
-            delayHPPolling();
-
-            // read current state from heat pump
-            heatPump.sync();
-            // get heat pump settings
-            heatpumpSettings settings = heatPump.getSettings();
-
-            LOG0("-- start HK Update--\n");
-            printHKValues();
-
-            settings.power = deviceState.power;
-            settings.mode = deviceState.mode;
-            settings.temperature = deviceState.targetTemperature;
-            settings.fan = deviceState.fanSpeed;
-            settings.vane = deviceState.vane;
-
-            LOG0("new HP Settings:\n");
-            printHPValues(settings);
-
-            heatPump.setSettings(settings);
-            heatPump.update();
+    void pollRoomTemperature() {
+        CO_BEGIN(roomTemperaturePoll);
+        for (;;) {
+            readRoomTemperature();
+            CO_SLEEP(roomTemperaturePoll, controllerClock, HP_TEMP_POLL_DELAY);
+        }
+        CO_END(roomTemperaturePoll);
+    }
 
+    /**
+     * HomeKit writes -> coalesce -> apply -> verify, repeated until the heat pump matches
+     * and no newer writes came in.
+     */
+    void applyUserChanges() {
+        CO_BEGIN(userChange);
+        for (;;) {
+            CO_AWAIT(userChange, hkWrites.pending());
+            do {
+                CO_AWAIT_DEADLINE(userChange, controllerClock, hkWrites.deadline());
+                readDeviceState();
+                applyDeviceState();
+                CO_SLEEP(userChange, controllerClock, 1000);
+            } while (!verifyDeviceState() || hkWrites.pending());
             deviceState.isUpdating = false;
-            deviceState.isVerifying = true;
-            deviceState.nextUpdateTime = millis() + 1000;
-            LOG0("-- end HK update --\n");
+            remoteChange.fields = 0;
+            metrics.commandConfirmed();
         }
+        CO_END(userChange);
+    }
 
-        if (deviceState.isVerifying && deviceState.nextUpdateTime < millis()) {
-            LOG0("verifying\n");
-            heatPump.sync();
-            const heatpumpSettings settings = heatPump.getSettings();
-
-            LOG0("Comparing settings vs deviceState:\n");
-            LOG0("  power: '%s' vs '%s' - %s\n", settings.power, deviceState.power,
-                 (strcmp(settings.power, deviceState.power) == 0 ? "match" : "MISMATCH"));
-            LOG0("  mode: '%s' vs '%s' - %s\n", settings.mode, deviceState.mode,
-                 (strcmp(settings.mode, deviceState.mode) == 0 ? "match" : "MISMATCH"));
-            LOG0("  temperature: %.1f vs %.1f - %s\n", settings.temperature, deviceState.targetTemperature,
-                 (settings.temperature == deviceState.targetTemperature ? "match" : "MISMATCH"));
-            LOG0("  fan: '%s' vs '%s' - %s\n", settings.fan, deviceState.fanSpeed,
-                 (strcmp(settings.fan, deviceState.fanSpeed) == 0 ? "match" : "MISMATCH"));
-            LOG0("  vane: '%s' vs '%s' - %s\n", settings.vane, deviceState.vane,
-                 (strcmp(settings.vane, deviceState.vane) == 0 ? "match" : "MISMATCH"));
-
-            const boolean configsMatch =
-                    strcmp(settings.power, deviceState.power) == 0 &&
-                    strcmp(settings.mode, deviceState.mode) == 0 &&
-                    settings.temperature == deviceState.targetTemperature &&
-                    strcmp(settings.fan, deviceState.fanSpeed) == 0 &&
-                    strcmp(settings.vane, deviceState.vane) == 0;
-
-
-            deviceState.isVerifying = false;
-            if (!configsMatch) {
-                LOG0("configs don't match, updating again\n");
-                deviceState.isUpdating = true;
-                deviceState.nextUpdateTime = millis() + 1000;
+    void pollSettings() {
+        CO_BEGIN(settingsPoll);
+        for (;;) {
+            CO_AWAIT_DEADLINE(settingsPoll, controllerClock, nextPollTime);
+            if (deviceState.isUpdating) {
+                // don't overwrite a HomeKit change in flight, the poll deadline moves out while it's applied
+                CO_AWAIT(settingsPoll, !deviceState.isUpdating);
+                continue;
             }
+            readSettings();
         }
+        CO_END(settingsPoll);
+    }
 
-        // if update not currently in progress, and it is time to poll
-        if (!deviceState.isUpdating && !deviceState.isVerifying && nextPollTime < millis()) {
-            LOG0("-- start heatpump update--\n");
-            delayHPPolling();
-
-            // read current state from heat pump
-            heatPump.sync();
-            // get heat pump settings
-            const heatpumpSettings settings = heatPump.getSettings();
+    /**
+     * Feeds the on-device history once a second, while the link is up and SNTP has set the clock.
+     */
+    void sampleHistory() {
+        CO_BEGIN(historySample);
+        CO_AWAIT(historySample, history.isReady());
+        for (;;) {
+            recordHistory();
+            CO_SLEEP(historySample, controllerClock, HISTORY_SAMPLE_INTERVAL);
+        }
+        CO_END(historySample);
+    }
 
-            LOG0("updating HK values from heat pump\n");
-            updateValues(settings);
+    /**
+     * Sleeps until the next weekly schedule transition and applies it. One the heat pump doesn't take (link
+     * down, listen-only) is retried every SCHEDULE_RETRY_INTERVAL, until it does or a later one replaces it.
+     */
+    void runSchedule() {
+        CO_BEGIN(scheduleTransition);
+        for (;;) {
+            CO_AWAIT_DEADLINE(scheduleTransition, controllerClock, nextScheduleCheck());
+            if (scheduleRunner.deadline().expired(controllerClock) &&
+                scheduleRunner.poll(time(nullptr), scheduledEntry)) {
+                schedulePending = true;
+            }
+            if (schedulePending && applyScheduleEntry(scheduledEntry)) schedulePending = false;
+            if (schedulePending) scheduleRetry = heatpumpDeadline::after(controllerClock, SCHEDULE_RETRY_INTERVAL);
+        }
+        CO_END(scheduleTransition);
+    }
 
-            LOG0("read HP Settings:\n");
-            printHPValues(settings);
+    heatpumpDeadline nextScheduleCheck() const {
+        const heatpumpDeadline transition = scheduleRunner.deadline();
+        return schedulePending && scheduleRetry.before(transition) ? scheduleRetry : transition;
+    }
 
-            printHKValues();
-            LOG0("-- end heatpump update--\n");
+    void checkpointRuntime() {
+        CO_BEGIN(runtimeCheckpoint);
+        for (;;) {
+            CO_SLEEP(runtimeCheckpoint, controllerClock, RUNTIME_SAVE_INTERVAL);
+            saveRuntime();
         }
+        CO_END(runtimeCheckpoint);
     }
 };
 
@@ -382,9 +707,7 @@ struct FanController final : Service::Fan {
     }
 
     boolean update() override {
-        handleUpdate();
-
-        return true;
+        return handleUpdate();
     }
 };
 
@@ -398,9 +721,7 @@ struct SlatController final : Service::Slat {
     }
 
     boolean update() override {
-        handleUpdate();
-
-        return true;
+        return handleUpdate();
     }
 };
 
@@ -410,20 +731,89 @@ SlatController *slatController;
 
 TaskHandle_t h_HK_poll;
 TaskHandle_t h_main_loop;
+TaskHandle_t h_MQTT_connect;
 
-[[noreturn]] void HK_poll(void *pvParameters) {
+[[noreturn]] void HK_poll(void *) {
     for (;;) {
-        homeSpan.poll();
+        {
+            HEATPUMP_TRACE_SPAN("homeSpan.poll"); // runs the controllers' loop() and update()
+            homeSpan.poll();
+        }
+        httpEndpoint.poll();
+        mqttBridge.poll();
+        telemetry.poll();
+
+        // sleep until the controller's next deadline or until the heat pump sends data.
+        // HomeSpan gives us no socket events, so cap the sleep to keep pairing and requests responsive.
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(min((unsigned long) HK_MAX_IDLE_MS, thermostatController->idleTime())));
     } // loop
 } // task
 
+/**
+ * Connects the MQTT bridge when its poll() asks, a broker that doesn't answer would hold up HK_poll for seconds.
+ */
+[[noreturn]] void MQTT_connect(void *) {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        mqttBridge.connect();
+    }
+}
+
+/**
+ * Wakes the HomeSpan task early, e.g. when the heat pump sends data.
+ */
+void wakeHKPoll() {
+    if (h_HK_poll) xTaskNotifyGive(h_HK_poll);
+}
+
+void startNetworkServices() {
+    configTzTime(TIMEZONE, NTP_SERVER);
+    // the schedule re-arms from the new wall clock time
+    sntp_set_time_sync_notification_cb([](struct timeval *) {
+        scheduleRunner.clockChanged();
+        wakeHKPoll();
+    });
+    httpEndpoint.setSchedule(&schedule);
+    httpEndpoint.setMetrics(&metrics);
+    httpEndpoint.setSettingsWriter(queueSettingsChange);
+    metrics.setCommandLimits({HK_SET_FRAME_P95_LIMIT_MS, HK_SET_ACK_P95_LIMIT_MS, HK_CONFIRMED_P95_LIMIT_MS,
+                              HK_FRAMES_P95_LIMIT});
+    if (history.isReady()) httpEndpoint.setHistory(&history);
+    if (!httpEndpoint.begin(HTTP_PORT)) {
+        LOG0("failed to start the http endpoint\n");
+    }
+    if (strlen(MQTT_SERVER) > 0) {
+        mqttBridge.setSettingsWriter(queueSettingsChange);
+        mqttBridge.begin(MQTT_SERVER, MQTT_PORT, MQTT_TOPIC);
+    }
+    if (TELEMETRY_PORT > 0 && !telemetry.begin(TELEMETRY_PORT)) {
+        LOG0("failed to start the telemetry stream\n");
+    }
+}
+
+#ifdef HEATPUMP_TRACE
+/**
+ * HomeSpan CLI command '@t': prints the recorded spans, save the output as a .json file to open it.
+ */
+void printTrace(const char *) {
+    heatpumpTrace::write([](const char *text, size_t length) { Serial.write((const uint8_t *) text, length); });
+}
+#endif
+
 void setup() {
     Serial.begin(115200);
 
     homeSpan.setLogLevel(1);
     if (STATUS_PIN > 0) homeSpan.setStatusPin(STATUS_PIN);
     if (CONTROL_PIN > 0) homeSpan.setControlPin(CONTROL_PIN);
-    homeSpan.begin(Category::Thermostats);
+    homeSpan.setWifiCallback(startNetworkServices);
+    {
+        HEATPUMP_TRACE_SPAN("setup: homeSpan.begin");
+        homeSpan.begin(Category::Thermostats);
+    }
+#ifdef HEATPUMP_TRACE
+    new SpanUserCommand('t', "- print the trace as Chrome trace JSON", printTrace);
+#endif
 
     new SpanAccessory();
 
@@ -438,22 +828,43 @@ void setup() {
     new Service::HAPProtocolInformation();
     new Characteristic::Version("1.1.0");
 
-    if (!heatPump.connect(&Serial2)) {
-        LOG0("failed to connect to the heat pump\n");
+    heatPump.setClock(&controllerClock);
+    metrics.setClock(&controllerClock);
+    heatPump.setStatistics(&statistics);
+    restoreRuntime();
+    heatPump.setRuntime(&runtime);
+    heatPump.setSettingsChangedCallback([]() { mqttBridge.settingsChanged(heatPump.getSettings()); });
+    heatPump.setStatusChangedCallback([](heatpumpStatus status) { mqttBridge.statusChanged(status); });
+    heatPump.setLinkStateChangedCallback([](heatpumpLinkState state) {
+        LOG0("heat pump link %s\n", heatpumpLinkStateName(state));
+    });
+    if (LISTEN_ONLY) heatPump.enableListenOnly();
+    {
+        HEATPUMP_TRACE_SPAN("setup: heatPump.connect");
+        if (!heatPump.connect(&Serial2)) {
+            LOG0("failed to connect to the heat pump\n");
+        }
     }
     heatPump.enableExternalUpdate();
+    if (strlen(HISTORY_PARTITION) > 0 && !(historyStorage.begin() && history.begin())) {
+        LOG0("no history, partition '%s' is missing or too small\n", HISTORY_PARTITION);
+    }
+    schedule.begin();
     // heatPump.setSettings({ //set some default settings
     //   "ON",  /* ON/OFF */
     //   "FAN", /* HEAT/COOL/FAN/DRY/AUTO */
-    //   26,    /* Between 16 and 31 */
+    //   heatpumpTemperature::fromDegrees(26), /* Between 16 and 31 */
     //   "4",   /* Fan speed: 1-4, AUTO, or QUIET */
     //   "3",   /* Air direction (vertical): 1-5, SWING, or AUTO */
     //   "|"    /* Air direction (horizontal): <<, <, |, >, >>, <>, or SWING */
     // });
 
-    thermostatController = new ThermostatController();
-    fanController = new FanController();
-    slatController = new SlatController();
+    {
+        HEATPUMP_TRACE_SPAN("setup: services");
+        thermostatController = new ThermostatController();
+        fanController = new FanController();
+        slatController = new SlatController();
+    }
 
     xTaskCreatePinnedToCore(
         HK_poll, /* Task function. */
@@ -463,9 +874,17 @@ void setup() {
         1, /* priority of the task */
         &h_HK_poll, /* Task handle to keep track of created task */
         0); /* pin task to core 0 */
+    metrics.setPollTask(h_HK_poll);
+    Serial2.onReceive(wakeHKPoll);
+    if (strlen(MQTT_SERVER) > 0) {
+        xTaskCreatePinnedToCore(MQTT_connect, "MQTT_connect", 4096, nullptr, 1, &h_MQTT_connect, 1);
+        mqttBridge.setConnectTask(h_MQTT_connect);
+    }
 
     delay(1000);
 }
 
 void loop() {
+    // everything runs in the HK_poll task, don't spin this core
+    vTaskDelay(portMAX_DELAY);
 }